@@ -6,10 +6,24 @@ function td = buildTrialData(trials, meta, varargin)
     p.KeepUnmatched = false;
     p.parse(varargin{:});
 
+    trials = expandPackedSignals(trials);
     tdi = MatUdpTrialDataInterfaceV11(trials, meta);
     tdi.includeSpikeData = p.Results.includeSpikeData;
     tdi.includeWaveforms = p.Results.includeWaveforms;
     tdi.includeContinuousNeuralData = p.Results.includeContinuousNeuralData;
 
     td = TrialData(tdi);
+end
+
+function trials = expandPackedSignals(trials)
+    % trials written with trialLogger -P hold variable size signals packed, see unpackRagged
+    flds = fieldnames(trials);
+    for iF = 1:numel(flds)
+        for iT = 1:numel(trials)
+            v = trials(iT).(flds{iF});
+            if isstruct(v) && isscalar(v) && isfield(v, 'lengths') && isfield(v, 'sampleDims')
+                trials(iT).(flds{iF}) = MatUdp.DataLoad.unpackRagged(v);
+            end
+        end
+    end
 end
\ No newline at end of file
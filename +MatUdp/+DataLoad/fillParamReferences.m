@@ -0,0 +1,42 @@
+function trials = fillParamReferences(trials, loadTrial)
+  % trials written with trialLogger -o (--params-on-change) hold a param only when its value changed,
+  % the others hold struct sameAsTrialId with the id of the trial that has it. This fills those in,
+  % trials is a cell array of trial structs. loadTrial(id) returns a trial not among them, [] if it
+  % can't be found, by default they aren't looked for
+  if nargin < 2
+    loadTrial = @(id) [];
+  end
+  if isempty(trials)
+    return;
+  end
+
+  ids = cellfun(@(t) double(t.trialId), trials);
+  others = containers.Map('KeyType', 'double', 'ValueType', 'any');
+  for i = 1:numel(trials)
+    flds = fieldnames(trials{i});
+    for iF = 1:numel(flds)
+      v = trials{i}.(flds{iF});
+      if ~isstruct(v) || ~isscalar(v) || ~isfield(v, 'sameAsTrialId')
+        continue;
+      end
+
+      id = double(v.sameAsTrialId);
+      iSource = find(ids == id, 1);
+      if ~isempty(iSource)
+        source = trials{iSource};
+      else
+        if ~isKey(others, id)
+          others(id) = loadTrial(id);
+        end
+        source = others(id);
+      end
+
+      if isempty(source) || ~isfield(source, flds{iF})
+        warning('Param %s of trial %d refers to trial %d, which was not found', flds{iF}, ids(i), id);
+        trials{i}.(flds{iF}) = [];
+      else
+        trials{i}.(flds{iF}) = source.(flds{iF});
+      end
+    end
+  end
+end
@@ -2,14 +2,36 @@ function [trials, meta] = loadAllTrialsInDirectoryRaw(folder, varargin)
   % returns all trials and meta files as cell arrays
   p = inputParser();
   p.addParameter('maxTrials', Inf, @isscalar); % stop after max trials
+  p.addParameter('signals', {}, @iscellstr); % only read these signals from trials written with trialLogger -V
   p.parse(varargin{:});
   maxTrials = p.Results.maxTrials;
+  signals = p.Results.signals;
 
   if ~exist(folder, 'dir')
     error('Folder %s does not exist', folder);
   end
+
+  % trials written with trialLogger --container
+  containers = dir(fullfile(folder, '*.mtc'));
+  if ~isempty(containers)
+    trials = cell(0, 1);
+    meta = cell(0, 1);
+    for i = 1:numel(containers)
+      [t, m] = loadTrialContainer(fullfile(folder, containers(i).name));
+      trials = cat(1, trials, t);
+      meta = cat(1, meta, m);
+    end
+    trials = MatUdp.DataLoad.fillParamReferences(trials);
+    if numel(trials) > maxTrials
+      trials = trials(1:maxTrials);
+      meta = meta(1:maxTrials);
+    end
+    meta = MatUdp.DataLoad.resolveSchemaMeta(folder, meta);
+    return;
+  end
   
   files = dir(fullfile(folder, '*.mat'));
+  files = files(~strcmp({files.name}, 'schema.mat'));
   if isempty(files)
     error('No mat files found in %s', folder);
   end
@@ -20,6 +42,31 @@ function [trials, meta] = loadAllTrialsInDirectoryRaw(folder, varargin)
     nFiles = maxTrials;
   end
   
+  if exist('loadTrialFiles', 'file') == 3
+    % reads the files on a pool of threads, see trial-loader-mex/loadTrialFiles.c
+    [trials, meta, ~, skipped] = loadTrialFiles(folder, 'files', names(1:nFiles), 'signals', signals);
+    if ~isempty(skipped)
+      % MAT v7.3 files
+      [t, m] = loadTrialFilesSerially(folder, skipped, signals);
+      trials = cat(1, trials, t);
+      meta = cat(1, meta, m);
+      [~, order] = sort(cellfun(@(trial) double(trial.trialId), trials));
+      trials = trials(order);
+      meta = meta(order);
+    end
+  else
+    [trials, meta] = loadTrialFilesSerially(folder, names(1:nFiles), signals);
+  end
+
+  % trials written with trialLogger -o refer to earlier ones for unchanged params
+  trials = MatUdp.DataLoad.fillParamReferences(trials, @(id) loadTrialById(folder, names, id));
+  % trials written with trialLogger -m keep their group layouts in schema.mat
+  meta = MatUdp.DataLoad.resolveSchemaMeta(folder, meta);
+
+end
+
+function [trials, meta] = loadTrialFilesSerially(folder, names, signals)
+  nFiles = numel(names);
   data = cellvec(nFiles);
   meta = cellvec(nFiles);
   valid = falsevec(nFiles);
@@ -27,7 +74,11 @@ function [trials, meta] = loadAllTrialsInDirectoryRaw(folder, varargin)
   prog = ProgressBar(nFiles, 'Loading .mat in %s', folder);
   for i = 1:nFiles
     prog.update(i);
-    d = load(fullfile(folder,names{i}), 'trial', 'meta');
+    if isempty(signals)
+      d = MatUdp.DataLoad.loadTrialFile(fullfile(folder,names{i}));
+    else
+      d = MatUdp.DataLoad.loadTrialFile(fullfile(folder,names{i}), signals);
+    end
     if ~isempty(d) && isfield(d, 'trial') && isfield(d, 'meta')
       % strip groups
       [data{i}, meta{i}] = deal(d.trial, d.meta);
@@ -38,5 +89,16 @@ function [trials, meta] = loadAllTrialsInDirectoryRaw(folder, varargin)
 
   trials = data(valid);
   meta = meta(valid);
+end
 
+function trial = loadTrialById(folder, names, id)
+  % a trial beyond maxTrials that params refer to
+  trial = [];
+  match = find(~cellfun(@isempty, strfind(names, sprintf('_id%06d_', id))), 1);
+  if ~isempty(match)
+    d = MatUdp.DataLoad.loadTrialFile(fullfile(folder, names{match}));
+    if isfield(d, 'trial')
+      trial = d.trial;
+    end
+  end
 end
\ No newline at end of file
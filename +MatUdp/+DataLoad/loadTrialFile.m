@@ -0,0 +1,24 @@
+function d = loadTrialFile(file, signals)
+  % loads trial and meta from a trial .mat file. Trials written with trialLogger -V (--split) keep
+  % each signal in a variable of its own, listed in trial.signalVariables; these are read back into
+  % trial, only those named in signals when given, so the rest are never read. Other trials are
+  % read whole whatever signals says
+  d = load(file, 'trial', 'meta');
+  if isempty(d) || ~isfield(d, 'trial') || ~isfield(d.trial, 'signalVariables')
+    return;
+  end
+
+  names = d.trial.signalVariables;
+  d.trial = rmfield(d.trial, 'signalVariables');
+  if nargin > 1
+    names = names(ismember(names, signals));
+  end
+  if isempty(names)
+    return;
+  end
+
+  s = load(file, names{:});
+  for i = 1:numel(names)
+    d.trial.(names{i}) = s.(names{i});
+  end
+end
@@ -0,0 +1,37 @@
+function [map, trialOffsets, dims] = mapSessionSignal(session, name)
+  % maps the data of one signal of a session file written by trialLogger/tools/compactSession.c,
+  % all trials one after the other, without reading any other signal. session is the file or what
+  % readSessionFileIndex returned for it. The data is map.Data.samples, e.g. for a whole session
+  %
+  %   [map, trialOffsets, dims] = MatUdp.DataLoad.mapSessionSignal(file, 'handX');
+  %   handX = map.Data.samples;
+  %
+  % Trial i's array is samples(trialOffsets(i)+1:trialOffsets(i+1)) reshaped to dims(i,:), a
+  % trial without the signal has all dims 0. Chars are mapped as uint16 and logicals as uint8.
+  % map is empty if no trial has any data of the signal
+  if ischar(session)
+    session = MatUdp.DataLoad.readSessionFileIndex(session);
+  end
+  if ~isfield(session.signals, name)
+    error('Session file %s has no signal %s', session.file, name);
+  end
+  signal = session.signals.(name);
+  trialOffsets = signal.trialOffsets;
+  dims = signal.dims;
+
+  switch signal.class
+    case 'char'
+      type = 'uint16';
+    case 'logical'
+      type = 'uint8';
+    otherwise
+      type = signal.class;
+  end
+
+  if signal.nElements == 0
+    map = [];
+  else
+    map = memmapfile(session.file, 'Offset', signal.dataOffset, ...
+      'Format', {type, [signal.nElements 1], 'samples'}, 'Repeat', 1);
+  end
+end
@@ -0,0 +1,46 @@
+function session = readSessionFileIndex(file)
+  % reads the index of a session file written by trialLogger/tools/compactSession.c, see
+  % trialLogger/src/sessionFile.h for the layout. session.trialIds lists the trials it holds and
+  % session.signals has a field for each signal with where its data is, see mapSessionSignal
+  fid = fopen(file, 'r', 'ieee-le');
+  if fid < 0
+    error('Could not open %s', file);
+  end
+  closeFile = onCleanup(@() fclose(fid));
+
+  magic = fread(fid, [1 8], '*char');
+  if ~strcmp(magic, 'MATUDPCS')
+    error('%s is not a complete session file', file);
+  end
+  header = fread(fid, 6, 'uint32');
+  offsets = fread(fid, 3, 'uint64');
+  [nTrials, nSignals, signalBytes] = deal(header(3), header(4), header(5));
+  [trialIdsOffset, signalsOffset] = deal(offsets(1), offsets(2));
+
+  fseek(fid, trialIdsOffset, 'bof');
+  session.file = file;
+  session.trialIds = fread(fid, nTrials, 'uint32');
+  session.signals = struct();
+
+  % mxClassID order, chars and logicals are mapped as their storage type
+  classNames = {'cell', 'struct', 'logical', 'char', 'void', 'double', 'single', 'int8', 'uint8', ...
+    'int16', 'uint16', 'int32', 'uint32', 'int64', 'uint64'};
+  for iS = 1:nSignals
+    fseek(fid, signalsOffset + (iS-1) * signalBytes, 'bof');
+    name = fread(fid, [1 64], '*char');
+    name = name(1:find([name char(0)] == char(0), 1) - 1);
+    fields = fread(fid, 4, 'uint32');
+    positions = fread(fid, 4, 'uint64');
+
+    signal.class = classNames{fields(1)};
+    signal.elementBytes = fields(2);
+    signal.dataOffset = positions(1);
+    signal.nElements = positions(2);
+
+    fseek(fid, positions(3), 'bof');
+    signal.trialOffsets = fread(fid, nTrials + 1, 'uint64');
+    fseek(fid, positions(4), 'bof');
+    signal.dims = reshape(fread(fid, nTrials * fields(3), 'uint32'), fields(3), nTrials)';
+    session.signals.(name) = signal;
+  end
+end
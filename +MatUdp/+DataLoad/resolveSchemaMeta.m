@@ -0,0 +1,51 @@
+function meta = resolveSchemaMeta(folder, meta)
+  % rebuilds meta.groups and meta.signals of trials written with trialLogger -m (--schema) from the
+  % group layouts in the saveTag folder's schema.mat. meta is a cell array of each trial's meta,
+  % those without .layouts are returned as they are. The registry is only ever appended to, so it
+  % is read once and again only when it has grown
+  persistent registries;
+  if isempty(registries)
+    registries = containers.Map();
+  end
+
+  withLayouts = cellfun(@(m) isfield(m, 'layouts'), meta);
+  if ~any(withLayouts)
+    return;
+  end
+
+  file = fullfile(folder, 'schema.mat');
+  info = dir(file);
+  if isempty(info)
+    error('Schema registry %s not found', file);
+  end
+  if registries.isKey(file) && registries(file).bytes == info.bytes
+    schema = registries(file).schema;
+  else
+    schema = load(file);
+    registries(file) = struct('bytes', info.bytes, 'schema', schema);
+  end
+
+  for i = find(withLayouts(:))'
+    meta{i} = resolveLayouts(meta{i}, schema);
+  end
+end
+
+function resolved = resolveLayouts(meta, schema)
+  resolved.groups = struct();
+  resolved.signals = struct();
+  for iG = 1:size(meta.layouts, 2)
+    entry = schema.(sprintf('h%08x_%08x', meta.layouts(1, iG), meta.layouts(2, iG)));
+    name = entry.group.name;
+    if isfield(meta.groups, name)
+      % event groups keep their own, listing the events of the trial
+      resolved.groups.(name) = meta.groups.(name);
+    else
+      resolved.groups.(name) = entry.group;
+    end
+
+    signals = fieldnames(entry.signals);
+    for iS = 1:numel(signals)
+      resolved.signals.(signals{iS}) = entry.signals.(signals{iS});
+    end
+  end
+end
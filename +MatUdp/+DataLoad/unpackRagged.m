@@ -0,0 +1,25 @@
+function values = unpackRagged(packed, which)
+  % expands a variable size signal written with trialLogger -P (--packed), a struct with .data,
+  % .lengths and .sampleDims, into the cell array written without it, one sample in each. which
+  % picks the samples to expand, as indices or a logical mask, all of them by default
+  lengths = double(packed.lengths(:));
+  if nargin < 2
+    which = 1:numel(lengths);
+  elseif islogical(which)
+    which = find(which);
+  end
+
+  stops = cumsum(lengths);
+  starts = stops - lengths;
+  sampleDims = double(packed.sampleDims(:)');
+
+  values = cell(numel(which), 1);
+  for i = 1:numel(which)
+    iS = which(i);
+    sample = packed.data(starts(iS)+1:stops(iS));
+    if ~isempty(sampleDims)
+      sample = reshape(sample, [sampleDims, lengths(iS) / prod(sampleDims)]);
+    end
+    values{i} = sample;
+  end
+end
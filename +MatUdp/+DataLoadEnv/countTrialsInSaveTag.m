@@ -23,6 +23,12 @@ function count = countTrialsInSaveTag(varargin)
         files = MatUdp.DataLoadEnv.listTrialFilesInSaveTagFolder(folderSaveTag);
 
         count(iST) = numel(files);
+
+        % plus the trials in any containers, counted from their index
+        containers = dir(fullfile(folderSaveTag, '*.mtc'));
+        for iC = 1:numel(containers)
+            count(iST) = count(iST) + numel(loadTrialContainer(fullfile(folderSaveTag, containers(iC).name), 'list'));
+        end
     end
 
 end
\ No newline at end of file
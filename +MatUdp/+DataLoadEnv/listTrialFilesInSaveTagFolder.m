@@ -4,6 +4,8 @@ function [files, info] = listTrialFilesInSaveTagFolder(saveTagFolder)
 % (within 5 seconds).
 
     filesInfo = dir(fullfile(saveTagFolder, '*.mat'));
+    % the schema registry of trials written with trialLogger -m
+    filesInfo = filesInfo(~strcmp({filesInfo.name}, 'schema.mat'));
     files = {filesInfo.name}';
     [info, valid] = MatUdp.DataLoadEnv.parseTrialFileName(files);
 
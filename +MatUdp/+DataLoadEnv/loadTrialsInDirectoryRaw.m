@@ -13,11 +13,28 @@ function [trials, meta] = loadTrialsInDirectoryRaw(folder, varargin)
         error('Folder %s does not exist', folder);
     end
 
+    % trials written with trialLogger --container
+    containers = dir(fullfile(folder, '*.mtc'));
+    if ~isempty(containers)
+        [trials, meta] = loadTrialsFromContainers(folder, {containers.name}, trialIdFilter, maxTrials);
+        % trials written with trialLogger -o refer to earlier ones for unchanged params
+        trials = MatUdp.DataLoad.fillParamReferences(trials, ...
+            @(id) loadContainerTrialById(folder, {containers.name}, id));
+        meta = MatUdp.DataLoad.resolveSchemaMeta(folder, meta);
+        for i = 1:numel(trials)
+            [trials{i}, meta{i}] = stripGroups(trials{i}, meta{i}, p.Results.excludeGroups);
+        end
+        return;
+    end
+
     [names, info] = MatUdp.DataLoadEnv.listTrialFilesInSaveTagFolder(folder);
     if isempty(names)
         error('No mat files found in %s', folder);
     end
 
+    allNames = names;
+    allTrialIds = [info.trialId];
+
     if ~isempty(trialIdFilter)
         % filter by those found in list
         trialIdsFound = [info.trialId];
@@ -30,6 +47,33 @@ function [trials, meta] = loadTrialsInDirectoryRaw(folder, varargin)
     if nargin > 1 && nFiles > maxTrials
         nFiles = maxTrials;
     end
+    if exist('loadTrialFiles', 'file') == 3
+        % reads the files on a pool of threads, see trial-loader-mex/loadTrialFiles.c
+        [trials, meta, ~, skipped] = loadTrialFiles(folder, 'files', names(1:nFiles));
+        meta = MatUdp.DataLoad.resolveSchemaMeta(folder, meta);
+        for i = 1:numel(trials)
+            [trials{i}, meta{i}] = stripGroups(trials{i}, meta{i}, p.Results.excludeGroups);
+        end
+        if ~isempty(skipped)
+            % MAT v7.3 files
+            [t, m, valid] = loadTrialFilesSerially(folder, skipped, p.Results.excludeGroups);
+            trials = cat(1, trials, t);
+            meta = cat(1, meta, m(valid));
+            [~, order] = sort(cellfun(@(trial) double(trial.trialId), trials));
+            trials = trials(order);
+            meta = meta(order);
+        end
+    else
+        [trials, meta] = loadTrialFilesSerially(folder, names(1:nFiles), p.Results.excludeGroups);
+    end
+
+    % trials written with trialLogger -o refer to earlier ones for unchanged params
+    trials = MatUdp.DataLoad.fillParamReferences(trials, ...
+        @(id) loadTrialById(folder, allNames, allTrialIds, id));
+end
+
+function [trials, meta, valid] = loadTrialFilesSerially(folder, names, excludeGroups)
+    nFiles = numel(names);
     data = cell(nFiles,1);
     meta = cell(nFiles,1);
     valid = false(nFiles,1);
@@ -37,11 +81,14 @@ function [trials, meta] = loadTrialsInDirectoryRaw(folder, varargin)
     %prog = ProgressBar(nFiles, 'Loading .mat in %s', folder);
     for i = 1:nFiles
         %prog.update(i);
-        d = load(fullfile(folder, names{i}), 'trial', 'meta');
+        d = MatUdp.DataLoad.loadTrialFile(fullfile(folder, names{i}));
         if ~isempty(d) && isfield(d, 'trial') && isfield(d, 'meta')
 
+            % trials written with trialLogger -m keep their group layouts in schema.mat
+            m = MatUdp.DataLoad.resolveSchemaMeta(folder, {d.meta});
+
             % strip groups
-            [data{i}, meta{i}] = stripGroups(d.trial, d.meta, p.Results.excludeGroups);
+            [data{i}, meta{i}] = stripGroups(d.trial, m{1}, excludeGroups);
             valid(i) = true;
         end
     end
@@ -50,6 +97,48 @@ function [trials, meta] = loadTrialsInDirectoryRaw(folder, varargin)
     trials = data(valid);
 end
 
+function trial = loadTrialById(folder, names, trialIds, id)
+% a trial left out by trialIdFilter or maxTrials that params refer to
+    trial = [];
+    match = find(trialIds == id, 1);
+    if ~isempty(match)
+        d = MatUdp.DataLoad.loadTrialFile(fullfile(folder, names{match}));
+        if isfield(d, 'trial')
+            trial = d.trial;
+        end
+    end
+end
+
+function trial = loadContainerTrialById(folder, names, id)
+% a trial left out by trialIdFilter or maxTrials that params refer to
+    trial = [];
+    trials = loadTrialsFromContainers(folder, names, id, 1);
+    if ~isempty(trials)
+        trial = trials{1};
+    end
+end
+
+function [trials, meta] = loadTrialsFromContainers(folder, names, trialIdFilter, maxTrials)
+% only the trials asked for are read, see trial-loader-mex/loadTrialContainer.c
+    trials = cell(0, 1);
+    meta = cell(0, 1);
+    for i = 1:numel(names)
+        file = fullfile(folder, names{i});
+        if isempty(trialIdFilter)
+            [t, m] = loadTrialContainer(file);
+        else
+            [t, m] = loadTrialContainer(file, double(trialIdFilter));
+        end
+        trials = cat(1, trials, t);
+        meta = cat(1, meta, m);
+    end
+
+    if numel(trials) > maxTrials
+        trials = trials(1:maxTrials);
+        meta = meta(1:maxTrials);
+    end
+end
+
 function [trial, meta] = stripGroups(trial, meta, groupsRemove)
     if isempty(groupsRemove), return; end
     signalsRemove = cell(0, 1);
@@ -35,6 +35,25 @@ prog = ProgressBar(numel(dateStr), 'Processing %d dates', numel(dateStr));
 for iD = 1:numel(dateStr)
   prog.update(iD);
 
+  % the binary trial index has every trial of the date, no need to list the trial files
+  indexFile = fullfile(MatUdp.DataLoadEnv.buildPathToDate('dateStr', dateStr{iD}, p.Unmatched), 'trialIndex.bin');
+  if exist(indexFile, 'file')
+    idx = queryTrialIndex(indexFile);
+    [keys, ~, which] = unique(table(string(idx.protocol), idx.saveTag), 'rows');
+    for iK = 1:height(keys)
+      if ~isempty(protocol) && ~ismember(keys{iK, 1}, protocol)
+        continue;
+      end
+      Date{c, 1} = dateStr{iD};
+      Protocol{c, 1} = char(keys{iK, 1});
+      SaveTag(c, 1) = keys{iK, 2};
+      % trials written twice, e.g. when the logger was restarted, count once
+      NumTrials(c, 1) = numel(unique(idx.trialId(which == iK)));
+      c = c+1;
+    end
+    continue;
+  end
+
   % loop over protocols included in list if specified
   protocolThis = MatUdp.DataLoadEnv.listProtocols('dateStr', dateStr{iD}, p.Unmatched);
   if ~isempty(protocol)
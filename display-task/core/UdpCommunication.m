@@ -9,6 +9,7 @@ classdef UdpCommunication < handle
   
   properties(SetAccess = protected, Hidden)
     state
+    latestSeq = struct() % .(groupName), seq of the sample last returned by readLatestGroups
   end
   
   properties(Dependent)
@@ -48,6 +49,7 @@ classdef UdpCommunication < handle
     function close(com)
       udpMexReceiver('stop');
       com.state = UdpCommunication.STATE_CLOSED;
+      com.latestSeq = struct(); % sequence numbers start over
     end
     
     function delete(com)
@@ -59,11 +61,38 @@ classdef UdpCommunication < handle
       udpMexReceiver('send', varargin{:});
     end
     
+    function subscribe(com, groupNames)
+      % only groupNames (and control groups) are buffered from here on, all groups again for {}
+      com.open();
+      udpMexReceiver('subscribe', groupNames);
+    end
+    
     function groups = readGroups(com)
       com.open();
       groups = udpMexReceiver('retrieveGroups');
     end
     
+    function [groups, received] = waitForGroups(com, groupNames, timeoutMs)
+      % as readGroups, once one of groupNames ({} for any) is received or timeoutMs is up,
+      % Inf waits for as long as it takes
+      com.open();
+      [groups, received] = udpMexReceiver('waitForGroups', groupNames, timeoutMs);
+    end
+    
+    function [groups, isNew] = readLatestGroups(com)
+      % the newest sample of every group received, at a small cost independent of how much was
+      % buffered. isNew flags the groups received since the last call, the samples received in
+      % between are skipped; use readGroups where every sample counts
+      com.open();
+      groups = udpMexReceiver('getLatestAll');
+      isNew = true(numel(groups), 1);
+      for iG = 1:numel(groups)
+        name = groups(iG).name;
+        isNew(iG) = ~isfield(com.latestSeq, name) || com.latestSeq.(name) < groups(iG).seq;
+        com.latestSeq.(name) = groups(iG).seq;
+      end
+    end
+    
     function [groups, meta] = pollCurrentTrial(com)
       com.open();
       [groups, meta] = udpMexReceiver('pollCurrentTrial');
@@ -0,0 +1,227 @@
+// see Makefile for the mex build
+//
+// Loads trials from a trial container written by the trialLogger with --container, see
+// trialLogger/src/container.h for the layout. Trials are located through the container's
+// footer, or by walking the records of a container that is still being written to, and only
+// the records asked for are read from disk.
+//
+//   [trials, meta, trialIds] = loadTrialContainer(fileName)           % every trial
+//   [trials, meta, trialIds] = loadTrialContainer(fileName, trialIds) % those listed, e.g. 10:20
+//   [trialIds, wallclockStart] = loadTrialContainer(fileName, 'list')
+//
+// trials and meta are cell columns in the order of trialIds, requested trialIds that aren't
+// in the container are skipped. wallclockStart is in seconds since the unix epoch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mex.h"
+
+#include "../trialLogger/src/container.h"
+#include "matParse.h"
+
+#define MAX_ERROR_LENGTH 512
+
+// list the trialIds in the container in order, returns how many
+static size_t listTrialIds(const ContainerIndex* pIndex, uint32_t* trialIds) {
+	size_t nTrials = 0;
+	for (uint32_t i = 0; i < pIndex->nSlots; i++) {
+		if (pIndex->offsets[i] != 0)
+			trialIds[nTrials++] = pIndex->firstTrialId + i;
+	}
+	return nTrials;
+}
+
+// read and parse the trial's record into its trial and meta variables
+static bool loadRecord(int fd, uint64_t offset, uint32_t trialId, mxArray** pMxTrial, mxArray** pMxMeta,
+		char* errMsg) {
+	ContainerRecordHeader record;
+	if (!containerReadRecordHeader(fd, offset, &record) || !containerCheckRecordHeader(&record) ||
+			record.magic != CONTAINER_RECORD_MAGIC || record.trialId != trialId) {
+		snprintf(errMsg, MAX_ERROR_LENGTH, "Invalid record for trial %u at offset %llu",
+				trialId, (unsigned long long)offset);
+		return false;
+	}
+
+	uint8_t* payload = (uint8_t*)malloc(record.payloadBytes > 0 ? record.payloadBytes : 1);
+	if (payload == NULL) {
+		snprintf(errMsg, MAX_ERROR_LENGTH, "Out of memory reading trial %u", trialId);
+		return false;
+	}
+
+	size_t nRead = 0;
+	while (nRead < record.payloadBytes) {
+		ssize_t n = pread(fd, payload + nRead, record.payloadBytes - nRead, offset + sizeof(record) + nRead);
+		if (n <= 0)
+			break;
+		nRead += n;
+	}
+	if (nRead < record.payloadBytes) {
+		free(payload);
+		snprintf(errMsg, MAX_ERROR_LENGTH, "Truncated record for trial %u", trialId);
+		return false;
+	}
+	if (containerChecksumFinal(containerChecksumUpdate(CONTAINER_CHECKSUM_SEED, payload, record.payloadBytes)) !=
+			record.payloadChecksum) {
+		free(payload);
+		snprintf(errMsg, MAX_ERROR_LENGTH, "Corrupt record for trial %u", trialId);
+		return false;
+	}
+
+	const uint8_t* p = payload;
+	size_t avail = record.payloadBytes;
+	*pMxTrial = NULL;
+	*pMxMeta = NULL;
+	while (avail > 0) {
+		char name[64];
+		size_t elementBytes;
+		const char* error = NULL;
+
+		mxArray* pm = matParseVariable(p, avail, name, sizeof(name), &elementBytes, &error);
+		if (pm == NULL) {
+			snprintf(errMsg, MAX_ERROR_LENGTH, "Trial %u: %s", trialId, error);
+			break;
+		}
+		if (strcmp(name, "trial") == 0 && *pMxTrial == NULL)
+			*pMxTrial = pm;
+		else if (strcmp(name, "meta") == 0 && *pMxMeta == NULL)
+			*pMxMeta = pm;
+		else
+			mxDestroyArray(pm);
+
+		p += elementBytes;
+		avail -= elementBytes;
+	}
+	free(payload);
+
+	if (*pMxTrial == NULL || *pMxMeta == NULL) {
+		if (avail == 0)
+			snprintf(errMsg, MAX_ERROR_LENGTH, "Trial %u is missing its trial or meta variable", trialId);
+		if (*pMxTrial != NULL)
+			mxDestroyArray(*pMxTrial);
+		if (*pMxMeta != NULL)
+			mxDestroyArray(*pMxMeta);
+		return false;
+	}
+	return true;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	char errMsg[MAX_ERROR_LENGTH] = "";
+	bool listOnly = false;
+
+	if (nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]))
+		mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:usage",
+				"Usage: [trials, meta, trialIds] = loadTrialContainer(fileName, [trialIds | 'list'])");
+	if (nrhs == 2 && mxIsChar(prhs[1])) {
+		char *mode = mxArrayToString(prhs[1]);
+		listOnly = strcmp(mode, "list") == 0;
+		mxFree(mode);
+		if (!listOnly)
+			mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:usage", "Second argument must be trialIds or 'list'");
+	} else if (nrhs == 2 && !mxIsDouble(prhs[1])) {
+		mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:usage", "trialIds must be a double vector");
+	}
+
+	char *fileName = mxArrayToString(prhs[0]);
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0) {
+		snprintf(errMsg, MAX_ERROR_LENGTH, "Could not open %s", fileName);
+		mxFree(fileName);
+		mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:open", "%s", errMsg);
+	}
+
+	ContainerIndex index;
+	if (!containerReadIndex(fd, &index)) {
+		close(fd);
+		snprintf(errMsg, MAX_ERROR_LENGTH, "%s is not a trial container", fileName);
+		mxFree(fileName);
+		mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:open", "%s", errMsg);
+	}
+	mxFree(fileName);
+
+	// the trialIds to look up, in the order they're returned
+	size_t nRequested;
+	uint32_t *trialIds;
+	if (nrhs == 2 && !listOnly) {
+		const double *requested = mxGetPr(prhs[1]);
+		nRequested = mxGetNumberOfElements(prhs[1]);
+		trialIds = (uint32_t*)mxCalloc(nRequested > 0 ? nRequested : 1, sizeof(uint32_t));
+		size_t nValid = 0;
+		for (size_t i = 0; i < nRequested; i++) {
+			if (requested[i] >= 0 && requested[i] <= UINT32_MAX)
+				trialIds[nValid++] = (uint32_t)requested[i];
+		}
+		nRequested = nValid;
+	} else {
+		trialIds = (uint32_t*)mxCalloc(index.nSlots > 0 ? index.nSlots : 1, sizeof(uint32_t));
+		nRequested = listTrialIds(&index, trialIds);
+	}
+
+	if (listOnly) {
+		mxArray *mxIds = mxCreateDoubleMatrix(nRequested, 1, mxREAL);
+		mxArray *mxWallclock = mxCreateDoubleMatrix(nRequested, 1, mxREAL);
+		double *ids = mxGetPr(mxIds);
+		double *wallclock = mxGetPr(mxWallclock);
+
+		for (size_t i = 0; i < nRequested; i++) {
+			ContainerRecordHeader record;
+			ids[i] = trialIds[i];
+			uint64_t offset = containerLookupTrial(&index, trialIds[i]);
+			wallclock[i] = containerReadRecordHeader(fd, offset, &record) ? record.wallclockStart : mxGetNaN();
+		}
+
+		plhs[0] = mxIds;
+		if (nlhs > 1)
+			plhs[1] = mxWallclock;
+		else
+			mxDestroyArray(mxWallclock);
+	} else {
+		mxArray *mxTrials = mxCreateCellMatrix(nRequested, 1);
+		mxArray *mxMetas = mxCreateCellMatrix(nRequested, 1);
+		size_t nFound = 0;
+
+		for (size_t i = 0; i < nRequested; i++) {
+			mxArray *mxTrial, *mxMeta;
+			uint64_t offset = containerLookupTrial(&index, trialIds[i]);
+			if (offset == 0)
+				continue;
+			if (!loadRecord(fd, offset, trialIds[i], &mxTrial, &mxMeta, errMsg))
+				break;
+
+			mxSetCell(mxTrials, nFound, mxTrial);
+			mxSetCell(mxMetas, nFound, mxMeta);
+			trialIds[nFound++] = trialIds[i];
+		}
+
+		if (errMsg[0] == '\0') {
+			mxSetM(mxTrials, nFound);
+			mxSetM(mxMetas, nFound);
+			plhs[0] = mxTrials;
+			if (nlhs > 1)
+				plhs[1] = mxMetas;
+			else
+				mxDestroyArray(mxMetas);
+			if (nlhs > 2) {
+				plhs[2] = mxCreateDoubleMatrix(nFound, 1, mxREAL);
+				double *ids = mxGetPr(plhs[2]);
+				for (size_t i = 0; i < nFound; i++)
+					ids[i] = trialIds[i];
+			}
+		} else {
+			mxDestroyArray(mxTrials);
+			mxDestroyArray(mxMetas);
+		}
+	}
+
+	mxFree(trialIds);
+	containerFreeIndex(&index);
+	close(fd);
+
+	if (errMsg[0] != '\0')
+		mexErrMsgIdAndTxt("MATLAB:loadTrialContainer:read", "%s", errMsg);
+}
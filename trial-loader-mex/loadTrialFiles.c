@@ -0,0 +1,519 @@
+// see Makefile for the mex build
+//
+// Loads the trials of a saveTag folder of .mat files written by the trialLogger, a bulk
+// counterpart of calling load() on each. The files are listed from the folder's trialIndex.txt,
+// or from the folder itself where there is none, and read on a pool of threads that keep ahead
+// of the MATLAB thread, which turns each file into mxArrays in turn as it arrives. Only MAT v5
+// files can be read, see matParse.h, those written with -f v7.3 are skipped with a warning.
+//
+//   [trials, meta, trialIds] = loadTrialFiles(folder)
+//   [trials, meta, trialIds] = loadTrialFiles(folder, 'maxTrials', 100, 'trialIds', 10:20, ...)
+//   [trials, meta, trialIds, skipped] = loadTrialFiles(...)
+//
+// Options, all optional:
+//   'files'      cellstr, load these files of the folder instead of listing them
+//   'trialIds'   only the trials with these ids
+//   'maxTrials'  at most this many of the files, in file name order
+//   'signals'    cellstr, of trials written with trialLogger -V only these signal variables are
+//                read, the rest never leave the disk. Other trials are read whole
+//   'threads'    reader threads (default 4)
+//   'readahead'  files read ahead of the MATLAB thread at most (default 4 per thread)
+//
+// trials and meta are cell columns in file name order, which is trialId order, with the signal
+// variables of trials written with -V put back into trial as MatUdp.DataLoad.loadTrialFile does.
+// Files that can't be read or lack trial or meta are skipped with a warning. trialIds holds the
+// id in each file's name. If skipped is asked for, the names of the files that aren't MAT v5 are
+// returned in it instead of warned about, for the caller to load() them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mex.h"
+
+#include "matParse.h"
+
+#define MAX_ERROR_LENGTH 512
+#define MAX_PATH_LENGTH 1024
+#define MAX_VARIABLE_NAME_LENGTH 64
+#define DEFAULT_READER_THREADS 4
+#define MAX_READER_THREADS 64
+#define DEFAULT_READAHEAD_PER_THREAD 4
+// MAT v5 files start with a 128 byte header, its last 4 bytes the version and endian indicator
+#define MAT_HEADER_BYTES 128
+// enough of a variable's element to find its name, see matPeekVariable
+#define VARIABLE_PEEK_BYTES 256
+#define TRIAL_INDEX_TXT "trialIndex.txt"
+
+typedef enum { FILE_QUEUED, FILE_READING, FILE_READ, FILE_FAILED } FileState;
+
+typedef struct TrialFile {
+	char* name;
+	double trialId; // NaN if the name doesn't have one
+	FileState state;
+	// the elements of the variables to parse, one after the other
+	uint8_t* data;
+	size_t nBytes;
+	bool notMatV5; // e.g. written with -f v7.3
+	char error[MAX_ERROR_LENGTH];
+} TrialFile;
+
+typedef struct Loader {
+	char* folder;
+	TrialFile* files;
+	size_t nFiles;
+	// signal variables to read of trials written with -V, all of them when nSignals is 0
+	char** signals;
+	size_t nSignals;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	size_t nextToRead; // next file for a reader to claim
+	size_t nParsed;    // files the MATLAB thread is done with
+	size_t readahead;  // readers stay at most this many files ahead of nParsed
+} Loader;
+
+// -- listing
+
+static int compareNames(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// the id in a trial file's name, subject_protocol_id<trialId>_time<time>.mat
+static double parseTrialId(const char* name) {
+	for (const char* p = strstr(name, "_id"); p != NULL; p = strstr(p + 1, "_id")) {
+		char* end;
+		unsigned long trialId = strtoul(p + 3, &end, 10);
+		if (end > p + 3 && strncmp(end, "_time", 5) == 0)
+			return (double)trialId;
+	}
+	return mxGetNaN();
+}
+
+static bool isTrialFileName(const char* name) {
+	size_t len = strlen(name);
+	return len > 4 && strcmp(name + len - 4, ".mat") == 0 && !mxIsNaN(parseTrialId(name));
+}
+
+static void addName(char*** pNames, size_t* pnNames, size_t* pnAllocated, const char* name) {
+	if (*pnNames == *pnAllocated) {
+		*pnAllocated = *pnAllocated > 0 ? 2 * *pnAllocated : 256;
+		*pNames = (char**)mxRealloc(*pNames, *pnAllocated * sizeof(char*));
+	}
+	char* copy = (char*)mxMalloc(strlen(name) + 1);
+	strcpy(copy, name);
+	(*pNames)[(*pnNames)++] = copy;
+}
+
+// the trial files of the folder, sorted, from its trialIndex.txt, which lists each file written
+// to it on a line of its own, or else from the folder itself
+static char** listTrialFiles(const char* folder, size_t* pnNames) {
+	char path[MAX_PATH_LENGTH];
+	char** names = NULL;
+	size_t nNames = 0, nAllocated = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", folder, TRIAL_INDEX_TXT);
+	FILE* index = fopen(path, "r");
+	if (index != NULL) {
+		char line[MAX_PATH_LENGTH];
+		while (fgets(line, sizeof(line), index) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (isTrialFileName(line))
+				addName(&names, &nNames, &nAllocated, line);
+		}
+		fclose(index);
+	} else {
+		DIR* dir = opendir(folder);
+		if (dir == NULL)
+			mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:open", "Could not open folder %s", folder);
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (isTrialFileName(entry->d_name))
+				addName(&names, &nNames, &nAllocated, entry->d_name);
+		}
+		closedir(dir);
+	}
+
+	// a trial logged twice to the index is loaded once
+	qsort(names, nNames, sizeof(char*), compareNames);
+	size_t nUnique = 0;
+	for (size_t i = 0; i < nNames; i++) {
+		if (nUnique > 0 && strcmp(names[i], names[nUnique - 1]) == 0)
+			mxFree(names[i]);
+		else
+			names[nUnique++] = names[i];
+	}
+
+	*pnNames = nUnique;
+	return names;
+}
+
+// -- reading, on the reader threads, which don't touch the mx API
+
+static bool readBytes(int fd, uint8_t* buffer, size_t nBytes, off_t offset) {
+	size_t nRead = 0;
+	while (nRead < nBytes) {
+		ssize_t n = pread(fd, buffer + nRead, nBytes - nRead, offset + nRead);
+		if (n <= 0)
+			return false;
+		nRead += n;
+	}
+	return true;
+}
+
+static bool isVariableWanted(const Loader* pLoader, const char* name) {
+	if (pLoader->nSignals == 0 || strcmp(name, "trial") == 0 || strcmp(name, "meta") == 0)
+		return true;
+	for (size_t i = 0; i < pLoader->nSignals; i++) {
+		if (strcmp(name, pLoader->signals[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+// read the elements of the variables wanted into pFile->data, the whole file past its header
+// unless only some signals are. Sets pFile->error on failure
+static bool readTrialFile(const Loader* pLoader, TrialFile* pFile) {
+	char path[MAX_PATH_LENGTH];
+	uint8_t header[MAT_HEADER_BYTES];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", pLoader->folder, pFile->name);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		snprintf(pFile->error, MAX_ERROR_LENGTH, "Could not open %s", pFile->name);
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	size_t fileBytes = (size_t)st.st_size;
+	// version 0x0100, little endian
+	if (fileBytes < MAT_HEADER_BYTES || !readBytes(fd, header, MAT_HEADER_BYTES, 0) ||
+			header[124] != 0x00 || header[125] != 0x01 || header[126] != 'I' || header[127] != 'M') {
+		snprintf(pFile->error, MAX_ERROR_LENGTH, "%s is not a MAT v5 file, load it with load()", pFile->name);
+		pFile->notMatV5 = true;
+		close(fd);
+		return false;
+	}
+
+	size_t nBytes = fileBytes - MAT_HEADER_BYTES;
+	pFile->data = (uint8_t*)malloc(nBytes > 0 ? nBytes : 1);
+	if (pFile->data == NULL) {
+		snprintf(pFile->error, MAX_ERROR_LENGTH, "Out of memory reading %s", pFile->name);
+		close(fd);
+		return false;
+	}
+
+	bool success = true;
+	if (pLoader->nSignals == 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		success = readBytes(fd, pFile->data, nBytes, MAT_HEADER_BYTES);
+		pFile->nBytes = nBytes;
+	} else {
+		// walk the variables by their tags and only read those wanted
+		size_t offset = MAT_HEADER_BYTES;
+		pFile->nBytes = 0;
+		while (success && offset < fileBytes) {
+			uint8_t peek[VARIABLE_PEEK_BYTES];
+			char name[MAX_VARIABLE_NAME_LENGTH];
+			size_t peekBytes = fileBytes - offset < VARIABLE_PEEK_BYTES ? fileBytes - offset : VARIABLE_PEEK_BYTES;
+			size_t elementBytes;
+
+			success = readBytes(fd, peek, peekBytes, offset) &&
+				matPeekVariable(peek, peekBytes, name, sizeof(name), &elementBytes);
+			if (!success)
+				break;
+			// the last element may go without its padding
+			if (elementBytes > fileBytes - offset)
+				elementBytes = fileBytes - offset;
+
+			if (isVariableWanted(pLoader, name)) {
+				success = readBytes(fd, pFile->data + pFile->nBytes, elementBytes, offset);
+				pFile->nBytes += elementBytes;
+			}
+			offset += elementBytes;
+		}
+	}
+	close(fd);
+
+	if (!success)
+		snprintf(pFile->error, MAX_ERROR_LENGTH, "Could not read %s", pFile->name);
+	return success;
+}
+
+static void* readerThread(void* arg) {
+	Loader* pLoader = (Loader*)arg;
+
+	pthread_mutex_lock(&pLoader->mutex);
+	while (true) {
+		while (pLoader->nextToRead < pLoader->nFiles && pLoader->nextToRead >= pLoader->nParsed + pLoader->readahead)
+			pthread_cond_wait(&pLoader->cond, &pLoader->mutex);
+		if (pLoader->nextToRead >= pLoader->nFiles)
+			break;
+
+		TrialFile* pFile = pLoader->files + pLoader->nextToRead++;
+		pFile->state = FILE_READING;
+		pthread_mutex_unlock(&pLoader->mutex);
+
+		bool success = readTrialFile(pLoader, pFile);
+
+		pthread_mutex_lock(&pLoader->mutex);
+		pFile->state = success ? FILE_READ : FILE_FAILED;
+		pthread_cond_broadcast(&pLoader->cond);
+	}
+	pthread_mutex_unlock(&pLoader->mutex);
+	return NULL;
+}
+
+// -- parsing, on the MATLAB thread
+
+// the trial and meta variables read from the file, with the signal variables of trials written
+// with -V put back into trial
+static bool parseTrialFile(TrialFile* pFile, mxArray** pMxTrial, mxArray** pMxMeta) {
+	const uint8_t* p = pFile->data;
+	size_t avail = pFile->nBytes;
+	mxArray* mxTrial = NULL;
+	mxArray* mxMeta = NULL;
+	mxArray* mxSignals = mxCreateStructMatrix(1, 1, 0, NULL);
+
+	while (avail > 0) {
+		char name[MAX_VARIABLE_NAME_LENGTH];
+		size_t elementBytes;
+		const char* error = NULL;
+
+		mxArray* pm = matParseVariable(p, avail, name, sizeof(name), &elementBytes, &error);
+		if (pm == NULL) {
+			snprintf(pFile->error, MAX_ERROR_LENGTH, "%s: %s", pFile->name, error);
+			break;
+		}
+		if (strcmp(name, "trial") == 0 && mxTrial == NULL)
+			mxTrial = pm;
+		else if (strcmp(name, "meta") == 0 && mxMeta == NULL)
+			mxMeta = pm;
+		else if (name[0] != '\0' && mxGetFieldNumber(mxSignals, name) < 0)
+			mxSetFieldByNumber(mxSignals, 0, mxAddField(mxSignals, name), pm);
+		else
+			mxDestroyArray(pm);
+
+		p += elementBytes;
+		avail -= elementBytes;
+	}
+
+	if (mxTrial == NULL || mxMeta == NULL) {
+		if (avail == 0)
+			snprintf(pFile->error, MAX_ERROR_LENGTH, "%s is missing its trial or meta variable", pFile->name);
+		if (mxTrial != NULL)
+			mxDestroyArray(mxTrial);
+		if (mxMeta != NULL)
+			mxDestroyArray(mxMeta);
+		mxDestroyArray(mxSignals);
+		return false;
+	}
+
+	// the signal variables follow the trial header in the order it lists them
+	int signalVariablesField = mxGetFieldNumber(mxTrial, "signalVariables");
+	if (signalVariablesField >= 0 && mxIsStruct(mxTrial) && mxGetNumberOfElements(mxTrial) == 1) {
+		mxRemoveField(mxTrial, signalVariablesField);
+		for (int i = 0; i < mxGetNumberOfFields(mxSignals); i++) {
+			int field = mxAddField(mxTrial, mxGetFieldNameByNumber(mxSignals, i));
+			mxSetFieldByNumber(mxTrial, 0, field, mxGetFieldByNumber(mxSignals, 0, i));
+			mxSetFieldByNumber(mxSignals, 0, i, NULL);
+		}
+	}
+	mxDestroyArray(mxSignals);
+
+	*pMxTrial = mxTrial;
+	*pMxMeta = mxMeta;
+	return true;
+}
+
+// -- options
+
+static char** getStringList(const mxArray* pm, const char* name, size_t* pN) {
+	if (!mxIsCell(pm))
+		mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "%s must be a cellstr", name);
+	*pN = mxGetNumberOfElements(pm);
+	char** list = (char**)mxCalloc(*pN > 0 ? *pN : 1, sizeof(char*));
+	for (size_t i = 0; i < *pN; i++) {
+		const mxArray* mxString = mxGetCell(pm, i);
+		if (mxString == NULL || !mxIsChar(mxString))
+			mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "%s must be a cellstr", name);
+		list[i] = mxArrayToString(mxString);
+	}
+	return list;
+}
+
+static double getScalar(const mxArray* pm, const char* name) {
+	if (!mxIsDouble(pm) || mxGetNumberOfElements(pm) != 1)
+		mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "%s must be a scalar", name);
+	return mxGetScalar(pm);
+}
+
+static bool isInList(double value, const double* list, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (list[i] == value)
+			return true;
+	}
+	return false;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	Loader loader;
+	char** names = NULL;
+	size_t nNames = 0;
+	const double* trialIds = NULL;
+	size_t nTrialIds = 0;
+	double maxTrials = mxGetInf();
+	double nThreads = DEFAULT_READER_THREADS;
+	double readahead = 0;
+
+	memset(&loader, 0, sizeof(loader));
+
+	if (nrhs < 1 || !mxIsChar(prhs[0]) || nrhs % 2 != 1)
+		mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage",
+				"Usage: [trials, meta, trialIds, skipped] = loadTrialFiles(folder, [option, value, ...])");
+
+	for (int i = 1; i < nrhs; i += 2) {
+		char name[32];
+		if (!mxIsChar(prhs[i]) || mxGetString(prhs[i], name, sizeof(name)) != 0)
+			mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "Option names must be strings");
+
+		const mxArray *value = prhs[i + 1];
+		if (strcmp(name, "files") == 0) {
+			names = getStringList(value, name, &nNames);
+		} else if (strcmp(name, "signals") == 0) {
+			loader.signals = getStringList(value, name, &loader.nSignals);
+		} else if (strcmp(name, "trialIds") == 0) {
+			if (!mxIsDouble(value))
+				mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "trialIds must be a double vector");
+			trialIds = mxGetPr(value);
+			nTrialIds = mxGetNumberOfElements(value);
+		} else if (strcmp(name, "maxTrials") == 0) {
+			maxTrials = getScalar(value, name);
+		} else if (strcmp(name, "threads") == 0) {
+			nThreads = getScalar(value, name);
+		} else if (strcmp(name, "readahead") == 0) {
+			readahead = getScalar(value, name);
+		} else {
+			mexErrMsgIdAndTxt("MATLAB:loadTrialFiles:usage", "Unknown option %s", name);
+		}
+	}
+
+	loader.folder = mxArrayToString(prhs[0]);
+	if (names == NULL)
+		names = listTrialFiles(loader.folder, &nNames);
+
+	// the files to load, those of the trials asked for up to maxTrials
+	loader.files = (TrialFile*)mxCalloc(nNames > 0 ? nNames : 1, sizeof(TrialFile));
+	for (size_t i = 0; i < nNames; i++) {
+		double trialId = parseTrialId(names[i]);
+		if (trialIds != NULL && !isInList(trialId, trialIds, nTrialIds))
+			continue;
+		if (loader.nFiles >= maxTrials)
+			break;
+		loader.files[loader.nFiles].name = names[i];
+		loader.files[loader.nFiles].trialId = trialId;
+		loader.nFiles++;
+	}
+
+	if (nThreads < 1)
+		nThreads = 1;
+	if (nThreads > MAX_READER_THREADS)
+		nThreads = MAX_READER_THREADS;
+	if (nThreads > loader.nFiles)
+		nThreads = loader.nFiles > 0 ? loader.nFiles : 1;
+	loader.readahead = readahead >= 1 ? (size_t)readahead : (size_t)nThreads * DEFAULT_READAHEAD_PER_THREAD;
+
+	pthread_mutex_init(&loader.mutex, NULL);
+	pthread_cond_init(&loader.cond, NULL);
+	pthread_t threads[MAX_READER_THREADS];
+	unsigned nStarted = 0;
+	for (unsigned i = 0; i < (unsigned)nThreads; i++) {
+		if (pthread_create(threads + nStarted, NULL, readerThread, &loader) == 0)
+			nStarted++;
+	}
+	if (nStarted == 0) {
+		// read them here then
+		loader.readahead = 1;
+	}
+
+	mxArray *mxTrials = mxCreateCellMatrix(loader.nFiles, 1);
+	mxArray *mxMetas = mxCreateCellMatrix(loader.nFiles, 1);
+	mxArray *mxTrialIds = mxCreateDoubleMatrix(loader.nFiles, 1, mxREAL);
+	double *loadedTrialIds = mxGetPr(mxTrialIds);
+	mxArray *mxSkipped = mxCreateCellMatrix(loader.nFiles, 1);
+	size_t nLoaded = 0, nSkipped = 0;
+
+	for (size_t i = 0; i < loader.nFiles; i++) {
+		TrialFile *pFile = loader.files + i;
+
+		if (nStarted == 0) {
+			pFile->state = readTrialFile(&loader, pFile) ? FILE_READ : FILE_FAILED;
+		} else {
+			pthread_mutex_lock(&loader.mutex);
+			while (pFile->state != FILE_READ && pFile->state != FILE_FAILED)
+				pthread_cond_wait(&loader.cond, &loader.mutex);
+			pthread_mutex_unlock(&loader.mutex);
+		}
+
+		mxArray *mxTrial, *mxMeta;
+		if (pFile->state == FILE_READ && parseTrialFile(pFile, &mxTrial, &mxMeta)) {
+			mxSetCell(mxTrials, nLoaded, mxTrial);
+			mxSetCell(mxMetas, nLoaded, mxMeta);
+			loadedTrialIds[nLoaded++] = pFile->trialId;
+		} else if (pFile->notMatV5 && nlhs > 3) {
+			mxSetCell(mxSkipped, nSkipped++, mxCreateString(pFile->name));
+		} else {
+			mexWarnMsgIdAndTxt("MATLAB:loadTrialFiles:skipped", "%s, skipped", pFile->error);
+		}
+		free(pFile->data);
+		pFile->data = NULL;
+
+		// let the readers move on
+		pthread_mutex_lock(&loader.mutex);
+		loader.nParsed = i + 1;
+		pthread_cond_broadcast(&loader.cond);
+		pthread_mutex_unlock(&loader.mutex);
+	}
+
+	for (unsigned i = 0; i < nStarted; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&loader.cond);
+	pthread_mutex_destroy(&loader.mutex);
+
+	mxSetM(mxTrials, nLoaded);
+	mxSetM(mxMetas, nLoaded);
+	mxSetM(mxTrialIds, nLoaded);
+	mxSetM(mxSkipped, nSkipped);
+	plhs[0] = mxTrials;
+	if (nlhs > 1)
+		plhs[1] = mxMetas;
+	else
+		mxDestroyArray(mxMetas);
+	if (nlhs > 2)
+		plhs[2] = mxTrialIds;
+	else
+		mxDestroyArray(mxTrialIds);
+	if (nlhs > 3)
+		plhs[3] = mxSkipped;
+	else
+		mxDestroyArray(mxSkipped);
+
+	for (size_t i = 0; i < nNames; i++)
+		mxFree(names[i]);
+	mxFree(names);
+	for (size_t i = 0; i < loader.nSignals; i++)
+		mxFree(loader.signals[i]);
+	if (loader.signals != NULL)
+		mxFree(loader.signals);
+	mxFree(loader.files);
+	mxFree(loader.folder);
+}
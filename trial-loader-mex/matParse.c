@@ -0,0 +1,385 @@
+// MAT v5 element parser, see matParse.h
+//
+// Follows "MAT-File Format" (MathWorks, Level 5 MAT-files): every data element is an 8 byte
+// tag (or a 4 byte tag for small elements of up to 4 bytes) followed by its data padded to
+// 8 bytes. An miMATRIX element holds array flags, dimensions, name and then the data, the
+// cell elements, or the struct field names and values.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "matParse.h"
+
+#define miINT8    1
+#define miUINT8   2
+#define miINT16   3
+#define miUINT16  4
+#define miINT32   5
+#define miUINT32  6
+#define miSINGLE  7
+#define miDOUBLE  9
+#define miINT64   12
+#define miUINT64  13
+#define miMATRIX  14
+#define miUTF8    16
+#define miUTF16   17
+#define miUTF32   18
+
+// array classes as stored in the array flags, the rest match mxClassID
+#define MAT_CLASS_OBJECT 3
+#define MAT_CLASS_SPARSE 5
+
+#define MAT_FLAG_COMPLEX 0x0800
+#define MAT_FLAG_LOGICAL 0x0200
+
+#define MAT_MAX_DIMS 32
+// MATLAB limits field names to 63 characters
+#define MAT_MAX_FIELD_NAME_LENGTH 64
+
+typedef struct Element {
+	uint32_t type;
+	uint32_t nBytes;
+	const uint8_t* data;
+} Element;
+
+static size_t padTo8(size_t nBytes) {
+	return (nBytes + 7) & ~(size_t)7;
+}
+
+// read the element at *pp and advance past it
+static bool nextElement(const uint8_t** pp, size_t* pAvail, Element* pe) {
+	const uint8_t* p = *pp;
+	size_t elementBytes;
+	uint32_t word;
+
+	if (*pAvail < 8)
+		return false;
+	memcpy(&word, p, 4);
+
+	if (word >> 16 != 0) {
+		// small data element, type and size share the first word
+		pe->type = word & 0xffff;
+		pe->nBytes = word >> 16;
+		pe->data = p + 4;
+		if (pe->nBytes > 4)
+			return false;
+		elementBytes = 8;
+	} else {
+		pe->type = word;
+		memcpy(&pe->nBytes, p + 4, 4);
+		pe->data = p + 8;
+		if (pe->nBytes > *pAvail - 8)
+			return false;
+		// the last element may go without its padding
+		elementBytes = 8 + padTo8(pe->nBytes);
+		if (elementBytes > *pAvail)
+			elementBytes = *pAvail;
+	}
+
+	*pp += elementBytes;
+	*pAvail -= elementBytes;
+	return true;
+}
+
+static size_t getSizeOfType(uint32_t type) {
+	switch (type) {
+		case miINT8: case miUINT8: case miUTF8:
+			return 1;
+		case miINT16: case miUINT16: case miUTF16:
+			return 2;
+		case miINT32: case miUINT32: case miSINGLE: case miUTF32:
+			return 4;
+		case miDOUBLE: case miINT64: case miUINT64:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+// the type data of this class is stored as when MATLAB doesn't narrow it
+static uint32_t getTypeOfClass(mxClassID classId) {
+	switch (classId) {
+		case mxDOUBLE_CLASS: return miDOUBLE;
+		case mxSINGLE_CLASS: return miSINGLE;
+		case mxINT8_CLASS:   return miINT8;
+		case mxUINT8_CLASS:  return miUINT8;
+		case mxINT16_CLASS:  return miINT16;
+		case mxUINT16_CLASS: return miUINT16;
+		case mxINT32_CLASS:  return miINT32;
+		case mxUINT32_CLASS: return miUINT32;
+		case mxINT64_CLASS:  return miINT64;
+		case mxUINT64_CLASS: return miUINT64;
+		case mxCHAR_CLASS:   return miUINT16;
+		case mxLOGICAL_CLASS: return miUINT8;
+		default: return 0;
+	}
+}
+
+static double readAsDouble(const uint8_t* p, uint32_t type) {
+	switch (type) {
+		case miINT8:   { int8_t v;   memcpy(&v, p, 1); return v; }
+		case miUINT8: case miUTF8: { uint8_t v; memcpy(&v, p, 1); return v; }
+		case miINT16:  { int16_t v;  memcpy(&v, p, 2); return v; }
+		case miUINT16: case miUTF16: { uint16_t v; memcpy(&v, p, 2); return v; }
+		case miINT32:  { int32_t v;  memcpy(&v, p, 4); return v; }
+		case miUINT32: case miUTF32: { uint32_t v; memcpy(&v, p, 4); return v; }
+		case miSINGLE: { float v;    memcpy(&v, p, 4); return v; }
+		case miDOUBLE: { double v;   memcpy(&v, p, 8); return v; }
+		case miINT64:  { int64_t v;  memcpy(&v, p, 8); return (double)v; }
+		case miUINT64: { uint64_t v; memcpy(&v, p, 8); return (double)v; }
+		default: return 0;
+	}
+}
+
+static void writeFromDouble(void* data, size_t i, mxClassID classId, double value) {
+	switch (classId) {
+		case mxDOUBLE_CLASS: ((double*)data)[i] = value; break;
+		case mxSINGLE_CLASS: ((float*)data)[i] = (float)value; break;
+		case mxINT8_CLASS:   ((int8_t*)data)[i] = (int8_t)value; break;
+		case mxUINT8_CLASS:  ((uint8_t*)data)[i] = (uint8_t)value; break;
+		case mxINT16_CLASS:  ((int16_t*)data)[i] = (int16_t)value; break;
+		case mxUINT16_CLASS: ((uint16_t*)data)[i] = (uint16_t)value; break;
+		case mxINT32_CLASS:  ((int32_t*)data)[i] = (int32_t)value; break;
+		case mxUINT32_CLASS: ((uint32_t*)data)[i] = (uint32_t)value; break;
+		case mxINT64_CLASS:  ((int64_t*)data)[i] = (int64_t)value; break;
+		case mxUINT64_CLASS: ((uint64_t*)data)[i] = (uint64_t)value; break;
+		case mxCHAR_CLASS:   ((mxChar*)data)[i] = (mxChar)value; break;
+		case mxLOGICAL_CLASS: ((mxLogical*)data)[i] = value != 0; break;
+		default: break;
+	}
+}
+
+// fill pm's data from the real part element, converting if it was stored narrowed
+static bool readArrayData(mxArray* pm, mxClassID classId, size_t nElements, const Element* pe) {
+	size_t typeSize = getSizeOfType(pe->type);
+	if (typeSize == 0 || pe->nBytes < nElements * typeSize)
+		return false;
+	if (nElements == 0)
+		return true;
+
+	void* data = mxGetData(pm);
+	if (pe->type == getTypeOfClass(classId)) {
+		memcpy(data, pe->data, nElements * typeSize);
+	} else {
+		for (size_t i = 0; i < nElements; i++)
+			writeFromDouble(data, i, classId, readAsDouble(pe->data + i*typeSize, pe->type));
+	}
+	return true;
+}
+
+static mxArray* parseMatrix(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		const char** pError);
+
+// the struct's field names, then its values element by element
+static bool readStructFields(const uint8_t** pp, size_t* pAvail, int* pnFields, char** pNameBlock) {
+	Element lengthElement, namesElement;
+	int32_t fieldNameLength;
+
+	if (!nextElement(pp, pAvail, &lengthElement) || lengthElement.nBytes < 4)
+		return false;
+	memcpy(&fieldNameLength, lengthElement.data, 4);
+	if (!nextElement(pp, pAvail, &namesElement) || fieldNameLength <= 0)
+		return false;
+
+	int nFields = (int)(namesElement.nBytes / fieldNameLength);
+	char* block = (char*)calloc(nFields > 0 ? nFields : 1, MAT_MAX_FIELD_NAME_LENGTH);
+	if (block == NULL)
+		return false;
+
+	for (int i = 0; i < nFields; i++) {
+		size_t len = strnlen((const char*)namesElement.data + i*fieldNameLength, fieldNameLength);
+		if (len >= MAT_MAX_FIELD_NAME_LENGTH)
+			len = MAT_MAX_FIELD_NAME_LENGTH - 1;
+		memcpy(block + i*MAT_MAX_FIELD_NAME_LENGTH, namesElement.data + i*fieldNameLength, len);
+	}
+
+	*pnFields = nFields;
+	*pNameBlock = block;
+	return true;
+}
+
+// parse the children of a cell or struct, nChildren of them
+static bool readChildren(mxArray* pm, bool isStruct, int nFields, size_t nChildren,
+		const uint8_t** pp, size_t* pAvail, const char** pError) {
+	char childName[MAT_MAX_FIELD_NAME_LENGTH];
+	Element child;
+
+	for (size_t i = 0; i < nChildren; i++) {
+		if (!nextElement(pp, pAvail, &child) || child.type != miMATRIX) {
+			*pError = "Missing cell or struct element";
+			return false;
+		}
+
+		mxArray* value = parseMatrix(child.data, child.nBytes, childName, sizeof(childName), pError);
+		if (value == NULL)
+			return false;
+
+		if (isStruct)
+			mxSetFieldByNumber(pm, i / nFields, (int)(i % nFields), value);
+		else
+			mxSetCell(pm, i, value);
+	}
+	return true;
+}
+
+// parse the content of an miMATRIX element
+static mxArray* parseMatrix(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		const char** pError) {
+	Element flagsElement, dimsElement, nameElement;
+	mwSize dims[MAT_MAX_DIMS];
+	size_t avail = nBytes;
+
+	name[0] = '\0';
+
+	// an empty element is an empty double, as MATLAB writes for unset cells
+	if (nBytes == 0)
+		return mxCreateDoubleMatrix(0, 0, mxREAL);
+
+	if (!nextElement(&p, &avail, &flagsElement) || flagsElement.type != miUINT32 || flagsElement.nBytes < 8) {
+		*pError = "Invalid array flags";
+		return NULL;
+	}
+	uint32_t flags;
+	memcpy(&flags, flagsElement.data, 4);
+	uint32_t arrayClass = flags & 0xff;
+
+	if ((flags & MAT_FLAG_COMPLEX) || arrayClass == MAT_CLASS_OBJECT || arrayClass == MAT_CLASS_SPARSE ||
+			arrayClass < mxCELL_CLASS || arrayClass > mxUINT64_CLASS) {
+		*pError = "Unsupported array class, only real numeric, logical, char, cell and struct arrays can be read";
+		return NULL;
+	}
+
+	if (!nextElement(&p, &avail, &dimsElement) || dimsElement.type != miINT32 ||
+			dimsElement.nBytes < 8 || dimsElement.nBytes > 4*MAT_MAX_DIMS) {
+		*pError = "Invalid array dimensions";
+		return NULL;
+	}
+	mwSize nDims = dimsElement.nBytes / 4;
+	size_t nElements = 1;
+	for (mwSize i = 0; i < nDims; i++) {
+		int32_t dim;
+		memcpy(&dim, dimsElement.data + 4*i, 4);
+		if (dim < 0) {
+			*pError = "Invalid array dimensions";
+			return NULL;
+		}
+		dims[i] = (mwSize)dim;
+		nElements *= (size_t)dim;
+	}
+
+	if (!nextElement(&p, &avail, &nameElement) || nameElement.type != miINT8) {
+		*pError = "Invalid array name";
+		return NULL;
+	}
+	size_t nameLength = nameElement.nBytes < maxNameLength ? nameElement.nBytes : maxNameLength - 1;
+	memcpy(name, nameElement.data, nameLength);
+	name[nameLength] = '\0';
+
+	mxArray* pm = NULL;
+	if (arrayClass == mxCELL_CLASS) {
+		pm = mxCreateCellArray(nDims, dims);
+		if (!readChildren(pm, false, 0, nElements, &p, &avail, pError)) {
+			mxDestroyArray(pm);
+			return NULL;
+		}
+
+	} else if (arrayClass == mxSTRUCT_CLASS) {
+		int nFields;
+		char* nameBlock;
+		if (!readStructFields(&p, &avail, &nFields, &nameBlock)) {
+			*pError = "Invalid struct field names";
+			return NULL;
+		}
+
+		const char** fieldNames = (const char**)calloc(nFields > 0 ? nFields : 1, sizeof(char*));
+		if (fieldNames == NULL) {
+			free(nameBlock);
+			*pError = "Out of memory";
+			return NULL;
+		}
+		for (int i = 0; i < nFields; i++)
+			fieldNames[i] = nameBlock + i*MAT_MAX_FIELD_NAME_LENGTH;
+
+		pm = mxCreateStructArray(nDims, dims, nFields, fieldNames);
+		free(fieldNames);
+		free(nameBlock);
+
+		if (nFields > 0 && !readChildren(pm, true, nFields, nElements * nFields, &p, &avail, pError)) {
+			mxDestroyArray(pm);
+			return NULL;
+		}
+
+	} else {
+		Element dataElement;
+		bool isLogical = (flags & MAT_FLAG_LOGICAL) != 0;
+		mxClassID classId = isLogical ? mxLOGICAL_CLASS : (mxClassID)arrayClass;
+
+		if (classId == mxCHAR_CLASS)
+			pm = mxCreateCharArray(nDims, dims);
+		else if (classId == mxLOGICAL_CLASS)
+			pm = mxCreateLogicalArray(nDims, dims);
+		else
+			pm = mxCreateNumericArray(nDims, dims, classId, mxREAL);
+
+		if (!nextElement(&p, &avail, &dataElement)) {
+			if (nElements == 0)
+				return pm;
+			mxDestroyArray(pm);
+			*pError = "Missing array data";
+			return NULL;
+		}
+		if (!readArrayData(pm, classId, nElements, &dataElement)) {
+			mxDestroyArray(pm);
+			*pError = "Invalid array data";
+			return NULL;
+		}
+	}
+
+	return pm;
+}
+
+mxArray* matParseVariable(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		size_t* pElementBytes, const char** pError) {
+	const uint8_t* start = p;
+	size_t avail = nBytes;
+	Element element;
+
+	if (!nextElement(&p, &avail, &element)) {
+		*pError = "Truncated variable";
+		return NULL;
+	}
+	if (element.type != miMATRIX) {
+		*pError = "Variable is not an miMATRIX element (compressed files are not supported)";
+		return NULL;
+	}
+
+	*pElementBytes = p - start;
+	return parseMatrix(element.data, element.nBytes, name, maxNameLength, pError);
+}
+
+bool matPeekVariable(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		size_t* pElementBytes) {
+	Element flagsElement, dimsElement, nameElement;
+	uint32_t type, dataBytes;
+
+	if (nBytes < 8)
+		return false;
+	memcpy(&type, p, 4);
+	memcpy(&dataBytes, p + 4, 4);
+	if (type != miMATRIX)
+		return false;
+	*pElementBytes = 8 + padTo8(dataBytes);
+
+	// the flags, dimensions and name lead the element
+	const uint8_t* q = p + 8;
+	size_t avail = nBytes - 8 < dataBytes ? nBytes - 8 : dataBytes;
+	if (!nextElement(&q, &avail, &flagsElement) || !nextElement(&q, &avail, &dimsElement) ||
+			!nextElement(&q, &avail, &nameElement) || nameElement.type != miINT8)
+		return false;
+
+	size_t nameLength = nameElement.nBytes < maxNameLength ? nameElement.nBytes : maxNameLength - 1;
+	memcpy(name, nameElement.data, nameLength);
+	name[nameLength] = '\0';
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef MATPARSE_H_INCLUDED
+#define MATPARSE_H_INCLUDED
+
+// Parses MAT v5 data elements held in memory into mxArrays, the counterpart of the native
+// writer in trialLogger/src/matfile.c. Numeric, logical, char, cell and struct arrays are
+// supported, in any storage type MATLAB itself writes. Sparse, complex, object and
+// compressed (miCOMPRESSED) elements are not, as the trialLogger never writes them.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mex.h"
+
+// parse the miMATRIX element at p, of at most nBytes. Its name is copied into name and the
+// bytes it takes up, tag and padding included, into *pElementBytes. Returns NULL with
+// *pError set to a static message if the element can't be parsed
+mxArray* matParseVariable(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		size_t* pElementBytes, const char** pError);
+
+// the name of the miMATRIX element at p, of which only the first nBytes need be at hand, and the
+// bytes the whole element takes up, tag and padding included. Unlike matParseVariable this
+// doesn't touch the mx API, so that it can be called from any thread
+bool matPeekVariable(const uint8_t* p, size_t nBytes, char* name, size_t maxNameLength,
+		size_t* pElementBytes);
+
+#endif // ifndef MATPARSE_H_INCLUDED
@@ -0,0 +1,305 @@
+// see Makefile for the mex build
+//
+// Queries the binary trial index (trialIndex.bin) the trialLogger keeps in each date folder,
+// see trialLogger/src/trialIndex.h. The whole index is read at once and filtered here, so
+// that sessions of tens of thousands of trials can be tabulated without touching the trials.
+//
+//   idx = queryTrialIndex(fileName)
+//   idx = queryTrialIndex(fileName, 'protocol', 'Center', 'saveTag', [1 2], ...)
+//
+// Filters, all optional and combined with and:
+//   'protocol'        protocol name
+//   'saveTag'         list of saveTags
+//   'trialIds'        list of trialIds
+//   'wallclockRange'  [start stop] in seconds since the unix epoch
+//   'minDuration'     in ms
+//
+// With 'verify', true each matching trial is also checked against the file it points to, a
+// .mat file of the indexed size or a complete container record of that trialId, and idx gets
+// a logical valid column. This reads every trial in full.
+//
+// idx is a scalar struct of columns, one row per matching trial in the order logged:
+// trialId, saveTag, protocol (cellstr), protocolVersion, wallclockStart, timestampStart,
+// timestampEnd, duration, fileName (cellstr, relative to the date folder), fileOffset,
+// fileBytes, groupTypeBytes (one column per group type, starting from type 0), dataRoot
+// (which of the logger's -d roots the file is on, 0 being the one holding the index) and staged
+// (logical, true while the file is still on the logger's staging tier).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "mex.h"
+
+#include "../trialLogger/src/trialIndex.h"
+#include "../trialLogger/src/container.h"
+
+typedef struct TrialIndexFilter {
+	char protocol[TRIAL_INDEX_PROTOCOL_LENGTH + 1];
+	const double *saveTags;
+	size_t nSaveTags;
+	const double *trialIds;
+	size_t nTrialIds;
+	double wallclockRange[2];
+	double minDuration;
+	// not a filter, adds the valid column
+	bool verify;
+} TrialIndexFilter;
+
+static bool isInList(double value, const double *list, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (list[i] == value)
+			return true;
+	}
+	return false;
+}
+
+static bool matchesFilter(const TrialIndexRecord *pRecord, const TrialIndexFilter *pFilter) {
+	if (pFilter->protocol[0] != '\0' &&
+			strncmp(pRecord->protocol, pFilter->protocol, TRIAL_INDEX_PROTOCOL_LENGTH) != 0)
+		return false;
+	if (pFilter->saveTags != NULL && !isInList(pRecord->saveTag, pFilter->saveTags, pFilter->nSaveTags))
+		return false;
+	if (pFilter->trialIds != NULL && !isInList(pRecord->trialId, pFilter->trialIds, pFilter->nTrialIds))
+		return false;
+	if (pRecord->wallclockStart < pFilter->wallclockRange[0] || pRecord->wallclockStart > pFilter->wallclockRange[1])
+		return false;
+	return pRecord->duration >= pFilter->minDuration;
+}
+
+static const double *getDoubleList(const mxArray *pm, const char *name, size_t *pN) {
+	if (!mxIsDouble(pm))
+		mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "%s must be a double vector", name);
+	*pN = mxGetNumberOfElements(pm);
+	return mxGetPr(pm);
+}
+
+static void parseFilter(int nrhs, const mxArray *prhs[], TrialIndexFilter *pFilter) {
+	memset(pFilter, 0, sizeof(TrialIndexFilter));
+	pFilter->wallclockRange[0] = -mxGetInf();
+	pFilter->wallclockRange[1] = mxGetInf();
+	pFilter->minDuration = -mxGetInf();
+
+	if (nrhs % 2 != 1)
+		mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "Filters must be given as name, value pairs");
+
+	for (int i = 1; i < nrhs; i += 2) {
+		char name[32];
+		size_t n;
+		if (!mxIsChar(prhs[i]) || mxGetString(prhs[i], name, sizeof(name)) != 0)
+			mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "Filter names must be strings");
+
+		const mxArray *value = prhs[i + 1];
+		if (strcmp(name, "protocol") == 0) {
+			if (!mxIsChar(value) || mxGetString(value, pFilter->protocol, sizeof(pFilter->protocol)) != 0)
+				mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "protocol must be a string of at most %d characters",
+						TRIAL_INDEX_PROTOCOL_LENGTH);
+		} else if (strcmp(name, "saveTag") == 0) {
+			pFilter->saveTags = getDoubleList(value, name, &pFilter->nSaveTags);
+		} else if (strcmp(name, "trialIds") == 0) {
+			pFilter->trialIds = getDoubleList(value, name, &pFilter->nTrialIds);
+		} else if (strcmp(name, "wallclockRange") == 0) {
+			const double *range = getDoubleList(value, name, &n);
+			if (n != 2)
+				mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "wallclockRange must be [start stop]");
+			pFilter->wallclockRange[0] = range[0];
+			pFilter->wallclockRange[1] = range[1];
+		} else if (strcmp(name, "minDuration") == 0) {
+			const double *minDuration = getDoubleList(value, name, &n);
+			if (n != 1)
+				mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "minDuration must be a scalar");
+			pFilter->minDuration = minDuration[0];
+		} else if (strcmp(name, "verify") == 0) {
+			if (mxGetNumberOfElements(value) != 1 || !(mxIsLogical(value) || mxIsNumeric(value)))
+				mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "verify must be true or false");
+			pFilter->verify = mxGetScalar(value) != 0;
+		} else {
+			mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "Unknown filter %s", name);
+		}
+	}
+}
+
+// read the whole index, returns the records and sets their count and stride
+static uint8_t *readIndex(const char *fileName, size_t *pnRecords, size_t *pRecordBytes, char *errMsg, size_t errLength) {
+	int fd = open(fileName, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		snprintf(errMsg, errLength, "Could not open %s", fileName);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	size_t nBytes = (size_t)st.st_size;
+	uint8_t *data = (uint8_t*)malloc(nBytes > 0 ? nBytes : 1);
+	size_t nRead = 0;
+	while (data != NULL && nRead < nBytes) {
+		ssize_t n = pread(fd, data + nRead, nBytes - nRead, nRead);
+		if (n <= 0)
+			break;
+		nRead += n;
+	}
+	close(fd);
+
+	TrialIndexHeader header;
+	if (data == NULL || nRead < sizeof(header)) {
+		snprintf(errMsg, errLength, "Could not read %s", fileName);
+		free(data);
+		return NULL;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, TRIAL_INDEX_MAGIC, 8) != 0 || header.recordBytes < sizeof(TrialIndexRecord)) {
+		snprintf(errMsg, errLength, "%s is not a trial index", fileName);
+		free(data);
+		return NULL;
+	}
+
+	// a record still being appended is left out
+	*pRecordBytes = header.recordBytes;
+	*pnRecords = (nRead - sizeof(header)) / header.recordBytes;
+	memmove(data, data + sizeof(header), *pnRecords * header.recordBytes);
+	return data;
+}
+
+// names fill their fields without a terminator when at full length
+static void getRecord(const uint8_t *records, size_t index, size_t recordBytes, TrialIndexRecord *pRecord) {
+	memcpy(pRecord, records + index*recordBytes, sizeof(TrialIndexRecord));
+}
+
+// whether the file the record points to holds the trial as indexed. Containers are kept open
+// in *pFd across consecutive records in them
+static bool verifyRecord(const char *folder, const TrialIndexRecord *pRecord, char *openPath, int *pFd) {
+	char path[PATH_MAX];
+	if (pRecord->fileName[0] == '\0')
+		return false;
+	snprintf(path, sizeof(path), "%s/%.*s", folder, TRIAL_INDEX_FILE_NAME_LENGTH, pRecord->fileName);
+
+	if (pRecord->fileOffset == 0) {
+		struct stat st;
+		return stat(path, &st) == 0 && (uint64_t)st.st_size == pRecord->fileBytes;
+	}
+
+	if (strcmp(openPath, path) != 0) {
+		if (*pFd >= 0)
+			close(*pFd);
+		*pFd = open(path, O_RDONLY);
+		strcpy(openPath, path);
+	}
+
+	ContainerRecordHeader header;
+	return *pFd >= 0 && containerReadRecordHeader(*pFd, pRecord->fileOffset, &header) &&
+			containerCheckRecordHeader(&header) && header.magic == CONTAINER_RECORD_MAGIC &&
+			header.trialId == pRecord->trialId && sizeof(header) + header.payloadBytes == pRecord->fileBytes &&
+			containerVerifyRecord(*pFd, pRecord->fileOffset, &header);
+}
+
+static void setNameCell(mxArray *mxCell, size_t index, const char *name, size_t maxLength) {
+	char buffer[TRIAL_INDEX_FILE_NAME_LENGTH + 1];
+	size_t len = strnlen(name, maxLength);
+	memcpy(buffer, name, len);
+	buffer[len] = '\0';
+	mxSetCell(mxCell, index, mxCreateString(buffer));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	char errMsg[512];
+	TrialIndexFilter filter;
+
+	if (nrhs < 1 || !mxIsChar(prhs[0]))
+		mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:usage", "Usage: idx = queryTrialIndex(fileName, [filter, value, ...])");
+	parseFilter(nrhs, prhs, &filter);
+
+	char *fileName = mxArrayToString(prhs[0]);
+	size_t nRecords, recordBytes;
+	uint8_t *records = readIndex(fileName, &nRecords, &recordBytes, errMsg, sizeof(errMsg));
+
+	// file names in the index are relative to its folder
+	char folder[PATH_MAX] = ".";
+	const char *slash = strrchr(fileName, '/');
+	if (slash != NULL)
+		snprintf(folder, sizeof(folder), "%.*s", (int)(slash - fileName), fileName);
+	mxFree(fileName);
+	if (records == NULL)
+		mexErrMsgIdAndTxt("MATLAB:queryTrialIndex:read", "%s", errMsg);
+
+	// find the matches first so that the columns can be allocated at their final size
+	size_t *matches = (size_t*)mxCalloc(nRecords > 0 ? nRecords : 1, sizeof(size_t));
+	size_t nMatches = 0;
+	for (size_t i = 0; i < nRecords; i++) {
+		TrialIndexRecord record;
+		getRecord(records, i, recordBytes, &record);
+		if (matchesFilter(&record, &filter))
+			matches[nMatches++] = i;
+	}
+
+	const char *fieldNames[] = { "trialId", "saveTag", "protocol", "protocolVersion", "wallclockStart",
+		"timestampStart", "timestampEnd", "duration", "fileName", "fileOffset", "fileBytes", "groupTypeBytes", "dataRoot",
+		"staged", "valid" };
+	int nFields = sizeof(fieldNames) / sizeof(fieldNames[0]) - (filter.verify ? 0 : 1);
+	mxArray *mxIndex = mxCreateStructMatrix(1, 1, nFields, fieldNames);
+
+	mxArray *mxColumns[15];
+	for (int f = 0; f < nFields; f++) {
+		if (f == 2 || f == 8)
+			mxColumns[f] = mxCreateCellMatrix(nMatches, 1);
+		else if (f == 11)
+			mxColumns[f] = mxCreateDoubleMatrix(nMatches, TRIAL_INDEX_GROUP_TYPES, mxREAL);
+		else if (f == 13 || f == 14)
+			mxColumns[f] = mxCreateLogicalMatrix(nMatches, 1);
+		else
+			mxColumns[f] = mxCreateDoubleMatrix(nMatches, 1, mxREAL);
+		mxSetFieldByNumber(mxIndex, 0, f, mxColumns[f]);
+	}
+
+	double *trialId = mxGetPr(mxColumns[0]);
+	double *saveTag = mxGetPr(mxColumns[1]);
+	double *protocolVersion = mxGetPr(mxColumns[3]);
+	double *wallclockStart = mxGetPr(mxColumns[4]);
+	double *timestampStart = mxGetPr(mxColumns[5]);
+	double *timestampEnd = mxGetPr(mxColumns[6]);
+	double *duration = mxGetPr(mxColumns[7]);
+	double *fileOffset = mxGetPr(mxColumns[9]);
+	double *fileBytes = mxGetPr(mxColumns[10]);
+	double *groupTypeBytes = mxGetPr(mxColumns[11]);
+	double *dataRoot = mxGetPr(mxColumns[12]);
+	mxLogical *staged = mxGetLogicals(mxColumns[13]);
+	mxLogical *valid = filter.verify ? mxGetLogicals(mxColumns[14]) : NULL;
+	char openPath[PATH_MAX] = "";
+	int fdOpen = -1;
+
+	for (size_t i = 0; i < nMatches; i++) {
+		TrialIndexRecord record;
+		getRecord(records, matches[i], recordBytes, &record);
+
+		trialId[i] = record.trialId;
+		saveTag[i] = record.saveTag;
+		protocolVersion[i] = record.protocolVersion;
+		wallclockStart[i] = record.wallclockStart;
+		timestampStart[i] = record.timestampStart;
+		timestampEnd[i] = record.timestampEnd;
+		duration[i] = record.duration;
+		fileOffset[i] = (double)record.fileOffset;
+		fileBytes[i] = (double)record.fileBytes;
+		dataRoot[i] = record.dataRoot;
+		staged[i] = (record.flags & TRIAL_INDEX_FLAG_STAGED) != 0;
+		for (int t = 0; t < TRIAL_INDEX_GROUP_TYPES; t++)
+			groupTypeBytes[i + t*nMatches] = (double)record.groupTypeBytes[t];
+		if (valid != NULL)
+			valid[i] = verifyRecord(folder, &record, openPath, &fdOpen);
+
+		setNameCell(mxColumns[2], i, record.protocol, TRIAL_INDEX_PROTOCOL_LENGTH);
+		setNameCell(mxColumns[8], i, record.fileName, TRIAL_INDEX_FILE_NAME_LENGTH);
+	}
+
+	if (fdOpen >= 0)
+		close(fdOpen);
+	mxFree(matches);
+	free(records);
+	plhs[0] = mxIndex;
+}
@@ -11,7 +11,7 @@
 #
 # Purpose   : start trialLogger
 #
-# Usage     : bin/trialLogger -r <receive_ip>:<receive_port> -d <storage_directory>
+# Usage     : bin/trialLogger -r <receive_ip>:<receive_port> -d <storage_directory> [-d <storage_directory> ...] [-t rr|space|queue] [-p] [-w <writer_threads>] [-f v5|v7.3] [-z <group_type>=<codec>[:<level>]] [-c] [-m] [-P] [-V] [-o] [-i auto|uring|pwrite] [-s <fsync_latency_ms>] [-S <staging_directory> [-R <migration_MB_per_s>]]
 #
 # NOTE      : Check if firewall does not blocking the port: sudo ufw status
 # ---------------------------------------------------------
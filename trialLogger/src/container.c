@@ -0,0 +1,500 @@
+// Append-only trial containers, see container.h
+//
+// Writers reserve the space for a record under containerMutex, then write it in parallel
+// through fileio.h: the payload first, the record header with its checksums last. The in-memory
+// index is updated once the record is complete and written out as the footer when the container
+// is closed. A container that is reopened has its footer (or a partially written tail) cut off
+// first, so new records always follow the last complete one. Torn records before that, left by
+// writers that died while later ones finished, are overwritten with padding headers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "errors.h"
+#include "container.h"
+
+#ifndef MATLAB_MEX_FILE
+#include <pthread.h>
+#include "utils.h"
+#include "fileio.h"
+#endif
+
+/////// READING ////////
+
+static bool preadAll(int fd, void* buffer, size_t nBytes, uint64_t offset) {
+	uint8_t* p = (uint8_t*)buffer;
+	while (nBytes > 0) {
+		ssize_t nRead = pread(fd, p, nBytes, (off_t)offset);
+		if (nRead < 0 && errno == EINTR)
+			continue;
+		if (nRead <= 0)
+			return false;
+		p += nRead;
+		offset += nRead;
+		nBytes -= nRead;
+	}
+	return true;
+}
+
+static bool pwriteAll(int fd, const void* buffer, size_t nBytes, uint64_t offset) {
+	const uint8_t* p = (const uint8_t*)buffer;
+	while (nBytes > 0) {
+		ssize_t nWritten = pwrite(fd, p, nBytes, (off_t)offset);
+		if (nWritten < 0 && errno == EINTR)
+			continue;
+		if (nWritten <= 0)
+			return false;
+		p += nWritten;
+		offset += nWritten;
+		nBytes -= nWritten;
+	}
+	return true;
+}
+
+// FNV-1a over 64 bit words, with the high bits folded back in since a multiply only carries up
+uint64_t containerChecksumUpdate(uint64_t state, const void* data, size_t nBytes) {
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t word;
+	for (; nBytes >= 8; p += 8, nBytes -= 8) {
+		memcpy(&word, p, 8);
+		state = (state ^ word) * 0x100000001b3ULL;
+		state ^= state >> 29;
+	}
+	for (; nBytes > 0; p++, nBytes--)
+		state = (state ^ *p) * 0x100000001b3ULL;
+	return state;
+}
+
+uint32_t containerChecksumFinal(uint64_t state) {
+	return (uint32_t)(state ^ (state >> 32));
+}
+
+static uint32_t getHeaderChecksum(const ContainerRecordHeader* pRecord) {
+	return containerChecksumFinal(containerChecksumUpdate(CONTAINER_CHECKSUM_SEED, pRecord,
+			offsetof(ContainerRecordHeader, headerChecksum)));
+}
+
+bool containerCheckRecordHeader(const ContainerRecordHeader* pRecord) {
+	return (pRecord->magic == CONTAINER_RECORD_MAGIC || pRecord->magic == CONTAINER_PADDING_MAGIC) &&
+			pRecord->headerChecksum == getHeaderChecksum(pRecord);
+}
+
+#define CHECKSUM_BLOCK_BYTES (1 << 20)
+
+// checksum of the nBytes at offset, false if they can't be read
+static bool checksumFileRange(int fd, uint64_t offset, uint64_t nBytes, uint32_t* pChecksum) {
+	uint8_t* buffer = (uint8_t*)malloc(CHECKSUM_BLOCK_BYTES);
+	if (buffer == NULL)
+		return false;
+
+	uint64_t state = CONTAINER_CHECKSUM_SEED;
+	bool success = true;
+	while (nBytes > 0 && success) {
+		size_t nBlock = nBytes < CHECKSUM_BLOCK_BYTES ? (size_t)nBytes : CHECKSUM_BLOCK_BYTES;
+		success = preadAll(fd, buffer, nBlock, offset);
+		state = containerChecksumUpdate(state, buffer, nBlock);
+		offset += nBlock;
+		nBytes -= nBlock;
+	}
+
+	free(buffer);
+	*pChecksum = containerChecksumFinal(state);
+	return success;
+}
+
+bool containerVerifyRecord(int fd, uint64_t offset, const ContainerRecordHeader* pRecord) {
+	uint32_t checksum;
+	if (pRecord->magic != CONTAINER_RECORD_MAGIC)
+		return true;
+	return checksumFileRange(fd, offset + sizeof(ContainerRecordHeader), pRecord->payloadBytes, &checksum) &&
+			checksum == pRecord->payloadChecksum;
+}
+
+// whether a complete record, or padding, starts at offset
+static bool isRecordAt(int fd, uint64_t fileSize, uint64_t offset, bool verifyPayload,
+		ContainerRecordHeader* pRecord) {
+	if (!containerReadRecordHeader(fd, offset, pRecord) || !containerCheckRecordHeader(pRecord))
+		return false;
+	if (pRecord->payloadBytes > fileSize - offset - sizeof(ContainerRecordHeader))
+		return false;
+	return !verifyPayload || containerVerifyRecord(fd, offset, pRecord);
+}
+
+// the offset of the next complete record after a torn one, 0 if there is none. Records start
+// 8 byte aligned, since the payloads are MAT data elements
+static uint64_t findNextRecord(int fd, uint64_t fileSize, uint64_t offset, bool verifyPayload) {
+	uint8_t* buffer = (uint8_t*)malloc(CHECKSUM_BLOCK_BYTES);
+	if (buffer == NULL)
+		return 0;
+
+	uint64_t found = 0;
+	ContainerRecordHeader record;
+	while (found == 0 && offset + sizeof(record) <= fileSize) {
+		size_t nBlock = fileSize - offset < CHECKSUM_BLOCK_BYTES ? (size_t)(fileSize - offset) : CHECKSUM_BLOCK_BYTES;
+		if (!preadAll(fd, buffer, nBlock, offset))
+			break;
+
+		size_t i;
+		for (i = 0; i + sizeof(record) <= nBlock; i += 8) {
+			uint32_t magic;
+			memcpy(&magic, buffer + i, sizeof(magic));
+			if ((magic == CONTAINER_RECORD_MAGIC || magic == CONTAINER_PADDING_MAGIC) &&
+					isRecordAt(fd, fileSize, offset + i, verifyPayload, &record)) {
+				found = offset + i;
+				break;
+			}
+		}
+		// headers straddling the end of the block are looked at with the next one
+		offset += i;
+	}
+
+	free(buffer);
+	return found;
+}
+
+// make room for trialId in the index, false if it would cover too many trialIds
+static bool growIndex(ContainerIndex* pIndex, uint32_t trialId) {
+	if (pIndex->nSlots == 0) {
+		pIndex->firstTrialId = trialId;
+		pIndex->nSlots = 0;
+	}
+
+	uint32_t first = trialId < pIndex->firstTrialId ? trialId : pIndex->firstTrialId;
+	uint64_t last = (uint64_t)pIndex->firstTrialId + pIndex->nSlots;
+	if (trialId >= last)
+		last = (uint64_t)trialId + 1;
+	if (last - first > CONTAINER_MAX_SLOTS)
+		return false;
+
+	uint32_t nSlots = (uint32_t)(last - first);
+	if (nSlots > pIndex->nSlotsAllocated) {
+		uint32_t nAllocate = pIndex->nSlotsAllocated > 0 ? pIndex->nSlotsAllocated : 64;
+		while (nAllocate < nSlots)
+			nAllocate *= 2;
+		uint64_t* offsets = (uint64_t*)realloc(pIndex->offsets, sizeof(uint64_t) * nAllocate);
+		if (offsets == NULL)
+			return false;
+		pIndex->offsets = offsets;
+		pIndex->nSlotsAllocated = nAllocate;
+	}
+
+	// trialIds below the first one shift everything up
+	uint32_t shift = pIndex->firstTrialId - first;
+	if (shift > 0 && pIndex->nSlots > 0)
+		memmove(pIndex->offsets + shift, pIndex->offsets, sizeof(uint64_t) * pIndex->nSlots);
+	if (shift > 0)
+		memset(pIndex->offsets, 0, sizeof(uint64_t) * shift);
+	memset(pIndex->offsets + shift + pIndex->nSlots, 0, sizeof(uint64_t) * (nSlots - shift - pIndex->nSlots));
+
+	pIndex->firstTrialId = first;
+	pIndex->nSlots = nSlots;
+	return true;
+}
+
+// later records of the same trialId win
+static bool addToIndex(ContainerIndex* pIndex, uint32_t trialId, uint64_t offset) {
+	if (!growIndex(pIndex, trialId))
+		return false;
+	pIndex->offsets[trialId - pIndex->firstTrialId] = offset;
+	return true;
+}
+
+static bool readFooter(int fd, uint64_t fileSize, ContainerIndex* pIndex) {
+	ContainerTrailer trailer;
+	if (fileSize < sizeof(ContainerFileHeader) + sizeof(ContainerTrailer))
+		return false;
+	if (!preadAll(fd, &trailer, sizeof(trailer), fileSize - sizeof(trailer)))
+		return false;
+	if (memcmp(trailer.magic, CONTAINER_TRAILER_MAGIC, 8) != 0 || trailer.nSlots > CONTAINER_MAX_SLOTS ||
+			trailer.indexOffset < sizeof(ContainerFileHeader) ||
+			trailer.indexOffset + sizeof(uint64_t) * trailer.nSlots + sizeof(trailer) != fileSize)
+		return false;
+
+	pIndex->offsets = (uint64_t*)malloc(sizeof(uint64_t) * (trailer.nSlots > 0 ? trailer.nSlots : 1));
+	if (pIndex->offsets == NULL)
+		return false;
+	if (!preadAll(fd, pIndex->offsets, sizeof(uint64_t) * trailer.nSlots, trailer.indexOffset)) {
+		containerFreeIndex(pIndex);
+		return false;
+	}
+
+	pIndex->firstTrialId = trailer.firstTrialId;
+	pIndex->nSlots = trailer.nSlots;
+	pIndex->nSlotsAllocated = trailer.nSlots;
+	pIndex->endOfRecords = trailer.indexOffset;
+	pIndex->hasFooter = true;
+	return true;
+}
+
+// walk the record headers up to the last complete record, stepping over torn ones. When
+// repairing, payloads are verified too and torn records are overwritten with padding, so
+// that later walks don't have to search past them
+static void scanRecords(int fd, uint64_t fileSize, uint64_t offset, ContainerIndex* pIndex, bool repair) {
+	ContainerRecordHeader record;
+
+	while (offset + sizeof(record) <= fileSize) {
+		if (!isRecordAt(fd, fileSize, offset, repair, &record)) {
+			uint64_t next = findNextRecord(fd, fileSize, offset + sizeof(record), repair);
+			if (next == 0)
+				break;
+
+			pIndex->nTornRecords++;
+			if (repair) {
+				ContainerRecordHeader padding = { CONTAINER_PADDING_MAGIC, 0, next - offset - sizeof(record), 0, 0, 0 };
+				padding.headerChecksum = getHeaderChecksum(&padding);
+				pwriteAll(fd, &padding, sizeof(padding), offset);
+			}
+			offset = next;
+			continue;
+		}
+
+		if (record.magic == CONTAINER_RECORD_MAGIC)
+			addToIndex(pIndex, record.trialId, offset);
+		offset += sizeof(record) + record.payloadBytes;
+	}
+
+	pIndex->endOfRecords = offset;
+}
+
+static bool readIndex(int fd, ContainerIndex* pIndex, bool repair) {
+	ContainerFileHeader header;
+	struct stat st;
+
+	memset(pIndex, 0, sizeof(ContainerIndex));
+	if (fstat(fd, &st) != 0 || !preadAll(fd, &header, sizeof(header), 0))
+		return false;
+	if (memcmp(header.magic, CONTAINER_FILE_MAGIC, 8) != 0 || header.version != CONTAINER_VERSION ||
+			header.headerBytes < sizeof(header))
+		return false;
+
+	if (!readFooter(fd, (uint64_t)st.st_size, pIndex))
+		scanRecords(fd, (uint64_t)st.st_size, header.headerBytes, pIndex, repair);
+	return true;
+}
+
+bool containerReadIndex(int fd, ContainerIndex* pIndex) {
+	return readIndex(fd, pIndex, false);
+}
+
+void containerFreeIndex(ContainerIndex* pIndex) {
+	if (pIndex->offsets != NULL)
+		free(pIndex->offsets);
+	memset(pIndex, 0, sizeof(ContainerIndex));
+}
+
+uint64_t containerLookupTrial(const ContainerIndex* pIndex, uint32_t trialId) {
+	if (trialId < pIndex->firstTrialId || trialId - pIndex->firstTrialId >= pIndex->nSlots)
+		return 0;
+	return pIndex->offsets[trialId - pIndex->firstTrialId];
+}
+
+bool containerReadRecordHeader(int fd, uint64_t offset, ContainerRecordHeader* pRecord) {
+	return preadAll(fd, pRecord, sizeof(ContainerRecordHeader), offset);
+}
+
+#ifndef MATLAB_MEX_FILE
+
+/////// WRITING ////////
+
+struct TrialContainer {
+	char fileName[MAX_FILENAME_LENGTH];
+	int fd;
+	ContainerIndex index;
+
+	// writers between containerAcquire and containerRelease
+	unsigned nWriting;
+	// closed when the last writer releases it
+	bool retiring;
+
+	struct TrialContainer* next;
+};
+
+// guards the list of open containers and everything in them
+static pthread_mutex_t containerMutex = PTHREAD_MUTEX_INITIALIZER;
+static TrialContainer* openContainers = NULL;
+
+// must hold containerMutex
+static TrialContainer* openContainer(const char* fileName, bool* pCreated) {
+	TrialContainer* pc = (TrialContainer*)CALLOC(sizeof(TrialContainer), 1);
+	if (pc == NULL)
+		return NULL;
+	strncpy(pc->fileName, fileName, MAX_FILENAME_LENGTH - 1);
+
+	pc->fd = open(fileName, O_RDWR | O_CREAT, 0666);
+	struct stat st;
+	if (pc->fd < 0 || fstat(pc->fd, &st) != 0) {
+		logError("Container Error: Could not open %s\n", fileName);
+		if (pc->fd >= 0)
+			close(pc->fd);
+		FREE(pc);
+		return NULL;
+	}
+
+	*pCreated = st.st_size == 0;
+	if (*pCreated) {
+		fileIoSyncDirectoryOf(fileName);
+		ContainerFileHeader header = { CONTAINER_FILE_MAGIC, CONTAINER_VERSION, sizeof(ContainerFileHeader) };
+		if (!fileIoWriteAll(pc->fd, &header, sizeof(header), 0)) {
+			logError("Container Error: Could not write to %s\n", fileName);
+			close(pc->fd);
+			FREE(pc);
+			return NULL;
+		}
+		pc->index.endOfRecords = sizeof(header);
+	} else {
+		if (!readIndex(pc->fd, &pc->index, true)) {
+			logError("Container Error: %s is not a trial container\n", fileName);
+			close(pc->fd);
+			FREE(pc);
+			return NULL;
+		}
+
+		// drop the footer, or whatever follows the last complete record, and append from there
+		if (ftruncate(pc->fd, (off_t)pc->index.endOfRecords) != 0)
+			logError("Container Error: Could not truncate %s\n", fileName);
+		pc->index.hasFooter = false;
+		if (pc->index.nTornRecords > 0)
+			logError("Container Error: Padded over %u torn records in %s\n", pc->index.nTornRecords, fileName);
+		logInfo("Container: Appending to %s after %u trial slots\n", fileName, pc->index.nSlots);
+	}
+
+	pc->next = openContainers;
+	openContainers = pc;
+	return pc;
+}
+
+// write the footer and close, must hold containerMutex
+static void closeContainer(TrialContainer* pc) {
+	TrialContainer** pp = &openContainers;
+	while (*pp != NULL && *pp != pc)
+		pp = &(*pp)->next;
+	if (*pp != NULL)
+		*pp = pc->next;
+
+	ContainerTrailer trailer = { pc->index.endOfRecords, pc->index.firstTrialId, pc->index.nSlots,
+		CONTAINER_TRAILER_MAGIC };
+	uint64_t indexBytes = sizeof(uint64_t) * pc->index.nSlots;
+	if (!fileIoWriteAll(pc->fd, pc->index.offsets, indexBytes, pc->index.endOfRecords) ||
+			!fileIoWriteAll(pc->fd, &trailer, sizeof(trailer), pc->index.endOfRecords + indexBytes))
+		logError("Container Error: Could not write the index of %s\n", pc->fileName);
+
+	fileIoSync(pc->fd);
+	if (close(pc->fd) != 0)
+		logError("Container Error: Could not close %s\n", pc->fileName);
+
+	containerFreeIndex(&pc->index);
+	FREE(pc);
+}
+
+TrialContainer* containerAcquire(const char* fileName, bool* pCreated) {
+	TrialContainer* pFound = NULL;
+	*pCreated = false;
+
+	pthread_mutex_lock(&containerMutex);
+
+	for (TrialContainer* pc = openContainers; pc != NULL; pc = pc->next) {
+		if (strncmp(pc->fileName, fileName, MAX_FILENAME_LENGTH) == 0)
+			pFound = pc;
+	}
+	if (pFound == NULL)
+		pFound = openContainer(fileName, pCreated);
+
+	// every other container is done with once its current writers are
+	TrialContainer* pc = openContainers;
+	while (pc != NULL) {
+		TrialContainer* pNext = pc->next;
+		if (pc != pFound) {
+			pc->retiring = true;
+			if (pc->nWriting == 0)
+				closeContainer(pc);
+		}
+		pc = pNext;
+	}
+
+	if (pFound != NULL) {
+		pFound->retiring = false;
+		pFound->nWriting++;
+	}
+
+	pthread_mutex_unlock(&containerMutex);
+	return pFound;
+}
+
+bool containerAppendTrial(TrialContainer* pc, uint32_t trialId, double wallclockStart,
+		const mxArray* mxTrial, const mxArray* mxMeta, uint64_t* pRecordOffset, uint64_t* pRecordBytes) {
+	size_t trialBytes = matGetVariableSize("trial", mxTrial);
+	size_t metaBytes = matGetVariableSize("meta", mxMeta);
+	if (trialBytes == 0 || metaBytes == 0) {
+		logError("Container Error: Trial %u exceeds the MAT v5 size limit\n", trialId);
+		return false;
+	}
+
+	ContainerRecordHeader record = { CONTAINER_RECORD_MAGIC, trialId, trialBytes + metaBytes, wallclockStart, 0, 0 };
+
+	// reserve the space, the record itself is written without holding the lock
+	pthread_mutex_lock(&containerMutex);
+	uint64_t offset = pc->index.endOfRecords;
+	pc->index.endOfRecords += sizeof(record) + record.payloadBytes;
+	pthread_mutex_unlock(&containerMutex);
+
+	bool success = false;
+	MATFile* pmf = matOpenRecord(pc->fd, (off_t)(offset + sizeof(record)));
+	if (pmf != NULL) {
+		success = matPutVariable(pmf, "trial", mxTrial) == 0 && matPutVariable(pmf, "meta", mxMeta) == 0;
+		success = matClose(pmf) == 0 && success;
+	}
+
+	// the payload is read back for its checksum, it is still in the page cache
+	if (success && !checksumFileRange(pc->fd, offset + sizeof(record), record.payloadBytes, &record.payloadChecksum))
+		success = false;
+
+	// a failed write leaves padding behind so that the records after it can still be walked
+	if (!success) {
+		logError("Container Error: Could not write trial %u to %s\n", trialId, pc->fileName);
+		record.magic = CONTAINER_PADDING_MAGIC;
+		record.payloadChecksum = 0;
+	}
+	record.headerChecksum = getHeaderChecksum(&record);
+	if (!fileIoWriteAll(pc->fd, &record, sizeof(record), offset)) {
+		logError("Container Error: Could not write record header to %s\n", pc->fileName);
+		success = false;
+	}
+
+	if (success) {
+		fileIoSync(pc->fd);
+
+		pthread_mutex_lock(&containerMutex);
+		if (!addToIndex(&pc->index, trialId, offset))
+			logError("Container Error: Trial %u is too far from the others in %s to be indexed\n",
+					trialId, pc->fileName);
+		pthread_mutex_unlock(&containerMutex);
+	}
+
+	*pRecordOffset = offset;
+	*pRecordBytes = sizeof(record) + record.payloadBytes;
+	return success;
+}
+
+void containerRelease(TrialContainer* pc) {
+	pthread_mutex_lock(&containerMutex);
+	pc->nWriting--;
+	if (pc->nWriting == 0 && pc->retiring)
+		closeContainer(pc);
+	pthread_mutex_unlock(&containerMutex);
+}
+
+void containerCloseAll() {
+	pthread_mutex_lock(&containerMutex);
+	while (openContainers != NULL)
+		closeContainer(openContainers);
+	pthread_mutex_unlock(&containerMutex);
+}
+
+#endif // ifndef MATLAB_MEX_FILE
@@ -0,0 +1,109 @@
+#ifndef CONTAINER_H_INCLUDED
+#define CONTAINER_H_INCLUDED
+
+// A trial container holds every trial of one saveTag in a single append-only file, instead of
+// one .mat file per trial. The layout is
+//
+//   ContainerFileHeader
+//   records   ContainerRecordHeader followed by payloadBytes of MAT v5 data elements, the
+//             "trial" and "meta" variables exactly as they follow the header of a .mat file
+//   footer    written when the container is closed, the uint64 offset of the record of each
+//             trialId from firstTrialId to firstTrialId + nSlots - 1 (0 if there is none),
+//             then a ContainerTrailer
+//
+// The footer gives O(1) lookup by trialId. A container without one (still being written, or
+// the logger died) is indexed by walking the record headers. Record headers are written after
+// their payload and carry checksums of both. Writers fill the space they reserved in parallel,
+// so a record may be torn while later ones are complete: a walk skips it by searching for the
+// next valid header, and stops where none follows. All values are in host (little endian)
+// byte order, as in the .mat files.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CONTAINER_FILE_EXTENSION ".mtc"
+#define CONTAINER_FILE_MAGIC "MATUDPTC"
+#define CONTAINER_TRAILER_MAGIC "MATUDPIX"
+#define CONTAINER_VERSION 2
+
+#define CONTAINER_RECORD_MAGIC  0x4c525455 // "UTRL", a trial
+#define CONTAINER_PADDING_MAGIC 0x44505455 // "UTPD", space left by a failed write, skipped
+
+// at most this many trialIds are covered by the footer
+#define CONTAINER_MAX_SLOTS (1u << 24)
+
+typedef struct ContainerFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;
+} ContainerFileHeader;
+
+typedef struct ContainerRecordHeader {
+	uint32_t magic;
+	uint32_t trialId;
+	uint64_t payloadBytes;
+	double wallclockStart;
+	uint32_t payloadChecksum; // of the payload, 0 for padding
+	uint32_t headerChecksum;  // of the fields above
+} ContainerRecordHeader;
+
+typedef struct ContainerTrailer {
+	uint64_t indexOffset;
+	uint32_t firstTrialId;
+	uint32_t nSlots;
+	char magic[8];
+} ContainerTrailer;
+
+typedef struct ContainerIndex {
+	uint32_t firstTrialId;
+	uint32_t nSlots;
+	uint32_t nSlotsAllocated;
+	uint64_t* offsets;
+
+	// where the footer is, or the next record goes
+	uint64_t endOfRecords;
+	bool hasFooter;
+	// torn records a walk stepped over
+	uint32_t nTornRecords;
+} ContainerIndex;
+
+// -- reading, also built into the MATLAB loaders
+// read the footer of the container open as fd, or walk its records if it has none,
+// false if fd isn't a trial container
+bool containerReadIndex(int fd, ContainerIndex*);
+void containerFreeIndex(ContainerIndex*);
+// offset of the trial's record, 0 if it isn't in the container
+uint64_t containerLookupTrial(const ContainerIndex*, uint32_t trialId);
+bool containerReadRecordHeader(int fd, uint64_t offset, ContainerRecordHeader*);
+// whether the header is one written whole, of a record or padding
+bool containerCheckRecordHeader(const ContainerRecordHeader*);
+// whether the record's payload matches its checksum, reads all of it
+bool containerVerifyRecord(int fd, uint64_t offset, const ContainerRecordHeader*);
+
+// running checksum of a payload, fed in pieces that are multiples of 8 bytes long but for the
+// last, starting from CONTAINER_CHECKSUM_SEED
+#define CONTAINER_CHECKSUM_SEED 0xcbf29ce484222325ULL
+uint64_t containerChecksumUpdate(uint64_t state, const void* data, size_t nBytes);
+uint32_t containerChecksumFinal(uint64_t state);
+
+#ifndef MATLAB_MEX_FILE
+
+#include "matfile.h"
+
+// -- writing
+typedef struct TrialContainer TrialContainer;
+
+// open the container for appending, creating it if needed. Other open containers are closed
+// once nobody is writing to them anymore, since trials move on from one saveTag to the next
+TrialContainer* containerAcquire(const char* fileName, bool* pCreated);
+// the offset and size of the record written are returned for the trial index
+bool containerAppendTrial(TrialContainer*, uint32_t trialId, double wallclockStart,
+		const mxArray* mxTrial, const mxArray* mxMeta, uint64_t* pRecordOffset, uint64_t* pRecordBytes);
+void containerRelease(TrialContainer*);
+// write the footers and close everything
+void containerCloseAll();
+
+#endif // ifndef MATLAB_MEX_FILE
+
+#endif // ifndef CONTAINER_H_INCLUDED
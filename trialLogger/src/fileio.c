@@ -0,0 +1,588 @@
+// File output backend, see fileio.h
+//
+// io_uring is driven through its raw system calls rather than liburing, so that nothing needs
+// to be installed for it. Each thread gets its own small ring: a round of group fsyncs is one
+// FSYNC submission per file, all sent with a single io_uring_enter, and with the uring backend
+// a write is one WRITEV submission that the writer waits on. Writes that extend a file are
+// mostly handed to io_uring's worker threads by the kernel, which made them several times
+// slower than pwritev on ext4, so auto only uses io_uring for the fsyncs. If the kernel has no
+// io_uring (ENOSYS before 5.1, EPERM when disabled through kernel.io_uring_disabled or seccomp)
+// everything goes through pwritev and fsync instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(LINUX) && !defined(NO_IO_URING)
+#define USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "errors.h"
+#include "utils.h"
+#include "fileio.h"
+
+// submission queue entries of each thread's ring, also the most fsyncs sent at once
+#define FILEIO_URING_ENTRIES 64
+
+// bin 0 counts latencies under 1 us, bin i those under 2^i us, the last bin everything longer
+#define FILEIO_HISTOGRAM_BINS 26
+
+typedef struct LatencyHistogram {
+	unsigned long long counts[FILEIO_HISTOGRAM_BINS];
+	unsigned long long n;
+	unsigned long long nUnits; // bytes written, or files fsync'd
+	double totalSec;
+	double maxSec;
+} LatencyHistogram;
+
+// files queued for the next group fsync, each a dup of the fd handed in
+typedef struct PendingSync {
+	int fd;
+	dev_t dev;
+	ino_t ino;
+} PendingSync;
+
+static volatile FileIoBackend backend = FILEIO_BACKEND_AUTO;
+static double syncLatencySec = -1;
+
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static LatencyHistogram writeLatency;
+static LatencyHistogram syncLatency;
+
+static pthread_mutex_t syncMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syncCond = PTHREAD_COND_INITIALIZER;
+static PendingSync* pendingSyncs = NULL;
+static unsigned nPendingSyncs = 0;
+static unsigned nPendingSyncsAllocated = 0;
+static double syncDeadline; // on the getMonotonicTime clock
+static bool syncRunning = false;
+static bool syncTerminating = false;
+static pthread_t syncThread;
+
+static void addLatency(LatencyHistogram* h, double sec, unsigned long long nUnits) {
+	double us = sec * 1e6;
+	unsigned bin = 0;
+	while (bin < FILEIO_HISTOGRAM_BINS - 1 && us >= (double)(1u << bin))
+		bin++;
+
+	pthread_mutex_lock(&statsMutex);
+	h->counts[bin]++;
+	h->n++;
+	h->nUnits += nUnits;
+	h->totalSec += sec;
+	if (sec > h->maxSec)
+		h->maxSec = sec;
+	pthread_mutex_unlock(&statsMutex);
+}
+
+
+bool fileIoSetBackendByName(const char* name) {
+	if (strcmp(name, "auto") == 0)
+		backend = FILEIO_BACKEND_AUTO;
+	else if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0)
+		backend = FILEIO_BACKEND_URING;
+	else if (strcmp(name, "pwrite") == 0)
+		backend = FILEIO_BACKEND_PWRITE;
+	else
+		return false;
+	return true;
+}
+
+void fileIoSetSyncLatency(double maxSec) {
+	syncLatencySec = maxSec;
+}
+
+static void fallBackToPwrite(const char* what, int err) {
+	pthread_mutex_lock(&statsMutex);
+	if (backend == FILEIO_BACKEND_URING)
+		logError("FileIO Error: io_uring %s failed (%s), writing with pwrite\n", what, strerror(err));
+	else if (backend == FILEIO_BACKEND_AUTO)
+		logInfo("FileIO: io_uring %s failed (%s), writing with pwrite\n", what, strerror(err));
+	backend = FILEIO_BACKEND_PWRITE;
+	pthread_mutex_unlock(&statsMutex);
+}
+
+/////// IO_URING ////////
+
+#ifdef USE_IO_URING
+
+typedef struct Uring {
+	int fd;
+	unsigned sqEntries;
+
+	void* sqRing;
+	size_t sqRingBytes;
+	void* cqRing;
+	size_t cqRingBytes;
+	struct io_uring_sqe* sqes;
+	size_t sqesBytes;
+
+	// shared with the kernel
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe* cqes;
+} Uring;
+
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static void uringFree(Uring* r) {
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqesBytes);
+	if (r->cqRing != NULL && r->cqRing != r->sqRing)
+		munmap(r->cqRing, r->cqRingBytes);
+	if (r->sqRing != NULL)
+		munmap(r->sqRing, r->sqRingBytes);
+	if (r->fd >= 0)
+		close(r->fd);
+	FREE(r);
+}
+
+static void* mapRing(int fd, size_t nBytes, off_t what) {
+	void* p = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+// errno is set if this returns NULL
+static Uring* uringCreate(unsigned entries) {
+	Uring* r = (Uring*)CALLOC(sizeof(Uring), 1);
+	if (r == NULL)
+		return NULL;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (r->fd < 0) {
+		int err = errno;
+		FREE(r);
+		errno = err;
+		return NULL;
+	}
+
+	r->sqEntries = params.sq_entries;
+	r->sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	r->cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// both rings share one mapping since 5.4
+	bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMmap) {
+		if (r->cqRingBytes > r->sqRingBytes)
+			r->sqRingBytes = r->cqRingBytes;
+		r->cqRingBytes = r->sqRingBytes;
+	}
+
+	r->sqRing = mapRing(r->fd, r->sqRingBytes, IORING_OFF_SQ_RING);
+	r->cqRing = singleMmap ? r->sqRing : mapRing(r->fd, r->cqRingBytes, IORING_OFF_CQ_RING);
+	r->sqes = (struct io_uring_sqe*)mapRing(r->fd, r->sqesBytes, IORING_OFF_SQES);
+	if (r->sqRing == NULL || r->cqRing == NULL || r->sqes == NULL) {
+		int err = errno;
+		uringFree(r);
+		errno = err;
+		return NULL;
+	}
+
+	uint8_t* sq = (uint8_t*)r->sqRing;
+	r->sqHead = (unsigned*)(sq + params.sq_off.head);
+	r->sqTail = (unsigned*)(sq + params.sq_off.tail);
+	r->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	r->sqArray = (unsigned*)(sq + params.sq_off.array);
+
+	uint8_t* cq = (uint8_t*)r->cqRing;
+	r->cqHead = (unsigned*)(cq + params.cq_off.head);
+	r->cqTail = (unsigned*)(cq + params.cq_off.tail);
+	r->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return r;
+}
+
+// the i-th entry of the next submission, cleared
+static struct io_uring_sqe* uringGetSqe(Uring* r, unsigned i) {
+	unsigned index = (*r->sqTail + i) & *r->sqMask;
+	r->sqArray[index] = index;
+	memset(r->sqes + index, 0, sizeof(struct io_uring_sqe));
+	r->sqes[index].user_data = i;
+	return r->sqes + index;
+}
+
+// submit the n entries filled in and wait for all of them, results[i] is the result of the
+// i-th. False if the ring itself failed, with errno set
+static bool uringRun(Uring* r, unsigned n, int32_t* results) {
+	__atomic_store_n(r->sqTail, *r->sqTail + n, __ATOMIC_RELEASE);
+
+	unsigned nSubmitted = 0, nCompleted = 0;
+	while (nCompleted < n) {
+		int rc = (int)syscall(__NR_io_uring_enter, r->fd, n - nSubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		nSubmitted += rc;
+
+		unsigned head = *r->cqHead;
+		unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			const struct io_uring_cqe* cqe = r->cqes + (head & *r->cqMask);
+			if (cqe->user_data < n)
+				results[cqe->user_data] = cqe->res;
+			nCompleted++;
+		}
+		__atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+static void freeThreadRing(void* r) {
+	uringFree((Uring*)r);
+}
+
+static void createRingKey() {
+	pthread_key_create(&ringKey, freeThreadRing);
+}
+
+// this thread's ring, NULL when writing with pwrite
+static Uring* getThreadRing() {
+	if (backend == FILEIO_BACKEND_PWRITE)
+		return NULL;
+
+	pthread_once(&ringKeyOnce, createRingKey);
+	Uring* r = (Uring*)pthread_getspecific(ringKey);
+	if (r == NULL) {
+		r = uringCreate(FILEIO_URING_ENTRIES);
+		if (r == NULL) {
+			fallBackToPwrite("setup", errno);
+			return NULL;
+		}
+		pthread_setspecific(ringKey, r);
+	}
+	return r;
+}
+
+static void dropThreadRing(Uring* r, int err) {
+	pthread_setspecific(ringKey, NULL);
+	uringFree(r);
+	fallBackToPwrite("submission", err);
+}
+
+#endif // ifdef USE_IO_URING
+
+/////// WRITING ////////
+
+ssize_t fileIoWritev(int fd, const struct iovec* iov, int nIov, off_t offset) {
+	double tStart = getMonotonicTime();
+	ssize_t nWritten = -1;
+	bool written = false;
+
+#ifdef USE_IO_URING
+	Uring* r = backend == FILEIO_BACKEND_URING ? getThreadRing() : NULL;
+	if (r != NULL) {
+		struct io_uring_sqe* sqe = uringGetSqe(r, 0);
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)iov;
+		sqe->len = (uint32_t)nIov;
+		sqe->off = (uint64_t)offset;
+
+		int32_t result;
+		if (uringRun(r, 1, &result)) {
+			written = true;
+			nWritten = result;
+			if (result < 0) {
+				errno = -result;
+				nWritten = -1;
+			}
+		} else {
+			dropThreadRing(r, errno);
+		}
+	}
+#endif
+
+	if (!written)
+		nWritten = pwritev(fd, iov, nIov, offset);
+
+	if (nWritten >= 0)
+		addLatency(&writeLatency, getMonotonicTime() - tStart, (unsigned long long)nWritten);
+	return nWritten;
+}
+
+bool fileIoWriteAll(int fd, const void* buffer, size_t nBytes, off_t offset) {
+	struct iovec iov = { (void*)buffer, nBytes };
+	while (iov.iov_len > 0) {
+		ssize_t nWritten = fileIoWritev(fd, &iov, 1, offset);
+		if (nWritten < 0 && errno == EINTR)
+			continue;
+		if (nWritten <= 0)
+			return false;
+		iov.iov_base = (uint8_t*)iov.iov_base + nWritten;
+		iov.iov_len -= nWritten;
+		offset += nWritten;
+	}
+	return true;
+}
+
+/////// GROUP COMMIT ////////
+
+// one round of fsyncs, all submitted at once with io_uring
+static void syncFiles(const PendingSync* files, unsigned nFiles) {
+	double tStart = getMonotonicTime();
+	unsigned nDone = 0;
+
+#ifdef USE_IO_URING
+	Uring* r = getThreadRing();
+	while (r != NULL && nDone < nFiles) {
+		int32_t results[FILEIO_URING_ENTRIES];
+		unsigned nBatch = nFiles - nDone;
+		if (nBatch > r->sqEntries)
+			nBatch = r->sqEntries;
+		if (nBatch > FILEIO_URING_ENTRIES)
+			nBatch = FILEIO_URING_ENTRIES;
+
+		for (unsigned i = 0; i < nBatch; i++) {
+			struct io_uring_sqe* sqe = uringGetSqe(r, i);
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fd = files[nDone + i].fd;
+		}
+		if (!uringRun(r, nBatch, results)) {
+			dropThreadRing(r, errno);
+			break;
+		}
+
+		for (unsigned i = 0; i < nBatch; i++) {
+			if (results[i] < 0)
+				logError("FileIO Error: fsync failed (%s)\n", strerror(-results[i]));
+		}
+		nDone += nBatch;
+	}
+#endif
+
+	for (; nDone < nFiles; nDone++) {
+		if (fsync(files[nDone].fd) != 0)
+			logError("FileIO Error: fsync failed (%s)\n", strerror(errno));
+	}
+
+	addLatency(&syncLatency, getMonotonicTime() - tStart, nFiles);
+}
+
+// wait on syncCond until deadline on the getMonotonicTime clock, must hold syncMutex
+static void waitForSyncUntil(double deadline) {
+	double remaining = deadline - getMonotonicTime();
+	if (remaining <= 0)
+		return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t)remaining;
+	ts.tv_nsec += (long)((remaining - floor(remaining)) * 1e9);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&syncCond, &syncMutex, &ts);
+}
+
+static void* syncThreadMain(void* dummy) {
+	pthread_mutex_lock(&syncMutex);
+	while (true) {
+		while (nPendingSyncs == 0 && !syncTerminating)
+			pthread_cond_wait(&syncCond, &syncMutex);
+
+		// let everything queued until the deadline join this round
+		while (nPendingSyncs > 0 && !syncTerminating && getMonotonicTime() < syncDeadline)
+			waitForSyncUntil(syncDeadline);
+
+		if (nPendingSyncs == 0)
+			break;
+
+		PendingSync* files = pendingSyncs;
+		unsigned nFiles = nPendingSyncs;
+		pendingSyncs = NULL;
+		nPendingSyncs = 0;
+		nPendingSyncsAllocated = 0;
+		pthread_mutex_unlock(&syncMutex);
+
+		syncFiles(files, nFiles);
+		for (unsigned i = 0; i < nFiles; i++)
+			close(files[i].fd);
+		FREE(files);
+
+		pthread_mutex_lock(&syncMutex);
+	}
+	pthread_mutex_unlock(&syncMutex);
+	return NULL;
+}
+
+void fileIoSync(int fd) {
+	if (!syncRunning)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return;
+
+	pthread_mutex_lock(&syncMutex);
+
+	// a file written to by several trials is fsync'd once per round
+	for (unsigned i = 0; i < nPendingSyncs; i++) {
+		if (pendingSyncs[i].dev == st.st_dev && pendingSyncs[i].ino == st.st_ino) {
+			pthread_mutex_unlock(&syncMutex);
+			return;
+		}
+	}
+
+	if (nPendingSyncs == nPendingSyncsAllocated) {
+		unsigned nToAllocate = nPendingSyncsAllocated > 0 ? nPendingSyncsAllocated*2 : FILEIO_URING_ENTRIES;
+		PendingSync* files = (PendingSync*)REALLOC(pendingSyncs, sizeof(PendingSync) * nToAllocate);
+		if (files == NULL) {
+			pthread_mutex_unlock(&syncMutex);
+			logError("FileIO Error: No memory to queue fsync\n");
+			return;
+		}
+		pendingSyncs = files;
+		nPendingSyncsAllocated = nToAllocate;
+	}
+
+	int syncFd = dup(fd);
+	if (syncFd < 0) {
+		pthread_mutex_unlock(&syncMutex);
+		logError("FileIO Error: Could not queue fsync (%s)\n", strerror(errno));
+		return;
+	}
+
+	if (nPendingSyncs == 0) {
+		syncDeadline = getMonotonicTime() + syncLatencySec;
+		pthread_cond_signal(&syncCond);
+	}
+	pendingSyncs[nPendingSyncs].fd = syncFd;
+	pendingSyncs[nPendingSyncs].dev = st.st_dev;
+	pendingSyncs[nPendingSyncs].ino = st.st_ino;
+	nPendingSyncs++;
+
+	pthread_mutex_unlock(&syncMutex);
+}
+
+void fileIoStart() {
+#ifdef USE_IO_URING
+	// find out now whether the kernel has io_uring, rather than on the first trial
+	if (backend != FILEIO_BACKEND_PWRITE) {
+		Uring* r = uringCreate(FILEIO_URING_ENTRIES);
+		if (r != NULL)
+			uringFree(r);
+		else
+			fallBackToPwrite("setup", errno);
+	}
+#else
+	if (backend == FILEIO_BACKEND_URING)
+		logError("FileIO Error: Built without io_uring, writing with pwrite\n");
+	backend = FILEIO_BACKEND_PWRITE;
+#endif
+
+	if (syncLatencySec >= 0) {
+		syncTerminating = false;
+		int rc = pthread_create(&syncThread, NULL, syncThreadMain, NULL);
+		if (rc) {
+			logError("FileIO Error: Return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
+		syncRunning = true;
+		logInfo("FileIO: Writing with %s, group fsync through %s within %.0f ms\n",
+				backend == FILEIO_BACKEND_URING ? "io_uring" : "pwrite",
+				backend == FILEIO_BACKEND_PWRITE ? "fsync" : "io_uring", 1000 * syncLatencySec);
+	} else {
+		logInfo("FileIO: Writing with %s\n", backend == FILEIO_BACKEND_URING ? "io_uring" : "pwrite");
+	}
+}
+
+void fileIoStop() {
+	if (!syncRunning)
+		return;
+
+	pthread_mutex_lock(&syncMutex);
+	syncTerminating = true;
+	pthread_cond_signal(&syncCond);
+	pthread_mutex_unlock(&syncMutex);
+
+	pthread_join(syncThread, NULL);
+	syncRunning = false;
+}
+
+/////// STATISTICS ////////
+
+static void formatLatency(char* buffer, size_t length, double us) {
+	if (us < 1000)
+		snprintf(buffer, length, "%.0f us", us);
+	else if (us < 1e6)
+		snprintf(buffer, length, "%.3g ms", us / 1000);
+	else
+		snprintf(buffer, length, "%.3g s", us / 1e6);
+}
+
+// one line with the totals, one with the counts of the bins that aren't empty
+static void logHistogram(const char* name, const char* what, const char* unit, const LatencyHistogram* h) {
+	if (h->n == 0)
+		return;
+
+	logInfo("FileIO: %s latency over %llu %s (%llu %s), %.3f ms mean, %.3f ms max\n", name, h->n, what,
+			h->nUnits, unit, 1000 * h->totalSec / h->n, 1000 * h->maxSec);
+
+	char line[FILEIO_HISTOGRAM_BINS * 32] = "";
+	size_t used = 0;
+	for (unsigned bin = 0; bin < FILEIO_HISTOGRAM_BINS; bin++) {
+		if (h->counts[bin] == 0)
+			continue;
+
+		char bound[16];
+		bool isLast = bin == FILEIO_HISTOGRAM_BINS - 1;
+		formatLatency(bound, sizeof(bound), (double)(1u << (isLast ? bin - 1 : bin)));
+		int n = snprintf(line + used, sizeof(line) - used, "  %s%s: %llu", isLast ? ">=" : "<", bound, h->counts[bin]);
+		if (n < 0 || (size_t)n >= sizeof(line) - used)
+			break;
+		used += n;
+	}
+	logInfo("FileIO: %s latency histogram%s\n", name, line);
+}
+
+void fileIoSyncDirectoryOf(const char* fileName) {
+	if (!syncRunning)
+		return;
+
+	char dir[MAX_FILENAME_LENGTH];
+	snprintf(dir, sizeof(dir), "%s", fileName);
+	char* last = strrchr(dir, '/');
+	if (last == NULL)
+		strcpy(dir, ".");
+	else if (last == dir)
+		last[1] = '\0';
+	else
+		*last = '\0';
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		logError("FileIO Error: Could not open %s to fsync it (%s)\n", dir, strerror(errno));
+		return;
+	}
+	fileIoSync(fd);
+	close(fd);
+}
+
+void fileIoLogStats() {
+	pthread_mutex_lock(&statsMutex);
+	LatencyHistogram writes = writeLatency;
+	LatencyHistogram syncs = syncLatency;
+	pthread_mutex_unlock(&statsMutex);
+
+	logHistogram("Write", "writes", "bytes", &writes);
+	logHistogram("Fsync", "rounds", "files", &syncs);
+}
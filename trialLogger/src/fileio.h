@@ -0,0 +1,48 @@
+#ifndef FILEIO_H_INCLUDED
+#define FILEIO_H_INCLUDED
+
+// File output shared by the .mat, container and index writers. Writes are positional and go
+// through pwritev, or io_uring with the uring backend. Group fsyncs are submitted through
+// io_uring on Linux kernels that have it (5.1 on), see fileio.c.
+//
+// Durability uses group commit: files handed to fileIoSync are fsync'd together by one thread,
+// at most the configured latency after the first of them was queued, so one round of fsyncs
+// covers every trial written in the meantime, along with the folders that got new entries.
+// Without a latency set nothing is fsync'd and
+// flushing is left to the kernel, as before.
+//
+// Write and fsync latencies are kept as histograms, see fileIoLogStats.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef enum {
+	FILEIO_BACKEND_AUTO,   // pwritev, fsyncs through io_uring where available
+	FILEIO_BACKEND_URING,  // writes and fsyncs through io_uring
+	FILEIO_BACKEND_PWRITE
+} FileIoBackend;
+
+// "auto", "uring" or "pwrite", before fileIoStart
+bool fileIoSetBackendByName(const char* name);
+// fsync written files at most maxSec after they were queued, < 0 never fsyncs (default)
+void fileIoSetSyncLatency(double maxSec);
+
+void fileIoStart();
+// fsync whatever is still queued and stop
+void fileIoStop();
+
+// returns the bytes written or -1 with errno set, as pwritev
+ssize_t fileIoWritev(int fd, const struct iovec* iov, int nIov, off_t offset);
+bool fileIoWriteAll(int fd, const void* buffer, size_t nBytes, off_t offset);
+
+// queue fd's file for the next group fsync, fd may be closed as soon as this returns
+void fileIoSync(int fd);
+// queue the folder holding fileName for the next group fsync, so that an entry just created,
+// renamed or linked in it is as durable as the files written
+void fileIoSyncDirectoryOf(const char* fileName);
+
+void fileIoLogStats();
+
+#endif // ifndef FILEIO_H_INCLUDED
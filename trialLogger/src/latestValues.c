@@ -0,0 +1,237 @@
+#include <string.h>
+#include <math.h>     // floor
+#include <errno.h>    // ETIMEDOUT
+#include <pthread.h>
+#include <time.h>
+
+#include "utils.h"
+#include "trie.h"
+#include "network.h"
+#include "latestValues.h"
+
+typedef struct LatestSlot {
+	char name[MAX_GROUP_NAME+1];
+	uint64_t seq;           // odd while the parser writes the slot, each sample adds 2
+	uint32_t nBytes;        // stored with release after data, see latestValuesRead
+	uint8_t *data;
+	uint32_t bytesAllocated;
+	uint8_t *retired;       // the first buffer once outgrown, a reader may still be copying from it
+	uint64_t nBuffered;     // samples that also went into the trial buffers, what waiters count
+	uint64_t nBufferedSeen; // nBuffered at latestValuesMarkSeen, reader only
+} LatestSlot;
+
+static bool latestEnabled = false;
+static LatestSlot *slots = NULL;
+static unsigned nSlots = 0;     // published with release once the slot holds its first sample
+static Trie *slotTrie = NULL;   // group name to slot, parser thread only
+static bool slotsFullReported = false;
+
+// broadcast by the parser after an update while there are waiters. Waits time out on the
+// monotonic clock so that setting the wall clock doesn't cut them short or stretch them
+static pthread_mutex_t latestWaitMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t latestWaitCond;
+static pthread_once_t latestWaitCondOnce = PTHREAD_ONCE_INIT;
+static unsigned nWaiters = 0;
+
+static void initWaitCond(void) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&latestWaitCond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+void latestValuesEnable(bool enable) {
+	pthread_once(&latestWaitCondOnce, initWaitCond);
+	if (enable && slots == NULL) {
+		slots = (LatestSlot*)CALLOC(LATEST_VALUES_MAX_GROUPS, sizeof(LatestSlot));
+		slotTrie = trie_create();
+		if (slots == NULL || slotTrie == NULL) {
+			logError("Latest Values Error: Could not allocate the group slots\n");
+			latestValuesClear();
+			return;
+		}
+	}
+	latestEnabled = enable;
+}
+
+void latestValuesUpdate(const char *groupName, const uint8_t *group, uint32_t nBytes, bool buffered) {
+	if (!latestEnabled)
+		return;
+
+	LatestSlot *ps = (LatestSlot*)trie_lookup(slotTrie, groupName);
+	bool newSlot = ps == NULL;
+	if (newSlot) {
+		if (nSlots == LATEST_VALUES_MAX_GROUPS) {
+			if (!slotsFullReported)
+				logError("Latest Values Error: More than %d groups, not keeping %s\n",
+						LATEST_VALUES_MAX_GROUPS, groupName);
+			slotsFullReported = true;
+			return;
+		}
+		ps = slots + nSlots;
+		strncpy(ps->name, groupName, MAX_GROUP_NAME);
+		trie_add(slotTrie, groupName, ps);
+	}
+
+	// a group takes at most one packet, so the first buffer outgrown is replaced by one that fits
+	// any, and kept until latestValuesClear
+	uint8_t *data = NULL;
+	if (nBytes > ps->bytesAllocated) {
+		uint32_t bytesToAllocate = ps->data == NULL ? nBytes : MAX_DATA_SIZE;
+		if (bytesToAllocate < nBytes)
+			bytesToAllocate = nBytes;
+		data = (uint8_t*)CALLOC(1, bytesToAllocate);
+		if (data == NULL) {
+			logError("Latest Values Error: Could not allocate %u bytes for group %s\n", bytesToAllocate,
+					groupName);
+			return;
+		}
+		ps->retired = ps->data;
+		ps->bytesAllocated = bytesToAllocate;
+	}
+
+	uint64_t seq = ps->seq;
+	__atomic_store_n(&ps->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (data != NULL)
+		__atomic_store_n(&ps->data, data, __ATOMIC_RELAXED);
+	memcpy(ps->data, group, nBytes);
+	__atomic_store_n(&ps->nBytes, nBytes, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ps->seq, seq + 2, __ATOMIC_RELEASE);
+	if (buffered)
+		__atomic_store_n(&ps->nBuffered, ps->nBuffered + 1, __ATOMIC_RELEASE);
+
+	if (newSlot)
+		__atomic_store_n(&nSlots, nSlots + 1, __ATOMIC_RELEASE);
+
+	// a waiter counts itself before checking the sequence numbers, and this update is visible
+	// before the waiters are counted, so that either it sees the update or is woken for it
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&nWaiters, __ATOMIC_RELAXED) > 0) {
+		pthread_mutex_lock(&latestWaitMutex);
+		pthread_cond_broadcast(&latestWaitCond);
+		pthread_mutex_unlock(&latestWaitMutex);
+	}
+}
+
+void latestValuesClear(void) {
+	latestEnabled = false;
+	if (slots != NULL) {
+		for (unsigned i = 0; i < nSlots; i++) {
+			FREE(slots[i].data);
+			FREE(slots[i].retired);
+		}
+		FREE(slots);
+		slots = NULL;
+	}
+	if (slotTrie != NULL)
+		trie_flush(slotTrie, NULL);
+	slotTrie = NULL;
+	nSlots = 0;
+	slotsFullReported = false;
+}
+
+unsigned latestValuesCount(void) {
+	return __atomic_load_n(&nSlots, __ATOMIC_ACQUIRE);
+}
+
+int latestValuesFind(const char *groupName) {
+	unsigned n = latestValuesCount();
+	for (unsigned i = 0; i < n; i++)
+		if (strcmp(slots[i].name, groupName) == 0)
+			return (int)i;
+	return -1;
+}
+
+const char *latestValuesName(unsigned slot) {
+	return slots[slot].name;
+}
+
+uint32_t latestValuesRead(unsigned slot, uint8_t **pBuffer, uint32_t *pAllocated, uint64_t *pSeq) {
+	LatestSlot *ps = slots + slot;
+	uint64_t seqBefore, seqAfter;
+	uint32_t nBytes;
+
+	for (;;) {
+		seqBefore = __atomic_load_n(&ps->seq, __ATOMIC_ACQUIRE);
+		if (seqBefore & 1)
+			continue;
+
+		// acquiring nBytes makes the buffer it was stored after visible, one at least that large
+		nBytes = __atomic_load_n(&ps->nBytes, __ATOMIC_ACQUIRE);
+		const uint8_t *data = __atomic_load_n(&ps->data, __ATOMIC_RELAXED);
+		if (nBytes > *pAllocated) {
+			uint8_t *buffer = (uint8_t*)REALLOC(*pBuffer, MAX_DATA_SIZE);
+			if (buffer == NULL) {
+				logError("Latest Values Error: Could not allocate read buffer\n");
+				return 0;
+			}
+			*pBuffer = buffer;
+			*pAllocated = MAX_DATA_SIZE;
+		}
+		memcpy(*pBuffer, data, nBytes);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seqAfter = __atomic_load_n(&ps->seq, __ATOMIC_RELAXED);
+		if (seqAfter == seqBefore)
+			break;
+	}
+
+	*pSeq = seqBefore / 2;
+	return nBytes;
+}
+
+void latestValuesMarkSeen(void) {
+	unsigned n = latestValuesCount();
+	for (unsigned i = 0; i < n; i++)
+		slots[i].nBufferedSeen = __atomic_load_n(&slots[i].nBuffered, __ATOMIC_ACQUIRE);
+}
+
+static bool anyGroupNew(const char **groupNames, unsigned nGroupNames) {
+	unsigned n = latestValuesCount();
+	for (unsigned i = 0; i < n; i++) {
+		if (__atomic_load_n(&slots[i].nBuffered, __ATOMIC_SEQ_CST) <= slots[i].nBufferedSeen)
+			continue;
+		if (nGroupNames == 0)
+			return true;
+		for (unsigned j = 0; j < nGroupNames; j++)
+			if (strcmp(slots[i].name, groupNames[j]) == 0)
+				return true;
+	}
+	return false;
+}
+
+bool latestValuesWaitForNew(const char **groupNames, unsigned nGroupNames, double timeoutSec) {
+	pthread_once(&latestWaitCondOnce, initWaitCond);
+
+	// NaN waits as 0, anything longer than the longest wait (infinity too) for the longest wait,
+	// so that the deadline can't overflow
+	if (!(timeoutSec > 0))
+		timeoutSec = 0;
+	if (timeoutSec > LATEST_VALUES_MAX_WAIT_SEC)
+		timeoutSec = LATEST_VALUES_MAX_WAIT_SEC;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (time_t)timeoutSec;
+	deadline.tv_nsec += (long)((timeoutSec - floor(timeoutSec)) * 1e9);
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	int rc = 0;
+	bool received;
+	pthread_mutex_lock(&latestWaitMutex);
+	__atomic_add_fetch(&nWaiters, 1, __ATOMIC_SEQ_CST);
+
+	while (!(received = anyGroupNew(groupNames, nGroupNames)) && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&latestWaitCond, &latestWaitMutex, &deadline);
+
+	__atomic_sub_fetch(&nWaiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&latestWaitMutex);
+	return received;
+}
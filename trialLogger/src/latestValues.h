@@ -0,0 +1,47 @@
+#ifndef LATESTVALUES_H_INCLUDED
+#define LATESTVALUES_H_INCLUDED
+
+// The latest sample of each group received, for consumers that only need the newest values
+// (e.g. a display polling the command groups every frame) rather than the trial's buffers.
+//
+// The parser copies each group, as it was received (header and serialized signals, see
+// parseGroupInfoHeader and parseSignalFromBuffer), into a slot of its own. Slots are seqlocks:
+// the parser is the only writer and never waits, readers copy the bytes out and retry if the
+// slot was written in the meantime. The slot's sequence number counts the samples received. A
+// reader may also wait for groups to arrive, the parser only takes a lock when one does.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// at most this many groups are kept, later groups are ignored
+#define LATEST_VALUES_MAX_GROUPS 256
+
+// off by default, so that the trial logger does no extra work
+void latestValuesEnable(bool enable);
+// the parser's update, group holds nBytes of a group received, once it has been buffered if it
+// was (only samples buffered count for latestValuesWaitForNew). Parser thread only
+void latestValuesUpdate(const char *groupName, const uint8_t *group, uint32_t nBytes, bool buffered);
+// free all slots, while there are no readers or writers
+void latestValuesClear(void);
+
+// number of groups received so far, slots 0 to count-1 are filled
+unsigned latestValuesCount(void);
+// slot of the group, -1 if it hasn't been received
+int latestValuesFind(const char *groupName);
+const char *latestValuesName(unsigned slot);
+// copies the latest sample of the group in slot into *pBuffer, grown to *pAllocated bytes as
+// needed (*pBuffer may start out NULL), and returns its size with its sequence number in *pSeq
+uint32_t latestValuesRead(unsigned slot, uint8_t **pBuffer, uint32_t *pAllocated, uint64_t *pSeq);
+
+// remember the samples of every group buffered so far, the ones buffered after are new. Call it
+// before handing the buffers out, so that every sample counted as seen goes out with them
+void latestValuesMarkSeen(void);
+// longest wait of latestValuesWaitForNew, longer timeouts are cut down to it. Wait in slices to
+// stay responsive for longer
+#define LATEST_VALUES_MAX_WAIT_SEC (24 * 3600.0)
+// block until a sample of any of the nGroupNames groups (any group if none) has been buffered
+// since latestValuesMarkSeen, for at most timeoutSec. Returns whether one has. One waiting
+// thread only
+bool latestValuesWaitForNew(const char **groupNames, unsigned nGroupNames, double timeoutSec);
+
+#endif // ifndef LATESTVALUES_H_INCLUDED
@@ -0,0 +1,1716 @@
+// Native MAT-file v5 writer, see matfile.h
+//
+// Layout follows "MAT-File Format" (MathWorks, Level 5 MAT-files): a 128 byte header followed
+// by one miMATRIX data element per variable. Every data element is an 8 byte tag plus data
+// padded to 8 bytes. Headers of each node are composed in the node itself, data is written
+// straight from where it lives, and the whole variable goes out through fileIoWritev.
+//
+// Built with USE_HDF5, mode "w7.3" writes MAT 7.3 files instead: HDF5 with a 512 byte user
+// block holding the MAT header, structs as groups, cells as object references into "#refs#",
+// and MATLAB_class attributes on everything. Larger arrays are stored as chunked datasets that
+// are shuffled and compressed here, then handed to HDF5 with H5Dwrite_chunk. The chunks are
+// compressed by a pool of threads of their own once matStartCompressionThreads was called, the
+// thread putting the variable only queues them and waits.
+
+#ifndef MATLAB_MEX_FILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#ifdef USE_HDF5
+#include <pthread.h>
+#include <zlib.h>
+#include <hdf5.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#endif
+
+#include "errors.h"
+#include "utils.h"
+#include "matfile.h"
+#include "fileio.h"
+
+// data element types
+#define miINT8    1
+#define miUINT8   2
+#define miINT16   3
+#define miUINT16  4
+#define miINT32   5
+#define miUINT32  6
+#define miSINGLE  7
+#define miDOUBLE  9
+#define miINT64   12
+#define miUINT64  13
+#define miMATRIX  14
+
+// array flags
+#define MAT_FLAG_LOGICAL 0x0200
+
+#define MAT_HEADER_LENGTH 128
+// MATLAB reads field names of up to 63 characters
+#define MAT_MIN_FIELD_NAME_LENGTH 32
+
+// iovecs collected before each write
+#define MAT_IOV_BATCH 512
+
+// tag + array flags + dims tag + dims + name tag, the name itself goes out as its own iovec
+#define MAT_NODE_HEADER_MAX (8 + 16 + 8 + 4*MAT_MAX_DIMS + 8)
+
+struct MatNode {
+	mxClassID classId;
+	mwSize nDims;
+	mwSize dims[MAT_MAX_DIMS];
+	size_t nElements;
+
+	// numeric, logical and char data
+	void* data;
+	bool dataBorrowed;
+
+	// cell elements, or struct field values as [element*nFields + field]
+	struct MatNode** children;
+
+	// struct field names
+	int nFields;
+	char** fieldNames;
+
+	// compression of this array in MAT 7.3 files, see matSetCompression
+	MatCodec codec;
+	int level;
+
+	// filled in while writing
+	uint8_t header[MAT_NODE_HEADER_MAX];
+	char* fieldNameBlock;
+	struct MatChunks* chunks;
+
+	// shared arrays are encoded once, as an unnamed v5 element, and only read from then on
+	bool shared;
+	unsigned refs;
+	uint8_t* encoded;
+	size_t encodedBytes;
+};
+
+struct MatFile {
+	int fd;
+	bool failed;
+	// records are written at offset into a file owned by the caller, files from 0
+	bool isRecord;
+	off_t offset;
+	// copied to memory from offset instead when set, see matShareArray
+	uint8_t* memory;
+	struct iovec iov[MAT_IOV_BATCH];
+	int nIov;
+
+#ifdef USE_HDF5
+	bool isMat73;
+	char* fileName;
+	hid_t h5File;
+	// "#refs#" group holding cell elements, created on first use
+	hid_t h5Refs;
+	unsigned nRefs;
+#endif
+};
+
+static const uint8_t zeroPadding[8] = { 0 };
+
+static void composeHeader(uint8_t* header, const char* description, const char* suffix, uint16_t version);
+#ifdef USE_HDF5
+static void freeNodeChunks(mxArray* pm);
+#endif
+
+// sized in place of cell elements or field values that were never set
+static const struct MatNode emptyNode = { mxDOUBLE_CLASS, 2, { 0, 0 }, 0 };
+
+// and its encoding, an unnamed 0x0 double
+static const uint32_t emptyNodeElement[14] = {
+	miMATRIX, 48,
+	miUINT32, 8, mxDOUBLE_CLASS, 0,
+	miINT32, 8, 0, 0,
+	miINT8, 0,
+	miDOUBLE, 0
+};
+
+static size_t padTo8(size_t nBytes) {
+	return (nBytes + 7) & ~(size_t)7;
+}
+
+static size_t getElementSizeOfClass(mxClassID classId) {
+	switch (classId) {
+		case mxDOUBLE_CLASS:
+		case mxINT64_CLASS:
+		case mxUINT64_CLASS:
+			return 8;
+		case mxSINGLE_CLASS:
+		case mxINT32_CLASS:
+		case mxUINT32_CLASS:
+			return 4;
+		case mxINT16_CLASS:
+		case mxUINT16_CLASS:
+		case mxCHAR_CLASS:
+			return 2;
+		case mxINT8_CLASS:
+		case mxUINT8_CLASS:
+		case mxLOGICAL_CLASS:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static uint32_t getDataTypeOfClass(mxClassID classId) {
+	switch (classId) {
+		case mxDOUBLE_CLASS:  return miDOUBLE;
+		case mxSINGLE_CLASS:  return miSINGLE;
+		case mxINT8_CLASS:    return miINT8;
+		case mxUINT8_CLASS:   return miUINT8;
+		case mxINT16_CLASS:   return miINT16;
+		case mxUINT16_CLASS:  return miUINT16;
+		case mxINT32_CLASS:   return miINT32;
+		case mxUINT32_CLASS:  return miUINT32;
+		case mxINT64_CLASS:   return miINT64;
+		case mxUINT64_CLASS:  return miUINT64;
+		case mxCHAR_CLASS:    return miUINT16;
+		case mxLOGICAL_CLASS: return miUINT8;
+		default:              return miUINT8;
+	}
+}
+
+// class stored in the array flags, logical arrays are uint8 with the logical flag set
+static uint32_t getArrayFlags(mxClassID classId) {
+	if (classId == mxLOGICAL_CLASS)
+		return MAT_FLAG_LOGICAL | mxUINT8_CLASS;
+	return (uint32_t)classId;
+}
+
+/////// ARRAYS ////////
+
+static mxArray* createNode(mxClassID classId, mwSize nDims, const mwSize* dims) {
+	if (nDims > MAT_MAX_DIMS) {
+		logError("MAT Error: Too many dimensions (%zu)\n", (size_t)nDims);
+		return NULL;
+	}
+
+	mxArray* pm = (mxArray*)CALLOC(sizeof(mxArray), 1);
+	if (pm == NULL)
+		return NULL;
+
+	pm->classId = classId;
+	pm->codec = MAT_CODEC_INHERIT;
+	pm->level = -1;
+
+	// MAT files hold at least two dimensions
+	pm->dims[0] = pm->dims[1] = 1;
+	pm->nDims = nDims < 2 ? 2 : nDims;
+	for (mwSize i = 0; i < nDims; i++)
+		pm->dims[i] = dims[i];
+
+	pm->nElements = 1;
+	for (mwSize i = 0; i < pm->nDims; i++)
+		pm->nElements *= pm->dims[i];
+
+	if (classId == mxCELL_CLASS) {
+		pm->children = (mxArray**)CALLOC(sizeof(mxArray*), pm->nElements > 0 ? pm->nElements : 1);
+		if (pm->children == NULL) {
+			FREE(pm);
+			return NULL;
+		}
+	}
+
+	return pm;
+}
+
+mxArray* mxCreateNumericArray(mwSize nDims, const mwSize* dims, mxClassID classId, mxComplexity flag) {
+	return createNode(classId, nDims, dims);
+}
+
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classId, mxComplexity flag) {
+	mwSize dims[2] = { m, n };
+	return createNode(classId, 2, dims);
+}
+
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag) {
+	return mxCreateNumericMatrix(m, n, mxDOUBLE_CLASS, flag);
+}
+
+mxArray* mxCreateLogicalArray(mwSize nDims, const mwSize* dims) {
+	return createNode(mxLOGICAL_CLASS, nDims, dims);
+}
+
+mxArray* mxCreateLogicalScalar(mxLogical value) {
+	mwSize dims[2] = { 1, 1 };
+	mxArray* pm = createNode(mxLOGICAL_CLASS, 2, dims);
+	uint8_t* data = (uint8_t*)mxGetData(pm);
+	if (data != NULL)
+		*data = value ? 1 : 0;
+	return pm;
+}
+
+mxArray* mxCreateCharArray(mwSize nDims, const mwSize* dims) {
+	return createNode(mxCHAR_CLASS, nDims, dims);
+}
+
+mxArray* mxCreateString(const char* str) {
+	size_t len = strlen(str);
+	mwSize dims[2] = { 1, len };
+	mxArray* pm = createNode(mxCHAR_CLASS, 2, dims);
+
+	uint16_t* data = (uint16_t*)mxGetData(pm);
+	if (data != NULL) {
+		for (size_t i = 0; i < len; i++)
+			data[i] = (uint8_t)str[i];
+	}
+	return pm;
+}
+
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n) {
+	mwSize dims[2] = { m, n };
+	return createNode(mxCELL_CLASS, 2, dims);
+}
+
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nFields, const char** fieldNames) {
+	mwSize dims[2] = { m, n };
+	mxArray* pm = createNode(mxSTRUCT_CLASS, 2, dims);
+	if (pm == NULL)
+		return NULL;
+
+	for (int i = 0; i < nFields; i++)
+		mxAddField(pm, fieldNames[i]);
+	return pm;
+}
+
+void mxDestroyArray(mxArray* pm) {
+	if (pm == NULL)
+		return;
+
+	// a shared array goes with its last reference
+	if (pm->shared && __atomic_sub_fetch(&pm->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	if (pm->children != NULL) {
+		size_t nChildren = pm->classId == mxSTRUCT_CLASS ? pm->nElements * pm->nFields : pm->nElements;
+		for (size_t i = 0; i < nChildren; i++)
+			mxDestroyArray(pm->children[i]);
+		FREE(pm->children);
+	}
+
+	for (int i = 0; i < pm->nFields; i++)
+		FREE(pm->fieldNames[i]);
+	if (pm->fieldNames != NULL)
+		FREE(pm->fieldNames);
+	if (pm->fieldNameBlock != NULL)
+		FREE(pm->fieldNameBlock);
+
+	if (pm->data != NULL && !pm->dataBorrowed)
+		FREE(pm->data);
+	if (pm->encoded != NULL)
+		FREE(pm->encoded);
+
+#ifdef USE_HDF5
+	freeNodeChunks(pm);
+#endif
+
+	FREE(pm);
+}
+
+void* mxGetData(const mxArray* pm) {
+	if (pm == NULL || pm->classId == mxCELL_CLASS || pm->classId == mxSTRUCT_CLASS)
+		return NULL;
+
+	if (pm->data == NULL && pm->nElements > 0) {
+		// allocated on first use so that borrowed data needs no allocation at all
+		mxArray* pmMutable = (mxArray*)pm;
+		pmMutable->data = CALLOC(getElementSizeOfClass(pm->classId), pm->nElements);
+		pmMutable->dataBorrowed = false;
+	}
+	return pm->data;
+}
+
+double* mxGetPr(const mxArray* pm) {
+	return (double*)mxGetData(pm);
+}
+
+double* mxGetDoubles(const mxArray* pm) {
+	return (double*)mxGetData(pm);
+}
+
+void mxSetM(mxArray* pm, mwSize m) {
+	if (m > pm->dims[0])
+		return;
+
+	size_t nElementsOld = pm->nElements;
+	pm->dims[0] = m;
+	pm->nElements = 1;
+	for (mwSize i = 0; i < pm->nDims; i++)
+		pm->nElements *= pm->dims[i];
+
+	// struct elements are laid out one after the other, only the trailing ones are dropped
+	if (pm->classId == mxSTRUCT_CLASS && pm->children != NULL && pm->dims[1] == 1) {
+		for (size_t i = pm->nElements * pm->nFields; i < nElementsOld * pm->nFields; i++) {
+			mxDestroyArray(pm->children[i]);
+			pm->children[i] = NULL;
+		}
+	}
+}
+
+void matSetBorrowedData(mxArray* pm, const void* data) {
+	if (pm->data != NULL && !pm->dataBorrowed)
+		FREE(pm->data);
+	pm->data = (void*)data;
+	pm->dataBorrowed = true;
+}
+
+/////// CELLS AND STRUCTS ////////
+
+void mxSetCell(mxArray* pm, mwIndex index, mxArray* value) {
+	if (pm->classId != mxCELL_CLASS || index >= pm->nElements)
+		return;
+	pm->children[index] = value;
+}
+
+int mxGetFieldNumber(const mxArray* pm, const char* fieldName) {
+	for (int i = 0; i < pm->nFields; i++) {
+		if (strcmp(pm->fieldNames[i], fieldName) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int mxAddField(mxArray* pm, const char* fieldName) {
+	if (pm->classId != mxSTRUCT_CLASS)
+		return -1;
+
+	int existing = mxGetFieldNumber(pm, fieldName);
+	if (existing >= 0)
+		return existing;
+
+	int nFields = pm->nFields + 1;
+	size_t nElements = pm->nElements > 0 ? pm->nElements : 1;
+
+	char** fieldNames = (char**)REALLOC(pm->fieldNames, sizeof(char*) * nFields);
+	if (fieldNames == NULL)
+		return -1;
+	pm->fieldNames = fieldNames;
+
+	// re-lay out the field values with room for the new field in each element
+	mxArray** children = (mxArray**)CALLOC(sizeof(mxArray*), nElements * nFields);
+	char* name = strdup(fieldName);
+	if (children == NULL || name == NULL) {
+		if (children != NULL)
+			FREE(children);
+		if (name != NULL)
+			FREE(name);
+		return -1;
+	}
+
+	if (pm->children != NULL) {
+		for (size_t e = 0; e < nElements; e++)
+			memcpy(children + e*nFields, pm->children + e*pm->nFields, sizeof(mxArray*) * pm->nFields);
+		FREE(pm->children);
+	}
+	pm->children = children;
+
+	pm->fieldNames[pm->nFields] = name;
+	pm->nFields = nFields;
+	return nFields - 1;
+}
+
+void mxSetFieldByNumber(mxArray* pm, mwIndex index, int fieldNumber, mxArray* value) {
+	if (pm->classId != mxSTRUCT_CLASS || index >= pm->nElements || fieldNumber < 0 || fieldNumber >= pm->nFields)
+		return;
+	pm->children[index*pm->nFields + fieldNumber] = value;
+}
+
+void mxSetField(mxArray* pm, mwIndex index, const char* fieldName, mxArray* value) {
+	mxSetFieldByNumber(pm, index, mxGetFieldNumber(pm, fieldName), value);
+}
+
+mxArray* mxGetField(const mxArray* pm, mwIndex index, const char* fieldName) {
+	return mxGetFieldByNumber(pm, index, mxGetFieldNumber(pm, fieldName));
+}
+
+int mxGetNumberOfFields(const mxArray* pm) {
+	return pm->classId == mxSTRUCT_CLASS ? pm->nFields : 0;
+}
+
+const char* mxGetFieldNameByNumber(const mxArray* pm, int fieldNumber) {
+	if (pm->classId != mxSTRUCT_CLASS || fieldNumber < 0 || fieldNumber >= pm->nFields)
+		return NULL;
+	return pm->fieldNames[fieldNumber];
+}
+
+mxArray* mxGetFieldByNumber(const mxArray* pm, mwIndex index, int fieldNumber) {
+	if (pm->classId != mxSTRUCT_CLASS || fieldNumber < 0 || fieldNumber >= pm->nFields || index >= pm->nElements)
+		return NULL;
+	return pm->children[index*pm->nFields + fieldNumber];
+}
+
+/////// WRITING ////////
+
+static size_t getFieldNameLength(const mxArray* pm) {
+	size_t len = MAT_MIN_FIELD_NAME_LENGTH;
+	for (int i = 0; i < pm->nFields; i++) {
+		if (strlen(pm->fieldNames[i]) + 1 > len)
+			len = strlen(pm->fieldNames[i]) + 1;
+	}
+	return padTo8(len);
+}
+
+static size_t getNumberOfChildren(const mxArray* pm) {
+	if (pm->classId == mxSTRUCT_CLASS)
+		return pm->nElements * pm->nFields;
+	if (pm->classId == mxCELL_CLASS)
+		return pm->nElements;
+	return 0;
+}
+
+// bytes following the miMATRIX tag for this node
+static size_t getNodeContentSize(const mxArray* pm, size_t nameLength) {
+	if (pm->shared && nameLength == 0)
+		return pm->encodedBytes - 8;
+
+	size_t nBytes = 16 + 8 + padTo8(4*pm->nDims) + 8 + padTo8(nameLength);
+
+	if (pm->classId == mxSTRUCT_CLASS)
+		nBytes += 8 + 8 + pm->nFields * getFieldNameLength(pm);
+	else if (pm->classId != mxCELL_CLASS)
+		nBytes += 8 + padTo8(pm->nElements * getElementSizeOfClass(pm->classId));
+
+	size_t nChildren = getNumberOfChildren(pm);
+	for (size_t i = 0; i < nChildren; i++) {
+		const mxArray* child = pm->children[i] != NULL ? pm->children[i] : &emptyNode;
+		nBytes += 8 + getNodeContentSize(child, 0);
+	}
+
+	return nBytes;
+}
+
+static void flushIov(MATFile* pmf) {
+	int iStart = 0;
+
+	if (pmf->memory != NULL) {
+		for (int i = 0; i < pmf->nIov; i++) {
+			memcpy(pmf->memory + pmf->offset, pmf->iov[i].iov_base, pmf->iov[i].iov_len);
+			pmf->offset += pmf->iov[i].iov_len;
+		}
+		pmf->nIov = 0;
+		return;
+	}
+
+	while (iStart < pmf->nIov && !pmf->failed) {
+		ssize_t nWritten = fileIoWritev(pmf->fd, pmf->iov + iStart, pmf->nIov - iStart, pmf->offset);
+		if (nWritten < 0) {
+			if (errno == EINTR)
+				continue;
+			pmf->failed = true;
+			break;
+		}
+		pmf->offset += nWritten;
+
+		// skip what went out, partially written iovecs are advanced in place
+		while (iStart < pmf->nIov && (size_t)nWritten >= pmf->iov[iStart].iov_len)
+			nWritten -= pmf->iov[iStart++].iov_len;
+		if (iStart < pmf->nIov) {
+			pmf->iov[iStart].iov_base = (uint8_t*)pmf->iov[iStart].iov_base + nWritten;
+			pmf->iov[iStart].iov_len -= nWritten;
+		}
+	}
+
+	pmf->nIov = 0;
+}
+
+static void pushIov(MATFile* pmf, const void* data, size_t nBytes) {
+	if (nBytes == 0)
+		return;
+	if (pmf->nIov == MAT_IOV_BATCH)
+		flushIov(pmf);
+
+	pmf->iov[pmf->nIov].iov_base = (void*)data;
+	pmf->iov[pmf->nIov].iov_len = nBytes;
+	pmf->nIov++;
+}
+
+static void pushPadding(MATFile* pmf, size_t nBytes) {
+	pushIov(pmf, zeroPadding, padTo8(nBytes) - nBytes);
+}
+
+static uint8_t* putTag(uint8_t* p, uint32_t type, uint32_t nBytes) {
+	memcpy(p, &type, 4);
+	memcpy(p + 4, &nBytes, 4);
+	return p + 8;
+}
+
+// queue the miMATRIX element for pm, the headers are composed in pm itself so they stay
+// valid until the iovecs have been written
+static bool pushNode(MATFile* pmf, mxArray* pm, const char* name) {
+	// shared arrays go out as encoded, nothing in them may be touched
+	if (pm->shared) {
+		if (name != NULL) {
+			logError("MAT Error: Shared array %s must be put inside a struct or cell\n", name);
+			return false;
+		}
+		pushIov(pmf, pm->encoded, pm->encodedBytes);
+		return true;
+	}
+
+	size_t nameLength = name != NULL ? strlen(name) : 0;
+	size_t contentSize = getNodeContentSize(pm, nameLength);
+	uint8_t* p = pm->header;
+
+	p = putTag(p, miMATRIX, (uint32_t)contentSize);
+
+	// array flags
+	uint32_t flags[2] = { getArrayFlags(pm->classId), 0 };
+	p = putTag(p, miUINT32, 8);
+	memcpy(p, flags, 8);
+	p += 8;
+
+	// dimensions
+	p = putTag(p, miINT32, (uint32_t)(4*pm->nDims));
+	for (mwSize i = 0; i < pm->nDims; i++) {
+		int32_t dim = (int32_t)pm->dims[i];
+		memcpy(p, &dim, 4);
+		p += 4;
+	}
+	memset(p, 0, padTo8(4*pm->nDims) - 4*pm->nDims);
+	p += padTo8(4*pm->nDims) - 4*pm->nDims;
+
+	// array name
+	p = putTag(p, miINT8, (uint32_t)nameLength);
+	pushIov(pmf, pm->header, p - pm->header);
+	pushIov(pmf, name, nameLength);
+	pushPadding(pmf, nameLength);
+
+	if (pm->classId == mxSTRUCT_CLASS) {
+		size_t fieldNameLength = getFieldNameLength(pm);
+		size_t blockSize = pm->nFields * fieldNameLength;
+
+		if (pm->fieldNameBlock != NULL)
+			FREE(pm->fieldNameBlock);
+		pm->fieldNameBlock = (char*)CALLOC(1, blockSize + 16);
+		if (pm->fieldNameBlock == NULL)
+			return false;
+
+		// field name length as a small data element, then the padded names
+		uint8_t* q = (uint8_t*)pm->fieldNameBlock;
+		uint16_t smallTag[2] = { miINT32, 4 };
+		int32_t fieldNameLength32 = (int32_t)fieldNameLength;
+		memcpy(q, smallTag, 4);
+		memcpy(q + 4, &fieldNameLength32, 4);
+		putTag(q + 8, miINT8, (uint32_t)blockSize);
+		for (int i = 0; i < pm->nFields; i++)
+			strncpy((char*)q + 16 + i*fieldNameLength, pm->fieldNames[i], fieldNameLength - 1);
+		pushIov(pmf, q, blockSize + 16);
+	} else if (pm->classId != mxCELL_CLASS) {
+		size_t nBytes = pm->nElements * getElementSizeOfClass(pm->classId);
+		if (nBytes > 0 && pm->data == NULL)
+			mxGetData(pm);
+		if (nBytes > 0 && pm->data == NULL)
+			return false;
+
+		// the data tag follows the name in the header buffer
+		uint8_t* dataTag = p;
+		putTag(dataTag, getDataTypeOfClass(pm->classId), (uint32_t)nBytes);
+		pushIov(pmf, dataTag, 8);
+		pushIov(pmf, pm->data, nBytes);
+		pushPadding(pmf, nBytes);
+	}
+
+	size_t nChildren = getNumberOfChildren(pm);
+	for (size_t i = 0; i < nChildren; i++) {
+		if (pm->children[i] == NULL)
+			pushIov(pmf, emptyNodeElement, sizeof(emptyNodeElement));
+		else if (!pushNode(pmf, pm->children[i], NULL))
+			return false;
+	}
+
+	return true;
+}
+
+/////// SHARED ARRAYS ////////
+
+bool matShareArray(mxArray* pm) {
+	if (pm == NULL || pm->shared)
+		return pm != NULL;
+
+	size_t contentSize = getNodeContentSize(pm, 0);
+	if (contentSize > UINT32_MAX)
+		return false;
+	uint8_t* encoded = (uint8_t*)MALLOC(8 + contentSize);
+	if (encoded == NULL)
+		return false;
+
+	// composing the headers allocates any data not yet accessed, so reading is all that's left
+	MATFile mf;
+	memset(&mf, 0, sizeof(mf));
+	mf.fd = -1;
+	mf.memory = encoded;
+	bool success = pushNode(&mf, pm, NULL);
+	flushIov(&mf);
+	if (!success || (size_t)mf.offset != 8 + contentSize) {
+		FREE(encoded);
+		return false;
+	}
+
+	pm->encoded = encoded;
+	pm->encodedBytes = 8 + contentSize;
+	pm->refs = 1;
+	pm->shared = true;
+	return true;
+}
+
+mxArray* matRetainSharedArray(mxArray* pm) {
+	if (pm == NULL || !pm->shared)
+		return NULL;
+	__atomic_add_fetch(&pm->refs, 1, __ATOMIC_RELAXED);
+	return pm;
+}
+
+/////// COMPRESSION ////////
+
+void matSetCompression(mxArray* pm, MatCodec codec, int level) {
+	if (pm == NULL)
+		return;
+	pm->codec = codec;
+	pm->level = level;
+}
+
+bool matGetCodecByName(const char* name, MatCodec* pCodec) {
+	static const char* codecNames[] = { "none", "zlib", "zstd", "lz4" };
+
+	for (int i = 0; i < (int)(sizeof(codecNames) / sizeof(codecNames[0])); i++) {
+		if (strcasecmp(name, codecNames[i]) == 0) {
+			*pCodec = (MatCodec)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool matIsCodecAvailable(MatCodec codec) {
+	switch (codec) {
+		case MAT_CODEC_NONE:
+			return true;
+#ifdef USE_HDF5
+		case MAT_CODEC_ZLIB:
+			return true;
+#endif
+#if defined(USE_HDF5) && defined(USE_ZSTD)
+		case MAT_CODEC_ZSTD:
+			return true;
+#endif
+#if defined(USE_HDF5) && defined(USE_LZ4)
+		case MAT_CODEC_LZ4:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+#ifdef USE_HDF5
+
+/////// MAT 7.3 ////////
+
+// ids of the HDF5 filter plugins for the codecs HDF5 doesn't ship with
+#define H5Z_FILTER_ZSTD 32015
+#define H5Z_FILTER_LZ4  32004
+
+#define MAT73_USERBLOCK_LENGTH 512
+// arrays smaller than this are stored contiguously and uncompressed
+#define MAT73_MIN_CHUNKED_BYTES 4096
+// uncompressed size each chunk aims for
+#define MAT73_CHUNK_BYTES (256 * 1024)
+// arrays whose rows alone are bigger than this are not chunked at all
+#define MAT73_MAX_CHUNK_BYTES (64 * 1024 * 1024)
+
+// the HDF5 library isn't necessarily built thread safe, every call into it holds this lock.
+// chunks are compressed before taking it, on the compression threads if they were started
+static pthread_mutex_t h5Mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// compressed chunks of an array, ready to be handed to H5Dwrite_chunk
+typedef struct MatChunks {
+	int nDims;
+	hsize_t chunkDims[MAT_MAX_DIMS];
+	// the one dimension chunks advance along, and how far each step goes
+	int chunkDim;
+	hsize_t chunkLength;
+	size_t elementSize;
+	// uncompressed size of every chunk, edge chunks are padded to it
+	size_t chunkBytes;
+
+	MatCodec codec;
+	int level;
+	bool shuffle;
+
+	uint32_t nChunks;
+	uint8_t** data;
+	size_t* nBytes;
+	uint32_t* filterMask;
+} MatChunks;
+
+static const char* mat73ClassNames[] = { "unknown", "cell", "struct", "logical", "char", "void",
+	"double", "single", "int8", "uint8", "int16", "uint16", "int32", "uint32", "int64", "uint64" };
+
+static hid_t getH5TypeOfClass(mxClassID classId) {
+	switch (classId) {
+		case mxDOUBLE_CLASS:  return H5T_NATIVE_DOUBLE;
+		case mxSINGLE_CLASS:  return H5T_NATIVE_FLOAT;
+		case mxINT8_CLASS:    return H5T_NATIVE_INT8;
+		case mxUINT8_CLASS:   return H5T_NATIVE_UINT8;
+		case mxINT16_CLASS:   return H5T_NATIVE_INT16;
+		case mxUINT16_CLASS:  return H5T_NATIVE_UINT16;
+		case mxINT32_CLASS:   return H5T_NATIVE_INT32;
+		case mxUINT32_CLASS:  return H5T_NATIVE_UINT32;
+		case mxINT64_CLASS:   return H5T_NATIVE_INT64;
+		case mxUINT64_CLASS:  return H5T_NATIVE_UINT64;
+		case mxCHAR_CLASS:    return H5T_NATIVE_UINT16;
+		case mxLOGICAL_CLASS: return H5T_NATIVE_UINT8;
+		default:              return H5T_NATIVE_DOUBLE;
+	}
+}
+
+// HDF5 lists dimensions slowest first, MATLAB fastest first
+static void getH5Dims(const mxArray* pm, hsize_t* h5Dims) {
+	for (mwSize i = 0; i < pm->nDims; i++)
+		h5Dims[i] = pm->dims[pm->nDims - 1 - i];
+}
+
+static void freeNodeChunks(mxArray* pm) {
+	MatChunks* pc = pm->chunks;
+	if (pc == NULL)
+		return;
+
+	for (uint32_t i = 0; i < pc->nChunks; i++) {
+		if (pc->data[i] != NULL)
+			FREE(pc->data[i]);
+	}
+	if (pc->data != NULL)
+		FREE(pc->data);
+	if (pc->nBytes != NULL)
+		FREE(pc->nBytes);
+	if (pc->filterMask != NULL)
+		FREE(pc->filterMask);
+	FREE(pc);
+	pm->chunks = NULL;
+}
+
+// byte shuffle as done by the HDF5 shuffle filter
+static void shuffleBytes(const uint8_t* src, uint8_t* dst, size_t nBytes, size_t elementSize) {
+	size_t nElements = nBytes / elementSize;
+	for (size_t b = 0; b < elementSize; b++) {
+		uint8_t* out = dst + b*nElements;
+		for (size_t i = 0; i < nElements; i++)
+			out[i] = src[i*elementSize + b];
+	}
+}
+
+#ifdef USE_LZ4
+static void putUint32BE(uint8_t* p, uint32_t value) {
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+#endif
+
+// compress nBytes of src into dst, returns the compressed size or 0 if it wouldn't be any smaller
+static size_t compressChunk(MatCodec codec, int level, const uint8_t* src, size_t nBytes, uint8_t* dst) {
+	switch (codec) {
+		case MAT_CODEC_ZLIB: {
+			uLongf nCompressed = nBytes;
+			if (compress2(dst, &nCompressed, src, nBytes, level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+				return 0;
+			return nCompressed;
+		}
+#ifdef USE_ZSTD
+		case MAT_CODEC_ZSTD: {
+			size_t nCompressed = ZSTD_compress(dst, nBytes, src, nBytes, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+			return ZSTD_isError(nCompressed) ? 0 : nCompressed;
+		}
+#endif
+#ifdef USE_LZ4
+		case MAT_CODEC_LZ4: {
+			// the lz4 filter expects the original size and block size up front, then each
+			// block prefixed by its compressed size, all big endian. Chunks go in one block
+			if (nBytes <= 16)
+				return 0;
+			int nCompressed = LZ4_compress_default((const char*)src, (char*)dst + 16, (int)nBytes, (int)nBytes - 16);
+			if (nCompressed <= 0)
+				return 0;
+			putUint32BE(dst, (uint32_t)((uint64_t)nBytes >> 32));
+			putUint32BE(dst + 4, (uint32_t)nBytes);
+			putUint32BE(dst + 8, (uint32_t)nBytes);
+			putUint32BE(dst + 12, (uint32_t)nCompressed);
+			return nCompressed + 16;
+		}
+#endif
+		default:
+			return 0;
+	}
+}
+
+// split the array into chunks along its slowest varying dimension, each chunk is then a contiguous
+// run of the array's data. The chunks themselves are compressed by compressNodeChunk
+static bool prepareNodeChunks(mxArray* pm, MatCodec codec, int level) {
+	size_t elementSize = getElementSizeOfClass(pm->classId);
+	hsize_t h5Dims[MAT_MAX_DIMS];
+	getH5Dims(pm, h5Dims);
+
+	// chunk along the first HDF5 dimension that isn't a singleton
+	int chunkDim = 0;
+	while (chunkDim < (int)pm->nDims - 1 && h5Dims[chunkDim] == 1)
+		chunkDim++;
+
+	size_t rowBytes = elementSize;
+	for (int i = chunkDim + 1; i < (int)pm->nDims; i++)
+		rowBytes *= h5Dims[i];
+	if (rowBytes > MAT73_MAX_CHUNK_BYTES)
+		return true;
+
+	hsize_t chunkLength = MAT73_CHUNK_BYTES / rowBytes;
+	if (chunkLength < 1)
+		chunkLength = 1;
+	if (chunkLength > h5Dims[chunkDim])
+		chunkLength = h5Dims[chunkDim];
+
+	MatChunks* pc = (MatChunks*)CALLOC(sizeof(MatChunks), 1);
+	if (pc == NULL)
+		return false;
+	pm->chunks = pc;
+
+	pc->nDims = (int)pm->nDims;
+	for (int i = 0; i < pc->nDims; i++)
+		pc->chunkDims[i] = i < chunkDim ? 1 : (i == chunkDim ? chunkLength : h5Dims[i]);
+	pc->chunkDim = chunkDim;
+	pc->chunkLength = chunkLength;
+	pc->elementSize = elementSize;
+	pc->chunkBytes = chunkLength * rowBytes;
+	pc->codec = codec;
+	pc->level = level;
+	pc->shuffle = elementSize > 1;
+	pc->nChunks = (uint32_t)((h5Dims[chunkDim] + chunkLength - 1) / chunkLength);
+
+	pc->data = (uint8_t**)CALLOC(sizeof(uint8_t*), pc->nChunks);
+	pc->nBytes = (size_t*)CALLOC(sizeof(size_t), pc->nChunks);
+	pc->filterMask = (uint32_t*)CALLOC(sizeof(uint32_t), pc->nChunks);
+	if (pc->data == NULL || pc->nBytes == NULL || pc->filterMask == NULL) {
+		freeNodeChunks(pm);
+		return false;
+	}
+	return true;
+}
+
+// shuffle and compress one chunk of an array, scratch is grown to twice the chunk size as needed
+static bool compressNodeChunk(mxArray* pm, uint32_t iChunk, uint8_t** pScratch, size_t* pScratchBytes) {
+	MatChunks* pc = pm->chunks;
+	size_t chunkBytes = pc->chunkBytes;
+	size_t nBytes = pm->nElements * pc->elementSize;
+
+	if (*pScratchBytes < 2 * chunkBytes) {
+		uint8_t* scratch = (uint8_t*)REALLOC(*pScratch, 2 * chunkBytes);
+		if (scratch == NULL)
+			return false;
+		*pScratch = scratch;
+		*pScratchBytes = 2 * chunkBytes;
+	}
+	uint8_t* raw = *pScratch;
+	uint8_t* shuffled = *pScratch + chunkBytes;
+
+	size_t offset = iChunk * chunkBytes;
+	size_t nBytesThisChunk = nBytes - offset < chunkBytes ? nBytes - offset : chunkBytes;
+
+	// edge chunks are stored at full size, pad them with zeros
+	memcpy(raw, (const uint8_t*)pm->data + offset, nBytesThisChunk);
+	memset(raw + nBytesThisChunk, 0, chunkBytes - nBytesThisChunk);
+
+	if (pc->shuffle)
+		shuffleBytes(raw, shuffled, chunkBytes, pc->elementSize);
+
+	pc->data[iChunk] = (uint8_t*)MALLOC(chunkBytes);
+	if (pc->data[iChunk] == NULL)
+		return false;
+
+	size_t nCompressed = compressChunk(pc->codec, pc->level, pc->shuffle ? shuffled : raw, chunkBytes, pc->data[iChunk]);
+	if (nCompressed > 0) {
+		pc->nBytes[iChunk] = nCompressed;
+		pc->filterMask[iChunk] = 0;
+	} else {
+		// incompressible, store as is and mark every filter as skipped
+		memcpy(pc->data[iChunk], raw, chunkBytes);
+		pc->nBytes[iChunk] = chunkBytes;
+		pc->filterMask[iChunk] = pc->shuffle ? 0x3 : 0x1;
+	}
+	return true;
+}
+
+// the chunks of one variable, queued for the compression threads as a whole
+typedef struct ChunkTask {
+	mxArray* pm;
+	uint32_t iChunk;
+} ChunkTask;
+
+typedef struct ChunkBatch {
+	ChunkTask* tasks;
+	uint32_t nTasks;
+	uint32_t capacity;
+
+	// taken by a compression thread so far, and done with
+	uint32_t nTaken;
+	uint32_t nDone;
+	bool failed;
+	pthread_cond_t doneCond;
+
+	struct ChunkBatch* next;
+} ChunkBatch;
+
+static bool addChunkTask(ChunkBatch* batch, mxArray* pm, uint32_t iChunk) {
+	if (batch->nTasks == batch->capacity) {
+		uint32_t capacity = batch->capacity == 0 ? 64 : 2 * batch->capacity;
+		ChunkTask* tasks = (ChunkTask*)REALLOC(batch->tasks, capacity * sizeof(ChunkTask));
+		if (tasks == NULL)
+			return false;
+		batch->tasks = tasks;
+		batch->capacity = capacity;
+	}
+	batch->tasks[batch->nTasks].pm = pm;
+	batch->tasks[batch->nTasks].iChunk = iChunk;
+	batch->nTasks++;
+	return true;
+}
+
+// split every array in the tree that is large enough into chunks, and add them to the batch
+static bool prepareNode(mxArray* pm, MatCodec codec, int level, ChunkBatch* batch) {
+	// shared arrays are read only, and written uncompressed
+	if (pm->shared)
+		return true;
+
+	if (pm->codec != MAT_CODEC_INHERIT) {
+		codec = pm->codec;
+		level = pm->level;
+	}
+
+	size_t nChildren = getNumberOfChildren(pm);
+	for (size_t i = 0; i < nChildren; i++) {
+		if (pm->children[i] != NULL && !prepareNode(pm->children[i], codec, level, batch))
+			return false;
+	}
+
+	if (pm->classId == mxCELL_CLASS || pm->classId == mxSTRUCT_CLASS || codec == MAT_CODEC_NONE)
+		return true;
+	if (pm->nElements * getElementSizeOfClass(pm->classId) < MAT73_MIN_CHUNKED_BYTES || pm->data == NULL)
+		return true;
+
+	freeNodeChunks(pm);
+	if (!prepareNodeChunks(pm, codec, level))
+		return false;
+	for (uint32_t i = 0; pm->chunks != NULL && i < pm->chunks->nChunks; i++) {
+		if (!addChunkTask(batch, pm, i))
+			return false;
+	}
+	return true;
+}
+
+/////// COMPRESSION THREADS ////////
+
+// batches wait here for the compression threads, which take their chunks one at a time
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolCond = PTHREAD_COND_INITIALIZER;
+static ChunkBatch* poolHead = NULL;
+static ChunkBatch* poolTail = NULL;
+static pthread_t* poolThreads = NULL;
+static unsigned nPoolThreads = 0;
+static bool poolTerminating = false;
+
+static void* compressionThread(void* dummy) {
+	uint8_t* scratch = NULL;
+	size_t scratchBytes = 0;
+
+	pthread_mutex_lock(&poolMutex);
+	while (true) {
+		// whatever is queued is still compressed when terminating
+		while (poolHead == NULL && !poolTerminating)
+			pthread_cond_wait(&poolCond, &poolMutex);
+		if (poolHead == NULL)
+			break;
+
+		ChunkBatch* batch = poolHead;
+		ChunkTask task = batch->tasks[batch->nTaken++];
+		if (batch->nTaken == batch->nTasks) {
+			poolHead = batch->next;
+			if (poolHead == NULL)
+				poolTail = NULL;
+		}
+		pthread_mutex_unlock(&poolMutex);
+
+		bool success = compressNodeChunk(task.pm, task.iChunk, &scratch, &scratchBytes);
+
+		pthread_mutex_lock(&poolMutex);
+		if (!success)
+			batch->failed = true;
+		if (++batch->nDone == batch->nTasks)
+			pthread_cond_signal(&batch->doneCond);
+	}
+	pthread_mutex_unlock(&poolMutex);
+
+	if (scratch != NULL)
+		FREE(scratch);
+	return NULL;
+}
+
+bool matStartCompressionThreads(unsigned nThreads) {
+	if (nThreads == 0 || nPoolThreads > 0)
+		return nPoolThreads > 0;
+
+	poolThreads = (pthread_t*)CALLOC(sizeof(pthread_t), nThreads);
+	if (poolThreads == NULL)
+		return false;
+
+	poolTerminating = false;
+	unsigned nStarted = 0;
+	for (; nStarted < nThreads; nStarted++) {
+		int rc = pthread_create(poolThreads + nStarted, NULL, compressionThread, NULL);
+		if (rc) {
+			logError("MAT Error: Return code from pthread_create() is %d\n", rc);
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&poolMutex);
+	nPoolThreads = nStarted;
+	pthread_mutex_unlock(&poolMutex);
+	if (nStarted == 0) {
+		FREE(poolThreads);
+		poolThreads = NULL;
+		return false;
+	}
+	return true;
+}
+
+void matStopCompressionThreads() {
+	if (poolThreads == NULL)
+		return;
+
+	pthread_mutex_lock(&poolMutex);
+	poolTerminating = true;
+	pthread_cond_broadcast(&poolCond);
+	pthread_mutex_unlock(&poolMutex);
+
+	for (unsigned i = 0; i < nPoolThreads; i++)
+		pthread_join(poolThreads[i], NULL);
+
+	pthread_mutex_lock(&poolMutex);
+	nPoolThreads = 0;
+	pthread_mutex_unlock(&poolMutex);
+	FREE(poolThreads);
+	poolThreads = NULL;
+}
+
+// compress the chunks of a batch on the compression threads and wait for them, or compress them
+// here when there are none
+static bool compressChunks(ChunkBatch* batch) {
+	if (batch->nTasks == 0)
+		return true;
+
+	pthread_mutex_lock(&poolMutex);
+	if (nPoolThreads == 0 || poolTerminating) {
+		pthread_mutex_unlock(&poolMutex);
+
+		uint8_t* scratch = NULL;
+		size_t scratchBytes = 0;
+		for (uint32_t i = 0; i < batch->nTasks && !batch->failed; i++) {
+			if (!compressNodeChunk(batch->tasks[i].pm, batch->tasks[i].iChunk, &scratch, &scratchBytes))
+				batch->failed = true;
+		}
+		if (scratch != NULL)
+			FREE(scratch);
+		return !batch->failed;
+	}
+
+	pthread_cond_init(&batch->doneCond, NULL);
+	batch->next = NULL;
+	if (poolTail != NULL)
+		poolTail->next = batch;
+	else
+		poolHead = batch;
+	poolTail = batch;
+	pthread_cond_broadcast(&poolCond);
+
+	while (batch->nDone < batch->nTasks)
+		pthread_cond_wait(&batch->doneCond, &poolMutex);
+	pthread_mutex_unlock(&poolMutex);
+
+	pthread_cond_destroy(&batch->doneCond);
+	return !batch->failed;
+}
+
+// chunk and compress every array in the tree that is large enough, without holding h5Mutex
+static bool compressNode(mxArray* pm) {
+	ChunkBatch batch;
+	memset(&batch, 0, sizeof(batch));
+
+	bool success = prepareNode(pm, MAT_CODEC_NONE, -1, &batch) && compressChunks(&batch);
+	if (batch.tasks != NULL)
+		FREE(batch.tasks);
+	return success;
+}
+
+static bool setStringAttribute(hid_t obj, const char* name, const char* value) {
+	hid_t type = H5Tcopy(H5T_C_S1);
+	H5Tset_size(type, strlen(value));
+	hid_t space = H5Screate(H5S_SCALAR);
+	hid_t attr = H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	bool success = attr >= 0 && H5Awrite(attr, type, value) >= 0;
+
+	if (attr >= 0)
+		H5Aclose(attr);
+	H5Sclose(space);
+	H5Tclose(type);
+	return success;
+}
+
+static bool setScalarAttribute(hid_t obj, const char* name, hid_t type, const void* value) {
+	hid_t space = H5Screate(H5S_SCALAR);
+	hid_t attr = H5Acreate2(obj, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	bool success = attr >= 0 && H5Awrite(attr, type, value) >= 0;
+
+	if (attr >= 0)
+		H5Aclose(attr);
+	H5Sclose(space);
+	return success;
+}
+
+// MATLAB_fields lists struct field names in order, each as a variable length array of chars
+static bool setFieldsAttribute(hid_t obj, const mxArray* pm) {
+	if (pm->nFields == 0)
+		return true;
+
+	hvl_t* names = (hvl_t*)CALLOC(sizeof(hvl_t), pm->nFields);
+	if (names == NULL)
+		return false;
+	for (int i = 0; i < pm->nFields; i++) {
+		names[i].len = strlen(pm->fieldNames[i]);
+		names[i].p = pm->fieldNames[i];
+	}
+
+	hid_t charType = H5Tcopy(H5T_C_S1);
+	H5Tset_size(charType, 1);
+	hid_t type = H5Tvlen_create(charType);
+	hsize_t nFields = pm->nFields;
+	hid_t space = H5Screate_simple(1, &nFields, NULL);
+	hid_t attr = H5Acreate2(obj, "MATLAB_fields", type, space, H5P_DEFAULT, H5P_DEFAULT);
+	bool success = attr >= 0 && H5Awrite(attr, type, names) >= 0;
+
+	if (attr >= 0)
+		H5Aclose(attr);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Tclose(charType);
+	FREE(names);
+	return success;
+}
+
+static bool setClassAttributes(hid_t obj, const mxArray* pm) {
+	bool success = setStringAttribute(obj, "MATLAB_class", mat73ClassNames[pm->classId]);
+	if (pm->classId == mxCHAR_CLASS) {
+		int32_t intDecode = 2;
+		success = success && setScalarAttribute(obj, "MATLAB_int_decode", H5T_NATIVE_INT32, &intDecode);
+	}
+	if (pm->classId == mxSTRUCT_CLASS)
+		success = success && setFieldsAttribute(obj, pm);
+	return success;
+}
+
+// empty arrays are stored as their dimensions and flagged with MATLAB_empty
+static bool writeEmptyMat73(hid_t loc, const char* name, const mxArray* pm) {
+	uint64_t dims[MAT_MAX_DIMS];
+	for (mwSize i = 0; i < pm->nDims; i++)
+		dims[i] = pm->dims[i];
+
+	hsize_t nDims = pm->nDims;
+	hid_t space = H5Screate_simple(1, &nDims, NULL);
+	hid_t dset = H5Dcreate2(loc, name, H5T_NATIVE_UINT64, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Sclose(space);
+	if (dset < 0)
+		return false;
+
+	uint8_t isEmpty = 1;
+	bool success = H5Dwrite(dset, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, dims) >= 0 &&
+		setClassAttributes(dset, pm) &&
+		setScalarAttribute(dset, "MATLAB_empty", H5T_NATIVE_UINT8, &isEmpty);
+
+	H5Dclose(dset);
+	return success;
+}
+
+static bool writeNumericMat73(hid_t loc, const char* name, mxArray* pm) {
+	hsize_t h5Dims[MAT_MAX_DIMS];
+	getH5Dims(pm, h5Dims);
+	hid_t type = getH5TypeOfClass(pm->classId);
+	MatChunks* pc = pm->chunks;
+
+	hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+	if (pc != NULL) {
+		H5Pset_chunk(dcpl, pc->nDims, pc->chunkDims);
+		if (pc->shuffle)
+			H5Pset_shuffle(dcpl);
+		if (pc->codec == MAT_CODEC_ZLIB) {
+			H5Pset_deflate(dcpl, pc->level < 0 ? 6 : pc->level);
+		} else if (pc->codec == MAT_CODEC_ZSTD) {
+			// optional so that HDF5 accepts it without the plugin present
+			unsigned level = pc->level < 0 ? 3 : pc->level;
+			H5Pset_filter(dcpl, H5Z_FILTER_ZSTD, H5Z_FLAG_OPTIONAL, 1, &level);
+		} else if (pc->codec == MAT_CODEC_LZ4) {
+			H5Pset_filter(dcpl, H5Z_FILTER_LZ4, H5Z_FLAG_OPTIONAL, 0, NULL);
+		}
+	}
+
+	hid_t space = H5Screate_simple((int)pm->nDims, h5Dims, NULL);
+	hid_t dset = H5Dcreate2(loc, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+	H5Sclose(space);
+	H5Pclose(dcpl);
+	if (dset < 0)
+		return false;
+
+	bool success = true;
+	if (pc != NULL) {
+		hsize_t offset[MAT_MAX_DIMS] = { 0 };
+		for (uint32_t iChunk = 0; iChunk < pc->nChunks && success; iChunk++) {
+			offset[pc->chunkDim] = iChunk * pc->chunkLength;
+			success = H5Dwrite_chunk(dset, H5P_DEFAULT, pc->filterMask[iChunk], offset,
+					pc->nBytes[iChunk], pc->data[iChunk]) >= 0;
+		}
+	} else {
+		const void* data = mxGetData(pm);
+		success = data != NULL && H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0;
+	}
+
+	success = success && setClassAttributes(dset, pm);
+	H5Dclose(dset);
+	freeNodeChunks(pm);
+	return success;
+}
+
+static bool writeNodeMat73(MATFile* pmf, hid_t loc, const char* name, mxArray* pm);
+
+// write pm into "#refs#" under a generated name and point *pRef at it
+static bool writeRefMat73(MATFile* pmf, mxArray* pm, hobj_ref_t* pRef) {
+	if (pmf->h5Refs < 0) {
+		pmf->h5Refs = H5Gcreate2(pmf->h5File, "#refs#", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+		if (pmf->h5Refs < 0)
+			return false;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "r%u", pmf->nRefs++);
+	if (!writeNodeMat73(pmf, pmf->h5Refs, name, pm))
+		return false;
+
+	return H5Rcreate(pRef, pmf->h5Refs, name, H5R_OBJECT, -1) >= 0;
+}
+
+// a dataset of references shaped like pm, one per element, used for cells and struct arrays
+static bool writeRefsMat73(MATFile* pmf, hid_t loc, const char* name, const mxArray* pm,
+		mxArray** elements, size_t stride, bool setClass) {
+	hobj_ref_t* refs = (hobj_ref_t*)CALLOC(sizeof(hobj_ref_t), pm->nElements);
+	if (refs == NULL)
+		return false;
+
+	bool success = true;
+	for (size_t i = 0; i < pm->nElements && success; i++)
+		success = writeRefMat73(pmf, elements[i*stride], refs + i);
+
+	hid_t dset = -1;
+	if (success) {
+		hsize_t h5Dims[MAT_MAX_DIMS];
+		getH5Dims(pm, h5Dims);
+		hid_t space = H5Screate_simple((int)pm->nDims, h5Dims, NULL);
+		dset = H5Dcreate2(loc, name, H5T_STD_REF_OBJ, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+		H5Sclose(space);
+		success = dset >= 0 && H5Dwrite(dset, H5T_STD_REF_OBJ, H5S_ALL, H5S_ALL, H5P_DEFAULT, refs) >= 0;
+	}
+	if (success && setClass)
+		success = setClassAttributes(dset, pm);
+
+	if (dset >= 0)
+		H5Dclose(dset);
+	FREE(refs);
+	return success;
+}
+
+static bool writeNodeMat73(MATFile* pmf, hid_t loc, const char* name, mxArray* pm) {
+	static const struct MatNode emptyDouble = { mxDOUBLE_CLASS, 2, { 0, 0 }, 0 };
+	if (pm == NULL)
+		return writeEmptyMat73(loc, name, &emptyDouble);
+
+	if (pm->nElements == 0)
+		return writeEmptyMat73(loc, name, pm);
+
+	if (pm->classId == mxCELL_CLASS)
+		return writeRefsMat73(pmf, loc, name, pm, pm->children, 1, true);
+
+	if (pm->classId != mxSTRUCT_CLASS)
+		return writeNumericMat73(loc, name, pm);
+
+	// structs are groups, fields of struct arrays hold one reference per element
+	hid_t group = H5Gcreate2(loc, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if (group < 0)
+		return false;
+
+	bool success = setClassAttributes(group, pm);
+	for (int f = 0; f < pm->nFields && success; f++) {
+		if (pm->nElements == 1)
+			success = writeNodeMat73(pmf, group, pm->fieldNames[f], pm->children[f]);
+		else
+			success = writeRefsMat73(pmf, group, pm->fieldNames[f], pm, pm->children + f, pm->nFields, false);
+	}
+
+	H5Gclose(group);
+	return success;
+}
+
+static MATFile* openMat73(const char* fileName) {
+	MATFile* pmf = (MATFile*)CALLOC(sizeof(MATFile), 1);
+	if (pmf == NULL)
+		return NULL;
+	pmf->isMat73 = true;
+	pmf->fd = -1;
+	pmf->h5Refs = -1;
+	pmf->fileName = strdup(fileName);
+
+	pthread_mutex_lock(&h5Mutex);
+	// errors are reported through logError instead
+	H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+	// leave room ahead of the HDF5 data for the MAT header, written on close
+	hid_t fcpl = H5Pcreate(H5P_FILE_CREATE);
+	H5Pset_userblock(fcpl, MAT73_USERBLOCK_LENGTH);
+	pmf->h5File = H5Fcreate(fileName, H5F_ACC_TRUNC, fcpl, H5P_DEFAULT);
+	H5Pclose(fcpl);
+	pthread_mutex_unlock(&h5Mutex);
+
+	if (pmf->h5File < 0 || pmf->fileName == NULL) {
+		logError("MAT Error: Could not create %s\n", fileName);
+		if (pmf->fileName != NULL)
+			FREE(pmf->fileName);
+		FREE(pmf);
+		return NULL;
+	}
+	fileIoSyncDirectoryOf(fileName);
+
+	return pmf;
+}
+
+static int putVariableMat73(MATFile* pmf, const char* name, const mxArray* pm) {
+	mxArray* pmMutable = (mxArray*)pm;
+
+	bool success = compressNode(pmMutable);
+	if (success) {
+		pthread_mutex_lock(&h5Mutex);
+		success = writeNodeMat73(pmf, pmf->h5File, name, pmMutable);
+		pthread_mutex_unlock(&h5Mutex);
+	}
+
+	if (!success) {
+		logError("MAT Error: Could not write variable %s\n", name);
+		pmf->failed = true;
+	}
+	return success ? 0 : 1;
+}
+
+static int closeMat73(MATFile* pmf) {
+	bool failed = pmf->failed;
+
+	pthread_mutex_lock(&h5Mutex);
+	if (pmf->h5Refs >= 0)
+		H5Gclose(pmf->h5Refs);
+	if (H5Fclose(pmf->h5File) < 0)
+		failed = true;
+	pthread_mutex_unlock(&h5Mutex);
+
+	// the MAT header goes into the user block
+	uint8_t header[MAT_HEADER_LENGTH];
+	composeHeader(header, "MATLAB 7.3 MAT-file", " HDF5 schema 1.00 .", 0x0200);
+	int fd = open(pmf->fileName, O_WRONLY);
+	if (fd < 0 || !fileIoWriteAll(fd, header, MAT_HEADER_LENGTH, 0))
+		failed = true;
+	if (fd >= 0)
+		fileIoSync(fd);
+	if (fd >= 0 && close(fd) != 0)
+		failed = true;
+
+	FREE(pmf->fileName);
+	FREE(pmf);
+	return failed ? EOF : 0;
+}
+
+#else
+
+// nothing is compressed without HDF5
+bool matStartCompressionThreads(unsigned nThreads) {
+	return false;
+}
+
+void matStopCompressionThreads() {
+}
+
+#endif // ifdef USE_HDF5
+
+/////// FILES ////////
+
+// descriptive text, subsystem data offset, version and endian indicator
+static void composeHeader(uint8_t* header, const char* description, const char* suffix, uint16_t version) {
+	char text[117];
+	char timeString[32];
+	time_t now = time(NULL);
+	struct tm timeInfo;
+	localtime_r(&now, &timeInfo);
+	strftime(timeString, sizeof(timeString), "%a %b %d %H:%M:%S %Y", &timeInfo);
+	snprintf_nowarn(text, sizeof(text), "%s, Platform: trialLogger, Created on: %s%s", description, timeString, suffix);
+
+	memset(header, ' ', 116);
+	memcpy(header, text, strlen(text));
+	memset(header + 116, 0, 8);
+	memcpy(header + 124, &version, 2);
+	header[126] = 'I';
+	header[127] = 'M';
+}
+
+// the end of the last complete data element of fd, which ends at fileEnd
+static off_t findEndOfElements(int fd, off_t fileEnd) {
+	off_t offset = MAT_HEADER_LENGTH;
+	uint8_t tag[8];
+	while (pread(fd, tag, sizeof(tag), offset) == sizeof(tag)) {
+		uint32_t nBytes;
+		memcpy(&nBytes, tag + 4, 4);
+		if (offset + 8 + (off_t)nBytes > fileEnd)
+			break;
+		offset += 8 + padTo8(nBytes);
+	}
+	return offset < fileEnd ? offset : fileEnd;
+}
+
+// an existing v5 file, variables put into it are appended after the last complete one. Whatever
+// a crash left of another is cut off, so that load() doesn't stop there
+static MATFile* openForUpdate(const char* fileName) {
+	MATFile* pmf = (MATFile*)CALLOC(sizeof(MATFile), 1);
+	if (pmf == NULL)
+		return NULL;
+
+	uint8_t header[MAT_HEADER_LENGTH];
+	pmf->fd = open(fileName, O_RDWR);
+	if (pmf->fd >= 0 && pread(pmf->fd, header, MAT_HEADER_LENGTH, 0) == MAT_HEADER_LENGTH &&
+			header[126] == 'I' && header[127] == 'M' && header[124] == 0x00 && header[125] == 0x01) {
+		off_t fileEnd = lseek(pmf->fd, 0, SEEK_END);
+		pmf->offset = findEndOfElements(pmf->fd, fileEnd);
+		if (pmf->offset < fileEnd) {
+			logError("MAT Error: Dropping the %lld bytes of an incomplete variable at the end of %s\n",
+					(long long)(fileEnd - pmf->offset), fileName);
+			if (ftruncate(pmf->fd, pmf->offset) != 0)
+				logError("MAT Error: Could not truncate %s (%s)\n", fileName, strerror(errno));
+		}
+		if (pmf->offset >= MAT_HEADER_LENGTH)
+			return pmf;
+	} else if (pmf->fd >= 0) {
+		logError("MAT Error: %s is not a v5 MAT file\n", fileName);
+	}
+
+	if (pmf->fd >= 0)
+		close(pmf->fd);
+	FREE(pmf);
+	return NULL;
+}
+
+MATFile* matOpen(const char* fileName, const char* mode) {
+#ifdef USE_HDF5
+	if (strcmp(mode, "w7.3") == 0)
+		return openMat73(fileName);
+#endif
+	if (strcmp(mode, "u") == 0)
+		return openForUpdate(fileName);
+	if (strcmp(mode, "w") != 0) {
+		logError("MAT Error: Mode \"%s\" is not supported\n", mode);
+		return NULL;
+	}
+
+	MATFile* pmf = (MATFile*)CALLOC(sizeof(MATFile), 1);
+	if (pmf == NULL)
+		return NULL;
+
+	pmf->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (pmf->fd < 0) {
+		FREE(pmf);
+		return NULL;
+	}
+	fileIoSyncDirectoryOf(fileName);
+
+	uint8_t header[MAT_HEADER_LENGTH];
+	composeHeader(header, "MATLAB 5.0 MAT-file", "", 0x0100);
+	pushIov(pmf, header, MAT_HEADER_LENGTH);
+	flushIov(pmf);
+
+	if (pmf->failed) {
+		close(pmf->fd);
+		FREE(pmf);
+		return NULL;
+	}
+
+	return pmf;
+}
+
+MATFile* matOpenRecord(int fd, off_t offset) {
+	MATFile* pmf = (MATFile*)CALLOC(sizeof(MATFile), 1);
+	if (pmf == NULL)
+		return NULL;
+
+	pmf->fd = fd;
+	pmf->isRecord = true;
+	pmf->offset = offset;
+	return pmf;
+}
+
+char** matGetDir(MATFile* pmf, int* num) {
+	*num = -1;
+	if (pmf == NULL || pmf->isRecord)
+		return NULL;
+#ifdef USE_HDF5
+	if (pmf->isMat73)
+		return NULL;
+#endif
+
+	// the names go after the pointers to them, in the same block
+	size_t nNames = 0, namesAllocated = 16, dirBytes = 0;
+	char (*names)[64] = (char(*)[64])CALLOC(sizeof(*names), namesAllocated);
+	if (names == NULL)
+		return NULL;
+
+	// walk the data elements up to the end of the last complete one, openForUpdate has cut off
+	// whatever a crash left of another
+	off_t offset = MAT_HEADER_LENGTH;
+	uint8_t element[8 + 16 + 8 + 4*MAT_MAX_DIMS + 8 + 64];
+	while (true) {
+		ssize_t nRead = pread(pmf->fd, element, sizeof(element), offset);
+		uint32_t type, nBytes;
+		if (nRead < 8)
+			break;
+		memcpy(&type, element, 4);
+		memcpy(&nBytes, element + 4, 4);
+		if (offset + 8 + (off_t)nBytes > pmf->offset)
+			break;
+
+		// array flags, dims, then the name as a normal or as a small data element
+		char name[64] = "";
+		uint32_t dimsBytes, nameType, nameBytes;
+		if (type == miMATRIX && nRead >= 8 + 16 + 8) {
+			memcpy(&dimsBytes, element + 8 + 16 + 4, 4);
+			size_t at = 8 + 16 + 8 + padTo8(dimsBytes);
+			if (dimsBytes <= 4*MAT_MAX_DIMS && (ssize_t)at + 8 <= nRead) {
+				memcpy(&nameType, element + at, 4);
+				if (nameType >> 16 != 0) {
+					nameBytes = nameType >> 16;
+					at += 4;
+				} else {
+					memcpy(&nameBytes, element + at + 4, 4);
+					at += 8;
+				}
+				if (nameBytes < sizeof(name) && (ssize_t)(at + nameBytes) <= nRead) {
+					memcpy(name, element + at, nameBytes);
+					name[nameBytes] = '\0';
+				}
+			}
+		}
+
+		if (name[0] != '\0') {
+			if (nNames == namesAllocated) {
+				char (*grown)[64] = (char(*)[64])REALLOC(names, sizeof(*names) * namesAllocated * 2);
+				if (grown == NULL) {
+					FREE(names);
+					return NULL;
+				}
+				names = grown;
+				namesAllocated *= 2;
+			}
+			strcpy(names[nNames++], name);
+			dirBytes += strlen(name) + 1;
+		}
+		offset += 8 + padTo8(nBytes);
+	}
+	pmf->offset = offset;
+
+	char** dir = (char**)MALLOC(nNames * sizeof(char*) + dirBytes + 1);
+	if (dir != NULL) {
+		char* p = (char*)(dir + nNames);
+		for (size_t i = 0; i < nNames; i++) {
+			dir[i] = p;
+			strcpy(p, names[i]);
+			p += strlen(p) + 1;
+		}
+		*num = (int)nNames;
+	}
+	FREE(names);
+	return dir;
+}
+
+void mxFree(void* ptr) {
+	if (ptr != NULL)
+		FREE(ptr);
+}
+
+size_t matGetVariableSize(const char* name, const mxArray* pm) {
+	size_t contentSize = getNodeContentSize(pm, strlen(name));
+	return contentSize > UINT32_MAX ? 0 : 8 + contentSize;
+}
+
+int matPutVariable(MATFile* pmf, const char* name, const mxArray* pm) {
+	if (pmf == NULL || pm == NULL || pmf->failed)
+		return 1;
+
+#ifdef USE_HDF5
+	if (pmf->isMat73)
+		return putVariableMat73(pmf, name, pm);
+#endif
+
+	if (getNodeContentSize(pm, strlen(name)) > UINT32_MAX) {
+		logError("MAT Error: Variable %s exceeds the MAT v5 size limit\n", name);
+		return 1;
+	}
+
+	bool success = pushNode(pmf, (mxArray*)pm, name);
+	flushIov(pmf);
+
+	return success && !pmf->failed ? 0 : 1;
+}
+
+int matClose(MATFile* pmf) {
+	if (pmf == NULL)
+		return EOF;
+
+#ifdef USE_HDF5
+	if (pmf->isMat73)
+		return closeMat73(pmf);
+#endif
+
+	// records are synced by the container once their header is written
+	bool failed = pmf->failed;
+	if (!pmf->isRecord) {
+		fileIoSync(pmf->fd);
+		if (close(pmf->fd) != 0)
+			failed = true;
+	}
+	FREE(pmf);
+
+	return failed ? EOF : 0;
+}
+
+#endif // ifndef MATLAB_MEX_FILE
@@ -0,0 +1,133 @@
+#ifndef MATFILE_H_INCLUDED
+#define MATFILE_H_INCLUDED
+
+// MEX builds use the MATLAB mat/mx libraries. The standalone trialLogger instead uses the
+// native MAT-file v5 writer in matfile.c, which implements the subset of the mx API used by
+// writer.c on top of a tree of MatNodes. Numeric data may be borrowed from the signal
+// buffers rather than copied, and each variable is streamed to disk with vectored writes,
+// so no MATLAB installation is needed to build or run the logger.
+
+#ifdef MATLAB_MEX_FILE
+
+#include "mat.h"
+
+#else
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef bool mxLogical;
+
+// values match MATLAB's mxClassID
+typedef enum {
+	mxUNKNOWN_CLASS = 0,
+	mxCELL_CLASS,
+	mxSTRUCT_CLASS,
+	mxLOGICAL_CLASS,
+	mxCHAR_CLASS,
+	mxVOID_CLASS,
+	mxDOUBLE_CLASS,
+	mxSINGLE_CLASS,
+	mxINT8_CLASS,
+	mxUINT8_CLASS,
+	mxINT16_CLASS,
+	mxUINT16_CLASS,
+	mxINT32_CLASS,
+	mxUINT32_CLASS,
+	mxINT64_CLASS,
+	mxUINT64_CLASS,
+	mxFUNCTION_CLASS
+} mxClassID;
+
+typedef enum { mxREAL, mxCOMPLEX } mxComplexity;
+
+typedef struct MatNode mxArray;
+typedef struct MatFile MATFile;
+
+// the most dimensions a numeric array may have
+#define MAT_MAX_DIMS 32
+
+// -- arrays
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classId, mxComplexity flag);
+mxArray* mxCreateNumericArray(mwSize nDims, const mwSize* dims, mxClassID classId, mxComplexity flag);
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag);
+mxArray* mxCreateLogicalArray(mwSize nDims, const mwSize* dims);
+mxArray* mxCreateLogicalScalar(mxLogical value);
+mxArray* mxCreateCharArray(mwSize nDims, const mwSize* dims);
+mxArray* mxCreateString(const char* str);
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n);
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nFields, const char** fieldNames);
+void mxDestroyArray(mxArray*);
+
+// data is allocated on first access, char arrays hold 2 bytes per character as in MATLAB
+void* mxGetData(const mxArray*);
+double* mxGetPr(const mxArray*);
+double* mxGetDoubles(const mxArray*);
+// shrink the number of rows
+void mxSetM(mxArray*, mwSize m);
+
+// -- cells and structs, values set are owned by the parent from then on
+void mxSetCell(mxArray*, mwIndex index, mxArray* value);
+int mxAddField(mxArray*, const char* fieldName);
+int mxGetFieldNumber(const mxArray*, const char* fieldName);
+mxArray* mxGetField(const mxArray*, mwIndex index, const char* fieldName);
+void mxSetField(mxArray*, mwIndex index, const char* fieldName, mxArray* value);
+void mxSetFieldByNumber(mxArray*, mwIndex index, int fieldNumber, mxArray* value);
+int mxGetNumberOfFields(const mxArray*);
+const char* mxGetFieldNameByNumber(const mxArray*, int fieldNumber);
+mxArray* mxGetFieldByNumber(const mxArray*, mwIndex index, int fieldNumber);
+
+// -- extensions
+// point a numeric or logical array at data owned elsewhere instead of copying it in,
+// data must stay unchanged until the array has been written out and destroyed
+void matSetBorrowedData(mxArray*, const void* data);
+
+// share an array that goes into many variables unchanged, e.g. meta data that only changes with
+// the schema. pm is encoded once and read only from then on: it may be put into any number of
+// structs and cells, written by any number of threads at once, and is freed with the last
+// reference. pm starts with one reference, false if it couldn't be encoded and is left as it was
+bool matShareArray(mxArray* pm);
+// another reference to a shared array, NULL if it isn't one
+mxArray* matRetainSharedArray(mxArray* pm);
+
+// compression of arrays in MAT 7.3 files, v5 files are never compressed
+typedef enum {
+	MAT_CODEC_INHERIT = -1, // whatever the enclosing cell or struct uses
+	MAT_CODEC_NONE = 0,
+	MAT_CODEC_ZLIB,
+	MAT_CODEC_ZSTD,         // needs the HDF5 zstd filter plugin (32015) to read
+	MAT_CODEC_LZ4           // needs the HDF5 lz4 filter plugin (32004) to read
+} MatCodec;
+
+// level < 0 picks the codec's default, lz4 ignores the level
+void matSetCompression(mxArray*, MatCodec codec, int level);
+bool matGetCodecByName(const char* name, MatCodec* pCodec);
+// whether this build can write the codec
+bool matIsCodecAvailable(MatCodec codec);
+// compress the chunks of MAT 7.3 variables on nThreads threads of their own, matPutVariable then
+// only queues them and waits. Until they are started, and once stopped, the caller compresses
+bool matStartCompressionThreads(unsigned nThreads);
+void matStopCompressionThreads();
+
+// -- files, modes "w" (v5) and, when built with USE_HDF5, "w7.3" (HDF5) are supported, as is
+// "u" to append variables to an existing v5 file. Unlike MATLAB's, "u" doesn't replace a variable
+// put again under the same name, so check matGetDir first
+MATFile* matOpen(const char* fileName, const char* mode);
+int matPutVariable(MATFile*, const char* name, const mxArray*);
+int matClose(MATFile*);
+// names of the variables in a v5 file opened with "u", one block to be freed with mxFree
+char** matGetDir(MATFile*, int* num);
+void mxFree(void*);
+
+// -- records, variables are written as bare v5 data elements starting at offset in fd,
+// without a file header, fd is left open by matClose. Used by the trial container.
+MATFile* matOpenRecord(int fd, off_t offset);
+// bytes matPutVariable will write for this variable, 0 if it exceeds the v5 size limit
+size_t matGetVariableSize(const char* name, const mxArray* pm);
+
+#endif // ifdef MATLAB_MEX_FILE
+
+#endif // ifndef MATFILE_H_INCLUDED
@@ -0,0 +1,577 @@
+// Staging tier migration, see migrator.h
+//
+// One thread works through the trials in the order they were logged. Files are copied with plain
+// pread/pwrite rather than through fileio.h, so that the latency histograms only describe the
+// trials' own writes, and each copy is fsync'd on its own since the staged file is deleted right
+// after. The copy is dropped from the page cache before it is read back, so the checksum is
+// compared against what the data root stored, where the kernel lets us.
+//
+// A trial that can't be migrated goes to the back of the queue and is tried again later, and the
+// trials left on the staging tier by an earlier run are queued again on start, found by walking
+// the staging root.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>         // offsetof
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ftw.h>            // nftw
+#include <sys/stat.h>
+#include <sys/resource.h>   // setpriority
+
+#ifdef LINUX
+#include <sys/syscall.h>
+#endif
+
+#include "errors.h"
+#include "utils.h"
+#include "trialIndex.h"
+#include "fileio.h"
+#include "migrator.h"
+
+// files are copied and checked in chunks of this size
+#define MIGRATOR_CHUNK_BYTES (1 << 20)
+// a trial whose copy fails or doesn't match is tried this often in a row, then again after
+// MIGRATOR_RETRY_INTERVAL_SEC. Once stopping, it is left staged for the next run
+#define MIGRATOR_ATTEMPTS 3
+#define MIGRATOR_RETRY_INTERVAL_SEC 60.0
+// the backlog is logged at most this often
+#define MIGRATOR_REPORT_INTERVAL_SEC 10.0
+// copies are written next to their final name with this appended, then renamed
+#define MIGRATOR_TEMP_SUFFIX ".migrating"
+
+// FNV-1a, 64 bit
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME 0x100000001b3ULL
+
+typedef struct MigrationJob {
+	char stagedName[MAX_FILENAME_LENGTH];
+	char archiveName[MAX_FILENAME_LENGTH];
+	char linkName[MAX_FILENAME_LENGTH];
+	char binaryIndexFileName[MAX_FILENAME_LENGTH];
+	off_t indexRecordOffset;
+	uint64_t nBytes;
+	double retryAt;         // getMonotonicTime after which a failed job is tried again, 0 if it hasn't failed
+} MigrationJob;
+
+typedef struct MigrationStats {
+	unsigned nMigrated;
+	unsigned nRetried;
+	unsigned nFailed;
+	uint64_t bytesMigrated;
+	double totalSec;
+	unsigned maxBacklog;
+	uint64_t maxBacklogBytes;
+} MigrationStats;
+
+static double rateLimit = 0;
+
+// the queue, oldest first. A job stays on it until it's done, so it counts in the backlog
+static pthread_mutex_t migratorMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t migratorCond;   // on CLOCK_MONOTONIC, see migratorStart
+static MigrationJob* jobs = NULL;
+static unsigned nJobs = 0;
+static unsigned nJobsAllocated = 0;
+static uint64_t backlogBytes = 0;
+static MigrationStats stats;
+static bool migratorRunning = false;
+static volatile bool migratorTerminating = false;
+static pthread_t migratorThread;
+
+// the binary index last updated, consecutive trials are mostly in the same one
+static char indexFileName[MAX_FILENAME_LENGTH] = "";
+static int indexFd = -1;
+
+void migratorSetRateLimit(double bytesPerSec) {
+	rateLimit = bytesPerSec;
+}
+
+static uint64_t addToChecksum(uint64_t checksum, const uint8_t* data, size_t nBytes) {
+	for (size_t i = 0; i < nBytes; i++) {
+		checksum ^= data[i];
+		checksum *= CHECKSUM_PRIME;
+	}
+	return checksum;
+}
+
+// sleep until nBytes could have been copied since tStart, unless stopping
+static void throttle(double tStart, uint64_t nBytes) {
+	double limit = rateLimit;
+	if (limit <= 0 || migratorTerminating)
+		return;
+
+	double ahead = nBytes / limit - (getMonotonicTime() - tStart);
+	if (ahead > 0) {
+		struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+		nanosleep(&ts, NULL);
+	}
+}
+
+static bool pwriteAll(int fd, const uint8_t* buffer, size_t nBytes, off_t offset) {
+	while (nBytes > 0) {
+		ssize_t n = pwrite(fd, buffer, nBytes, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buffer += n;
+		nBytes -= n;
+		offset += n;
+	}
+	return true;
+}
+
+// checksum of the first nBytes of fd, false if it's shorter
+static bool checksumFile(int fd, uint64_t nBytes, uint8_t* buffer, uint64_t* pChecksum) {
+	uint64_t checksum = CHECKSUM_SEED;
+	uint64_t offset = 0;
+	while (offset < nBytes) {
+		size_t nChunk = nBytes - offset < MIGRATOR_CHUNK_BYTES ? (size_t)(nBytes - offset) : MIGRATOR_CHUNK_BYTES;
+		ssize_t n = pread(fd, buffer, nChunk, (off_t)offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		checksum = addToChecksum(checksum, buffer, n);
+		offset += n;
+	}
+	*pChecksum = checksum;
+	return true;
+}
+
+// copy the staged file to tempName and make it durable, returning the checksum of what was read
+static bool copyToTemp(const MigrationJob* pJob, const char* tempName, uint8_t* buffer,
+		uint64_t* pChecksum, uint64_t* pBytes) {
+	int in = open(pJob->stagedName, O_RDONLY);
+	struct stat st;
+	if (in < 0 || fstat(in, &st) != 0) {
+		logError("Migrator Error: Could not open %s (%s)\n", pJob->stagedName, strerror(errno));
+		if (in >= 0)
+			close(in);
+		return false;
+	}
+
+	int out = open(tempName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0) {
+		logError("Migrator Error: Could not create %s (%s)\n", tempName, strerror(errno));
+		close(in);
+		return false;
+	}
+
+	uint64_t checksum = CHECKSUM_SEED;
+	uint64_t nBytes = (uint64_t)st.st_size;
+	uint64_t offset = 0;
+	double tStart = getMonotonicTime();
+	bool success = true;
+	while (success && offset < nBytes) {
+		size_t nChunk = nBytes - offset < MIGRATOR_CHUNK_BYTES ? (size_t)(nBytes - offset) : MIGRATOR_CHUNK_BYTES;
+		ssize_t n = pread(in, buffer, nChunk, (off_t)offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0 || !pwriteAll(out, buffer, n, (off_t)offset)) {
+			logError("Migrator Error: Could not copy %s to %s (%s)\n", pJob->stagedName, tempName,
+					n == 0 ? "file shrank" : strerror(errno));
+			success = false;
+			break;
+		}
+		checksum = addToChecksum(checksum, buffer, n);
+		offset += n;
+		throttle(tStart, offset);
+	}
+	close(in);
+
+	if (success && fsync(out) != 0) {
+		logError("Migrator Error: Could not fsync %s (%s)\n", tempName, strerror(errno));
+		success = false;
+	}
+#ifdef LINUX
+	// read it back from the data root rather than from memory
+	if (success)
+		posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	if (close(out) != 0)
+		success = false;
+
+	*pChecksum = checksum;
+	*pBytes = nBytes;
+	return success;
+}
+
+// make a rename in the folder holding fileName durable
+static void syncDirectoryOf(const char* fileName) {
+	char dir[MAX_FILENAME_LENGTH];
+	strncpy(dir, fileName, MAX_FILENAME_LENGTH - 1);
+	dir[MAX_FILENAME_LENGTH - 1] = '\0';
+	char* last = strrchr(dir, '/');
+	if (last == NULL)
+		return;
+	*last = '\0';
+
+	int fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return;
+	fsync(fd);
+	close(fd);
+}
+
+// point linkName at target, replacing whatever it is in one step
+static bool replaceLink(const char* linkName, const char* target) {
+	char tempName[MAX_FILENAME_LENGTH + sizeof(MIGRATOR_TEMP_SUFFIX)];
+	snprintf(tempName, sizeof(tempName), "%s%s", linkName, MIGRATOR_TEMP_SUFFIX);
+	unlink(tempName);
+	if (symlink(target, tempName) != 0 || rename(tempName, linkName) != 0) {
+		logError("Migrator Error: Could not link %s to %s (%s)\n", linkName, target, strerror(errno));
+		unlink(tempName);
+		return false;
+	}
+	return true;
+}
+
+// the trial is on its data root now, a single aligned write so that readers of the index see
+// the record either before or after it
+static void clearStagedFlag(const MigrationJob* pJob) {
+	if (pJob->indexRecordOffset < 0)
+		return;
+
+	if (strncmp(indexFileName, pJob->binaryIndexFileName, MAX_FILENAME_LENGTH) != 0) {
+		if (indexFd >= 0)
+			close(indexFd);
+		snprintf(indexFileName, MAX_FILENAME_LENGTH, "%s", pJob->binaryIndexFileName);
+		indexFd = open(indexFileName, O_RDWR);
+	}
+
+	off_t offset = pJob->indexRecordOffset + offsetof(TrialIndexRecord, flags);
+	uint32_t flags;
+	if (indexFd < 0 || pread(indexFd, &flags, sizeof(flags), offset) != sizeof(flags)) {
+		logError("Migrator Error: Could not read the record of %s in %s\n", pJob->archiveName, indexFileName);
+		return;
+	}
+
+	flags &= ~TRIAL_INDEX_FLAG_STAGED;
+	if (pwrite(indexFd, &flags, sizeof(flags), offset) != sizeof(flags))
+		logError("Migrator Error: Could not update the record of %s in %s\n", pJob->archiveName, indexFileName);
+	else
+		fileIoSync(indexFd);
+}
+
+static bool migrateFile(const MigrationJob* pJob, uint8_t* buffer, uint64_t* pBytes) {
+	char tempName[MAX_FILENAME_LENGTH + sizeof(MIGRATOR_TEMP_SUFFIX)];
+	snprintf(tempName, sizeof(tempName), "%s%s", pJob->archiveName, MIGRATOR_TEMP_SUFFIX);
+
+	uint64_t checksum, checksumCopy, nBytes;
+	if (!copyToTemp(pJob, tempName, buffer, &checksum, &nBytes)) {
+		unlink(tempName);
+		return false;
+	}
+
+	int fd = open(tempName, O_RDONLY);
+	bool verified = fd >= 0 && checksumFile(fd, nBytes, buffer, &checksumCopy) && checksumCopy == checksum;
+	struct stat st;
+	verified = verified && fstat(fd, &st) == 0 && (uint64_t)st.st_size == nBytes;
+	if (fd >= 0)
+		close(fd);
+	if (!verified) {
+		logError("Migrator Error: Copy of %s in %s doesn't match\n", pJob->stagedName, tempName);
+		unlink(tempName);
+		return false;
+	}
+
+	// readers go from the link to the staged file straight to the copy
+	if (rename(tempName, pJob->archiveName) != 0) {
+		logError("Migrator Error: Could not rename %s to %s (%s)\n", tempName, pJob->archiveName, strerror(errno));
+		unlink(tempName);
+		return false;
+	}
+	syncDirectoryOf(pJob->archiveName);
+
+	if (strncmp(pJob->linkName, pJob->archiveName, MAX_FILENAME_LENGTH) != 0 &&
+			replaceLink(pJob->linkName, pJob->archiveName))
+		syncDirectoryOf(pJob->linkName);
+
+	clearStagedFlag(pJob);
+
+	if (unlink(pJob->stagedName) != 0)
+		logError("Migrator Error: Could not delete %s (%s)\n", pJob->stagedName, strerror(errno));
+
+	*pBytes = nBytes;
+	return true;
+}
+
+// below the writers, both for the CPU and, on Linux, for the disks
+static void lowerPriority() {
+#ifdef LINUX
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if (setpriority(PRIO_PROCESS, tid, 19) != 0)
+		logInfo("Migrator: Could not lower the thread priority (%s)\n", strerror(errno));
+	// best effort class at its lowest level: IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7) for IOPRIO_WHO_PROCESS
+	if (syscall(SYS_ioprio_set, 1, tid, (2 << 13) | 7) != 0)
+		logInfo("Migrator: Could not lower the I/O priority (%s)\n", strerror(errno));
+#endif
+}
+
+// the oldest job that is due, all are once stopping, or -1 with when the next one is in *pRetryAt
+static int findDueJob(double* pRetryAt) {
+	double now = getMonotonicTime();
+	*pRetryAt = 0;
+	for (unsigned i = 0; i < nJobs; i++) {
+		if (migratorTerminating || jobs[i].retryAt <= now)
+			return (int)i;
+		if (*pRetryAt == 0 || jobs[i].retryAt < *pRetryAt)
+			*pRetryAt = jobs[i].retryAt;
+	}
+	return -1;
+}
+
+static void* migratorThreadMain(void* dummy) {
+	lowerPriority();
+
+	uint8_t* buffer = (uint8_t*)MALLOC(MIGRATOR_CHUNK_BYTES);
+	if (buffer == NULL)
+		diep("Migrator: No memory for copy buffer");
+
+	double lastReport = 0;
+	pthread_mutex_lock(&migratorMutex);
+	while (true) {
+		double retryAt;
+		int iJob = findDueJob(&retryAt);
+		if (iJob < 0 && nJobs == 0 && migratorTerminating)
+			break;
+		if (iJob < 0 && nJobs == 0) {
+			pthread_cond_wait(&migratorCond, &migratorMutex);
+			continue;
+		}
+		if (iJob < 0) {
+			struct timespec deadline = { (time_t)retryAt, (long)((retryAt - (time_t)retryAt) * 1e9) };
+			pthread_cond_timedwait(&migratorCond, &migratorMutex, &deadline);
+			continue;
+		}
+
+		MigrationJob job = jobs[iJob];
+		unsigned backlog = nJobs;
+		uint64_t backlogBytesNow = backlogBytes;
+		pthread_mutex_unlock(&migratorMutex);
+
+		// one trial in flight isn't a backlog
+		double tStart = getMonotonicTime();
+		if (backlog > 1 && tStart - lastReport >= MIGRATOR_REPORT_INTERVAL_SEC) {
+			logInfo("Migrator: %u trials (%.1f MB) waiting to be migrated\n", backlog, backlogBytesNow / 1e6);
+			lastReport = tStart;
+		}
+
+		uint64_t nBytes = 0;
+		unsigned attempt = 0;
+		bool migrated = false;
+		while (!migrated && attempt++ < MIGRATOR_ATTEMPTS)
+			migrated = migrateFile(&job, buffer, &nBytes);
+
+		pthread_mutex_lock(&migratorMutex);
+		nJobs--;
+		memmove(jobs + iJob, jobs + iJob + 1, sizeof(MigrationJob) * (nJobs - iJob));
+		stats.nRetried += attempt - 1;
+		if (migrated) {
+			backlogBytes -= job.nBytes;
+			stats.nMigrated++;
+			stats.bytesMigrated += nBytes;
+			stats.totalSec += getMonotonicTime() - tStart;
+		} else if (migratorTerminating) {
+			logError("Migrator Error: Leaving %s staged after %d attempts\n", job.stagedName, MIGRATOR_ATTEMPTS);
+			backlogBytes -= job.nBytes;
+			stats.nFailed++;
+		} else {
+			// behind the trials that are waiting, the queue has room for it still
+			logError("Migrator Error: Could not migrate %s in %d attempts, retrying in %.0f s\n", job.stagedName,
+					MIGRATOR_ATTEMPTS, MIGRATOR_RETRY_INTERVAL_SEC);
+			job.retryAt = getMonotonicTime() + MIGRATOR_RETRY_INTERVAL_SEC;
+			jobs[nJobs++] = job;
+		}
+	}
+	pthread_mutex_unlock(&migratorMutex);
+
+	if (indexFd >= 0)
+		close(indexFd);
+	indexFd = -1;
+	indexFileName[0] = '\0';
+	FREE(buffer);
+	return NULL;
+}
+
+void migratorStart() {
+	// retries are timed by getMonotonicTime
+	pthread_condattr_t condAttr;
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&migratorCond, &condAttr);
+	pthread_condattr_destroy(&condAttr);
+
+	migratorTerminating = false;
+	int rc = pthread_create(&migratorThread, NULL, migratorThreadMain, NULL);
+	if (rc) {
+		logError("Migrator Error: Return code from pthread_create() is %d\n", rc);
+		exit(-1);
+	}
+	migratorRunning = true;
+
+	if (rateLimit > 0)
+		logInfo("Migrator: Migrating staged trials at up to %.3g MB/s\n", rateLimit / 1e6);
+	else
+		logInfo("Migrator: Migrating staged trials\n");
+}
+
+void migratorStop() {
+	if (!migratorRunning)
+		return;
+
+	pthread_mutex_lock(&migratorMutex);
+	if (nJobs > 0)
+		logInfo("Migrator: Migrating the remaining %u trials (%.1f MB)\n", nJobs, backlogBytes / 1e6);
+	migratorTerminating = true;
+	pthread_cond_signal(&migratorCond);
+	pthread_mutex_unlock(&migratorMutex);
+
+	pthread_join(migratorThread, NULL);
+	migratorRunning = false;
+
+	FREE(jobs);
+	jobs = NULL;
+	nJobsAllocated = 0;
+	pthread_cond_destroy(&migratorCond);
+}
+
+void migratorEnqueue(const char* stagedName, const char* archiveName, const char* linkName,
+		const char* binaryIndexFileName, off_t indexRecordOffset) {
+	struct stat st;
+	uint64_t nBytes = stat(stagedName, &st) == 0 ? (uint64_t)st.st_size : 0;
+
+	pthread_mutex_lock(&migratorMutex);
+
+	if (!migratorRunning || migratorTerminating) {
+		pthread_mutex_unlock(&migratorMutex);
+		logError("Migrator Error: Not running, leaving %s staged\n", stagedName);
+		return;
+	}
+
+	if (nJobs == nJobsAllocated) {
+		unsigned nToAllocate = nJobsAllocated > 0 ? nJobsAllocated*2 : 64;
+		MigrationJob* newJobs = (MigrationJob*)REALLOC(jobs, sizeof(MigrationJob) * nToAllocate);
+		if (newJobs == NULL)
+			diep("Migrator: No memory for migration queue");
+		jobs = newJobs;
+		nJobsAllocated = nToAllocate;
+	}
+
+	MigrationJob* pJob = jobs + nJobs++;
+	snprintf(pJob->stagedName, MAX_FILENAME_LENGTH, "%s", stagedName);
+	snprintf(pJob->archiveName, MAX_FILENAME_LENGTH, "%s", archiveName);
+	snprintf(pJob->linkName, MAX_FILENAME_LENGTH, "%s", linkName);
+	snprintf(pJob->binaryIndexFileName, MAX_FILENAME_LENGTH, "%s", binaryIndexFileName);
+	pJob->indexRecordOffset = indexRecordOffset;
+	pJob->nBytes = nBytes;
+	pJob->retryAt = 0;
+
+	backlogBytes += nBytes;
+	if (nJobs > stats.maxBacklog)
+		stats.maxBacklog = nJobs;
+	if (backlogBytes > stats.maxBacklogBytes)
+		stats.maxBacklogBytes = backlogBytes;
+
+	pthread_cond_signal(&migratorCond);
+	pthread_mutex_unlock(&migratorMutex);
+}
+
+// the walk of the staging root in migratorEnqueueLeftovers
+static const char* leftoverStagingRoot;
+static const char* const* leftoverDataRoots;
+static unsigned nLeftoverDataRoots;
+static unsigned nLeftovers;
+
+// offset of the last record listing fileName in binaryIndexFileName, copied to *pRecord, or -1
+static off_t findIndexRecord(const char* binaryIndexFileName, const char* fileName, TrialIndexRecord* pRecord) {
+	int fd = open(binaryIndexFileName, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	off_t found = -1;
+	TrialIndexHeader header;
+	TrialIndexRecord record;
+	if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+			memcmp(header.magic, TRIAL_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+			header.recordBytes == sizeof(TrialIndexRecord)) {
+		for (off_t offset = sizeof(header); pread(fd, &record, sizeof(record), offset) == sizeof(record);
+				offset += sizeof(record)) {
+			if (strncmp(record.fileName, fileName, TRIAL_INDEX_FILE_NAME_LENGTH) == 0) {
+				*pRecord = record;
+				found = offset;
+			}
+		}
+	}
+	close(fd);
+	return found;
+}
+
+// a trial staged at stagingRoot/store/subject/date/protocol/saveTag#/file.mat is listed on the first
+// data root at the same path, and its record in the date folder's trialIndex.bin says which data
+// root it goes to. One without a record goes to the first
+static int enqueueLeftover(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+	size_t length = strlen(path);
+	if (type != FTW_F || length < 4 || strcmp(path + length - 4, ".mat") != 0)
+		return 0;
+
+	const char* relative = path + strlen(leftoverStagingRoot);
+	while (*relative == '/')
+		relative++;
+	const char* relativeToIndex = relative;
+	for (unsigned i = 0; i < 3 && relativeToIndex != NULL; i++) {
+		relativeToIndex = strchr(relativeToIndex, '/');
+		if (relativeToIndex != NULL)
+			relativeToIndex++;
+	}
+	if (relativeToIndex == NULL)
+		return 0;
+
+	char binaryIndexFileName[MAX_FILENAME_LENGTH];
+	char archiveName[MAX_FILENAME_LENGTH];
+	char linkName[MAX_FILENAME_LENGTH];
+	snprintf(binaryIndexFileName, MAX_FILENAME_LENGTH, "%s/%.*s%s", leftoverDataRoots[0],
+			(int)(relativeToIndex - relative), relative, TRIAL_INDEX_FILE_NAME);
+
+	TrialIndexRecord record;
+	off_t recordOffset = findIndexRecord(binaryIndexFileName, relativeToIndex, &record);
+	unsigned root = recordOffset >= 0 && record.dataRoot < nLeftoverDataRoots ? record.dataRoot : 0;
+	snprintf(archiveName, MAX_FILENAME_LENGTH, "%s/%s", leftoverDataRoots[root], relative);
+	snprintf(linkName, MAX_FILENAME_LENGTH, "%s/%s", leftoverDataRoots[0], relative);
+
+	migratorEnqueue(path, archiveName, linkName, binaryIndexFileName, recordOffset);
+	nLeftovers++;
+	return 0;
+}
+
+void migratorEnqueueLeftovers(const char* stagingRoot, const char* const* dataRootPaths, unsigned nDataRoots) {
+	leftoverStagingRoot = stagingRoot;
+	leftoverDataRoots = dataRootPaths;
+	nLeftoverDataRoots = nDataRoots;
+	nLeftovers = 0;
+
+	if (nftw(stagingRoot, enqueueLeftover, 16, FTW_PHYS) != 0)
+		logError("Migrator Error: Could not look through %s for staged trials (%s)\n", stagingRoot, strerror(errno));
+	if (nLeftovers > 0)
+		logInfo("Migrator: Migrating %u trials left staged by an earlier run\n", nLeftovers);
+}
+
+void migratorLogStats() {
+	pthread_mutex_lock(&migratorMutex);
+	MigrationStats s = stats;
+	pthread_mutex_unlock(&migratorMutex);
+
+	if (s.nMigrated + s.nFailed == 0)
+		return;
+
+	logInfo("Migrator: %u trials (%.1f MB) migrated, %.1f ms each on average, %u retries, %u left staged\n",
+			s.nMigrated, s.bytesMigrated / 1e6, s.nMigrated > 0 ? 1000 * s.totalSec / s.nMigrated : 0.0,
+			s.nRetried, s.nFailed);
+	logInfo("Migrator: Backlog peaked at %u trials (%.1f MB)\n", s.maxBacklog, s.maxBacklogBytes / 1e6);
+}
@@ -0,0 +1,37 @@
+#ifndef MIGRATOR_H_INCLUDED
+#define MIGRATOR_H_INCLUDED
+
+// Background migration of trials from the staging tier to their data root, see setStagingRoot
+// in writer.h. Trials are written to fast local storage and linked to from where they're listed
+// on the data root, then copied over by a low priority thread at a limited rate. A copy is
+// fsync'd and read back to compare checksums before it replaces the link (by rename, so readers
+// always find a complete file), the trial's record in trialIndex.bin loses its
+// TRIAL_INDEX_FLAG_STAGED and the staged file is deleted. trialIndex.txt needs no update, since
+// the name it lists stays valid throughout. Trials that couldn't be migrated are tried again
+// later, and those left staged when the logger stopped are picked up when it starts again.
+//
+// Not built into the MEX receiver.
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// bytes per second copied to the data roots, <= 0 for no limit (default)
+void migratorSetRateLimit(double bytesPerSec);
+
+void migratorStart();
+// migrate the remaining backlog, no longer rate limited, and stop
+void migratorStop();
+
+// migrate stagedName to archiveName. linkName is the link to the trial that readers see, which
+// is either archiveName itself or is pointed to it once the trial is there. indexRecordOffset is
+// that of the trial's record in binaryIndexFileName, < 0 if it has none
+void migratorEnqueue(const char* stagedName, const char* archiveName, const char* linkName,
+		const char* binaryIndexFileName, off_t indexRecordOffset);
+
+// queue the trials an earlier run left under stagingRoot, e.g. after a crash or a migration
+// that didn't succeed before it stopped. The first of the data roots lists them
+void migratorEnqueueLeftovers(const char* stagingRoot, const char* const* dataRootPaths, unsigned nDataRoots);
+
+void migratorLogStats();
+
+#endif // ifndef MIGRATOR_H_INCLUDED
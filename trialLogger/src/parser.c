@@ -1,8 +1,56 @@
 #include <stdio.h>  // printf(), etc.
 #include <string.h> // string operation
+#include <pthread.h>
 
 #include "utils.h"
+#include "trie.h"
 #include "parser.h"
+#include "latestValues.h"
+
+// the groups buffered, all of them while none are subscribed to. The parser only takes the lock
+// once there is a subscription
+static pthread_mutex_t subscriptionMutex = PTHREAD_MUTEX_INITIALIZER;
+static Trie *subscriptionTrie = NULL;
+static bool subscriptionActive = false;
+static char subscribedMark; // value of each group name on subscriptionTrie
+
+bool parserSubscribeGroups(const char **groupNames, unsigned nGroupNames) {
+	Trie *trie = NULL;
+	if (nGroupNames > 0) {
+		trie = trie_create();
+		if (trie == NULL) {
+			logError("Parser: Could not allocate group subscription\n");
+			return false;
+		}
+		for (unsigned i = 0; i < nGroupNames; i++)
+			trie_add(trie, groupNames[i], &subscribedMark);
+	}
+
+	pthread_mutex_lock(&subscriptionMutex);
+	Trie *previous = subscriptionTrie;
+	subscriptionTrie = trie;
+	__atomic_store_n(&subscriptionActive, trie != NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&subscriptionMutex);
+
+	if (previous != NULL)
+		trie_flush(previous, NULL);
+	return true;
+}
+
+bool parserIsGroupSubscribed(const char *groupName) {
+	if (!__atomic_load_n(&subscriptionActive, __ATOMIC_ACQUIRE))
+		return true;
+
+	pthread_mutex_lock(&subscriptionMutex);
+	bool subscribed = subscriptionTrie == NULL || trie_lookup(subscriptionTrie, groupName) != NULL;
+	pthread_mutex_unlock(&subscriptionMutex);
+	return subscribed;
+}
+
+// data type ids come off the network, getSizeOfDataTypeId gives up on any it doesn't know
+static bool isValidDataTypeId(uint8_t dataTypeId) {
+	return dataTypeId <= DTID_LOGICAL;
+}
 
 // this is the callback function called by the network thread
 // to receive packet data placed into a PacketData struct
@@ -17,7 +65,7 @@ void processReceivedPacketData(const PacketData *pRaw) {
 	const uint8_t *pBufStart = pRaw->data;
 	const uint8_t *pBuf = pRaw->data;
 
-	bool isControlGroup, firstTimeGroupSeen, success, waitingNextTrial;
+	bool isControlGroup, success, waitingNextTrial;
 	int iSignal, nSignals;
 
 //	logInfo("Processing raw data!");
@@ -30,6 +78,8 @@ void processReceivedPacketData(const PacketData *pRaw) {
 			break;
 		}
 
+		const uint8_t *pGroupStart = pBuf;
+
 		// parse the group header and build out the GroupInfo g
 		pBuf = parseGroupInfoHeader(pBuf, &g);
 		if (pBuf == NULL) {
@@ -44,6 +94,18 @@ void processReceivedPacketData(const PacketData *pRaw) {
 			return;
 		}
 
+		// step over the signals of groups not subscribed to without parsing them. Control groups
+		// are always parsed, they mark the trials
+		if (g.type != GROUP_TYPE_CONTROL && !parserIsGroupSubscribed(g.name)) {
+			for (iSignal = 0; iSignal < nSignals && pBuf != NULL; iSignal++)
+				pBuf = skipSignalInBuffer(pBuf);
+			if (pBuf == NULL) {
+				logError("Parser: Error skipping signal in buffer\n");
+				return;
+			}
+			continue;
+		}
+
 		// can do different processing here depending on the version of the packet
 
 		// handle control groups differently
@@ -93,14 +155,19 @@ void processReceivedPacketData(const PacketData *pRaw) {
 			waitingNextTrial = controlGetWaitingForNextTrial();
 
 			if (!waitingNextTrial) {
-				firstTimeGroupSeen = false;
 				// find existing group info onto the group trie and hold onto that pointer
 				pgOnTrie = findGroupInfoInTrie(&g);
 				if (pgOnTrie == NULL) {
-					firstTimeGroupSeen = true;
-					// build a new group info on the group trie
-					// this will also allocate the signals pointer list to be length nSignals
-					pgOnTrie = addGroupInfoToTrie(&g);
+					// build a new group info on the group trie, along with a SignalDataBuffer
+					// for each signal and the plan for ingesting this group's samples
+					pgOnTrie = addGroupInfoToTrie(&g, (const SignalSample*)samples);
+					if (pgOnTrie == NULL) {
+						logError("Parser: Error building group info %s\n", g.name);
+						for (iSignal = 0; iSignal < nSignals; iSignal++)
+							freeSignalSampleData(samples + iSignal);
+						FREE(samples);
+						return;
+					}
 				}
 
 				// check the hash matches, bail if not
@@ -119,39 +186,27 @@ void processReceivedPacketData(const PacketData *pRaw) {
 				for (iSignal = 0; iSignal < nSignals; iSignal++)
 					samples[iSignal].pGroupInfo = pgOnTrie;
 
-				// if it's the first time we've seen this group, build a SignalDataBuffer for each signal
-				if (firstTimeGroupSeen) {
-					for (iSignal = 0; iSignal < nSignals; iSignal++) {
-						pgOnTrie->signals[iSignal] = buildSignalDataBufferFromSample(samples + iSignal);
-
-						if (pgOnTrie->signals == NULL) {
-							logError("Parser: Error building signal data buffer\n");
-							for (iSignal = 0; iSignal < nSignals; iSignal++)
-								freeSignalSampleData(samples + iSignal);
-							FREE(samples);
-							return;
-						}
-					}
-				}
-
 				// add the timestamp to the group info, this is also where adjust the timestamps
 				// for this sample based on signals with SIGNAL_TYPE_TIMESTAMP and SIGNAL_TYPE_TIMESTAMPOFFSET
 				// update the pgOnTrie's last timestamp with the last corrected timestamp as well
 				pgOnTrie->lastTimestamp = pushTimestampToGroupInfo(pgOnTrie, g.lastTimestamp, (const SignalSample*)samples, nSignals);
-				// and push each signal sample to each signal data buffer
-				for (iSignal = 0; iSignal < nSignals; iSignal++) {
-					success = pushSignalSampleToSignalDataBuffer(pgOnTrie->signals[iSignal], samples + iSignal);
-					if (!success) {
-						logError("Parser: Issue pushing signal data sample\n");
-						for (iSignal = 0; iSignal < nSignals; iSignal++)
-							freeSignalSampleData(samples + iSignal);
-						FREE(samples);
-						return;
-					}
+				// and push the signal samples to the group's column buffer or each signal data buffer
+				success = pushSignalSamplesToGroupInfo(pgOnTrie, (const SignalSample*)samples);
+				if (!success) {
+					logError("Parser: Issue pushing signal data sample\n");
+					for (iSignal = 0; iSignal < nSignals; iSignal++)
+						freeSignalSampleData(samples + iSignal);
+					FREE(samples);
+					return;
 				}
 			}
 		}
 
+		// the group as received is the latest value of it, whether or not it was buffered above.
+		// Updated once buffered, so that whoever is woken for it finds it in the buffers
+		latestValuesUpdate(g.name, pGroupStart, (uint32_t)(pBuf - pGroupStart),
+				!isControlGroup && !waitingNextTrial);
+
 		// free data used by the SignalSamples
 		for (iSignal = 0; iSignal < nSignals; iSignal++)
 			freeSignalSampleData(samples + iSignal);
@@ -218,6 +273,10 @@ const uint8_t *parseSignalFromBuffer(const uint8_t *buffer, SignalSample *ps) {
 
 	// store the data type
 	STORE_UINT8(pBuf, ps->dataTypeId);
+	if (!isValidDataTypeId(ps->dataTypeId)) {
+		logError("Parser: Signal '%s' data type id invalid (%d)!\n", ps->name, ps->dataTypeId);
+		return NULL;
+	}
 
 	// store the number of dimensions
 	STORE_UINT8(pBuf, ps->nDims);
@@ -261,6 +320,59 @@ const uint8_t *parseSignalFromBuffer(const uint8_t *buffer, SignalSample *ps) {
 	return pBuf;
 }
 
+// reads only the lengths of a single signal sample off the bytestream buffer, as laid out for
+// parseSignalFromBuffer, to step over it without allocating
+//
+// if the lengths are invalid, returns NULL
+// otherwise returns a pointer to the next unread byte in the buffer
+const uint8_t *skipSignalInBuffer(const uint8_t *buffer) {
+	const uint8_t *pBuf = buffer;
+
+	// bit flags and signal type
+	pBuf += 2;
+
+	uint16_t lenName;
+	STORE_UINT16(pBuf, lenName);
+	if (lenName == 0 || lenName > MAX_SIGNAL_NAME) {
+		logError("Parser: Signal name too long (%d)", lenName);
+		return NULL;
+	}
+	pBuf += lenName;
+
+	uint16_t lenUnits;
+	STORE_UINT16(pBuf, lenUnits);
+	if (lenUnits > MAX_SIGNAL_UNITS) {
+		logError("Parser: Signal units too long (%d)", lenUnits);
+		return NULL;
+	}
+	pBuf += lenUnits;
+
+	uint8_t dataTypeId, nDims;
+	STORE_UINT8(pBuf, dataTypeId);
+	STORE_UINT8(pBuf, nDims);
+	if (!isValidDataTypeId(dataTypeId)) {
+		logError("Parser: Signal data type id invalid (%d)!\n", dataTypeId);
+		return NULL;
+	}
+	if (nDims > MAX_SIGNAL_NDIMS || nDims == 0) {
+		logError("Parser: Signal dimension count invalid (%d)!\n", nDims);
+		return NULL;
+	}
+
+	unsigned nElements = 1;
+	for (int idim = 0; idim < nDims; idim++) {
+		uint16_t dim;
+		STORE_UINT16(pBuf, dim);
+		if (dim > MAX_SIGNAL_SIZE) {
+			logError("Parser: Signal dimension %d invalid (%d)!\n", idim, dim);
+			return NULL;
+		}
+		nElements *= dim;
+	}
+
+	return pBuf + nElements * getSizeOfDataTypeId(dataTypeId);
+}
+
 // given the bytestream buffer, read the next few bytes of buffer which
 // are expected to constitute a serialized group info header, store the group info in pg,
 // and return the advanced pointer into the buffer (i.e. to the next unread character)
@@ -29,5 +29,17 @@ const uint8_t *parseGroupInfoHeader(const uint8_t*, GroupInfo*);
 // if parsing successful, returns a pointer to the next unread byte in the buffer
 const uint8_t *parseSignalFromBuffer(const uint8_t*, SignalSample*);
 
+// reads only the lengths of a single signal sample off the bytestream buffer to step over it
+//
+// if the lengths are invalid, returns NULL
+// otherwise returns a pointer to the next unread byte in the buffer
+const uint8_t *skipSignalInBuffer(const uint8_t*);
+
+// only buffer the nGroupNames groups named from here on, and control groups, all groups again if
+// nGroupNames is 0. The others are stepped over before their signals are parsed
+bool parserSubscribeGroups(const char **groupNames, unsigned nGroupNames);
+// whether the group is buffered under the current subscription, control groups aside
+bool parserIsGroupSubscribed(const char *groupName);
+
 #endif // ifndef PARSER_H_INCLUDED
 
@@ -0,0 +1,60 @@
+#ifndef SESSIONFILE_H_INCLUDED
+#define SESSIONFILE_H_INCLUDED
+
+// Columnar session file, written by tools/compactSession.c from a saveTag folder of .mat files
+// once the session is over. Each signal's data of all trials is one contiguous array, so that a
+// reader can map a whole session's handX without touching any other signal. The layout is
+//
+//   SessionFileHeader
+//   trialIds  uint32[nTrials], ascending
+//   signals   SessionSignal[nSignals], sorted by name
+//   for each signal, the trialOffsetsOffset and dimsOffset arrays it points to
+//   for each signal, its data at dataOffset, aligned to SESSION_DATA_ALIGNMENT
+//
+// A trial's array of a signal holds its elements in MATLAB's (column major) order. Signals
+// concatenate their samples along the last dimension, so the data of consecutive trials is the
+// concatenation of their samples as long as the other dimensions match. All values are in host
+// (little endian) byte order, as in the .mat files. The header is written last, a file without
+// its magic is incomplete.
+//
+// See +MatUdp/+DataLoad/readSessionFileIndex.m and mapSessionSignal.m for the MATLAB side.
+
+#include <stdint.h>
+
+#define SESSION_FILE_NAME "session.mcs"
+#define SESSION_FILE_MAGIC "MATUDPCS"
+#define SESSION_FILE_VERSION 1
+
+// fits any MATLAB variable name
+#define SESSION_SIGNAL_NAME_LENGTH 64
+// each signal's data starts on a page of its own
+#define SESSION_DATA_ALIGNMENT 4096
+
+typedef struct SessionFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;
+	uint32_t nTrials;
+	uint32_t nSignals;
+	uint32_t signalBytes;     // sizeof(SessionSignal), readers step through the signals by it
+	uint32_t reserved;
+	uint64_t trialIdsOffset;
+	uint64_t signalsOffset;
+	uint64_t fileBytes;
+} SessionFileHeader;
+
+typedef struct SessionSignal {
+	char name[SESSION_SIGNAL_NAME_LENGTH]; // zero padded
+	uint32_t classId;         // mxClassID, chars are 2 byte, logicals 1 byte elements
+	uint32_t elementBytes;
+	uint32_t nDims;           // of every trial's array
+	uint32_t reserved;
+	uint64_t dataOffset;
+	uint64_t nElements;       // of all trials
+	uint64_t trialOffsetsOffset; // uint64[nTrials + 1], the first element of each trial in the data,
+	                          // then nElements
+	uint64_t dimsOffset;      // uint32[nTrials][nDims], the size of each trial's array, all 0 for a
+	                          // trial that doesn't have the signal
+} SessionSignal;
+
+#endif // ifndef SESSIONFILE_H_INCLUDED
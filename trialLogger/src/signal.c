@@ -1,9 +1,13 @@
 #include <stdio.h>   // printf(), etc.
 #include <stdlib.h>  // For EXIT_FAILURE, EXIT_SUCCESS, malloc etc.
 #include <string.h>  // string operations
+#include <strings.h> // strcasecmp
 #include <pthread.h> // POSIX treads
+#include <errno.h>   // ETIMEDOUT
+#include <time.h>    // clock_gettime
+#include <math.h>    // floor
 
-#include "mat.h"
+#include "matfile.h"
 
 #include "errors.h"
 #include "utils.h"
@@ -59,6 +63,20 @@ DataLoggerStatus *dlStatusesRetired[STATUSES_RETIRED_NUM_BUFFER];
 unsigned nStatusesRetired = 0;
 pthread_mutex_t dlStatusesRetiredMutex = PTHREAD_MUTEX_INITIALIZER;
 
+// the writer thread sleeps on writerWakeCond until a trial completes or a status retires,
+// writerWakeSeq counts the notifications so that none are missed while the writer is busy
+pthread_mutex_t writerWakeMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t writerWakeCond = PTHREAD_COND_INITIALIZER;
+uint32_t writerWakeSeq = 0;
+
+// next writeSeq to assign to a completed trial, 0 means none assigned
+uint32_t trialWriteSeqNext = 1;
+
+// whether to log every change of param values within each trial, see controlSetParamChangeLog
+bool paramChangeLogEnabled = false;
+
+static void updateSignalDataBufferDims(SignalDataBuffer*, const SignalSample*, bool);
+
 // these match the data type ids defined in signal.h
 // note that "char" is actually uint8, but determines how we store it downstream
 // i.e. char will be converted to a matlab string
@@ -97,6 +115,17 @@ bool getGroupTypeName(uint8_t groupType, char *buffer) {
 	return true;
 }
 
+// lookup group type by name in groupTypeNames[], ignoring case
+bool getGroupTypeByName(const char *name, uint8_t *pGroupType) {
+	for (unsigned i = 1; i < sizeof(groupTypeNames) / sizeof(groupTypeNames[0]); i++) {
+		if (strcasecmp(name, groupTypeNames[i]) == 0) {
+			*pGroupType = (uint8_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
 // lookup group type by name in groupTypeNames[]
 bool getSignalTypeName(uint8_t signalType, char *buffer) {
 	// group types are 1-indexed, see GROUP_TYPE_* in signal.h
@@ -201,7 +230,55 @@ GroupInfo *findGroupInfoInTrie(const GroupInfo *pg) {
 	return pgOnTrie;
 }
 
-GroupInfo *addGroupInfoToTrie(const GroupInfo *pg) {
+// work out once how samples of this group are ingested: which signals carry the timestamps,
+// which signals replace their last value rather than buffer, and how many bytes each sample has
+// returns false only if memory could not be allocated
+static bool planGroupInfoIngest(GroupInfo *pg, const SignalSample *samples) {
+	pg->idxSignalTimestamp = -1;
+	pg->idxSignalTimestampOffset = -1;
+	pg->isColumnar = false;
+
+	if (pg->nSignals == 0)
+		return true;
+
+	pg->replaceSignal = (bool*)CALLOC(sizeof(bool), pg->nSignals);
+	pg->expectedBytes = (uint32_t*)CALLOC(sizeof(uint32_t), pg->nSignals);
+	if (pg->replaceSignal == NULL || pg->expectedBytes == NULL)
+		return false;
+
+	// fixed layout analog groups (no variable size or param signals) are buffered in columns,
+	// one row per received sample, so that each packet needs a single capacity check
+	bool columnar = pg->type == GROUP_TYPE_ANALOG;
+
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		const SignalSample *ps = samples + i;
+
+		if (ps->type == SIGNAL_TYPE_TIMESTAMP) {
+			if (ps->dataTypeId != DTID_UINT32)
+				logError("Signal Error: Signal with type TIMESTAMP must have data type uint32\n");
+			else
+				pg->idxSignalTimestamp = i;
+		}
+		if (ps->type == SIGNAL_TYPE_TIMESTAMPOFFSET) {
+			if (ps->dataTypeId != DTID_SINGLE)
+				logError("Signal Error: Signal with type TIMESTAMPOFFSET must have data type single\n");
+			else
+				pg->idxSignalTimestampOffset = i;
+		}
+
+		// param's aren't buffered, each new value replaces the last
+		pg->replaceSignal[i] = pg->type == GROUP_TYPE_PARAM || ps->type == SIGNAL_TYPE_PARAM;
+		pg->expectedBytes[i] = ps->dataBytes;
+
+		if (ps->isVariable || ps->type == SIGNAL_TYPE_PARAM || ps->dataBytes == 0)
+			columnar = false;
+	}
+
+	pg->isColumnar = columnar;
+	return true;
+}
+
+GroupInfo *addGroupInfoToTrie(const GroupInfo *pg, const SignalSample *samples) {
 	char key[GROUPKEYLENGTH];
 	buildGroupKey(pg, key);
 	GroupTrie *gtrie = getCurrentGroupTrie();
@@ -216,6 +293,27 @@ GroupInfo *addGroupInfoToTrie(const GroupInfo *pg) {
 
 	// allocate SignalDataBuffers list for this group info
 	pgOnTrie->signals = (SignalDataBuffer**)CALLOC(sizeof(SignalDataBuffer*), pg->nSignals);
+	if (pgOnTrie->signals == NULL && pg->nSignals > 0) {
+		FREE(pgOnTrie);
+		return NULL;
+	}
+
+	// build a SignalDataBuffer for each signal from its first sample
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		SignalDataBuffer *psdb = buildSignalDataBufferFromSample(samples + i);
+		if (psdb == NULL) {
+			freeGroupInfo(pgOnTrie);
+			return NULL;
+		}
+		psdb->pGroupInfo = pgOnTrie;
+		psdb->indexInGroup = i;
+		pgOnTrie->signals[i] = psdb;
+	}
+
+	if ( !planGroupInfoIngest(pgOnTrie, samples) ) {
+		freeGroupInfo(pgOnTrie);
+		return NULL;
+	}
 
 	trie_add(gtrie, key, pgOnTrie);
 
@@ -241,11 +339,17 @@ void freeGroupInfo(GroupInfo *pg) {
 		pg->signals = NULL;
 	}
 
-	// free timestamp buffers
+	// free timestamp and column buffers
 	for (i = 0; i < BUFFER_NUM_TRIALS; i++) {
 		freeTimestampBuffer(pg->tsBuffers + i);
+		freeColumnBuffer(pg->columnBuffers + i, pg->nSignals);
 	}
 
+	if (pg->replaceSignal != NULL)
+		FREE(pg->replaceSignal);
+	if (pg->expectedBytes != NULL)
+		FREE(pg->expectedBytes);
+
 	// free the pointer itself
 	FREE(pg);
 }
@@ -262,67 +366,154 @@ void freeGroupInfoTrie(GroupTrie *gtrie) {
 	trie_flush(gtrie, (void (*)(void*))freeGroupInfo);
 }
 
+// whether any signal of the param group differs from the value last received
+static bool paramGroupChanged(const GroupInfo *pg, const SignalSample *signals) {
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		const SignalDataBuffer *psdb = pg->signals[i];
+		if (psdb == NULL || !sampleBufferDataEquals(&psdb->lastValue, signals[i].dataBytes, signals[i].data))
+			return true;
+	}
+	return false;
+}
+
 // append a timestamped sample to the group info's internal list
-// if signals contains signals with type SIGNAL_TYPE_TIMESTAMP or SIGNAL_TYPE_TIMESTAMPOFFSET,
-// use these to adjust or otherwise replace the timestamps directly
+// if the group has signals with type SIGNAL_TYPE_TIMESTAMP or SIGNAL_TYPE_TIMESTAMPOFFSET (see the
+// ingest plan), use these to adjust or otherwise replace the timestamps directly
 // length of signals must match pg->nSignals
 timestamp_t pushTimestampToGroupInfo(GroupInfo *pg, timestamp_t ts, const SignalSample *signals, int nSignals) {
 	controlMarkCurrentTrialUtilized(ts); // essential for this trial to be written to disk
 	TimestampBuffer *ptb = pg->tsBuffers + controlGetCurrentTrialIndex();
 
-	// first, check whether the group has any signals with type SIGNAL_TYPE_TIMESTAMPS
-	// with type DTID_UINT32
-	
-	int idxSignalTimestamp = -1;
-	int idxSignalTimestampOffset = -1;
-	unsigned nTimestamps;
+	// the group header timestamp is whole ms
+	uint32_t msHeader = (uint32_t)ts;
+	const uint32_t *ms = NULL;
+	const single_t *offsets = NULL;
+	uint32_t nTimestamps = 1;
+
+	// if we're overriding the group timestamp, we may be carrying multiple samples
+	if (pg->idxSignalTimestamp >= 0) {
+		const SignalSample *ps = signals + pg->idxSignalTimestamp;
+		ms = (const uint32_t*)ps->data;
+		nTimestamps = ps->dataBytes / sizeof(uint32_t);
+	}
+	if (pg->idxSignalTimestampOffset >= 0) {
+		const SignalSample *ps = signals + pg->idxSignalTimestampOffset;
+		uint32_t nOffsets = ps->dataBytes / sizeof(single_t);
+		offsets = (const single_t*)ps->data;
+		if (ms == NULL || nOffsets < nTimestamps)
+			nTimestamps = nOffsets;
+	}
 
-	for (unsigned i = 0; i < nSignals; i++) {
-		const SignalSample *ps = signals + i;
+	if (nTimestamps == 0)
+		return pg->lastTimestamp;
 
-		if (ps->type == SIGNAL_TYPE_TIMESTAMP) {
-			if (ps->dataTypeId != DTID_UINT32)
-				logError("Signal Error: Signal with type TIMESTAMP must have data type uint32\n");
-			else
-				idxSignalTimestamp = i;
-		}
-		if (ps->type == SIGNAL_TYPE_TIMESTAMPOFFSET) {
-			if (ps->dataTypeId != DTID_SINGLE)
-				logError("SIgnal Error: Signal with type TIMESTAMPOFFSET must have data type single\n");
-			else
-				idxSignalTimestampOffset = i;
+	uint32_t iLast = nTimestamps - 1;
+	uint32_t msLast = ms != NULL ? ms[iLast] : msHeader;
+	single_t offsetLast = offsets != NULL ? offsets[iLast] : 0;
+
+	bool success = true;
+	if (pg->type == GROUP_TYPE_PARAM) {
+		// replace the existing timestamp, param's aren't buffered. The values are compared before
+		// pushSignalSamplesToGroupInfo stores them, so an unchanged resend keeps the time of the change
+		if (ptb->nSamples == 0 || paramGroupChanged(pg, signals))
+			success = replaceTimestampBufferDataMs(ptb, msLast, offsetLast);
+	} else {
+		// push the new samples, the timeseries will allocate new memory as needed
+		success = pushTimestampsMsToTimestampBuffer(ptb, nTimestamps, ms, msHeader, offsets);
+	}
+	if ( !success )
+		logError("Signal Error: Could not allocate memory for timestamps of group %s\n", pg->name);
+
+	return (timestamp_t)msLast + (timestamp_t)offsetLast;
+}
+
+// move the rows buffered so far into each signal's own SampleBuffer, after which
+// the rest of this trial is buffered per signal
+static bool spillColumnBufferToSignals(GroupInfo *pg, unsigned trialIdx) {
+	ColumnBuffer *pcb = pg->columnBuffers + trialIdx;
+
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		SampleBuffer *ptb = pg->signals[i]->buffers + trialIdx;
+		uint32_t nBytes = pg->expectedBytes[i];
+
+		for (uint32_t iRow = 0; iRow < pcb->nRows; iRow++) {
+			if (!pushSampleToSampleBuffer(ptb, nBytes, pcb->columns[i] + iRow*nBytes))
+				return false;
 		}
 	}
 
-	// if we're overriding the group timestamp, meaning we may be carrying multiple samples
-	if (idxSignalTimestamp >= 0)
-		nTimestamps = signals[idxSignalTimestamp].dataBytes / getSizeOfDataTypeId(DTID_UINT32);
-	else if (idxSignalTimestampOffset >= 0)
-		nTimestamps = signals[idxSignalTimestampOffset].dataBytes / getSizeOfDataTypeId(DTID_SINGLE);
-	else
-		nTimestamps = 1;
+	pcb->nRows = 0;
+	pcb->spilled = true;
+	return true;
+}
 
-	// loop over the timestamps and adjust each accordingly
-	timestamp_t tsCorrected = 0.;
-	for (unsigned iT = 0; iT < nTimestamps; iT++) {
-		tsCorrected = ts;
+// push one sample of every signal in the group to the current trial
+// samples must have length pg->nSignals and match pg->signals in order
+bool pushSignalSamplesToGroupInfo(GroupInfo *pg, const SignalSample *samples) {
+	unsigned trialIdx = controlGetCurrentTrialIndex();
+	ColumnBuffer *pcb = pg->columnBuffers + trialIdx;
+	unsigned i;
 
-		if (idxSignalTimestamp >= 0)
-			tsCorrected = (timestamp_t) (((uint32_t*)(signals[idxSignalTimestamp].data))[iT]);
+	// keep count of the trial size for the writers' scheduling
+	DataLoggerStatusByTrial *dlTrial = controlGetCurrentStatusByTrial();
+	uint64_t nBytes = 0;
+	for (i = 0; i < pg->nSignals; i++)
+		nBytes += samples[i].dataBytes;
+	dlTrial->nBytesBuffered += nBytes;
+	dlTrial->nBytesByGroupType[pg->type < MAX_GROUP_TYPES ? pg->type : 0] += nBytes;
 
-		if (idxSignalTimestampOffset >= 0)
-			tsCorrected += (timestamp_t) (((single_t*)(signals[idxSignalTimestampOffset].data))[iT]);
+	if (pg->isColumnar && !pcb->spilled) {
+		for (i = 0; i < pg->nSignals; i++) {
+			if (samples[i].dataBytes != pg->expectedBytes[i])
+				break;
+		}
 
-		if (pg->type == GROUP_TYPE_PARAM) {
-			// replace the existing timestamp, param's aren't buffered
-			replaceTimestampBufferData(ptb, tsCorrected);
-		} else {
-			// push the new sample, the timeseries will allocate new memory as needed
-			pushTimestampToTimestampBuffer(ptb, tsCorrected);
+		if (i == pg->nSignals) {
+			// every sample fits its column, append a row
+			if ( !ensureColumnBufferCapacity(pcb, pg, pcb->nRows + 1) ) {
+				logError("Signal Error: Could not allocate memory for column buffer %s\n", pg->name);
+				return false;
+			}
+
+			for (i = 0; i < pg->nSignals; i++) {
+				uint32_t nBytes = pg->expectedBytes[i];
+				updateSignalDataBufferDims(pg->signals[i], samples + i, pcb->nRows == 0);
+				memcpy(pcb->columns[i] + pcb->nRows*nBytes, samples[i].data, nBytes);
+			}
+			pcb->nRows++;
+
+			return true;
+		}
+
+		logError("Signal Error: Signal %s in group %s changed size, buffering per signal for this trial\n",
+				samples[i].name, pg->name);
+		if ( !spillColumnBufferToSignals(pg, trialIdx) ) {
+			logError("Signal Error: Could not allocate memory for signal buffers %s\n", pg->name);
+			return false;
+		}
+	}
+
+	for (i = 0; i < pg->nSignals; i++) {
+		if ( !pushSignalSampleToSignalDataBuffer(pg->signals[i], samples + i) )
+			return false;
+	}
+
+	return true;
+}
+
+// clear all buffered data of this group for trialIdx without deallocating buffers
+void clearGroupInfoTrialData(GroupInfo *pg, unsigned trialIdx) {
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		SignalDataBuffer *psdb = pg->signals[i];
+		if (psdb != NULL) {
+			clearSampleBuffer(psdb->buffers + trialIdx);
+			clearSampleBuffer(psdb->changeValues + trialIdx);
+			clearTimestampBuffer(psdb->changeTimes + trialIdx);
 		}
 	}
 
-	return tsCorrected;
+	clearColumnBuffer(pg->columnBuffers + trialIdx);
+	clearTimestampBuffer(pg->tsBuffers + trialIdx);
 }
 
 // iterating over the signal trie
@@ -367,6 +558,8 @@ bool checkSignalDataBufferMatchesSample(const SignalDataBuffer *psdb, const Sign
 // build a new SignalDataBuffer and copy metadata from a SignalSample
 SignalDataBuffer *buildSignalDataBufferFromSample(const SignalSample *ps) {
 	SignalDataBuffer *psdb = (SignalDataBuffer*)CALLOC(sizeof(SignalDataBuffer), 1);
+	if (psdb == NULL)
+		return NULL;
 
 	psdb->isVariable = ps->isVariable;
 	psdb->concatLastDim = ps->concatLastDim;
@@ -385,19 +578,9 @@ SignalDataBuffer *buildSignalDataBufferFromSample(const SignalSample *ps) {
 	return psdb;
 }
 
-// given a data sample from a particular signal, either find this signal data buffer
-// in the signal trie, or create one for it. then add the signal sample data to
-// data buffer for the current trial
-bool pushSignalSampleToSignalDataBuffer(SignalDataBuffer *psdb, const SignalSample *ps) {
-	bool success;
-
-	// get the timeseries buffer we're currently writing into
-	SampleBuffer *ptb = psdb->buffers + controlGetCurrentTrialIndex();
-
-	unsigned groupType = psdb->pGroupInfo->type;
-	unsigned signalType = psdb->type;
-
-	if (ptb->nSamples == 0) {
+// keep track of the sample dimensions, which determine whether samples can be concatenated
+static void updateSignalDataBufferDims(SignalDataBuffer *psdb, const SignalSample *ps, bool firstSample) {
+	if (firstSample) {
 		// first sample, update dimensions of the sample
 		psdb->nDims = ps->nDims;
 		memcpy(psdb->dims, ps->dims, psdb->nDims*sizeof(*psdb->dims));
@@ -411,10 +594,50 @@ bool pushSignalSampleToSignalDataBuffer(SignalDataBuffer *psdb, const SignalSamp
 				psdb->dimChangesSize[iDim] = true;
 		}
 	}
+}
+
+// replace the param value held for the current trial, copying only when the value has changed
+// since it was last received or if this is the first value for the trial
+static bool pushParamSampleToSignalDataBuffer(SignalDataBuffer *psdb, SampleBuffer *ptb, const SignalSample *ps) {
+	unsigned trialIdx = controlGetCurrentTrialIndex();
+	bool changed = !sampleBufferDataEquals(&psdb->lastValue, ps->dataBytes, ps->data);
+
+	if (changed) {
+		if ( !replaceSampleBufferData(&psdb->lastValue, ps->dataBytes, ps->data) )
+			return false;
+		psdb->lastChangeTimestamp = psdb->pGroupInfo->lastTimestamp;
+	}
+
+	if (changed || ptb->nSamples == 0) {
+		if ( !replaceSampleBufferData(ptb, ps->dataBytes, ps->data) )
+			return false;
+	}
+
+	// log the value in effect at the start of the trial and each change thereafter
+	if (paramChangeLogEnabled && (changed || psdb->changeValues[trialIdx].nSamples == 0)) {
+		if ( !pushSampleToSampleBuffer(psdb->changeValues + trialIdx, ps->dataBytes, ps->data) )
+			return false;
+		if ( !pushTimestampToTimestampBuffer(psdb->changeTimes + trialIdx, psdb->lastChangeTimestamp) )
+			return false;
+	}
+
+	return true;
+}
+
+// given a data sample from a particular signal, either find this signal data buffer
+// in the signal trie, or create one for it. then add the signal sample data to
+// data buffer for the current trial
+bool pushSignalSampleToSignalDataBuffer(SignalDataBuffer *psdb, const SignalSample *ps) {
+	bool success;
+
+	// get the timeseries buffer we're currently writing into
+	SampleBuffer *ptb = psdb->buffers + controlGetCurrentTrialIndex();
+
+	updateSignalDataBufferDims(psdb, ps, ptb->nSamples == 0);
 
-	if (groupType == GROUP_TYPE_PARAM || signalType == SIGNAL_TYPE_PARAM) {
-		// replace the existing value, param's aren't buffered
-		success = replaceSampleBufferData(ptb, ps->dataBytes, ps->data);
+	if (psdb->pGroupInfo->replaceSignal[psdb->indexInGroup]) {
+		// param's aren't buffered, and are typically resent unchanged with every packet
+		success = pushParamSampleToSignalDataBuffer(psdb, ptb, ps);
 	} else {
 		// push the new sample, the timeseries will allocate new memory as needed
 		success = pushSampleToSampleBuffer(ptb, ps->dataBytes, ps->data);
@@ -432,48 +655,103 @@ bool pushSignalSampleToSignalDataBuffer(SignalDataBuffer *psdb, const SignalSamp
 void freeSignalDataBuffer(SignalDataBuffer *psdb) {
 	for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
 		freeSampleBuffer(psdb->buffers +i);
+		freeSampleBuffer(psdb->changeValues + i);
+		freeTimestampBuffer(psdb->changeTimes + i);
+	}
+	freeSampleBuffer(&psdb->lastValue);
+	FREE(psdb->writtenValue);
+	psdb->writtenValue = NULL;
+}
+
+// fill pView with the samples buffered for this signal in trialIdx, reading from
+// the group's column buffer if the group is buffered column-wise
+void getSignalSampleView(const SignalDataBuffer *psdb, unsigned trialIdx, SampleBufferView *pView) {
+	const GroupInfo *pg = psdb->pGroupInfo;
+	const ColumnBuffer *pcb = pg->columnBuffers + trialIdx;
+
+	if (pg->isColumnar && !pcb->spilled) {
+		uint32_t nBytes = pg->expectedBytes[psdb->indexInGroup];
+
+		pView->data = pcb->nRows > 0 ? pcb->columns[psdb->indexInGroup] : NULL;
+		pView->nSamples = pcb->nRows;
+		pView->nDataBytes = pcb->nRows * nBytes;
+		pView->bytesFixed = nBytes;
+		pView->bytesEachSample = NULL;
+	} else {
+		const SampleBuffer *ptb = psdb->buffers + trialIdx;
+
+		pView->data = ptb->data;
+		pView->nSamples = ptb->nSamples;
+		pView->nDataBytes = ptb->nDataBytes;
+		pView->bytesFixed = ptb->samplesDifferentSizes ? 0 : ptb->bytesFixed;
+		pView->bytesEachSample = ptb->samplesDifferentSizes ? ptb->bytesEachSample : NULL;
 	}
 }
 
+// as getSignalSampleView, narrowed to the (at most) nSamples samples from firstSample on. The samples
+// before firstSample aren't touched, only the sizes of variable size samples are added up
+void getSignalSampleViewRange(const SignalDataBuffer *psdb, unsigned trialIdx, uint32_t firstSample,
+		uint32_t nSamples, SampleBufferView *pView) {
+	getSignalSampleView(psdb, trialIdx, pView);
+
+	if (firstSample > pView->nSamples)
+		firstSample = pView->nSamples;
+	if (nSamples > pView->nSamples - firstSample)
+		nSamples = pView->nSamples - firstSample;
+
+	uint32_t nSkippedBytes = 0;
+	if (pView->bytesEachSample == NULL) {
+		nSkippedBytes = firstSample * pView->bytesFixed;
+		pView->nDataBytes = nSamples * pView->bytesFixed;
+	} else {
+		for (uint32_t i = 0; i < firstSample; i++)
+			nSkippedBytes += pView->bytesEachSample[i];
+		pView->bytesEachSample += firstSample;
+		pView->nDataBytes = 0;
+		for (uint32_t i = 0; i < nSamples; i++)
+			pView->nDataBytes += pView->bytesEachSample[i];
+	}
+
+	if (pView->data != NULL)
+		pView->data += nSkippedBytes;
+	pView->nSamples = nSamples;
+}
+
 //////// TIMESTAMP BUFFER UTILS ////////
 
-// ensure that ptb can acccommodate nSamples of data, at bytesPerSample bytes each
+// runs are abandoned for explicit timestamps once they take more memory than uint32 ms would
+#define TIMESTAMP_MIN_RUNS_BEFORE_EXPLICIT 8
+
+// ensure that ptb can acccommodate nSamples of explicit timestamps
 // returns true if successful, false if couldn't allocate enough memory
 bool ensureTimestampBufferCapacity(TimestampBuffer *ptb, uint32_t nSamples) {
 	uint32_t samplesToAllocate;
 
-	if (ptb->timestamps == NULL) {
-		// not allocated yet, CALLOC from scratch
-		// allocate bytesEachSample array to be same length as timestamps (except uint32)
-		ptb->timestamps = (timestamp_t*)CALLOC(sizeof(timestamp_t), nSamples);
-		if (ptb->timestamps == NULL) {
-			ptb->samplesAllocated = 0;
-			return false;
-		}
+	if (ptb->samplesAllocated >= nSamples)
+		return true;
 
-		ptb->samplesAllocated = nSamples;
-		ptb->nSamples = 0;
-	} else {
-		// rellocate a larger space for new data
-		if (ptb->samplesAllocated < nSamples) {
-			// allocate more data, either double the allocated space or the needed bytes, whichever is larger
-			if (ptb->samplesAllocated*2 > nSamples)
-				// double capacity
-				samplesToAllocate = ptb->samplesAllocated * 2;
-			else
-				// use requested capacity
-				samplesToAllocate = nSamples;
+	// allocate more, either double the allocated space or the needed samples, whichever is larger
+	if (ptb->samplesAllocated*2 > nSamples)
+		samplesToAllocate = ptb->samplesAllocated * 2;
+	else
+		samplesToAllocate = nSamples;
 
-			ptb->timestamps = (timestamp_t*)REALLOC(ptb->timestamps, sizeof(timestamp_t) * samplesToAllocate);
-			if (ptb->timestamps == NULL) {
-				ptb->samplesAllocated = 0;
-				return false;
-			}
+	ptb->ms = (uint32_t*)REALLOC(ptb->ms, sizeof(uint32_t) * samplesToAllocate);
+	if (ptb->ms == NULL) {
+		ptb->samplesAllocated = 0;
+		return false;
+	}
 
-			ptb->samplesAllocated = samplesToAllocate;
+	if (ptb->offsets != NULL) {
+		ptb->offsets = (single_t*)REALLOC(ptb->offsets, sizeof(single_t) * samplesToAllocate);
+		if (ptb->offsets == NULL) {
+			ptb->samplesAllocated = 0;
+			return false;
 		}
 	}
 
+	ptb->samplesAllocated = samplesToAllocate;
+
 	return true;
 }
 
@@ -483,27 +761,120 @@ bool ensureTimestampBufferAdditionalCapacity(TimestampBuffer *ptb, uint32_t nSam
 
 // clear the buffer without freeing memory
 void clearTimestampBuffer(TimestampBuffer *ptb) {
-	memset(ptb->timestamps, 0, ptb->samplesAllocated*sizeof(timestamp_t));
+	ptb->nRuns = 0;
+	ptb->explicitTimestamps = false;
+	ptb->hasOffsets = false;
 	ptb->nSamples = 0;
 }
 
 // free the internal memory used by a TimestampBuffer, but do not FREE the pointer itself
 void freeTimestampBuffer(TimestampBuffer *ptb) {
-	if (ptb->timestamps != NULL)
-		FREE(ptb->timestamps);
-
+	if (ptb->runs != NULL)
+		FREE(ptb->runs);
+	if (ptb->ms != NULL)
+		FREE(ptb->ms);
+	if (ptb->offsets != NULL)
+		FREE(ptb->offsets);
+
+	ptb->runsAllocated = 0;
 	ptb->samplesAllocated = 0;
-	ptb->nSamples = 0;
+	clearTimestampBuffer(ptb);
 }
 
-bool pushTimestampToTimestampBuffer(TimestampBuffer *ptb, timestamp_t timestamp) {
-	// allocate space for the additional samples
+// expand the runs received so far into explicit timestamps
+static bool expandTimestampBufferRuns(TimestampBuffer *ptb) {
 	bool success = ensureTimestampBufferAdditionalCapacity(ptb, 1);
 	if ( !success )
 		return false;
 
+	uint32_t iSample = 0;
+	for (uint32_t iRun = 0; iRun < ptb->nRuns; iRun++) {
+		const TimestampRun *pr = ptb->runs + iRun;
+		for (uint32_t i = 0; i < pr->count; i++)
+			ptb->ms[iSample++] = pr->start + i*pr->step;
+	}
+
+	ptb->nRuns = 0;
+	ptb->explicitTimestamps = true;
+	return true;
+}
+
+// start storing offsets, the samples received so far had none
+static bool addTimestampBufferOffsets(TimestampBuffer *ptb) {
+	if (ptb->offsets == NULL) {
+		ptb->offsets = (single_t*)CALLOC(sizeof(single_t), ptb->samplesAllocated);
+		if (ptb->offsets == NULL)
+			return false;
+	} else
+		memset(ptb->offsets, 0, ptb->nSamples*sizeof(single_t));
+
+	ptb->hasOffsets = true;
+	return true;
+}
+
+// extend the last run with ms if it continues it regularly, otherwise start a new run
+static bool pushTimestampMsToRuns(TimestampBuffer *ptb, uint32_t ms) {
+	TimestampRun *pr = ptb->nRuns > 0 ? ptb->runs + ptb->nRuns - 1 : NULL;
+
+	if (pr != NULL && pr->count == 1 && ms >= pr->start) {
+		pr->step = ms - pr->start;
+		pr->count++;
+		return true;
+	}
+	if (pr != NULL && pr->count > 1 && ms == pr->start + pr->count*pr->step) {
+		pr->count++;
+		return true;
+	}
+
+	if (ptb->nRuns == ptb->runsAllocated) {
+		uint32_t runsToAllocate = ptb->runsAllocated > 0 ? ptb->runsAllocated*2 : 4;
+		TimestampRun *runs = (TimestampRun*)REALLOC(ptb->runs, sizeof(TimestampRun) * runsToAllocate);
+		if (runs == NULL)
+			return false;
+		ptb->runs = runs;
+		ptb->runsAllocated = runsToAllocate;
+	}
+
+	pr = ptb->runs + ptb->nRuns++;
+	pr->start = ms;
+	pr->step = 0;
+	pr->count = 1;
+	return true;
+}
+
+bool pushTimestampMsToTimestampBuffer(TimestampBuffer *ptb, uint32_t ms, single_t offset) {
+	bool success;
+
+	if (!ptb->explicitTimestamps) {
+		// fractional timestamps or irregular sampling, switch to explicit timestamps
+		if (offset != 0 || (ptb->nRuns >= TIMESTAMP_MIN_RUNS_BEFORE_EXPLICIT &&
+					ptb->nRuns*sizeof(TimestampRun) > ptb->nSamples*sizeof(uint32_t))) {
+			success = expandTimestampBufferRuns(ptb);
+		} else {
+			success = pushTimestampMsToRuns(ptb, ms);
+			if (success)
+				ptb->nSamples++;
+			return success;
+		}
+		if ( !success )
+			return false;
+	}
+
+	// allocate space for the additional samples
+	success = ensureTimestampBufferAdditionalCapacity(ptb, 1);
+	if ( !success )
+		return false;
+
+	if (offset != 0 && !ptb->hasOffsets) {
+		success = addTimestampBufferOffsets(ptb);
+		if ( !success )
+			return false;
+	}
+
 	// store the new timestamp
-	ptb->timestamps[ptb->nSamples] = timestamp;
+	ptb->ms[ptb->nSamples] = ms;
+	if (ptb->hasOffsets)
+		ptb->offsets[ptb->nSamples] = offset;
 
 	// increment the used counter
 	ptb->nSamples++;
@@ -511,11 +882,116 @@ bool pushTimestampToTimestampBuffer(TimestampBuffer *ptb, timestamp_t timestamp)
 	return true;
 }
 
+// push n timestamps in one go, as carried by multi-timestamp groups
+// if ms is NULL, every timestamp has msConstant whole ms; if offsets is NULL, all offsets are zero
+bool pushTimestampsMsToTimestampBuffer(TimestampBuffer *ptb, uint32_t n, const uint32_t *ms,
+		uint32_t msConstant, const single_t *offsets) {
+	bool anyOffset = false;
+	uint32_t i;
+
+	if (offsets != NULL) {
+		for (i = 0; i < n; i++) {
+			if (offsets[i] != 0) {
+				anyOffset = true;
+				break;
+			}
+		}
+	}
+
+	if (!ptb->explicitTimestamps) {
+		if (!anyOffset) {
+			// whole ms only, these may still extend the runs
+			for (i = 0; i < n; i++) {
+				if ( !pushTimestampMsToTimestampBuffer(ptb, ms != NULL ? ms[i] : msConstant, 0) )
+					return false;
+			}
+			return true;
+		}
+
+		if ( !expandTimestampBufferRuns(ptb) )
+			return false;
+	}
+
+	// allocate space for all samples at once
+	if ( !ensureTimestampBufferAdditionalCapacity(ptb, n) )
+		return false;
+
+	if (anyOffset && !ptb->hasOffsets) {
+		if ( !addTimestampBufferOffsets(ptb) )
+			return false;
+	}
+
+	if (ms != NULL)
+		memcpy(ptb->ms + ptb->nSamples, ms, n*sizeof(uint32_t));
+	else {
+		for (i = 0; i < n; i++)
+			ptb->ms[ptb->nSamples + i] = msConstant;
+	}
+
+	if (ptb->hasOffsets) {
+		if (anyOffset)
+			memcpy(ptb->offsets + ptb->nSamples, offsets, n*sizeof(single_t));
+		else
+			memset(ptb->offsets + ptb->nSamples, 0, n*sizeof(single_t));
+	}
+
+	ptb->nSamples += n;
+
+	return true;
+}
+
+bool replaceTimestampBufferDataMs(TimestampBuffer *ptb, uint32_t ms, single_t offset) {
+	clearTimestampBuffer(ptb);
+	return pushTimestampMsToTimestampBuffer(ptb, ms, offset);
+}
+
+// split timestamp into whole ms and the fractional part
+bool pushTimestampToTimestampBuffer(TimestampBuffer *ptb, timestamp_t timestamp) {
+	timestamp_t ms = timestamp < 0 ? 0 : floor(timestamp);
+	return pushTimestampMsToTimestampBuffer(ptb, (uint32_t)ms, (single_t)(timestamp - ms));
+}
+
 bool replaceTimestampBufferData(TimestampBuffer *ptb, timestamp_t timestamp) {
 	clearTimestampBuffer(ptb);
 	return pushTimestampToTimestampBuffer(ptb, timestamp);
 }
 
+// write the nSamples timestamps minus offset into dest
+void copyTimestampBufferData(const TimestampBuffer *ptb, timestamp_t *dest, timestamp_t offset) {
+	copyTimestampBufferDataRange(ptb, 0, ptb->nSamples, dest, offset);
+}
+
+// as copyTimestampBufferData, but only the (at most) nSamples timestamps from firstSample on
+void copyTimestampBufferDataRange(const TimestampBuffer *ptb, uint32_t firstSample, uint32_t nSamples,
+		timestamp_t *dest, timestamp_t offset) {
+	if (firstSample >= ptb->nSamples)
+		return;
+	if (nSamples > ptb->nSamples - firstSample)
+		nSamples = ptb->nSamples - firstSample;
+
+	if (!ptb->explicitTimestamps) {
+		// skip whole runs up to the one firstSample falls in
+		uint32_t skip = firstSample;
+		for (uint32_t iRun = 0; iRun < ptb->nRuns && nSamples > 0; iRun++) {
+			const TimestampRun *pr = ptb->runs + iRun;
+			if (skip >= pr->count) {
+				skip -= pr->count;
+				continue;
+			}
+			timestamp_t ts = (timestamp_t)pr->start - offset;
+			for (uint32_t i = skip; i < pr->count && nSamples > 0; i++, nSamples--)
+				*dest++ = ts + (timestamp_t)(i*pr->step);
+			skip = 0;
+		}
+	} else if (ptb->hasOffsets) {
+		for (uint32_t i = firstSample; i < firstSample + nSamples; i++)
+			*dest++ = (timestamp_t)ptb->ms[i] + (timestamp_t)ptb->offsets[i] - offset;
+	} else {
+		for (uint32_t i = firstSample; i < firstSample + nSamples; i++)
+			*dest++ = (timestamp_t)ptb->ms[i] - offset;
+	}
+}
+
 //////// SAMPLE BUFFER UTILS ////////
 
 // ensure that ptb can acccommodate nSamples of data, at bytesPerSample bytes each
@@ -532,50 +1008,40 @@ bool ensureSampleBufferCapacity(SampleBuffer* ptb, uint32_t nSamples, uint32_t d
 		}
 		ptb->dataAllocated = dataBytesNeeded;
 
-		// allocate bytesEachSample array to be same length as timestamps (except uint32)
-		ptb->bytesEachSample = (uint32_t*)CALLOC(sizeof(uint32_t), nSamples);
-		if (ptb->bytesEachSample == NULL) {
-			ptb->samplesAllocated = 0;
-			return false;
-		}
-
-		ptb->samplesAllocated = nSamples;
 		ptb->nSamples = 0;
 		ptb->nDataBytes = 0;
-	} else {
+	} else if (ptb->dataAllocated < dataBytesNeeded) {
 		// rellocate a larger space for new data
-		if (ptb->dataAllocated < dataBytesNeeded) {
-			// allocate more data, either double the allocated space or the needed bytes, whichever is larger
-			if (ptb->dataAllocated*2 > dataBytesNeeded)
-				dataBytesToAllocate = ptb->dataAllocated * 2;
-			else
-				dataBytesToAllocate = dataBytesNeeded;
-
-			ptb->data = (uint8_t*)REALLOC(ptb->data, dataBytesToAllocate);
-			if (ptb->data == NULL) {
-				ptb->dataAllocated = 0;
-				return false;
-			}
+		// allocate more data, either double the allocated space or the needed bytes, whichever is larger
+		if (ptb->dataAllocated*2 > dataBytesNeeded)
+			dataBytesToAllocate = ptb->dataAllocated * 2;
+		else
+			dataBytesToAllocate = dataBytesNeeded;
 
-			ptb->dataAllocated = dataBytesToAllocate;
+		ptb->data = (uint8_t*)REALLOC(ptb->data, dataBytesToAllocate);
+		if (ptb->data == NULL) {
+			ptb->dataAllocated = 0;
+			return false;
 		}
 
-		// rellocate a larger space for bytes per sample
-		if (ptb->samplesAllocated < nSamples) {
-			// allocate more timestamps, either double the allocated space or the needed bytes, whichever is larger
-			if (ptb->samplesAllocated*2 > nSamples)
-				samplesToAllocate = ptb->samplesAllocated * 2;
-			else
-				samplesToAllocate = nSamples;
+		ptb->dataAllocated = dataBytesToAllocate;
+	}
 
-			ptb->bytesEachSample = (uint32_t*)REALLOC(ptb->bytesEachSample, sizeof(uint32_t)*samplesToAllocate);
-			if (ptb->bytesEachSample == NULL) {
-				ptb->samplesAllocated = 0;
-				return false;
-			}
+	// bytes per sample are only tracked once samples have had different sizes
+	if (ptb->samplesDifferentSizes && ptb->samplesAllocated < nSamples) {
+		// allocate more, either double the allocated space or the needed samples, whichever is larger
+		if (ptb->samplesAllocated*2 > nSamples)
+			samplesToAllocate = ptb->samplesAllocated * 2;
+		else
+			samplesToAllocate = nSamples;
 
-			ptb->samplesAllocated = samplesToAllocate;
+		ptb->bytesEachSample = (uint32_t*)REALLOC(ptb->bytesEachSample, sizeof(uint32_t)*samplesToAllocate);
+		if (ptb->bytesEachSample == NULL) {
+			ptb->samplesAllocated = 0;
+			return false;
 		}
+
+		ptb->samplesAllocated = samplesToAllocate;
 	}
 
 	return true;
@@ -587,10 +1053,9 @@ bool ensureSampleBufferAdditionalCapacity(SampleBuffer *ptb, uint32_t nSamplesAd
 
 // clear the buffer without freeing memory
 void clearSampleBuffer(SampleBuffer *ptb) {
-	memset(ptb->data, 0, ptb->dataAllocated);
-	memset(ptb->bytesEachSample, 0, ptb->samplesAllocated*sizeof(uint32_t));
 	ptb->nSamples = 0;
 	ptb->nDataBytes = 0;
+	ptb->bytesFixed = 0;
 	ptb->samplesDifferentSizes = false;
 }
 
@@ -606,24 +1071,46 @@ void freeSampleBuffer(SampleBuffer *ptb) {
 	ptb->samplesAllocated = 0;
 	ptb->nSamples = 0;
 	ptb->nDataBytes = 0;
+	ptb->bytesFixed = 0;
 	ptb->samplesDifferentSizes = false;
 }
 
+// the first sample with a different size has arrived: start keeping track of the size of
+// each sample, filling in the fixed stride for the samples received so far
+static bool trackSampleBufferSizes(SampleBuffer *ptb) {
+	ptb->samplesDifferentSizes = true;
+
+	bool success = ensureSampleBufferAdditionalCapacity(ptb, 1, 0);
+	if ( !success )
+		return false;
+
+	for (uint32_t i = 0; i < ptb->nSamples; i++)
+		ptb->bytesEachSample[i] = ptb->bytesFixed;
+
+	return true;
+}
+
 bool pushSampleToSampleBuffer(SampleBuffer *ptb, uint32_t nDataBytes, const uint8_t *data) {
 	// allocate space for the additional samples
 	bool success = ensureSampleBufferAdditionalCapacity(ptb, 1, nDataBytes);
 	if ( !success )
 		return false;
 
+	// samples share a fixed stride until one with a different size arrives
+	if (ptb->nSamples == 0)
+		ptb->bytesFixed = nDataBytes;
+	else if (!ptb->samplesDifferentSizes && nDataBytes != ptb->bytesFixed) {
+		success = trackSampleBufferSizes(ptb);
+		if ( !success )
+			return false;
+	}
+
 	// store the new data
 	memcpy(ptb->data + ptb->nDataBytes, data, nDataBytes);
 
 	// and the size of this sample
-	ptb->bytesEachSample[ptb->nSamples] = nDataBytes;
-
-	// check whether samples remained same size as previous
-	if (ptb->nSamples > 1 && ptb->bytesEachSample[ptb->nSamples] != ptb->bytesEachSample[ptb->nSamples-1])
-		ptb->samplesDifferentSizes = true;
+	if (ptb->samplesDifferentSizes)
+		ptb->bytesEachSample[ptb->nSamples] = nDataBytes;
 
 	// increment the used counters
 	ptb->nSamples++;
@@ -632,12 +1119,79 @@ bool pushSampleToSampleBuffer(SampleBuffer *ptb, uint32_t nDataBytes, const uint
 	return true;
 }
 
+bool sampleBufferDataEquals(const SampleBuffer *ptb, uint32_t nDataBytes, const uint8_t *data) {
+	if (ptb->nSamples != 1 || ptb->nDataBytes != nDataBytes)
+		return false;
+
+	return nDataBytes == 0 || memcmp(ptb->data, data, nDataBytes) == 0;
+}
+
 // dump all existing values and add the new ones
 bool replaceSampleBufferData(SampleBuffer *ptb, uint32_t nDataBytes, const uint8_t *data) {
 	clearSampleBuffer(ptb);
 	return pushSampleToSampleBuffer(ptb, nDataBytes, data);
 }
 
+//////// COLUMN BUFFER UTILS ////////
+
+// ensure that every column of pcb can accommodate nRows, at pg->expectedBytes bytes per row
+// returns true if successful, false if couldn't allocate enough memory
+bool ensureColumnBufferCapacity(ColumnBuffer *pcb, const GroupInfo *pg, uint32_t nRows) {
+	uint32_t rowsToAllocate;
+
+	if (pcb->columns == NULL) {
+		// not allocated yet, one column pointer per signal
+		pcb->columns = (uint8_t**)CALLOC(sizeof(uint8_t*), pg->nSignals);
+		if (pcb->columns == NULL)
+			return false;
+
+		pcb->rowsAllocated = 0;
+		pcb->nRows = 0;
+	}
+
+	if (pcb->rowsAllocated >= nRows)
+		return true;
+
+	// allocate more rows, either double the allocated space or the needed rows, whichever is larger
+	if (pcb->rowsAllocated*2 > nRows)
+		rowsToAllocate = pcb->rowsAllocated * 2;
+	else
+		rowsToAllocate = nRows;
+
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		uint8_t *column = (uint8_t*)REALLOC(pcb->columns[i], (size_t)rowsToAllocate * pg->expectedBytes[i]);
+		if (column == NULL)
+			return false;
+		pcb->columns[i] = column;
+	}
+
+	pcb->rowsAllocated = rowsToAllocate;
+
+	return true;
+}
+
+// clear the buffer without freeing memory
+void clearColumnBuffer(ColumnBuffer *pcb) {
+	pcb->nRows = 0;
+	pcb->spilled = false;
+}
+
+// free the internal memory used by a ColumnBuffer
+void freeColumnBuffer(ColumnBuffer *pcb, uint16_t nSignals) {
+	if (pcb->columns != NULL) {
+		for (unsigned i = 0; i < nSignals; i++) {
+			if (pcb->columns[i] != NULL)
+				FREE(pcb->columns[i]);
+		}
+		FREE(pcb->columns);
+		pcb->columns = NULL;
+	}
+
+	pcb->rowsAllocated = 0;
+	pcb->nRows = 0;
+	pcb->spilled = false;
+}
+
 ////// DATA LOGGER STATUS //////
 
 bool processControlSignalSamples(unsigned nSamples, const SignalSample *samples) {
@@ -813,6 +1367,8 @@ void freeDataLoggerStatus(DataLoggerStatus *dlStatus) {
 
 	if (dlStatus->gtrie != NULL)
 		freeGroupInfoTrie(dlStatus->gtrie);
+	if (dlStatus->metaCache != NULL)
+		dlStatus->freeMetaCache(dlStatus->metaCache);
 
 	FREE(dlStatus);
 }
@@ -821,6 +1377,11 @@ DataLoggerStatus *controlGetCurrentStatus() {
 	return dlStatusCurrent;
 }
 
+DataLoggerStatusByTrial *controlGetCurrentStatusByTrial() {
+	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
+	return dlStatus->byTrial + dlStatus->currentTrial;
+}
+
 unsigned controlGetCurrentTrialIndex() {
 	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
 	return dlStatus->currentTrial;
@@ -832,6 +1393,14 @@ bool controlGetWaitingForNextTrial() {
 	return dlStatus->pendingNextTrial;
 }
 
+void controlSetParamChangeLog(bool enabled) {
+	paramChangeLogEnabled = enabled;
+}
+
+bool controlGetParamChangeLog() {
+	return paramChangeLogEnabled;
+}
+
 // clear all the data associated with a particular trial without deallocating buffers
 // DOES NOT lock mutex for that data logger status
 void controlClearTrialData(DataLoggerStatus *dlStatus, unsigned trialIdx) {
@@ -841,13 +1410,8 @@ void controlClearTrialData(DataLoggerStatus *dlStatus, unsigned trialIdx) {
 
 	while (groupNode != NULL) {
 		GroupInfo *pg = (GroupInfo*)groupNode->value;
-		// clear each signal's buffer for that trial
-		for (unsigned i = 0; i < pg->nSignals; i++) {
-			clearSampleBuffer(pg->signals[i]->buffers + trialIdx);
-		}
-
-		// clear timestamp buffer for that trial
-		clearTimestampBuffer(pg->tsBuffers + trialIdx);
+		// clear each signal's buffer, the column and timestamp buffers for that trial
+		clearGroupInfoTrialData(pg, trialIdx);
 
 		// get next group
 		groupNode = getNextGroupNode(groupNode);
@@ -856,23 +1420,52 @@ void controlClearTrialData(DataLoggerStatus *dlStatus, unsigned trialIdx) {
 	PTHREAD_MUTEX_UNLOCK(&dlStatus->mutex);
 }
 
-// lock the mutex for this dlStatus, and then find the next non-utilized trial in the array of trials
-// returns the trialIdx if there is one or -1 if no trials may be written
-int controlGetNextCompleteTrialToWrite(DataLoggerStatus *dlStatus) {
+// find a complete trial in dlStatus not already being written, either the oldest or
+// the one with the fewest bytes buffered, and mark it as being written
+// must hold dlStatus->mutex
+static void assignDataRoots(DataLoggerStatus *dlStatus, DataRootAssignFn assignFn) {
+	while (true) {
+		int next = -1;
+		for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
+			const DataLoggerStatusByTrial *dlTrial = dlStatus->byTrial + i;
+			if (!dlTrial->completed || !dlTrial->utilized || dlTrial->dataRootAssigned || dlTrial->writeSeq == 0)
+				continue;
+			if (next < 0 || dlTrial->writeSeq < dlStatus->byTrial[next].writeSeq)
+				next = i;
+		}
+		if (next < 0)
+			break;
+
+		dlStatus->byTrial[next].dataRoot = assignFn(dlStatus, next);
+		dlStatus->byTrial[next].dataRootAssigned = true;
+	}
+}
+
+static int claimCompleteTrialToWrite(DataLoggerStatus *dlStatus, bool smallestFirst, int dataRoot,
+		DataRootAssignFn assignFn) {
 	PTHREAD_MUTEX_LOCK(&dlStatus->mutex);
 
+	if (assignFn != NULL)
+		assignDataRoots(dlStatus, assignFn);
+
 	// find the next trial slot in the buffer that isn't being actively logged
-	// this must find something since only one trial should be actively writing at any point in time
 	bool found = false;
-	unsigned newTrial;
+	unsigned newTrial = 0;
 	for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
-		 newTrial = (dlStatus->currentTrial + i + 1) % BUFFER_NUM_TRIALS;
-		 if (!dlStatus->byTrial[newTrial].activeLogging &&
-				  dlStatus->byTrial[newTrial].completed &&
-					dlStatus->byTrial[newTrial].utilized) {
-			 found = true;
-			 break;
-		 }
+		unsigned trialIdx = (dlStatus->currentTrial + i + 1) % BUFFER_NUM_TRIALS;
+		DataLoggerStatusByTrial *dlTrial = dlStatus->byTrial + trialIdx;
+
+		if (dlTrial->activeLogging || dlTrial->activeWriting || !dlTrial->completed || !dlTrial->utilized)
+			continue;
+		if (assignFn != NULL && dataRoot >= 0 && dlTrial->dataRootAssigned && dlTrial->dataRoot != (unsigned)dataRoot)
+			continue;
+
+		if (!found || (smallestFirst && dlTrial->nBytesBuffered < dlStatus->byTrial[newTrial].nBytesBuffered)) {
+			newTrial = trialIdx;
+			found = true;
+			if (!smallestFirst)
+				break;
+		}
 	}
 
 	if (found)
@@ -886,6 +1479,54 @@ int controlGetNextCompleteTrialToWrite(DataLoggerStatus *dlStatus) {
 		return -1;
 }
 
+// lock the mutex for this dlStatus, and then find the next non-utilized trial in the array of trials
+// returns the trialIdx if there is one or -1 if no trials may be written
+int controlGetNextCompleteTrialToWrite(DataLoggerStatus *dlStatus) {
+	return claimCompleteTrialToWrite(dlStatus, false, -1, NULL);
+}
+
+int controlClaimSmallestCompleteTrialToWrite(DataLoggerStatus *dlStatus) {
+	return claimCompleteTrialToWrite(dlStatus, true, -1, NULL);
+}
+
+int controlClaimSmallestCompleteTrialForDataRoot(DataLoggerStatus *dlStatus, int dataRoot, DataRootAssignFn assignFn) {
+	return claimCompleteTrialToWrite(dlStatus, true, dataRoot, assignFn);
+}
+
+static void findLowestPendingWriteSeq(DataLoggerStatus *dlStatus, bool *found, uint32_t *pSeq) {
+	PTHREAD_MUTEX_LOCK(&dlStatus->mutex);
+
+	for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
+		const DataLoggerStatusByTrial *dlTrial = dlStatus->byTrial + i;
+		if (!dlTrial->completed || !dlTrial->utilized || dlTrial->writeSeq == 0)
+			continue;
+
+		if (!*found || dlTrial->writeSeq < *pSeq) {
+			*pSeq = dlTrial->writeSeq;
+			*found = true;
+		}
+	}
+
+	PTHREAD_MUTEX_UNLOCK(&dlStatus->mutex);
+}
+
+bool controlGetLowestPendingWriteSeq(uint32_t *pSeq) {
+	bool found = false;
+
+	PTHREAD_MUTEX_LOCK(&dlStatusesRetiredMutex);
+
+	for (unsigned i = 0; i < nStatusesRetired; i++)
+		findLowestPendingWriteSeq(dlStatusesRetired[i], &found, pSeq);
+
+	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
+	if (dlStatus != NULL)
+		findLowestPendingWriteSeq(dlStatus, &found, pSeq);
+
+	PTHREAD_MUTEX_UNLOCK(&dlStatusesRetiredMutex);
+
+	return found;
+}
+
 void controlMarkTrialWritten(DataLoggerStatus *dlStatus, unsigned trialIdx) {
 	PTHREAD_MUTEX_LOCK(&dlStatus->mutex);
 
@@ -893,6 +1534,8 @@ void controlMarkTrialWritten(DataLoggerStatus *dlStatus, unsigned trialIdx) {
 	dlStatus->byTrial[trialIdx].utilized = false;
 	dlStatus->byTrial[trialIdx].completed = false;
 	dlStatus->byTrial[trialIdx].activeLogging = false;
+	dlStatus->byTrial[trialIdx].writeSeq = 0;
+	dlStatus->byTrial[trialIdx].dataRootAssigned = false;
 
 	PTHREAD_MUTEX_UNLOCK(&dlStatus->mutex);
 }
@@ -998,6 +1641,8 @@ void controlFlushTrialsOlderThan(timestamp_t nSeconds) {
 			dlStatus->byTrial[i].activeLogging= false;
 			dlStatus->byTrial[i].completed = false;
 			dlStatus->byTrial[i].wallclockEnd = 0;
+			dlStatus->byTrial[i].writeSeq = 0;
+			dlStatus->byTrial[i].dataRootAssigned = false;
 		}
 	}
 
@@ -1011,8 +1656,50 @@ void controlMarkTrialComplete(DataLoggerStatus *dlStatus, unsigned trialIdx) {
 
 	dlStatus->byTrial[trialIdx].completed = true;
 	dlStatus->byTrial[trialIdx].activeLogging = false;
+	dlStatus->byTrial[trialIdx].completedAt = getMonotonicTime();
+	if (dlStatus->byTrial[trialIdx].utilized && dlStatus->byTrial[trialIdx].writeSeq == 0)
+		dlStatus->byTrial[trialIdx].writeSeq = trialWriteSeqNext++;
 
 	PTHREAD_MUTEX_UNLOCK(&dlStatus->mutex);
+
+	controlNotifyWriter();
+}
+
+void controlNotifyWriter() {
+	pthread_mutex_lock(&writerWakeMutex);
+	writerWakeSeq++;
+	pthread_cond_broadcast(&writerWakeCond);
+	pthread_mutex_unlock(&writerWakeMutex);
+}
+
+static void unlockWriterWakeMutex(void *dummy) {
+	pthread_mutex_unlock(&writerWakeMutex);
+}
+
+bool controlWaitForWriterWork(uint32_t *seqSeen, double timeoutSec) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += (time_t)timeoutSec;
+	deadline.tv_nsec += (long)((timeoutSec - floor(timeoutSec)) * 1e9);
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	int rc = 0;
+	bool woken;
+	pthread_mutex_lock(&writerWakeMutex);
+	// pthread_cond_timedwait is a cancellation point, release the mutex if cancelled there
+	pthread_cleanup_push(unlockWriterWakeMutex, NULL);
+
+	while (writerWakeSeq == *seqSeen && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&writerWakeCond, &writerWakeMutex, &deadline);
+
+	woken = writerWakeSeq != *seqSeen;
+	*seqSeen = writerWakeSeq;
+
+	pthread_cleanup_pop(1);
+	return woken;
 }
 
 // something in the status is about to change and we need to abandon the current one,
@@ -1029,12 +1716,12 @@ DataLoggerStatus *controlAdvanceToNewStatus() {
 
 	dlStatusCurrent = dlStatusNew;
 
-	// then push the old status to the retired list
-	controlPushRetiredStatus(dlStatusPrev);
-
 	// mark the trial we were just using as finished
 	controlMarkTrialComplete(dlStatusPrev, dlStatusPrev->currentTrial);
 
+	// then push the old status to the retired list, after which it is left to the writers
+	controlPushRetiredStatus(dlStatusPrev);
+
 	return dlStatusNew;
 }
 
@@ -1048,6 +1735,8 @@ void controlPushRetiredStatus(DataLoggerStatus *dlStatus) {
 	dlStatusesRetired[nStatusesRetired++] = dlStatus;
 
 	PTHREAD_MUTEX_UNLOCK(&dlStatusesRetiredMutex);
+
+	controlNotifyWriter();
 }
 
 DataLoggerStatus *controlPopRetiredStatus() {
@@ -1058,15 +1747,44 @@ DataLoggerStatus *controlPopRetiredStatus() {
 
 		// technically it's a LIFO rather than FIFO buffer, but it doesn't matter really
 		// as long as no data gets lost
-		DataLoggerStatus *ret = dlStatusesRetired[nStatusesRetired-1];
-		dlStatusesRetired[nStatusesRetired-1] = NULL;
-		nStatusesRetired--;
+		DataLoggerStatus *ret = NULL;
+		if (nStatusesRetired > 0) {
+			ret = dlStatusesRetired[nStatusesRetired-1];
+			dlStatusesRetired[nStatusesRetired-1] = NULL;
+			nStatusesRetired--;
+
+			// the caller holds on to it until controlReleaseStatus
+			ret->writerRefs++;
+			ret->freeWhenReleased = true;
+		}
 
 		PTHREAD_MUTEX_UNLOCK(&dlStatusesRetiredMutex);
 		return ret;
 	}
 }
 
+DataLoggerStatus *controlAcquireCurrentStatus() {
+	PTHREAD_MUTEX_LOCK(&dlStatusesRetiredMutex);
+
+	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
+	if (dlStatus != NULL)
+		dlStatus->writerRefs++;
+
+	PTHREAD_MUTEX_UNLOCK(&dlStatusesRetiredMutex);
+	return dlStatus;
+}
+
+void controlReleaseStatus(DataLoggerStatus *dlStatus) {
+	PTHREAD_MUTEX_LOCK(&dlStatusesRetiredMutex);
+
+	bool freeStatus = --dlStatus->writerRefs == 0 && dlStatus->freeWhenReleased;
+
+	PTHREAD_MUTEX_UNLOCK(&dlStatusesRetiredMutex);
+
+	if (freeStatus)
+		freeDataLoggerStatus(dlStatus);
+}
+
 void controlFlushRetiredStatuses() {
 	DataLoggerStatus *dlStatus;
 	while ((dlStatus = controlPopRetiredStatus()) != NULL)
@@ -1124,9 +1842,16 @@ unsigned controlAdvanceToNextTrial(uint32_t trialId, bool continuingSameTrial) {
 	dlStatus->byTrial[newTrial].activeLogging = true;
 	dlStatus->byTrial[newTrial].completed = false;
 	dlStatus->byTrial[newTrial].utilized = false;
+	dlStatus->byTrial[newTrial].writeSeq = 0;
+	dlStatus->byTrial[newTrial].dataRootAssigned = false;
+	dlStatus->byTrial[newTrial].nBytesBuffered = 0;
+	memset(dlStatus->byTrial[newTrial].nBytesByGroupType, 0, sizeof(dlStatus->byTrial[newTrial].nBytesByGroupType));
 
 	dlStatus->byTrial[lastTrial].completed = true;
 	dlStatus->byTrial[lastTrial].activeLogging = false;
+	dlStatus->byTrial[lastTrial].completedAt = getMonotonicTime();
+	if (dlStatus->byTrial[lastTrial].utilized && dlStatus->byTrial[lastTrial].writeSeq == 0)
+		dlStatus->byTrial[lastTrial].writeSeq = trialWriteSeqNext++;
 
 	dlStatus->currentTrial = newTrial;
 
@@ -1138,6 +1863,9 @@ unsigned controlAdvanceToNextTrial(uint32_t trialId, bool continuingSameTrial) {
 
 	PTHREAD_MUTEX_UNLOCK(&dlStatus->mutex);
 
+	// the trial we just left may be written now
+	controlNotifyWriter();
+
 /*
 	if (autoTrialId)
 		logInfo("Signal: Advancing to new trial, trialId = <automatic by time>\n");
@@ -37,6 +37,9 @@
 #define GROUP_TYPE_SPIKE   5
 #define GROUP_TYPE_FIELD   6
 
+// group types below this are counted and configured separately, see nBytesByGroupType
+#define MAX_GROUP_TYPES    8
+
 ///////////// SIGNAL TYPE DEFINITIONS /////////////
 
 // see addGroupTimestampsField to see how 1 and 2 are used
@@ -106,7 +109,9 @@ typedef double double_t;
 
 /////////// DATA STRUCTURES //////////////
 
-#define BUFFER_NUM_TRIALS 3
+// one trial being logged, one free to advance into, and the rest for trials
+// waiting on or being written by the writer threads
+#define BUFFER_NUM_TRIALS 8
 
 typedef Trie GroupTrie;
 typedef double timestamp_t; // timestamps in ms
@@ -136,6 +141,15 @@ typedef struct DataLoggerStatusByTrial {
 
 	timestamp_t timestampStart; // timestamps provided by the xpc computer (milliseconds)
 	timestamp_t timestampEnd;   // most recently updated group
+
+	double completedAt;         // getMonotonicTime() when the trial was marked complete
+	uint32_t writeSeq;          // assigned in order of completion, the order trials go into the index files
+	uint64_t nBytesBuffered;    // data bytes received, so that writers can take smaller trials first
+	uint64_t nBytesByGroupType[MAX_GROUP_TYPES]; // the same split by group type, for the binary trial index
+
+	// data root the trial is written to, assigned once complete, see controlClaimSmallestCompleteTrialForDataRoot
+	bool dataRootAssigned;
+	unsigned dataRoot;
 } DataLoggerStatusByTrial;
 
 // and collect this info here
@@ -147,6 +161,11 @@ typedef struct DataLoggerStatus {
 	// before freeing all memory
 	bool retired;
 
+	// number of writer threads using this status, guarded by the retired statuses mutex.
+	// once retired and popped, the last writer to release it frees it
+	unsigned writerRefs;
+	bool freeWhenReleased;
+
 	// for thread-safe buffering and access
 	pthread_mutex_t mutex;
 	pthread_mutexattr_t mutexAttr;
@@ -170,16 +189,39 @@ typedef struct DataLoggerStatus {
 	unsigned currentTrial; // indexes into all arrays marked with length [BUFFER_NUM_TRIALS]
 	DataLoggerStatusByTrial byTrial[BUFFER_NUM_TRIALS];
 	GroupTrie* gtrie;
+
+	// meta data built from gtrie that the writers reuse, and how to free it with the status
+	void* metaCache;
+	void (*freeMetaCache)(void*);
 } DataLoggerStatus;
 
+// regularly spaced whole millisecond timestamps start, start+step, ..., start+(count-1)*step
+typedef struct TimestampRun {
+	uint32_t start;
+	uint32_t step;
+	uint32_t count;
+} TimestampRun;
+
 // timestamps are buffered inside GroupInfo (for each trial)
+//
+// xPC timestamps are whole milliseconds and most groups tick regularly, so timestamps are stored
+// as runs until a fractional timestamp arrives or the runs stop paying off. From then on
+// (until cleared) each timestamp is stored explicitly as uint32 ms, plus a single offset once
+// any sample has a nonzero offset (see SIGNAL_TYPE_TIMESTAMPOFFSET)
 typedef struct TimestampBuffer {
-	timestamp_t* timestamps;
+	TimestampRun* runs;
+	uint32_t nRuns;
+	uint32_t runsAllocated;
+
+	bool explicitTimestamps;
+	uint32_t* ms;
+	single_t* offsets;  // NULL or all zero until a nonzero offset arrives
+	bool hasOffsets;
 
 	// in use
 	uint32_t nSamples;
 
-	// allocated
+	// allocated (explicit timestamps)
 	uint32_t samplesAllocated;
 } TimestampBuffer;
 
@@ -194,16 +236,48 @@ typedef struct SampleBuffer {
 	uint32_t nSamples;
 	uint32_t nDataBytes;
 
-	// how many bytes in each sample
-	uint32_t* bytesEachSample;
+	// how many bytes in every sample, valid while samplesDifferentSizes is false
+	uint32_t bytesFixed;
 
 	// have all samples so far have had same size?
 	bool samplesDifferentSizes;
 
+	// how many bytes in each sample, only allocated and filled once samplesDifferentSizes
+	uint32_t* bytesEachSample;
+
 	// length of bytesEachSample allocated
 	uint32_t samplesAllocated;
 } SampleBuffer;
 
+// groups whose signals all have a fixed size are buffered column-wise inside GroupInfo
+// (for each trial): one row per received sample, one contiguous column per signal
+typedef struct ColumnBuffer {
+	// rows in use
+	uint32_t nRows;
+
+	// rows allocated in every column
+	uint32_t rowsAllocated;
+
+	// one column per signal, each rowsAllocated * expectedBytes[iSignal] bytes
+	uint8_t** columns;
+
+	// a sample arrived with an unexpected size this trial, so the rows were moved
+	// to the signals' SampleBuffers and the rest of the trial is buffered there
+	bool spilled;
+} ColumnBuffer;
+
+// read-only view of the samples buffered for one signal in one trial,
+// wherever they are stored (SampleBuffer or the group's ColumnBuffer)
+typedef struct SampleBufferView {
+	const uint8_t* data;
+	uint32_t nSamples;
+	uint32_t nDataBytes;
+
+	// every sample has bytesFixed bytes, unless bytesEachSample is not NULL
+	uint32_t bytesFixed;
+	const uint32_t* bytesEachSample;
+} SampleBufferView;
+
 // pre-declare since the reference is circular below
 struct SignalDataBuffer;
 
@@ -222,6 +296,16 @@ typedef struct GroupInfo {
 	struct SignalDataBuffer** signals;
 
 	TimestampBuffer tsBuffers[BUFFER_NUM_TRIALS];
+
+	// ingest plan, computed once by addGroupInfoToTrie from the first samples of the group
+	int idxSignalTimestamp;       // SIGNAL_TYPE_TIMESTAMP signal overriding the header timestamp, or -1
+	int idxSignalTimestampOffset; // SIGNAL_TYPE_TIMESTAMPOFFSET signal adjusting the timestamps, or -1
+	bool* replaceSignal;          // for each signal, whether a new value replaces the last (params)
+	uint32_t* expectedBytes;      // bytes of the first sample of each signal
+
+	// fixed layout analog groups are buffered in columns rather than per signal
+	bool isColumnar;
+	ColumnBuffer columnBuffers[BUFFER_NUM_TRIALS];
 } GroupInfo;
 
 // signal sample buffer plus metadata about signal
@@ -251,10 +335,27 @@ typedef struct SignalDataBuffer {
 
 	// pointer back to the group info for convenience
 	GroupInfo* pGroupInfo;
+	uint16_t indexInGroup;   // position within pGroupInfo->signals
 
 	// buffers for signal data, we hold several trials simultaneously and loop through them so
 	// that the writer thread has time to keep up with the network-receive thread
 	SampleBuffer buffers[BUFFER_NUM_TRIALS];
+
+	// param values are only copied into buffers when they change
+	SampleBuffer lastValue;          // last received value, kept across trials
+	timestamp_t lastChangeTimestamp; // when lastValue was first received
+
+	// optional param change log, each distinct value received during the trial and when it arrived
+	SampleBuffer changeValues[BUFFER_NUM_TRIALS];
+	TimestampBuffer changeTimes[BUFFER_NUM_TRIALS];
+
+	// with params written only on change, the value last written in full and where, see writer.c
+	bool writtenValueValid;
+	uint64_t writtenValueHash;
+	uint8_t *writtenValue;           // compared in full when the hash matches
+	size_t writtenValueBytes;
+	uint64_t writtenSaveTagKey;
+	uint32_t writtenTrialId;
 } SignalDataBuffer;
 
 typedef struct SignalSample {
@@ -283,6 +384,7 @@ typedef struct SignalSample {
 uint8_t getSizeOfDataTypeId(uint8_t);
 const char* getDataTypeIdName(uint8_t);
 bool getGroupTypeName(uint8_t, char*);
+bool getGroupTypeByName(const char*, uint8_t*);
 bool getSignalTypeName(uint8_t, char*);
 
 bool mallocSignalSampleData(SignalSample*);
@@ -292,7 +394,7 @@ void printSignal(const SignalSample*);
 void printGroupInfo(const GroupInfo*);
 
 // -- TIMESTAMP BUFFER
-// ensure that TimestampBuffer can acccommodate nSamples of data, at bytesPerSample bytes each
+// ensure that TimestampBuffer can acccommodate nSamples of explicit timestamps
 // returns true if successful, false if couldn't allocate enough memory
 bool ensureTimestampBufferCapacity(TimestampBuffer*, uint32_t);
 bool ensureTimestampBufferAdditionalCapacity(TimestampBuffer*, uint32_t);
@@ -300,9 +402,19 @@ bool ensureTimestampBufferAdditionalCapacity(TimestampBuffer*, uint32_t);
 void clearTimestampBuffer(TimestampBuffer*);
 // free the internal memory used by a TimestampBuffer, but do not FREE the pointer itself
 void freeTimestampBuffer(TimestampBuffer*);
+// push a single timestamp, given as whole ms plus fractional offset, to a TimestampBuffer
+bool pushTimestampMsToTimestampBuffer(TimestampBuffer*, uint32_t, single_t);
+bool replaceTimestampBufferDataMs(TimestampBuffer*, uint32_t, single_t);
+// push n timestamps at once, ms may be NULL to use the same ms for each, offsets may be NULL if all zero
+bool pushTimestampsMsToTimestampBuffer(TimestampBuffer*, uint32_t n, const uint32_t* ms, uint32_t msConstant, const single_t* offsets);
 // push a single timestamp to a TimestampBuffer
 bool pushTimestampToTimestampBuffer(TimestampBuffer*, timestamp_t);
 bool replaceTimestampBufferData(TimestampBuffer*, timestamp_t);
+// write the nSamples timestamps minus offset into dest
+void copyTimestampBufferData(const TimestampBuffer*, timestamp_t*, timestamp_t);
+// the same for only the timestamps from firstSample on, at most nSamples of them
+void copyTimestampBufferDataRange(const TimestampBuffer*, uint32_t firstSample, uint32_t nSamples,
+		timestamp_t*, timestamp_t);
 
 // -- SAMPLE BUFFER
 // ensure that SampleBuffer can acccommodate nSamples of data, at bytesPerSample bytes each
@@ -314,9 +426,19 @@ void clearSampleBuffer(SampleBuffer*);
 // free the internal memory used by a SampleBuffer
 void freeSampleBuffer(SampleBuffer*);
 bool pushSampleToSampleBuffer(SampleBuffer*, uint32_t, const uint8_t*);
+// returns true if SampleBuffer holds exactly one sample equal to the given data
+bool sampleBufferDataEquals(const SampleBuffer*, uint32_t, const uint8_t*);
 // dump all existing values and add the new ones
 bool replaceSampleBufferData(SampleBuffer*, uint32_t, const uint8_t*);
 
+// -- COLUMN BUFFER
+// ensure that every column in ColumnBuffer can accommodate nRows
+bool ensureColumnBufferCapacity(ColumnBuffer*, const GroupInfo*, uint32_t);
+// clear the buffer without freeing memory
+void clearColumnBuffer(ColumnBuffer*);
+// free the internal memory used by a ColumnBuffer
+void freeColumnBuffer(ColumnBuffer*, uint16_t);
+
 // -- SIGNAL DATA BUFFER
 bool checkSignalDataBufferMatchesSample(const SignalDataBuffer*, const SignalSample*);
 // build a new SignalDataBuffer and copy metadata from a SignalSample
@@ -327,15 +449,25 @@ SignalDataBuffer* buildSignalDataBufferFromSample(const SignalSample*);
 bool pushSignalSampleToSignalDataBuffer(SignalDataBuffer*, const SignalSample*);
 // free memory used by a signal data buffer object but not the pointer itself
 void freeSignalDataBuffer(SignalDataBuffer*);
+// fill SampleBufferView with the samples buffered for this signal in trialIdx
+void getSignalSampleView(const SignalDataBuffer*, unsigned, SampleBufferView*);
+// the same for only the samples from firstSample on, at most nSamples of them
+void getSignalSampleViewRange(const SignalDataBuffer*, unsigned, uint32_t firstSample, uint32_t nSamples,
+		SampleBufferView*);
 
 // -- GroupInfo and GroupTrie
 GroupInfo* findGroupInfoInTrie(const GroupInfo*);
-GroupInfo* addGroupInfoToTrie(const GroupInfo*);
+// add a new group to the trie, building its signal data buffers and ingest plan from the first samples
+GroupInfo* addGroupInfoToTrie(const GroupInfo*, const SignalSample*);
 void freeGroupInfo(GroupInfo*);
 void freeGroupInfoTrie(GroupTrie*);
 // push a timestamp or multiple timestamps to a group, checking the signals in samples for signals
 // of type SIGNAL_TYPE_TIMESTAMP or SIGNAL_TYPE_TIMESTAMPOFFSET and doing appropriate timestamp adjustments
 timestamp_t pushTimestampToGroupInfo(GroupInfo*, timestamp_t, const SignalSample* samples, int nSignals);
+// push one sample of every signal in the group to the current trial
+bool pushSignalSamplesToGroupInfo(GroupInfo*, const SignalSample*);
+// clear all buffered data of this group for trialIdx without deallocating buffers
+void clearGroupInfoTrialData(GroupInfo*, unsigned);
 // iterating over the signal trie
 GroupTrie* getCurrentGroupTrie();
 GroupTrie* getFirstGroupNode(GroupTrie*);
@@ -350,6 +482,9 @@ void controlTerminate();
 
 // returns true if data logger is waiting for next trial command before writing additional trials
 bool controlGetWaitingForNextTrial();
+// whether to keep a log of every param value change within each trial, off by default
+void controlSetParamChangeLog(bool);
+bool controlGetParamChangeLog();
 // receive a list of control signal samples and process them
 bool processControlSignalSamples(unsigned, const SignalSample*);
 // initialize dlStatus, optionally copying values from prevStatus if not NULL
@@ -378,10 +513,26 @@ unsigned controlManualSplitCurrentTrialMarkForWriting(DataLoggerStatus*);
 // find the next non-utilized trial in the array of trials
 // returns the trialIdx if there is one or -1 if no trials may be written
 int controlGetNextCompleteTrialToWrite(DataLoggerStatus*);
+// as above, but takes the complete trial with the fewest bytes buffered rather than the oldest
+int controlClaimSmallestCompleteTrialToWrite(DataLoggerStatus*);
+// picks the data root for a complete trial of the status, called with the status' mutex held
+typedef unsigned (*DataRootAssignFn)(const DataLoggerStatus*, unsigned trialIdx);
+// for writers split by data root: complete trials without a data root are assigned one by
+// assignFn in the order they were completed, then the smallest trial assigned to dataRoot is
+// claimed, or the smallest of all if dataRoot is negative
+int controlClaimSmallestCompleteTrialForDataRoot(DataLoggerStatus*, int dataRoot, DataRootAssignFn assignFn);
+// lowest writeSeq of any complete trial not yet written in the current or retired statuses
+// returns false if there are none
+bool controlGetLowestPendingWriteSeq(uint32_t*);
 void controlMarkTrialWritten(DataLoggerStatus*, unsigned);
 // mark this trial as utilized until at least this timestamp
 void controlMarkCurrentTrialUtilized(timestamp_t);
 void controlMarkTrialComplete(DataLoggerStatus*, unsigned);
+// wake the writer threads, called whenever a trial completes or a status is retired
+void controlNotifyWriter();
+// block until controlNotifyWriter has been called since *seqSeen was last updated, or timeoutSec elapses
+// returns true if woken by a notification. cancellation point for the writer threads
+bool controlWaitForWriterWork(uint32_t* seqSeen, double timeoutSec);
 void controlMarkTrialWritten(DataLoggerStatus*, unsigned);
 // advance to the next trial within the active DataLoggerStatus
 // begin writing immediately. return old trial idx
@@ -392,7 +543,11 @@ unsigned controlAdvanceToNextTrial(uint32_t, bool);
 // mark it as retired, and move to a new one
 DataLoggerStatus* controlAdvanceToNewStatus();
 void controlPushRetiredStatus(DataLoggerStatus*);
+// pop a retired status, which is freed by controlReleaseStatus once no writer is using it
 DataLoggerStatus* controlPopRetiredStatus();
+// hold on to the current status for writing, release with controlReleaseStatus
+DataLoggerStatus* controlAcquireCurrentStatus();
+void controlReleaseStatus(DataLoggerStatus*);
 void controlFlushRetiredStatuses();
 
 #endif // ifndef SIGNAL_H_INCLUDE
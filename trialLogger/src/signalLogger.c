@@ -20,6 +20,8 @@
 #include "utils.h"
 #include "signal.h"
 #include "writer.h"
+#include "fileio.h"
+#include "migrator.h"
 #include "parser.h"
 #include "network.h"
 
@@ -34,7 +36,57 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
 			parseNetworkAddress(arg, &recv_addr);
 			break;
 		case 'd':
-			setDataRoot(arg);
+			if (!addDataRoot(arg))
+				argp_error(state, "Too many data roots");
+			break;
+		case 't':
+			if (!setDataRootPolicy(arg))
+				argp_error(state, "Unknown data root policy %s", arg);
+			break;
+		case 'p':
+			controlSetParamChangeLog(true);
+			break;
+		case 'w':
+			setWriterThreadCount((unsigned)atoi(arg));
+			break;
+		case 'Z':
+			setCompressionThreadCount((unsigned)atoi(arg));
+			break;
+		case 'f':
+			if (!setOutputFormat(arg))
+				argp_error(state, "Unsupported output format %s", arg);
+			break;
+		case 'c':
+			setContainerOutput(true);
+			break;
+		case 'm':
+			setSchemaRegistry(true);
+			break;
+		case 'P':
+			setPackedVariableSize(true);
+			break;
+		case 'V':
+			setSplitSignalVariables(true);
+			break;
+		case 'o':
+			setParamsOnChange(true);
+			break;
+		case 'z':
+			if (!setGroupTypeCompression(arg))
+				argp_error(state, "Invalid compression %s", arg);
+			break;
+		case 'i':
+			if (!fileIoSetBackendByName(arg))
+				argp_error(state, "Unknown I/O backend %s", arg);
+			break;
+		case 's':
+			fileIoSetSyncLatency(atof(arg) / 1000);
+			break;
+		case 'S':
+			setStagingRoot(arg);
+			break;
+		case 'R':
+			migratorSetRateLimit(atof(arg) * 1e6);
 			break;
 		case ARGP_KEY_INIT: // passed before any parsing happenes
 			setNetworkAddress(&recv_addr, "", "", 29001);            // default network configuration for local server
@@ -59,7 +111,25 @@ int main(int argc, char *argv[]) {
 	// parse startup options
 	struct argp_option options[] = {
 		{ "recv", 'r', "IP:PORT or PORT", 0, "Specify IP address and port to receive packets"},
-		{ "dataroot", 'd', "PATH", 0, "Specify data root folder"},
+		{ "dataroot", 'd', "PATH", 0, "Specify data root folder, repeat to stripe trials over several roots each with its own writers"},
+		{ "stripe", 't', "rr|space|queue", 0,
+			"Assign trials to data roots in turn, by free space or by fewest trials queued (default rr)"},
+		{ "param-log", 'p', 0, 0, "Log each change of param values within a trial"},
+		{ "writers", 'w', "N", 0, "Number of threads writing trials to disk (default 1)"},
+		{ "compress-threads", 'Z', "N", 0, "Number of threads compressing v7.3 chunks for the writers (default one per CPU, at most 32)"},
+		{ "format", 'f', "v5|v7.3", 0, "MAT file format, v7.3 (HDF5) needs a build with HDF5=1 (default v5)"},
+		{ "container", 'c', 0, 0, "Append the trials of each saveTag to one .mtc container file instead of a .mat file per trial"},
+		{ "schema", 'm', 0, 0, "Keep each group layout once in the saveTag's schema.mat, trials' meta only lists the layouts they have"},
+		{ "packed", 'P', 0, 0, "Pack the samples of variable size signals into one vector with their lengths instead of a cell with an array each"},
+		{ "split", 'V', 0, 0, "Write each signal as a variable of its own so that it can be loaded alone, the trial variable only holds the trial's header"},
+		{ "params-on-change", 'o', 0, 0, "Write params only when their value changed since the last trial of the saveTag that has it, other trials refer to that one"},
+		{ "compress", 'z', "TYPE=CODEC[:LEVEL]", 0,
+			"Compression of v7.3 files by group type (control, param, analog, event, note or all), "
+			"CODEC is none, zlib, zstd or lz4 (default all=zlib)"},
+		{ "io", 'i', "auto|uring|pwrite", 0, "Write files through io_uring or pwrite, auto writes with pwrite and submits fsyncs through io_uring where the kernel has it (default auto)"},
+		{ "sync", 's', "MS", 0, "fsync trials and index files in groups, at most MS milliseconds after they were written (default no fsync)"},
+		{ "stage", 'S', "PATH", 0, "Write trials to fast local storage at PATH first and migrate them to the data roots in the background"},
+		{ "migrate-rate", 'R', "MB/S", 0, "Limit the migration of staged trials to MB/S megabytes per second (default no limit)"},
 		{ 0 }
 	};
 	struct argp argp = { options, parse_opt, 0, 0 };
@@ -71,7 +141,7 @@ int main(int argc, char *argv[]) {
 
 	// copy the default data root in, later make this an option?
 	if ( !checkDataRootAccessible() ) {
-		fprintf(stderr, "No read/write access to data root. Check writer permissions on %s", getDataRoot());
+		fprintf(stderr, "No read/write access to data root. Check writer permissions\n");
 		exit(1);
 	}
 	logInfo("Info: signal data root at %s\n", getDataRoot());
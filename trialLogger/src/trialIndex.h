@@ -0,0 +1,59 @@
+#ifndef TRIALINDEX_H_INCLUDED
+#define TRIALINDEX_H_INCLUDED
+
+// Binary trial index: trialIndex.bin sits next to the date folder's trialIndex.txt and gets a
+// fixed size record for every trial as it is logged, so that a session can be listed, counted
+// and filtered without opening any trial files. The file is a TrialIndexHeader followed by
+// the records, in host (little endian) byte order. Readers step through records by the
+// header's recordBytes, so fields may be added at the end later on.
+//
+// See trial-loader-mex/queryTrialIndex.c for the MATLAB side.
+
+#include <stdint.h>
+
+#define TRIAL_INDEX_FILE_NAME "trialIndex.bin"
+#define TRIAL_INDEX_MAGIC "MATUDPTI"
+#define TRIAL_INDEX_VERSION 1
+
+// matches MAX_GROUP_TYPES in signal.h
+#define TRIAL_INDEX_GROUP_TYPES 8
+#define TRIAL_INDEX_PROTOCOL_LENGTH 32
+#define TRIAL_INDEX_FILE_NAME_LENGTH 128
+
+// the file is still on the staging tier, fileName links to it until it's been migrated
+#define TRIAL_INDEX_FLAG_STAGED 0x1
+
+typedef struct TrialIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordBytes;
+} TrialIndexHeader;
+
+typedef struct TrialIndexRecord {
+	uint32_t trialId;
+	uint32_t saveTag;
+	double wallclockStart;   // sec since the unix epoch
+	double timestampStart;   // ms, as sent by the real-time machine
+	double timestampEnd;
+	double duration;         // ms, as in trial.duration
+
+	// where the trial is stored, fileOffset is that of its record in a container and 0 for
+	// .mat files. fileName is relative to the date folder on the first data root, as in
+	// trialIndex.txt
+	uint64_t fileOffset;
+	uint64_t fileBytes;
+
+	// data bytes received, indexed by GROUP_TYPE_*
+	uint64_t groupTypeBytes[TRIAL_INDEX_GROUP_TYPES];
+
+	uint32_t protocolVersion;
+	uint32_t dataRoot;       // which of the logger's data roots (-d) holds the file, fileName is a link
+	                         // to it in the first one
+	char protocol[TRIAL_INDEX_PROTOCOL_LENGTH];     // not terminated if it fills the field
+	char fileName[TRIAL_INDEX_FILE_NAME_LENGTH];    // terminated, empty if the name didn't fit
+
+	uint32_t flags;          // TRIAL_INDEX_FLAG_*, cleared in place as the trial moves
+	uint32_t reserved;
+} TrialIndexRecord;
+
+#endif // ifndef TRIALINDEX_H_INCLUDED
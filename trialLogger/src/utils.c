@@ -8,7 +8,10 @@
 #include <time.h>
 #include <math.h>
 #include <execinfo.h>
+
+#ifdef MATLAB_MEX_FILE
 #include "mex.h"
+#endif
 
 #include "signal.h"
 #include "utils.h"
@@ -98,6 +101,12 @@ double toc() {
     return totalElapsed;
     //logInfo("Elapsed time : %.6f seconds\n", totalElapsed);
 }
+
+double getMonotonicTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
 //#endif
 
 mxClassID convertDataTypeIdToMxClassId(uint8_t dataTypeId)
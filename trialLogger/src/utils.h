@@ -10,7 +10,7 @@
 	#include "mex.h"
 #endif
 
-#include "mat.h"
+#include "matfile.h"
 
 #include "errors.h"
 #include "signal.h"
@@ -21,6 +21,7 @@ void   ticPause();  // pause timer
 void   ticResume(); // resume timer
 double tocCheck();  // update and get the current elapsed time
 double toc();       // stop timer, get the elapsed time since the tic command
+double getMonotonicTime(); // seconds on a clock unaffected by wallclock adjustments
 
 #define SECONDS_IN_DAY 86400.0
 #define UNIX_EPOCH_OFFSET_SECONDS (719529.0 * SECONDS_IN_DAY)
@@ -3,45 +3,210 @@
 #include <stdio.h>    // printf(), etc.
 #include <stdlib.h>   // For EXIT_FAILURE, EXIT_SUCCESS, malloc etc.
 #include <string.h>   // string operations
+#include <strings.h>  // strcasecmp
 
-#include "mat.h"
+#include "matfile.h"
 
 #include <pthread.h>  // unix POSIX multi-threaded
 #include <unistd.h>   // standard symbolic constants and types, e.g. NULL
 #include <time.h>     // date and time information
 #include <math.h>     // mathematical functions
 #include <sys/stat.h> // data returned by the [f,l]stat() function
+#include <sys/statvfs.h> // free space on the data roots
+#include <fcntl.h>    // open
+#include <errno.h>    // EEXIST
 
 #include "errors.h"
 #include "utils.h"
 #include "signal.h"
 #include "signalLogger.h"
+#include "container.h"
+#include "trialIndex.h"
+#include "fileio.h"
+#include "migrator.h"
+#include "parser.h"
+#include "latestValues.h"
 
 #include "writer.h"
 
-#define WRITE_INTERVAL_USEC 10*1000
+// the writer is woken as soon as there is something to write, this is only a backstop
+#define WRITE_IDLE_TIMEOUT_SEC 1.0
 #define PATH_SEPARATOR "/"
+// how long the free space of a data root is trusted for before checking it again
+#define DATA_ROOT_FREE_SPACE_TTL_SEC 1.0
 
 typedef struct timespec timespec;
 
-pthread_t writerThread;
+// each writer thread claims complete trials on its own and keeps its own file info
+typedef struct WriterWorker {
+	pthread_t thread;
+	unsigned index;
+	unsigned dataRoot; // writes the trials assigned to this data root
+	uint32_t wakeSeq;
+	SignalFileInfo sigFileInfo;
+} WriterWorker;
+
+unsigned nWriterWorkers = 1;
+WriterWorker writerWorkers[MAX_WRITER_THREADS];
+// stored with release by signalWriterThreadTerminate, loaded with acquire by the writers between trials
+bool writerTerminating = false;
+
+// trials are written in parallel but logged to the index files in the order they were completed.
+// each trial being written has an entry until it has been logged, logging happens once no
+// trial with a lower writeSeq is still pending
+typedef struct IndexEntry {
+	uint32_t writeSeq;
+	bool written;
+	// trials appended to an existing container aren't logged again
+	bool logToIndex;
+	// trials that couldn't be written aren't logged to the binary index
+	bool logToBinaryIndex;
+	SignalFileInfo sigFileInfo;
+	// logged to the binary index whatever logToIndex says
+	TrialIndexRecord indexRecord;
+} IndexEntry;
+
+pthread_mutex_t indexMutex = PTHREAD_MUTEX_INITIALIZER;
+IndexEntry *indexEntries = NULL;
+unsigned nIndexEntries = 0;
+unsigned indexEntriesAllocated = 0;
+// index files currently open, shared by all writers
+SignalFileInfo indexFiles = { .indexFile = { -1 }, .saveTagIndexFile = { -1 }, .binaryIndexFile = { -1 } };
+
+// delay between a trial being marked complete and a writer starting on it, guarded by indexMutex
+typedef struct WriteDelayStats {
+	unsigned nTrials;
+	double totalSec;
+	double maxSec;
+} WriteDelayStats;
+WriteDelayStats writeDelayStats;
+
+// "w" for MAT v5 or "w7.3" for HDF5 based MAT 7.3 files, see setOutputFormat
+const char *matFileMode = "w";
+
+// threads compressing the chunks of MAT 7.3 files, 0 for one per online CPU up to
+// MAX_COMPRESSION_THREADS, see setCompressionThreadCount
+unsigned nCompressionThreads = 0;
+
+// append trials to one container per saveTag instead of writing a .mat file each, see container.h
+bool containerOutput = false;
+
+// keep the group layouts in each saveTag's schema registry instead of in every trial, see
+// setSchemaRegistry
+bool schemaRegistry = false;
+
+// write samples of signals that can't be concatenated packed into one vector instead of a cell
+// each, see setPackedVariableSize
+bool packedVariableSize = false;
+
+// write each signal of a trial as a top-level variable of its own, see setSplitSignalVariables
+bool splitSignalVariables = false;
+
+// write params only when they differ from the last trial of the saveTag written with them, see
+// setParamsOnChange
+bool paramsOnChange = false;
+pthread_mutex_t paramsOnChangeMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifndef MATLAB_MEX_FILE
+// compression of each group type's data in MAT 7.3 files, indexed by GROUP_TYPE_*
+typedef struct GroupTypeCompression {
+	MatCodec codec;
+	int level;
+} GroupTypeCompression;
+GroupTypeCompression groupTypeCompression[MAX_GROUP_TYPES] = {
+	{ MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 },
+	{ MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 }, { MAT_CODEC_ZLIB, -1 }
+};
+#endif
 
 typedef struct EventTrieInfo {
 	char eventName[MAX_SIGNAL_NAME];
 	TimestampBuffer tsBuffer;
 } EventTrieInfo;
 
+void freeEventTrieInfo(EventTrieInfo *info) {
+	freeTimestampBuffer(&info->tsBuffer);
+	FREE(info);
+}
+
+// trials are striped over the data roots, each with its own writer threads. The first root holds
+// the index files for all of them, and a link to every trial written to another root in the
+// saveTag folder the trial would have gone to, so that readers only ever look at the first one
+typedef struct DataRoot {
+	char path[MAX_FILENAME_LENGTH];
+	// from statvfs, refreshed after DATA_ROOT_FREE_SPACE_TTL_SEC
+	uint64_t bytesFree;
+	double bytesFreeCheckedAt;
+} DataRoot;
+
+DataRoot dataRoots[MAX_DATA_ROOTS] = { { "/data/udpTrialLogger" } };
+unsigned nDataRoots = 1;
+bool dataRootsGiven = false; // the first addDataRoot replaces the default
+DataRootPolicy dataRootPolicy = DATA_ROOT_ROUND_ROBIN;
+pthread_mutex_t dataRootMutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned dataRootNextRoundRobin = 0;
+
+// trials are written here first when set, mirroring the data roots' folders, see migrator.h
+char stagingRoot[MAX_FILENAME_LENGTH] = "";
+
+// meta.groups and meta.signals only change when groups are added to a status' trie, so each
+// status keeps them shared (see matShareArray) for all of its trials. Kept until the trie grows,
+// event groups' meta is still built each trial since it lists that trial's events
+typedef struct MetaCache {
+	unsigned refs;
+	unsigned generation; // tells caches apart, even one freed from another at the same address
+	unsigned nGroups;
+	struct {
+		const GroupInfo* pg;
+		mxArray* mxGroupMeta; // NULL for event groups
+	} *groups;
+	mxArray* mxSignalMeta;
+	mxArray* mxLayouts; // meta.layouts, with a schema registry only
+} MetaCache;
+
+#ifndef MATLAB_MEX_FILE
+// guards the statuses' metaCache and the refs of each, the arrays within are refcounted on their own
+pthread_mutex_t metaCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned metaCacheGeneration = 0;
+
+// the layouts registered in the schema.mat of the saveTag folders written to last. Each layout is
+// a variable named for the group's configHash and the hash of its name, since groups generated
+// from the same bus share a configHash, see buildSchemaEntry
+#define SCHEMA_REGISTRY_FILE_NAME "schema.mat"
+#define MAX_SCHEMA_REGISTRIES 4
+typedef struct SchemaRegistry {
+	char fileName[MAX_FILENAME_LENGTH];
+	uint64_t *keys;
+	unsigned nKeys;
+	unsigned keysAllocated;
+	// of the meta cache whose groups were all registered when last checked
+	unsigned checkedGeneration;
+} SchemaRegistry;
+
+pthread_mutex_t schemaRegistryMutex = PTHREAD_MUTEX_INITIALIZER;
+SchemaRegistry schemaRegistries[MAX_SCHEMA_REGISTRIES];
+unsigned schemaRegistryNextSlot = 0;
+#endif
+
 /// PRIVATE DECLARATIONS
-char dataRoot[MAX_FILENAME_LENGTH] = "/data/udpTrialLogger";
 
 void* signalWriterThread(void*);
 void signalWriterThreadCleanup(void* dummy);
 void updateSignalFileInfo(SignalFileInfo*, DataLoggerStatus*, unsigned);
+void updateSignalIndexFiles(SignalFileInfo*, const SignalFileInfo*);
+static bool updateDataDirectory(char*, const char*);
+static void linkToDataRoot(const SignalFileInfo*);
+static DataLoggerStatus* claimRetiredStatus();
 
-void writeTrialsToMATFile(DataLoggerStatus*);
-void writeTrialToMATFile(DataLoggerStatus*, unsigned);
+void writeTrialsToMATFile(WriterWorker*, DataLoggerStatus*, int);
+void writeTrialToMATFile(WriterWorker*, DataLoggerStatus*, unsigned);
 void writeMxArrayToSigFile(mxArray*, mxArray*, const SignalFileInfo*);
-void logToSignalIndexFile(const SignalFileInfo* pSigFileInfo);
+bool writeMxArrayToContainer(mxArray*, mxArray*, const SignalFileInfo*, uint32_t, double, TrialIndexRecord*, bool*);
+void logToSignalIndexFile(SignalFileInfo* pIndexFiles, const SignalFileInfo* pSigFileInfo);
+static void closeIndexFile(IndexFile*);
+static void fillTrialIndexRecord(TrialIndexRecord*, const DataLoggerStatus*, unsigned, const SignalFileInfo*);
+static off_t logToBinaryIndexFile(SignalFileInfo* pIndexFiles, const TrialIndexRecord* pRecord);
+static void migrateStagedFile(const SignalFileInfo*, const char*, off_t);
 
 void buildStructForTrial(DataLoggerStatus*, unsigned, bool, mxArray**, mxArray**);
 
@@ -53,105 +218,553 @@ mxArray* setSignalMetaFields(const SignalDataBuffer*, mxArray*, int);
 bool addGroupTimestampsField(mxArray* mxTrial, const GroupInfo* pg, unsigned trialIdx,
     timestamp_t timeTrialStart, bool useGroupPrefix, unsigned index, unsigned nSamples);
 void addSignalDataField(mxArray*, const SignalDataBuffer*, unsigned, bool, unsigned);
+void addParamChangeLogFields(mxArray*, const SignalDataBuffer*, unsigned, timestamp_t);
+uint64_t getSaveTagKey(const DataLoggerStatus*, unsigned);
+bool addParamReferenceField(mxArray*, SignalDataBuffer*, const DataLoggerStatus*, unsigned, unsigned, uint64_t);
 void addTrialMetaFields(mxArray*, const DataLoggerStatus*, unsigned);
 void addEventGroupFields(mxArray*, mxArray*, const GroupInfo*, unsigned, timestamp_t, bool, unsigned);
-SignalFileInfo sigFileInfo;
+
+static void addGroupSignalMeta(mxArray*, const GroupInfo*);
+static mxArray* buildSignalMeta(GroupTrie*);
+static mxArray* buildLayouts(GroupTrie*);
+static void registerSchemas(DataLoggerStatus*, const SignalFileInfo*);
+static MetaCache* acquireMetaCache(DataLoggerStatus*);
+static void releaseMetaCache(MetaCache*);
+static mxArray* retainCachedMeta(mxArray*);
 
 bool checkDataRootAccessible() {
-	// check that we have read and write access to the data root
-	return access( dataRoot, R_OK | W_OK ) != -1;
+	// check that we have read and write access to every data root
+	for (unsigned i = 0; i < nDataRoots; i++) {
+		if (access( dataRoots[i].path, R_OK | W_OK ) == -1) {
+			logError("Writer Error: No read/write access to data root %s\n", dataRoots[i].path);
+			return false;
+		}
+	}
+	if (stagingRoot[0] != '\0' && access( stagingRoot, R_OK | W_OK ) == -1) {
+		logError("Writer Error: No read/write access to staging root %s\n", stagingRoot);
+		return false;
+	}
+	return true;
 }
 
 const char *getDataRoot() {
-	return dataRoot;
+	return dataRoots[0].path;
 }
 
-void setDataRoot(const char *path) {
-	strncpy(dataRoot, path, MAX_FILENAME_LENGTH);
+static void copyRootPath(char *rootPath, const char *path) {
+	strncpy(rootPath, path, MAX_FILENAME_LENGTH - 1);
 
 	// strip trailing slash if found
-	int last = strnlen(dataRoot, MAX_FILENAME_LENGTH) - 1;
-	if (dataRoot[last] == '\\')
-		dataRoot[last] = '\0';
+	int last = strnlen(rootPath, MAX_FILENAME_LENGTH) - 1;
+	if (last > 0 && (rootPath[last] == '\\' || rootPath[last] == '/'))
+		rootPath[last] = '\0';
+}
+
+static void setDataRootPath(unsigned root, const char *path) {
+	copyRootPath(dataRoots[root].path, path);
+}
+
+void setDataRoot(const char *path) {
+	setDataRootPath(0, path);
+	nDataRoots = 1;
+	dataRootsGiven = true;
+
+	printf("Data root is now %s\n", dataRoots[0].path);
+}
+
+bool addDataRoot(const char *path) {
+	if (!dataRootsGiven) {
+		setDataRoot(path);
+		return true;
+	}
+	if (nDataRoots == MAX_DATA_ROOTS) {
+		logError("Writer Error: At most %d data roots can be used\n", MAX_DATA_ROOTS);
+		return false;
+	}
+
+	setDataRootPath(nDataRoots++, path);
+	printf("Data root %u is %s\n", nDataRoots - 1, dataRoots[nDataRoots - 1].path);
+	return true;
+}
+
+// "rr" takes the data roots in turn, "space" the one with the most free space left once the
+// trials queued for it are written, "queue" the one with the fewest trials queued
+bool setDataRootPolicy(const char *policy) {
+	if (strcasecmp(policy, "rr") == 0)
+		dataRootPolicy = DATA_ROOT_ROUND_ROBIN;
+	else if (strcasecmp(policy, "space") == 0)
+		dataRootPolicy = DATA_ROOT_FREE_SPACE;
+	else if (strcasecmp(policy, "queue") == 0)
+		dataRootPolicy = DATA_ROOT_QUEUE_DEPTH;
+	else {
+		logError("Writer Error: Unknown data root policy %s\n", policy);
+		return false;
+	}
+	return true;
+}
+
+// must hold dataRootMutex
+static uint64_t getDataRootBytesFree(DataRoot *pRoot) {
+	double now = getMonotonicTime();
+	if (pRoot->bytesFreeCheckedAt == 0 || now - pRoot->bytesFreeCheckedAt > DATA_ROOT_FREE_SPACE_TTL_SEC) {
+		struct statvfs st;
+		if (statvfs(pRoot->path, &st) == 0)
+			pRoot->bytesFree = (uint64_t)st.f_bavail * st.f_frsize;
+		else
+			pRoot->bytesFree = 0;
+		pRoot->bytesFreeCheckedAt = now;
+	}
+	return pRoot->bytesFree;
+}
+
+// called by the writers with the status' mutex held, see controlClaimSmallestCompleteTrialForDataRoot.
+// trials of this status waiting on or being written to a root count as its queue
+static unsigned assignDataRoot(const DataLoggerStatus *dlStatus, unsigned trialIdx) {
+	if (nDataRoots == 1)
+		return 0;
+
+	unsigned nQueued[MAX_DATA_ROOTS] = { 0 };
+	uint64_t bytesQueued[MAX_DATA_ROOTS] = { 0 };
+	for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
+		const DataLoggerStatusByTrial *dlTrial = dlStatus->byTrial + i;
+		if (dlTrial->completed && dlTrial->utilized && dlTrial->dataRootAssigned && dlTrial->dataRoot < nDataRoots) {
+			nQueued[dlTrial->dataRoot]++;
+			bytesQueued[dlTrial->dataRoot] += dlTrial->nBytesBuffered;
+		}
+	}
+
+	unsigned chosen = 0;
+	pthread_mutex_lock(&dataRootMutex);
+	switch (dataRootPolicy) {
+		case DATA_ROOT_ROUND_ROBIN:
+			chosen = dataRootNextRoundRobin++ % nDataRoots;
+			break;
+		case DATA_ROOT_FREE_SPACE: {
+			int64_t mostLeft = 0;
+			for (unsigned r = 0; r < nDataRoots; r++) {
+				int64_t left = (int64_t)getDataRootBytesFree(dataRoots + r) - (int64_t)bytesQueued[r];
+				if (r == 0 || left > mostLeft) {
+					chosen = r;
+					mostLeft = left;
+				}
+			}
+			break;
+		}
+		case DATA_ROOT_QUEUE_DEPTH:
+			// ties go round robin so that idle roots all get used
+			for (unsigned i = 0; i < nDataRoots; i++) {
+				unsigned r = (dataRootNextRoundRobin + i) % nDataRoots;
+				if (i == 0 || nQueued[r] < nQueued[chosen] ||
+						(nQueued[r] == nQueued[chosen] && bytesQueued[r] < bytesQueued[chosen]))
+					chosen = r;
+			}
+			dataRootNextRoundRobin++;
+			break;
+	}
+	pthread_mutex_unlock(&dataRootMutex);
+
+	return chosen;
+}
+
+void setWriterThreadCount(unsigned nThreads) {
+	if (nThreads < 1 || nThreads > MAX_WRITER_THREADS) {
+		logError("Writer Error: Number of writer threads must be between 1 and %d\n", MAX_WRITER_THREADS);
+		nThreads = nThreads < 1 ? 1 : MAX_WRITER_THREADS;
+	}
+	nWriterWorkers = nThreads;
+}
+
+void setCompressionThreadCount(unsigned nThreads) {
+	if (nThreads < 1 || nThreads > MAX_COMPRESSION_THREADS) {
+		logError("Writer Error: Number of compression threads must be between 1 and %d\n", MAX_COMPRESSION_THREADS);
+		nThreads = nThreads < 1 ? 1 : MAX_COMPRESSION_THREADS;
+	}
+	nCompressionThreads = nThreads;
+}
+
+// format is "v5" (default) or "v7.3", the latter needs a build with USE_HDF5
+bool setOutputFormat(const char *format) {
+	if (strcasecmp(format, "v5") == 0) {
+		matFileMode = "w";
+		return true;
+	}
+
+#if defined(MATLAB_MEX_FILE) || defined(USE_HDF5)
+	if (strcasecmp(format, "v7.3") == 0) {
+		matFileMode = "w7.3";
+		return true;
+	}
+#endif
+
+	logError("Writer Error: Unsupported output format %s\n", format);
+	return false;
+}
+
+#ifndef MATLAB_MEX_FILE
+void setContainerOutput(bool useContainer) {
+	containerOutput = useContainer;
+}
+
+void setSchemaRegistry(bool useRegistry) {
+	schemaRegistry = useRegistry;
+}
+
+void setPackedVariableSize(bool usePacked) {
+	packedVariableSize = usePacked;
+}
 
-	printf("Data root is now %s\n", dataRoot);
+void setSplitSignalVariables(bool useSplit) {
+	splitSignalVariables = useSplit;
 }
 
-// this function is run as a separate thread from the main() derived thread
+void setParamsOnChange(bool onChange) {
+	paramsOnChange = onChange;
+}
+
+void setStagingRoot(const char *path) {
+	copyRootPath(stagingRoot, path);
+	printf("Staging root is %s\n", stagingRoot);
+}
+
+// spec is GROUPTYPE=CODEC[:LEVEL], e.g. analog=zstd:5, GROUPTYPE may be "all"
+bool setGroupTypeCompression(const char *spec) {
+	char typeName[MAX_GROUP_TYPE_NAME];
+	char codecName[16];
+	int level = -1;
+
+	if (sscanf(spec, "%19[^=]=%15[^:]:%d", typeName, codecName, &level) < 2) {
+		logError("Writer Error: Compression must be given as GROUPTYPE=CODEC[:LEVEL], not %s\n", spec);
+		return false;
+	}
+
+	MatCodec codec;
+	if (!matGetCodecByName(codecName, &codec) || !matIsCodecAvailable(codec)) {
+		logError("Writer Error: Codec %s is not available\n", codecName);
+		return false;
+	}
+
+	uint8_t groupType;
+	if (strcasecmp(typeName, "all") == 0) {
+		for (unsigned i = 0; i < MAX_GROUP_TYPES; i++) {
+			groupTypeCompression[i].codec = codec;
+			groupTypeCompression[i].level = level;
+		}
+	} else if (getGroupTypeByName(typeName, &groupType) && groupType < MAX_GROUP_TYPES) {
+		groupTypeCompression[groupType].codec = codec;
+		groupTypeCompression[groupType].level = level;
+	} else {
+		logError("Writer Error: Unknown group type %s\n", typeName);
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+// compress data arrays as configured for their group's type, MAT v5 files ignore this
+static void setArrayCompressionForGroupType(mxArray *mxData, uint8_t groupType) {
+#ifndef MATLAB_MEX_FILE
+	if (groupType < MAX_GROUP_TYPES)
+		matSetCompression(mxData, groupTypeCompression[groupType].codec, groupTypeCompression[groupType].level);
+#endif
+}
+
+// this function is run as separate threads from the main() derived thread
 // the main() thread reads packets off the network, assembles and parses them
 // and pushes signals onto the signal buffer queue
 //
-// this thread's job is to pull signals off the signal buffer, build Matlab mxArrays
-// which contain their data, and write them to disk periodically as .mat files
-void *signalWriterThread(void *dummy){
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-	pthread_cleanup_push(signalWriterThreadCleanup, NULL);
-
+// these threads' job is to pull complete trials off the signal buffer, build Matlab mxArrays
+// which contain their data, and write them to disk as .mat files
+void *signalWriterThread(void *arg){
+	WriterWorker *pWorker = (WriterWorker*)arg;
 	DataLoggerStatus *dlStatus;
 
-	while (1) {
+	while (!__atomic_load_n(&writerTerminating, __ATOMIC_ACQUIRE)) {
 		// first we check the retired statuses buffer to see if there are any old trials to write
-		while ((dlStatus = controlPopRetiredStatus()) != NULL) {
-			writeTrialsToMATFile(dlStatus);
-			freeDataLoggerStatus(dlStatus);
+		// whoever pops a retired status writes all of it, whichever data roots its trials go to
+		while ((dlStatus = claimRetiredStatus()) != NULL) {
+			writeTrialsToMATFile(pWorker, dlStatus, -1);
+			controlReleaseStatus(dlStatus);
 		}
 
-		dlStatus = controlGetCurrentStatus();
-		if (dlStatus != NULL)
-			writeTrialsToMATFile(dlStatus);
+		dlStatus = controlAcquireCurrentStatus();
+		if (dlStatus != NULL) {
+			writeTrialsToMATFile(pWorker, dlStatus, (int)pWorker->dataRoot);
+			controlReleaseStatus(dlStatus);
+		}
 
-		pthread_testcancel();
-		usleep(WRITE_INTERVAL_USEC);
+		// sleep until the network thread completes a trial or retires a status
+		controlWaitForWriterWork(&pWorker->wakeSeq, WRITE_IDLE_TIMEOUT_SEC);
 	}
 
-	pthread_cleanup_pop(0);
-
 	return NULL;
 }
 
 void signalWriterThreadCleanup(void *dummy) {
 	logInfo("Writer: SignalWriteThread: Cleaning up\n");
 
-	if (sigFileInfo.indexFile != NULL)
-		fclose(sigFileInfo.indexFile);
+	if (writeDelayStats.nTrials > 0)
+		logInfo("Writer: %u trials written, write started %.3f ms (mean), %.3f ms (max) after trial completion\n",
+				writeDelayStats.nTrials, 1000 * writeDelayStats.totalSec / writeDelayStats.nTrials,
+				1000 * writeDelayStats.maxSec);
+
+	closeIndexFile(&indexFiles.indexFile);
+	closeIndexFile(&indexFiles.saveTagIndexFile);
+	closeIndexFile(&indexFiles.binaryIndexFile);
+
+	if (indexEntries != NULL)
+		FREE(indexEntries);
+
+#ifndef MATLAB_MEX_FILE
+	containerCloseAll();
+	migratorStop();
+#endif
+
+	// the last round of fsyncs, after everything above has been queued for it
+	fileIoStop();
+	fileIoLogStats();
+#ifndef MATLAB_MEX_FILE
+	migratorLogStats();
+#endif
 }
 
 void signalWriterThreadStart() {
-	// Start File Writer Thread
-	int rcWriter = pthread_create(&writerThread, NULL, signalWriterThread, NULL);
-	if (rcWriter) {
-		logError("Writer Error: Return code from pthread_create() is %d\n", rcWriter);
-		exit(-1);
+	if (containerOutput && strcmp(matFileMode, "w") != 0) {
+		logError("Writer Error: Trial containers hold MAT v5 records, writing v5\n");
+		matFileMode = "w";
+	}
+	if (containerOutput && splitSignalVariables) {
+		logError("Writer Error: Trial containers hold whole trials, not splitting signals\n");
+		splitSignalVariables = false;
 	}
+
+	fileIoStart();
+
+#ifndef MATLAB_MEX_FILE
+	// a container is appended to until its saveTag is done with, so it can't be moved meanwhile
+	if (stagingRoot[0] != '\0' && containerOutput) {
+		logError("Writer Error: Trial containers are written to the data roots, not staged\n");
+		stagingRoot[0] = '\0';
+	}
+	if (stagingRoot[0] != '\0') {
+		migratorStart();
+		const char *dataRootPaths[MAX_DATA_ROOTS];
+		for (unsigned i = 0; i < nDataRoots; i++)
+			dataRootPaths[i] = dataRoots[i].path;
+		migratorEnqueueLeftovers(stagingRoot, dataRootPaths, nDataRoots);
+	}
+#endif
+
+	// every data root gets at least one writer of its own
+	if (nWriterWorkers < nDataRoots) {
+		logInfo("Writer: Using %u writer threads, one per data root\n", nDataRoots);
+		nWriterWorkers = nDataRoots;
+	}
+	if (nDataRoots > 1)
+		logInfo("Writer: Striping trials over %u data roots\n", nDataRoots);
+
+#ifndef MATLAB_MEX_FILE
+	// writers only queue the chunks of their MAT 7.3 variables, these compress them
+	if (strcmp(matFileMode, "w7.3") == 0) {
+		unsigned nThreads = nCompressionThreads;
+		if (nThreads == 0) {
+			long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+			nThreads = nCpus < 1 ? 1 : (nCpus > MAX_COMPRESSION_THREADS ? MAX_COMPRESSION_THREADS : (unsigned)nCpus);
+		}
+		if (matStartCompressionThreads(nThreads))
+			logInfo("Writer: Started %u compression threads\n", nThreads);
+		else
+			logError("Writer Error: Could not start compression threads, writers compress themselves\n");
+	}
+#endif
+
+	// Start File Writer Threads
+	for (unsigned i = 0; i < nWriterWorkers; i++) {
+		writerWorkers[i].index = i;
+		writerWorkers[i].dataRoot = i % nDataRoots;
+		int rcWriter = pthread_create(&writerWorkers[i].thread, NULL, signalWriterThread, writerWorkers + i);
+		if (rcWriter) {
+			logError("Writer Error: Return code from pthread_create() is %d\n", rcWriter);
+			exit(-1);
+		}
+	}
+	if (nWriterWorkers > 1)
+		logInfo("Writer: Started %u writer threads\n", nWriterWorkers);
 }
 
+// let each writer finish the trial it's on, then stop
 void signalWriterThreadTerminate() {
-	pthread_cancel(writerThread);
-	pthread_join(writerThread, NULL);
+	__atomic_store_n(&writerTerminating, true, __ATOMIC_RELEASE);
+	controlNotifyWriter();
+
+	for (unsigned i = 0; i < nWriterWorkers; i++)
+		pthread_join(writerWorkers[i].thread, NULL);
+#ifndef MATLAB_MEX_FILE
+	matStopCompressionThreads();
+#endif
+
+	signalWriterThreadCleanup(NULL);
 }
 
-void writeTrialsToMATFile(DataLoggerStatus *dlStatus) {
-	unsigned trialIdx;
-	while ((trialIdx = controlGetNextCompleteTrialToWrite(dlStatus)) != -1)
-		writeTrialToMATFile(dlStatus, trialIdx);
+// add an entry for a trial about to be written, unless there is one already
+// must hold indexMutex
+static void addIndexEntry(uint32_t writeSeq) {
+	for (unsigned i = 0; i < nIndexEntries; i++) {
+		if (indexEntries[i].writeSeq == writeSeq)
+			return;
+	}
+
+	if (nIndexEntries == indexEntriesAllocated) {
+		unsigned entriesToAllocate = indexEntriesAllocated > 0 ? indexEntriesAllocated*2 : BUFFER_NUM_TRIALS;
+		IndexEntry *entries = (IndexEntry*)REALLOC(indexEntries, sizeof(IndexEntry) * entriesToAllocate);
+		if (entries == NULL)
+			diep("Writer: No memory for index entries");
+		indexEntries = entries;
+		indexEntriesAllocated = entriesToAllocate;
+	}
+
+	IndexEntry *pEntry = indexEntries + nIndexEntries++;
+	pEntry->writeSeq = writeSeq;
+	pEntry->written = false;
+	pEntry->logToIndex = true;
 }
 
-void writeTrialToMATFile(DataLoggerStatus *dlStatus, unsigned trialIdx) {
-	mxArray *mxTrial, *mxMeta;
+// log written entries to the index files in writeSeq order, stopping at the first
+// trial that is still pending
+// must hold indexMutex
+static void flushIndexEntries() {
+	uint32_t seqPending;
+	bool anyPending = controlGetLowestPendingWriteSeq(&seqPending);
+
+	for (unsigned i = 0; i < nIndexEntries; i++) {
+		if (!indexEntries[i].written && (!anyPending || indexEntries[i].writeSeq < seqPending)) {
+			seqPending = indexEntries[i].writeSeq;
+			anyPending = true;
+		}
+	}
 
-	updateSignalFileInfo(&sigFileInfo, dlStatus, trialIdx);
+	while (nIndexEntries > 0) {
+		unsigned iNext = nIndexEntries;
+		for (unsigned i = 0; i < nIndexEntries; i++) {
+			if (indexEntries[i].written && (iNext == nIndexEntries ||
+						indexEntries[i].writeSeq < indexEntries[iNext].writeSeq))
+				iNext = i;
+		}
 
-	buildStructForTrial(dlStatus, trialIdx, true, &mxTrial, &mxMeta);
-	writeMxArrayToSigFile(mxTrial, mxMeta, &sigFileInfo);
+		if (iNext == nIndexEntries || (anyPending && indexEntries[iNext].writeSeq > seqPending))
+			break;
 
-	logInfo("Writer: Wrote trial %d to %s\n", dlStatus->byTrial[trialIdx].trialId,
-			sigFileInfo.fileNameShort);
+		updateSignalIndexFiles(&indexFiles, &indexEntries[iNext].sigFileInfo);
+		if (indexEntries[iNext].logToIndex)
+			logToSignalIndexFile(&indexFiles, &indexEntries[iNext].sigFileInfo);
+		if (indexEntries[iNext].logToBinaryIndex) {
+			off_t recordOffset = logToBinaryIndexFile(&indexFiles, &indexEntries[iNext].indexRecord);
+			migrateStagedFile(&indexEntries[iNext].sigFileInfo, indexFiles.binaryIndexFileName, recordOffset);
+		}
 
-	logToSignalIndexFile(&sigFileInfo);
+		indexEntries[iNext] = indexEntries[--nIndexEntries];
+	}
+}
+
+// pop a retired status, adding entries for all of its unwritten trials in the same step so
+// that later trials of the current status can't be logged before them
+static DataLoggerStatus *claimRetiredStatus() {
+	pthread_mutex_lock(&indexMutex);
+
+	DataLoggerStatus *dlStatus = controlPopRetiredStatus();
+	if (dlStatus != NULL) {
+		pthread_mutex_lock(&dlStatus->mutex);
+		for (unsigned i = 0; i < BUFFER_NUM_TRIALS; i++) {
+			const DataLoggerStatusByTrial *dlTrial = dlStatus->byTrial + i;
+			if (dlTrial->completed && dlTrial->utilized && dlTrial->writeSeq != 0)
+				addIndexEntry(dlTrial->writeSeq);
+		}
+		pthread_mutex_unlock(&dlStatus->mutex);
+	}
+
+	pthread_mutex_unlock(&indexMutex);
+	return dlStatus;
+}
+
+// write the trials assigned to dataRoot, or all of them if it's negative
+void writeTrialsToMATFile(WriterWorker *pWorker, DataLoggerStatus *dlStatus, int dataRoot) {
+	int trialIdx;
+	// take small trials first so that one huge trial doesn't hold up the rest
+	while ((trialIdx = controlClaimSmallestCompleteTrialForDataRoot(dlStatus, dataRoot, assignDataRoot)) != -1)
+		writeTrialToMATFile(pWorker, dlStatus, trialIdx);
+}
+
+void writeTrialToMATFile(WriterWorker *pWorker, DataLoggerStatus *dlStatus, unsigned trialIdx) {
+	SignalFileInfo *pSigFileInfo = &pWorker->sigFileInfo;
+	mxArray *mxTrial, *mxMeta;
+	TrialIndexRecord indexRecord;
+
+	// the trial slot may be reused once built, hold on to what we need afterwards
+	uint32_t writeSeq = dlStatus->byTrial[trialIdx].writeSeq;
+	uint32_t trialId = dlStatus->byTrial[trialIdx].trialId;
+	double wallclockStart = dlStatus->byTrial[trialIdx].wallclockStart;
+	double completedAt = dlStatus->byTrial[trialIdx].completedAt;
+
+	pthread_mutex_lock(&indexMutex);
+	addIndexEntry(writeSeq);
+	if (completedAt > 0) {
+		double delay = getMonotonicTime() - completedAt;
+		writeDelayStats.nTrials++;
+		writeDelayStats.totalSec += delay;
+		if (delay > writeDelayStats.maxSec)
+			writeDelayStats.maxSec = delay;
+	}
+	pthread_mutex_unlock(&indexMutex);
+
+	updateSignalFileInfo(pSigFileInfo, dlStatus, trialIdx);
+	fillTrialIndexRecord(&indexRecord, dlStatus, trialIdx, pSigFileInfo);
+
+	// the arrays may point straight into the trial's buffers, so only clear them once written
+	buildStructForTrial(dlStatus, trialIdx, false, &mxTrial, &mxMeta);
+	if (schemaRegistry)
+		registerSchemas(dlStatus, pSigFileInfo);
+	bool logToIndex = true, written = true;
+	if (containerOutput) {
+		written = writeMxArrayToContainer(mxTrial, mxMeta, pSigFileInfo, trialId, wallclockStart, &indexRecord,
+				&logToIndex);
+	} else {
+		writeMxArrayToSigFile(mxTrial, mxMeta, pSigFileInfo);
+		struct stat st;
+		if (stat(pSigFileInfo->fileName, &st) == 0)
+			indexRecord.fileBytes = (uint64_t)st.st_size;
+	}
+
+	// a container is linked to once, when created
+	if (logToIndex)
+		linkToDataRoot(pSigFileInfo);
+	indexRecord.dataRoot = pSigFileInfo->dataRoot;
+
+	if (written)
+		logInfo("Writer: Wrote trial %d to %s\n", trialId, pSigFileInfo->fileNameShort);
+	else
+		logError("Writer Error: Trial %u was not written to %s, leaving it out of the index\n", trialId,
+				pSigFileInfo->fileNameShort);
 
 	mxDestroyArray(mxTrial);
 	mxDestroyArray(mxMeta);
+
+	controlClearTrialData(dlStatus, trialIdx);
+	controlMarkTrialWritten(dlStatus, trialIdx);
+
+	// hand the file over to be logged in the index files in order
+	pthread_mutex_lock(&indexMutex);
+	for (unsigned i = 0; i < nIndexEntries; i++) {
+		if (indexEntries[i].writeSeq == writeSeq) {
+			indexEntries[i].sigFileInfo = *pSigFileInfo;
+			indexEntries[i].written = true;
+			indexEntries[i].logToIndex = logToIndex;
+			indexEntries[i].logToBinaryIndex = written;
+			indexEntries[i].indexRecord = indexRecord;
+			break;
+		}
+	}
+	flushIndexEntries();
+	pthread_mutex_unlock(&indexMutex);
 }
 
 void buildTrialStructForCurrentTrial(mxArray **pMxTrial, mxArray **pMxMeta) {
@@ -198,6 +811,8 @@ void buildTrialStructForLastCompleteTrial(mxArray **pMxTrial, mxArray **pMxMeta)
 // builds a trial struct in *pMxTrial and meta data struct in *pMxMeta
 // if clearBuffers is true, each timestamp buffer, signal data buffer will be cleared
 // and the trial will be marked as written
+// outside of MEX builds signal data arrays borrow the buffers' memory, so the buffers must
+// not be cleared until the arrays have been written and destroyed
 void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool clearBuffers,
 		mxArray **pMxTrial, mxArray **pMxMeta) {
 	DataLoggerStatusByTrial *trialStatus = dlStatus->byTrial + trialIdx;
@@ -206,19 +821,26 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 	GroupTrie *gtrie = dlStatus->gtrie;
 
 	const char *metaFields[] = {"groups", "signals"};
+	// with a schema registry, see registerSchemas
+	const char *schemaMetaFields[] = {"groups", "layouts"};
 	mxArray *mxTrial;
 	mxArray *mxMeta;
 	mxArray *mxGroupMeta;
-	mxArray *mxSignalMeta;
+	mxArray *mxSignalMeta = NULL;
+
+	// the meta data built for earlier trials of this status, NULL to build it here
+	MetaCache *pCache = acquireMetaCache(dlStatus);
+	bool cacheMatches = pCache != NULL;
 
 	// outer trial struct
 	mxTrial = mxCreateStructMatrix(1,1,0,NULL);
 	// outer meta struct
-	mxMeta = mxCreateStructMatrix(1, 1, 2, metaFields);
+	mxMeta = mxCreateStructMatrix(1, 1, 2, schemaRegistry ? schemaMetaFields : metaFields);
 	// meta.groups struct
 	mxGroupMeta = mxCreateStructMatrix(1,1,0,NULL);
 	// meta.signals struct
-	mxSignalMeta = mxCreateStructMatrix(1,1,0,NULL);
+	if (pCache == NULL && !schemaRegistry)
+		mxSignalMeta = mxCreateStructMatrix(1,1,0,NULL);
 
 	// add fields like .protocol, subject, duration, etc.
 	// to trial (not the meta struct, sorry for the name collision)
@@ -227,6 +849,9 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 	// all timestamps written to the struct will be relative to this start time
 	timestamp_t trialStartTime = trialStatus->timestampStart;
 
+	// params only refer to trials in the same saveTag folder
+	uint64_t saveTagKey = paramsOnChange ? getSaveTagKey(dlStatus, trialIdx) : 0;
+
 	GroupTrie *groupNode = getFirstGroupNode(gtrie);
 	SignalDataBuffer *psdb;
 
@@ -235,8 +860,18 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 		GroupInfo *pg = (GroupInfo*)groupNode->value;
 		unsigned nSamples = pg->tsBuffers[trialIdx].nSamples;
 
-		// build an mxArray containing meta data about this group
-		addGroupMetaField(mxGroupMeta, (const GroupInfo*)pg);
+		// build an mxArray containing meta data about this group, unless it's cached
+		mxArray *mxCachedGroupMeta = NULL;
+		if (!cacheMatches || iGroup >= pCache->nGroups || pCache->groups[iGroup].pg != pg)
+			cacheMatches = false;
+		else if (!schemaRegistry)
+			mxCachedGroupMeta = retainCachedMeta(pCache->groups[iGroup].mxGroupMeta);
+
+		// only event groups' meta differs between trials and stays with them in the registry's stead
+		if (mxCachedGroupMeta != NULL)
+			mxSetFieldByNumber(mxGroupMeta, 0, mxAddField(mxGroupMeta, pg->name), mxCachedGroupMeta);
+		else if (!schemaRegistry || pg->type == GROUP_TYPE_EVENT)
+			addGroupMetaField(mxGroupMeta, (const GroupInfo*)pg);
 
 		if (pg->type == GROUP_TYPE_ANALOG) {
 			// build an mxArray containing timestamps for this group
@@ -254,17 +889,20 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 				// these have been accounted for by addGroupTimestampsField above
 				if (psdb->type != SIGNAL_TYPE_TIMESTAMP && psdb->type != SIGNAL_TYPE_TIMESTAMPOFFSET) {
 					// add to meta.signals.(name)
-					addSignalMetaField(mxSignalMeta, (const SignalDataBuffer*) psdb);
+					if (mxSignalMeta != NULL)
+						addSignalMetaField(mxSignalMeta, (const SignalDataBuffer*) psdb);
 
 					// build an mxArray for this signal's data
 					// don't use group prefix on the signal and hope there are no collisions
 					// todo CHECK FOR COLLISIONS?
-					addSignalDataField(mxTrial, psdb, trialIdx, false, nSamples);
-				}
+					if (!paramsOnChange || !pg->replaceSignal[i] ||
+							!addParamReferenceField(mxTrial, psdb, dlStatus, trialIdx, nSamples, saveTagKey))
+						addSignalDataField(mxTrial, psdb, trialIdx, false, nSamples);
 
-				// clear the timeseries buffer as these samples are no longer needed
-				if (clearBuffers)
-					clearSampleBuffer(psdb->buffers + trialIdx);
+					// each value the param took during the trial and when it changed
+					if (controlGetParamChangeLog() && pg->replaceSignal[i])
+						addParamChangeLogFields(mxTrial, psdb, trialIdx, trialStartTime);
+				}
 
 				iSignal++;
 			}
@@ -274,21 +912,11 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 			// so we write a new field with each event in it containing the timestamps encountered
 			mxArray *mxThisGroupMeta = mxGetField(mxGroupMeta, 0, pg->name);
 			addEventGroupFields(mxTrial, mxThisGroupMeta, pg, trialIdx, trialStartTime, false, 0);
-
-			// clear the timeseries buffer as these samples are no longer needed
-			if (clearBuffers) {
-				for (unsigned i = 0; i < pg->nSignals; i++) {
-					psdb = pg->signals[i];
-					if (psdb == NULL)
-						continue;
-					clearSampleBuffer(psdb->buffers + trialIdx);
-				}
-			}
 		}
 
-		// clear the group's timestamp buffer
+		// clear the group's sample and timestamp buffers as these samples are no longer needed
 		if (clearBuffers)
-			clearTimestampBuffer(pg->tsBuffers + trialIdx);
+			clearGroupInfoTrialData(pg, trialIdx);
 
 		// advance to the next group on the trie
 		groupNode = getNextGroupNode(groupNode);
@@ -296,9 +924,27 @@ void buildStructForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx, bool cle
 		iGroup++;
 	}
 
+	// the cached meta.signals and meta.layouts miss the groups added since the cache was built
+	if (schemaRegistry) {
+		mxArray *mxLayouts = NULL;
+		if (cacheMatches && iGroup == pCache->nGroups)
+			mxLayouts = retainCachedMeta(pCache->mxLayouts);
+		if (mxLayouts == NULL)
+			mxLayouts = buildLayouts(gtrie);
+		mxSetField(mxMeta, 0, "layouts", mxLayouts);
+	} else if (pCache != NULL) {
+		if (cacheMatches && iGroup == pCache->nGroups)
+			mxSignalMeta = retainCachedMeta(pCache->mxSignalMeta);
+		if (mxSignalMeta == NULL)
+			mxSignalMeta = buildSignalMeta(gtrie);
+	}
+	if (pCache != NULL)
+		releaseMetaCache(pCache);
+
 	// set meta.groups = mxGroupMeta
 	mxSetField(mxMeta, 0, "groups", mxGroupMeta);
-	mxSetField(mxMeta, 0, "signals", mxSignalMeta);
+	if (!schemaRegistry)
+		mxSetField(mxMeta, 0, "signals", mxSignalMeta);
 
 	// mark that trial as no longer being actively written
 	if (clearBuffers)
@@ -327,29 +973,38 @@ void updateSignalFileInfo(SignalFileInfo *pSignalFile, DataLoggerStatus *pStatus
 
 	// build pathBufferIndex as   dataRoot/storeName/subject/YYYYMMDD/
 	// build pathBufferSaveTag as dataRoot/storeName/subject/YYYYMMDD/protocol/saveTag#/
+	// both on the first data root, where the trials are listed whichever root they're written to
 	char pathBufferIndex[MAX_FILENAME_LENGTH];
 	char pathBufferTrial[MAX_FILENAME_LENGTH];
 	snprintf_nowarn(pathBufferIndex, MAX_FILENAME_LENGTH,
-			"%s/%s/%s/%s", dataRoot, pStatus->dataStore, pStatus->subject, dateFolderBuffer);
+			"%s/%s/%s/%s", dataRoots[0].path, pStatus->dataStore, pStatus->subject, dateFolderBuffer);
 	snprintf_nowarn(pathBufferTrial, MAX_FILENAME_LENGTH,
 			"%s/%s/saveTag%03d", pathBufferIndex, pStatus->protocol, pStatus->saveTag);
 
-	// check that this data directory exists if it's changed from last time
-	if (strncmp(pathBufferTrial, pSignalFile->filePath, MAX_FILENAME_LENGTH) != 0) {
-		// path has changed, need to check that this path exists, and/or create it
-		if (access( pathBufferTrial, R_OK | W_OK ) == -1) {
-			// this new path doesn't exist or we can't access it --> mkdir it
-			int failed = mkdirRecursive(pathBufferTrial);
-			if (failed)
-				diep("Error creating trial data directory");
-		}
+	// and the same saveTag folder on the data root the trial goes to
+	unsigned root = trialStatus->dataRootAssigned && trialStatus->dataRoot < nDataRoots ? trialStatus->dataRoot : 0;
+	char pathBufferRoot[MAX_FILENAME_LENGTH];
+	snprintf_nowarn(pathBufferRoot, MAX_FILENAME_LENGTH, "%s/%s/%s/%s/%s/saveTag%03d", dataRoots[root].path,
+			pStatus->dataStore, pStatus->subject, dateFolderBuffer, pStatus->protocol, pStatus->saveTag);
+	pSignalFile->dataRoot = root;
+	pSignalFile->staged = stagingRoot[0] != '\0';
 
-		// update the filePath so we don't try to create it again
-		strncpy(pSignalFile->filePath, pathBufferTrial, MAX_FILENAME_LENGTH);
+	// check that this data directory exists if it's changed from last time
+	if (pSignalFile->staged) {
+		// written to the same folder on the staging tier, and moved to the data root from there
+		char pathBufferStaging[MAX_FILENAME_LENGTH];
+		snprintf_nowarn(pathBufferStaging, MAX_FILENAME_LENGTH, "%s/%s/%s/%s/%s/saveTag%03d", stagingRoot,
+				pStatus->dataStore, pStatus->subject, dateFolderBuffer, pStatus->protocol, pStatus->saveTag);
+		if (updateDataDirectory(pSignalFile->filePath, pathBufferStaging))
+			logInfo("Writer: Updating trial staging dir : %s\n", pSignalFile->filePath);
+		updateDataDirectory(pSignalFile->archivePath, pathBufferRoot);
+	} else if (updateDataDirectory(pSignalFile->filePath, pathBufferRoot)) {
 		logInfo("Writer: Updating trial data dir : %s\n", pSignalFile->filePath);
 	}
+	if (root > 0 || pSignalFile->staged)
+		updateDataDirectory(pSignalFile->linkPath, pathBufferTrial);
 
-	// now check the index file to make sure it exists
+	// now work out the index files, which are opened when the trial is logged to them
 	// the index file is simply a list of .mat files written to this directory
 	// which makes it is easy for other programs to detect when these files
 	// are added, rather than having to stat the whole directory repeatedly
@@ -361,36 +1016,28 @@ void updateSignalFileInfo(SignalFileInfo *pSignalFile, DataLoggerStatus *pStatus
 	snprintf(saveTagIndexFileBuffer, MAX_FILENAME_LENGTH,
 			"%s/trialIndex.txt", pathBufferTrial);
 
-	// check whether the index file is the same as last time
-	if (strncmp(indexFileBuffer, pSignalFile->indexFileName, MAX_FILENAME_LENGTH) != 0) {
-		// it's changed from last time
-		strncpy(pSignalFile->indexFileName, indexFileBuffer, MAX_FILENAME_LENGTH);
-		logInfo("Writer: Updating trial index file : %s\n", pSignalFile->indexFileName);
-
-		pSignalFile->indexFile = fopen(pSignalFile->indexFileName, "a");
-		if (pSignalFile->indexFile == NULL)
-			diep("Error opening index file.");
-	}
-
-	// check whether the save tag index file is the same as last time
-	if (strncmp(saveTagIndexFileBuffer, pSignalFile->saveTagIndexFileName, MAX_FILENAME_LENGTH) != 0) {
-		// it's changed from last time
-		strncpy(pSignalFile->saveTagIndexFileName, saveTagIndexFileBuffer, MAX_FILENAME_LENGTH);
-		logInfo("Writer: Updating save-tag index file : %s\n", pSignalFile->saveTagIndexFileName);
-
-		pSignalFile->saveTagIndexFile = fopen(pSignalFile->saveTagIndexFileName, "a");
-		if (pSignalFile->saveTagIndexFile == NULL)
-			diep("Error opening save-tag index file.");
-	}
+	strncpy(pSignalFile->indexFileName, indexFileBuffer, MAX_FILENAME_LENGTH);
+	snprintf_nowarn(pSignalFile->binaryIndexFileName, MAX_FILENAME_LENGTH,
+			"%s/%s", pathBufferIndex, TRIAL_INDEX_FILE_NAME);
+	strncpy(pSignalFile->saveTagIndexFileName, saveTagIndexFileBuffer, MAX_FILENAME_LENGTH);
 
 	// create a unique mat file name based on <subject>_protocol_<date.time.msec>_id<trialId>.mat
 	char fileTimeBuffer[MAX_FILENAME_LENGTH];
 	strftime(fileTimeBuffer, MAX_FILENAME_LENGTH, "%Y%m%d.%H%M%S", &timeInfo);
 
-	// assemble short file name without path
-	snprintf_nowarn(pSignalFile->fileNameShort, MAX_FILENAME_LENGTH,
-			"%s_%s_id%06d_time%s.%03d.mat", pStatus->subject, pStatus->protocol,
-			trialStatus->trialId, fileTimeBuffer, msec);
+	// assemble short file name without path, or that of the saveTag's container on this data root
+	if (containerOutput && root > 0)
+		snprintf_nowarn(pSignalFile->fileNameShort, MAX_FILENAME_LENGTH,
+				"%s_%s_saveTag%03d_root%u%s", pStatus->subject, pStatus->protocol, pStatus->saveTag,
+				root, CONTAINER_FILE_EXTENSION);
+	else if (containerOutput)
+		snprintf_nowarn(pSignalFile->fileNameShort, MAX_FILENAME_LENGTH,
+				"%s_%s_saveTag%03d%s", pStatus->subject, pStatus->protocol, pStatus->saveTag,
+				CONTAINER_FILE_EXTENSION);
+	else
+		snprintf_nowarn(pSignalFile->fileNameShort, MAX_FILENAME_LENGTH,
+				"%s_%s_id%06d_time%s.%03d.mat", pStatus->subject, pStatus->protocol,
+				trialStatus->trialId, fileTimeBuffer, msec);
 
 	// path relative to index file, e.g. protocol/saveTag#/fileName.mat
 	snprintf_nowarn(pSignalFile->fileNameRelativeToIndex, MAX_FILENAME_LENGTH,
@@ -399,31 +1046,267 @@ void updateSignalFileInfo(SignalFileInfo *pSignalFile, DataLoggerStatus *pStatus
 	// assemble file name with path
 	snprintf_nowarn(pSignalFile->fileName, MAX_FILENAME_LENGTH,
 			"%s/%s", pSignalFile->filePath, pSignalFile->fileNameShort);
+
+	if (root > 0 || pSignalFile->staged)
+		snprintf_nowarn(pSignalFile->linkName, MAX_FILENAME_LENGTH,
+				"%s/%s", pSignalFile->linkPath, pSignalFile->fileNameShort);
+	else
+		pSignalFile->linkName[0] = '\0';
+
+	if (pSignalFile->staged)
+		snprintf_nowarn(pSignalFile->archiveName, MAX_FILENAME_LENGTH,
+				"%s/%s", pSignalFile->archivePath, pSignalFile->fileNameShort);
+	else
+		pSignalFile->archiveName[0] = '\0';
+}
+
+// make sure path exists if it isn't the one in cachedPath already, true if it wasn't
+static bool updateDataDirectory(char *cachedPath, const char *path) {
+	if (strncmp(path, cachedPath, MAX_FILENAME_LENGTH) == 0)
+		return false;
+
+	// path has changed, need to check that this path exists, and/or create it
+	if (access( path, R_OK | W_OK ) == -1) {
+		// this new path doesn't exist or we can't access it --> mkdir it
+		// another writer thread may have just created it
+		int failed = mkdirRecursive(path);
+		if (failed && errno != EEXIST)
+			diep("Error creating trial data directory");
+
+		// the new folders' entries in their parents
+		char dir[MAX_FILENAME_LENGTH];
+		snprintf(dir, MAX_FILENAME_LENGTH, "%s", path);
+		for (char *last; (last = strrchr(dir, '/')) != NULL && last > dir; *last = '\0')
+			fileIoSyncDirectoryOf(dir);
+	}
+
+	// update the cached path so we don't try to create it again
+	strncpy(cachedPath, path, MAX_FILENAME_LENGTH);
+	return true;
+}
+
+// link to a file written to another data root, or the staging tier, from where it's listed on
+// the first root
+static void linkToDataRoot(const SignalFileInfo *pSigFileInfo) {
+	if (pSigFileInfo->linkName[0] == '\0')
+		return;
+	if (symlink(pSigFileInfo->fileName, pSigFileInfo->linkName) == 0)
+		fileIoSyncDirectoryOf(pSigFileInfo->linkName);
+	else if (errno != EEXIST)
+		logError("Writer Error: Could not link %s to %s (%s)\n", pSigFileInfo->linkName, pSigFileInfo->fileName,
+				strerror(errno));
+}
+
+static void closeIndexFile(IndexFile *pFile) {
+	if (pFile->fd < 0)
+		return;
+	fileIoSync(pFile->fd);
+	close(pFile->fd);
+	pFile->fd = -1;
+}
+
+// open for appending at its current end
+static void openIndexFile(IndexFile *pFile, const char *fileName, const char *errorMessage) {
+	struct stat st;
+	closeIndexFile(pFile);
+	pFile->fd = open(fileName, O_WRONLY | O_CREAT, 0666);
+	if (pFile->fd < 0 || fstat(pFile->fd, &st) != 0)
+		diep(errorMessage);
+	pFile->size = st.st_size;
+	if (pFile->size == 0)
+		fileIoSyncDirectoryOf(fileName);
+}
+
+// appended with the trial files' writes, made durable in the same group fsync
+static bool appendToIndexFile(IndexFile *pFile, const void *data, size_t nBytes) {
+	if (!fileIoWriteAll(pFile->fd, data, nBytes, pFile->size))
+		return false;
+	pFile->size += nBytes;
+	fileIoSync(pFile->fd);
+	return true;
 }
 
-void logToSignalIndexFile(const SignalFileInfo *pSigFileInfo) {
+// make sure pIndexFiles has the index files named in pSignalFile open
+void updateSignalIndexFiles(SignalFileInfo *pIndexFiles, const SignalFileInfo *pSignalFile) {
+	// check whether the index file is the same as last time
+	if (strncmp(pSignalFile->indexFileName, pIndexFiles->indexFileName, MAX_FILENAME_LENGTH) != 0) {
+		// it's changed from last time
+		strncpy(pIndexFiles->indexFileName, pSignalFile->indexFileName, MAX_FILENAME_LENGTH);
+		logInfo("Writer: Updating trial index file : %s\n", pIndexFiles->indexFileName);
+
+		openIndexFile(&pIndexFiles->indexFile, pIndexFiles->indexFileName, "Error opening index file.");
+	}
+
+	// check whether the save tag index file is the same as last time
+	if (strncmp(pSignalFile->saveTagIndexFileName, pIndexFiles->saveTagIndexFileName, MAX_FILENAME_LENGTH) != 0) {
+		// it's changed from last time
+		strncpy(pIndexFiles->saveTagIndexFileName, pSignalFile->saveTagIndexFileName, MAX_FILENAME_LENGTH);
+		logInfo("Writer: Updating save-tag index file : %s\n", pIndexFiles->saveTagIndexFileName);
+
+		openIndexFile(&pIndexFiles->saveTagIndexFile, pIndexFiles->saveTagIndexFileName,
+				"Error opening save-tag index file.");
+	}
+
+	// and the binary index, which starts with a header when new
+	if (strncmp(pSignalFile->binaryIndexFileName, pIndexFiles->binaryIndexFileName, MAX_FILENAME_LENGTH) != 0) {
+		strncpy(pIndexFiles->binaryIndexFileName, pSignalFile->binaryIndexFileName, MAX_FILENAME_LENGTH);
+
+		openIndexFile(&pIndexFiles->binaryIndexFile, pIndexFiles->binaryIndexFileName,
+				"Error opening binary index file.");
+
+		// one with records of another size is moved aside rather than appended to
+		TrialIndexHeader header;
+		if (pIndexFiles->binaryIndexFile.size > 0 &&
+				(pread(pIndexFiles->binaryIndexFile.fd, &header, sizeof(header), 0) != sizeof(header) ||
+				 header.recordBytes != sizeof(TrialIndexRecord))) {
+			char oldFileName[MAX_FILENAME_LENGTH + 4];
+			snprintf(oldFileName, sizeof(oldFileName), "%s.old", pIndexFiles->binaryIndexFileName);
+			logError("Writer Error: %s has records of another layout, moving it to %s\n",
+					pIndexFiles->binaryIndexFileName, oldFileName);
+			closeIndexFile(&pIndexFiles->binaryIndexFile);
+			if (rename(pIndexFiles->binaryIndexFileName, oldFileName) != 0)
+				diep("Error moving binary index file.");
+			openIndexFile(&pIndexFiles->binaryIndexFile, pIndexFiles->binaryIndexFileName,
+					"Error opening binary index file.");
+		}
+
+		if (pIndexFiles->binaryIndexFile.size == 0) {
+			TrialIndexHeader header = { TRIAL_INDEX_MAGIC, TRIAL_INDEX_VERSION, sizeof(TrialIndexRecord) };
+			appendToIndexFile(&pIndexFiles->binaryIndexFile, &header, sizeof(header));
+		}
+	}
+}
+
+void logToSignalIndexFile(SignalFileInfo *pIndexFiles, const SignalFileInfo *pSigFileInfo) {
 	// write the string to the index file
-	if (pSigFileInfo->indexFile == NULL)
+	if (pIndexFiles->indexFile.fd < 0)
 		diep("Index file not opened\n");
-	if (pSigFileInfo->saveTagIndexFile == NULL)
+	if (pIndexFiles->saveTagIndexFile.fd < 0)
 		diep("Index file not opened\n");
 
-	fprintf(pSigFileInfo->indexFile, "%s\n", pSigFileInfo->fileNameRelativeToIndex);
-	fflush(pSigFileInfo->indexFile);
-	fprintf(pSigFileInfo->saveTagIndexFile, "%s\n", pSigFileInfo->fileNameShort);
-	fflush(pSigFileInfo->saveTagIndexFile);
+	char line[MAX_FILENAME_LENGTH + 1];
+	int length = snprintf(line, sizeof(line), "%s\n", pSigFileInfo->fileNameRelativeToIndex);
+	if (!appendToIndexFile(&pIndexFiles->indexFile, line, length))
+		logError("Writer Error: Could not log %s to %s\n", pSigFileInfo->fileNameShort, pIndexFiles->indexFileName);
+	length = snprintf(line, sizeof(line), "%s\n", pSigFileInfo->fileNameShort);
+	if (!appendToIndexFile(&pIndexFiles->saveTagIndexFile, line, length))
+		logError("Writer Error: Could not log %s to %s\n", pSigFileInfo->fileNameShort,
+				pIndexFiles->saveTagIndexFileName);
+}
+
+// returns where the record went, -1 if it couldn't be written
+static off_t logToBinaryIndexFile(SignalFileInfo *pIndexFiles, const TrialIndexRecord *pRecord) {
+	if (pIndexFiles->binaryIndexFile.fd < 0)
+		diep("Binary index file not opened\n");
+
+	off_t offset = pIndexFiles->binaryIndexFile.size;
+	if (!appendToIndexFile(&pIndexFiles->binaryIndexFile, pRecord, sizeof(TrialIndexRecord))) {
+		logError("Writer Error: Could not log trial %u to %s\n", pRecord->trialId, pIndexFiles->binaryIndexFileName);
+		return -1;
+	}
+	return offset;
+}
+
+// a staged trial is migrated once it's been logged, so that its index record can be updated
+static void migrateStagedFile(const SignalFileInfo *pSigFileInfo, const char *binaryIndexFileName,
+		off_t indexRecordOffset) {
+#ifndef MATLAB_MEX_FILE
+	if (pSigFileInfo->staged)
+		migratorEnqueue(pSigFileInfo->fileName, pSigFileInfo->archiveName, pSigFileInfo->linkName,
+				binaryIndexFileName, indexRecordOffset);
+#endif
+}
+
+// everything but where the trial ends up, which is filled in once written
+static void fillTrialIndexRecord(TrialIndexRecord *pRecord, const DataLoggerStatus *dlStatus, unsigned trialIdx,
+		const SignalFileInfo *pSigFileInfo) {
+	const DataLoggerStatusByTrial *trialStatus = dlStatus->byTrial + trialIdx;
+
+	memset(pRecord, 0, sizeof(TrialIndexRecord));
+	pRecord->trialId = trialStatus->trialId;
+	pRecord->saveTag = dlStatus->saveTag;
+	pRecord->wallclockStart = trialStatus->wallclockStart;
+	pRecord->timestampStart = trialStatus->timestampStart;
+	pRecord->timestampEnd = trialStatus->timestampEnd;
+	pRecord->duration = round((trialStatus->timestampEnd - trialStatus->timestampStart)) + 1;
+	for (unsigned i = 0; i < TRIAL_INDEX_GROUP_TYPES && i < MAX_GROUP_TYPES; i++)
+		pRecord->groupTypeBytes[i] = trialStatus->nBytesByGroupType[i];
+	pRecord->protocolVersion = dlStatus->protocolVersion;
+	// the protocol may fill its field unterminated, a file name that doesn't fit is left out
+	size_t length = strnlen(dlStatus->protocol, TRIAL_INDEX_PROTOCOL_LENGTH);
+	memcpy(pRecord->protocol, dlStatus->protocol, length);
+	length = strlen(pSigFileInfo->fileNameRelativeToIndex);
+	if (length < TRIAL_INDEX_FILE_NAME_LENGTH)
+		memcpy(pRecord->fileName, pSigFileInfo->fileNameRelativeToIndex, length);
+	else
+		logError("Writer Error: File name %s is too long for trialIndex.bin, logged without it\n",
+				pSigFileInfo->fileNameRelativeToIndex);
+	if (pSigFileInfo->staged)
+		pRecord->flags |= TRIAL_INDEX_FLAG_STAGED;
+}
+
+// the fields addTrialMetaFields adds, which stay in the trial variable when signals are split off
+static const char *trialHeaderFields[] = { "subject", "protocol", "protocolVersion", "dataStore",
+	"date", "saveTag", "trialId", "trialIdStr", "wallclockStart", "tsStart", "tsStop", "duration",
+	"format", "timeUnits" };
+
+static bool isTrialHeaderField(const char *name) {
+	for (unsigned i = 0; i < sizeof(trialHeaderFields) / sizeof(trialHeaderFields[0]); i++) {
+		if (strcmp(name, trialHeaderFields[i]) == 0)
+			return true;
+	}
+	// can't be a variable of its own
+	return strcmp(name, "trial") == 0 || strcmp(name, "meta") == 0;
+}
+
+// put the trial header as the trial variable, with the names of the other fields of mxTrial in
+// .signalVariables, then each of those as a variable of its own so that they can be loaded one by
+// one. The header fields are moved out of mxTrial
+static int putSplitTrialVariables(MATFile *pmat, mxArray *mxTrial) {
+	int nFields = mxGetNumberOfFields(mxTrial);
+	int nSignals = 0;
+	for (int i = 0; i < nFields; i++) {
+		if (!isTrialHeaderField(mxGetFieldNameByNumber(mxTrial, i)))
+			nSignals++;
+	}
+
+	mxArray *mxHeader = mxCreateStructMatrix(1, 1, 0, NULL);
+	mxArray *mxSignalVariables = mxCreateCellMatrix(nSignals, 1);
+	int iSignal = 0;
+	for (int i = 0; i < nFields; i++) {
+		const char *name = mxGetFieldNameByNumber(mxTrial, i);
+		if (isTrialHeaderField(name)) {
+			mxSetFieldByNumber(mxHeader, 0, mxAddField(mxHeader, name), mxGetFieldByNumber(mxTrial, 0, i));
+			mxSetFieldByNumber(mxTrial, 0, i, NULL);
+		} else
+			mxSetCell(mxSignalVariables, iSignal++, mxCreateString(name));
+	}
+	mxSetFieldByNumber(mxHeader, 0, mxAddField(mxHeader, "signalVariables"), mxSignalVariables);
+
+	int error = matPutVariable(pmat, "trial", mxHeader);
+	mxDestroyArray(mxHeader);
+
+	for (int i = 0; i < nFields && !error; i++) {
+		mxArray *mxSignal = mxGetFieldByNumber(mxTrial, 0, i);
+		if (mxSignal != NULL)
+			error = matPutVariable(pmat, mxGetFieldNameByNumber(mxTrial, i), mxSignal);
+	}
+	return error;
 }
 
 void writeMxArrayToSigFile(mxArray *mxTrial, mxArray *mxMeta, const SignalFileInfo *pSigFileInfo) {
 	int error;
 
 	// open the file
-	MATFile *pmat = matOpen(pSigFileInfo->fileName, "w");
+	MATFile *pmat = matOpen(pSigFileInfo->fileName, matFileMode);
 	if (pmat == NULL)
 		diep("Error opening MAT file");
 
 	// put variable in file
-	error = matPutVariable(pmat, "trial", mxTrial);
+	if (splitSignalVariables)
+		error = putSplitTrialVariables(pmat, mxTrial);
+	else
+		error = matPutVariable(pmat, "trial", mxTrial);
 	if (error)
 		diep("Error putting trial variable in MAT file");
 
@@ -435,6 +1318,27 @@ void writeMxArrayToSigFile(mxArray *mxTrial, mxArray *mxMeta, const SignalFileIn
 	matClose(pmat);
 }
 
+// append the trial to its saveTag's container, with where it was put in *pIndexRecord. Returns
+// whether it was written; *pCreated whether the container is new and so should be logged in the
+// index files, even if the trial wasn't written to it
+bool writeMxArrayToContainer(mxArray *mxTrial, mxArray *mxMeta, const SignalFileInfo *pSigFileInfo,
+		uint32_t trialId, double wallclockStart, TrialIndexRecord *pIndexRecord, bool *pCreated) {
+#ifdef MATLAB_MEX_FILE
+	diep("Trial containers are not supported in MEX builds");
+	return false;
+#else
+	TrialContainer *pContainer = containerAcquire(pSigFileInfo->fileName, pCreated);
+	if (pContainer == NULL)
+		diep("Error opening trial container");
+
+	bool success = containerAppendTrial(pContainer, trialId, wallclockStart, mxTrial, mxMeta,
+			&pIndexRecord->fileOffset, &pIndexRecord->fileBytes);
+
+	containerRelease(pContainer);
+	return success;
+#endif
+}
+
 void addTrialMetaFields(mxArray *mxTrial, const DataLoggerStatus *dlStatus, unsigned trialIdx) {
 	// add subject field
 	unsigned fieldNum;
@@ -522,6 +1426,283 @@ void addTrialMetaFields(mxArray *mxTrial, const DataLoggerStatus *dlStatus, unsi
 	mxSetFieldByNumber(mxTrial, 0, fieldNum, mxCreateString("ms"));
 }
 
+// meta.signals.(name) for each signal of pg, as buildStructForTrial adds them
+static void addGroupSignalMeta(mxArray *mxSignalMeta, const GroupInfo *pg) {
+	if (pg->type == GROUP_TYPE_EVENT)
+		return;
+
+	for (unsigned i = 0; i < pg->nSignals; i++) {
+		const SignalDataBuffer *psdb = pg->signals[i];
+		if (psdb != NULL && psdb->type != SIGNAL_TYPE_TIMESTAMP && psdb->type != SIGNAL_TYPE_TIMESTAMPOFFSET)
+			addSignalMetaField(mxSignalMeta, psdb);
+	}
+}
+
+// meta.signals for all groups on gtrie
+static mxArray *buildSignalMeta(GroupTrie *gtrie) {
+	mxArray *mxSignalMeta = mxCreateStructMatrix(1,1,0,NULL);
+
+	for (GroupTrie *groupNode = getFirstGroupNode(gtrie); groupNode != NULL; groupNode = getNextGroupNode(groupNode))
+		addGroupSignalMeta(mxSignalMeta, (const GroupInfo*)groupNode->value);
+
+	return mxSignalMeta;
+}
+
+// FNV-1a, tells apart groups that share a configHash
+static uint32_t hashGroupName(const char *name) {
+	uint32_t hash = 2166136261u;
+	for (const char *p = name; *p != '\0'; p++)
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+	return hash;
+}
+
+// meta.layouts for all groups on gtrie, one column of configHash and name hash per group, in the
+// order meta.groups would list them
+static mxArray *buildLayouts(GroupTrie *gtrie) {
+	unsigned nGroups = getGroupCount(gtrie);
+	mxArray *mxLayouts = mxCreateNumericMatrix(2, nGroups, mxUINT32_CLASS, mxREAL);
+	uint32_t *layouts = (uint32_t*)mxGetData(mxLayouts);
+
+	unsigned iGroup = 0;
+	for (GroupTrie *groupNode = getFirstGroupNode(gtrie); groupNode != NULL && iGroup < nGroups;
+			groupNode = getNextGroupNode(groupNode), iGroup++) {
+		const GroupInfo *pg = (const GroupInfo*)groupNode->value;
+		layouts[2*iGroup] = pg->configHash;
+		layouts[2*iGroup + 1] = hashGroupName(pg->name);
+	}
+
+	return mxLayouts;
+}
+
+#ifndef MATLAB_MEX_FILE
+// trials written with the cache hold their own references to the arrays in it
+static void destroyMetaCache(MetaCache *pCache) {
+	for (unsigned i = 0; i < pCache->nGroups; i++)
+		mxDestroyArray(pCache->groups[i].mxGroupMeta);
+	FREE(pCache->groups);
+	mxDestroyArray(pCache->mxSignalMeta);
+	mxDestroyArray(pCache->mxLayouts);
+	FREE(pCache);
+}
+
+static void releaseMetaCache(MetaCache *pCache) {
+	pthread_mutex_lock(&metaCacheMutex);
+	bool last = --pCache->refs == 0;
+	pthread_mutex_unlock(&metaCacheMutex);
+	if (last)
+		destroyMetaCache(pCache);
+}
+
+static void freeMetaCache(void *pCache) {
+	releaseMetaCache((MetaCache*)pCache);
+}
+
+// arrays that couldn't be shared are left out, and built for each trial as before
+static mxArray *shareOrDestroy(mxArray *pm) {
+	if (matShareArray(pm))
+		return pm;
+	mxDestroyArray(pm);
+	return NULL;
+}
+
+static MetaCache *buildMetaCache(GroupTrie *gtrie) {
+	MetaCache *pCache = (MetaCache*)CALLOC(sizeof(MetaCache), 1);
+	if (pCache == NULL)
+		return NULL;
+
+	unsigned nGroups = getGroupCount(gtrie);
+	pCache->groups = CALLOC(sizeof(*pCache->groups), nGroups > 0 ? nGroups : 1);
+	if (pCache->groups == NULL) {
+		FREE(pCache);
+		return NULL;
+	}
+
+	for (GroupTrie *groupNode = getFirstGroupNode(gtrie); groupNode != NULL && pCache->nGroups < nGroups;
+			groupNode = getNextGroupNode(groupNode)) {
+		const GroupInfo *pg = (const GroupInfo*)groupNode->value;
+		pCache->groups[pCache->nGroups].pg = pg;
+		if (pg->type != GROUP_TYPE_EVENT)
+			pCache->groups[pCache->nGroups].mxGroupMeta = shareOrDestroy(setGroupMetaFields(pg, NULL, 0));
+		pCache->nGroups++;
+	}
+	pCache->mxSignalMeta = shareOrDestroy(buildSignalMeta(gtrie));
+	if (schemaRegistry)
+		pCache->mxLayouts = shareOrDestroy(buildLayouts(gtrie));
+
+	pCache->generation = ++metaCacheGeneration;
+	pCache->refs = 1; // held by the status
+	return pCache;
+}
+
+// NULL if it couldn't be shared and has to be built for each trial
+static mxArray *retainCachedMeta(mxArray *pm) {
+	return matRetainSharedArray(pm);
+}
+
+// the status' cache with a reference for the caller, rebuilt if groups were added since
+static MetaCache *acquireMetaCache(DataLoggerStatus *dlStatus) {
+	pthread_mutex_lock(&metaCacheMutex);
+
+	MetaCache *pCache = (MetaCache*)dlStatus->metaCache;
+	if (pCache == NULL || pCache->nGroups != getGroupCount(dlStatus->gtrie)) {
+		MetaCache *pNewCache = buildMetaCache(dlStatus->gtrie);
+		if (pNewCache != NULL) {
+			// writers still using the old one keep it until they release it
+			if (pCache != NULL && --pCache->refs == 0)
+				destroyMetaCache(pCache);
+			pCache = pNewCache;
+			dlStatus->metaCache = pCache;
+			dlStatus->freeMetaCache = freeMetaCache;
+		}
+	}
+
+	if (pCache != NULL)
+		pCache->refs++;
+	pthread_mutex_unlock(&metaCacheMutex);
+	return pCache;
+}
+
+static bool isSchemaRegistered(const SchemaRegistry *pReg, uint64_t key) {
+	for (unsigned i = 0; i < pReg->nKeys; i++) {
+		if (pReg->keys[i] == key)
+			return true;
+	}
+	return false;
+}
+
+static void addSchemaKey(SchemaRegistry *pReg, uint64_t key) {
+	if (pReg->nKeys == pReg->keysAllocated) {
+		unsigned keysAllocated = pReg->keysAllocated > 0 ? 2*pReg->keysAllocated : 32;
+		uint64_t *keys = (uint64_t*)REALLOC(pReg->keys, sizeof(uint64_t) * keysAllocated);
+		if (keys == NULL)
+			return;
+		pReg->keys = keys;
+		pReg->keysAllocated = keysAllocated;
+	}
+	pReg->keys[pReg->nKeys++] = key;
+}
+
+// the registry of the saveTag folder at path, taking over the least recently opened slot if new
+static SchemaRegistry *getSchemaRegistry(const char *path) {
+	char fileName[MAX_FILENAME_LENGTH];
+	snprintf_nowarn(fileName, MAX_FILENAME_LENGTH, "%s/%s", path, SCHEMA_REGISTRY_FILE_NAME);
+
+	for (unsigned i = 0; i < MAX_SCHEMA_REGISTRIES; i++) {
+		if (strcmp(schemaRegistries[i].fileName, fileName) == 0)
+			return schemaRegistries + i;
+	}
+
+	// layouts already in the file are picked up when it's opened to add some
+	SchemaRegistry *pReg = schemaRegistries + schemaRegistryNextSlot;
+	schemaRegistryNextSlot = (schemaRegistryNextSlot + 1) % MAX_SCHEMA_REGISTRIES;
+	strcpy(pReg->fileName, fileName);
+	pReg->nKeys = 0;
+	pReg->checkedGeneration = 0;
+	return pReg;
+}
+
+// opens the registry to append to, creating it if needed, and adds the layouts it has to pReg
+static MATFile *openSchemaRegistry(SchemaRegistry *pReg) {
+	if (access(pReg->fileName, F_OK) != 0)
+		return matOpen(pReg->fileName, "w");
+
+	MATFile *pmat = matOpen(pReg->fileName, "u");
+	int nNames;
+	char **names = matGetDir(pmat, &nNames);
+	if (names == NULL) {
+		// never written over, trials written before refer to what's in there
+		matClose(pmat);
+		return NULL;
+	}
+
+	for (int i = 0; i < nNames; i++) {
+		unsigned configHash, nameHash;
+		if (sscanf(names[i], "h%8x_%8x", &configHash, &nameHash) == 2 &&
+				!isSchemaRegistered(pReg, (uint64_t)configHash << 32 | nameHash))
+			addSchemaKey(pReg, (uint64_t)configHash << 32 | nameHash);
+	}
+	mxFree(names);
+	return pmat;
+}
+
+// entry.group as in meta.groups, entry.signals as the group's part of meta.signals
+static mxArray *buildSchemaEntry(const GroupInfo *pg) {
+	const char *fieldNames[] = {"group", "signals"};
+	mxArray *mxEntry = mxCreateStructMatrix(1, 1, 2, fieldNames);
+	mxArray *mxSignalMeta = mxCreateStructMatrix(1,1,0,NULL);
+
+	addGroupSignalMeta(mxSignalMeta, pg);
+	mxSetField(mxEntry, 0, "group", setGroupMetaFields(pg, NULL, 0));
+	mxSetField(mxEntry, 0, "signals", mxSignalMeta);
+	return mxEntry;
+}
+
+// make sure every group the trial in pSigFileInfo may have is in its saveTag's registry before the
+// trial is written. The registry sits on the first data root, where readers find the trials
+static void registerSchemas(DataLoggerStatus *dlStatus, const SignalFileInfo *pSigFileInfo) {
+	// groups are only added to a status, so unless the cache was rebuilt all of them are there
+	MetaCache *pCache = acquireMetaCache(dlStatus);
+	pthread_mutex_lock(&schemaRegistryMutex);
+
+	SchemaRegistry *pReg = getSchemaRegistry(pSigFileInfo->linkName[0] != '\0' ?
+			pSigFileInfo->linkPath : pSigFileInfo->filePath);
+	if (pCache == NULL || pReg->checkedGeneration != pCache->generation) {
+		MATFile *pmat = NULL;
+		bool failed = false;
+
+		for (GroupTrie *groupNode = getFirstGroupNode(dlStatus->gtrie); groupNode != NULL && !failed;
+				groupNode = getNextGroupNode(groupNode)) {
+			const GroupInfo *pg = (const GroupInfo*)groupNode->value;
+			uint64_t key = (uint64_t)pg->configHash << 32 | hashGroupName(pg->name);
+			if (isSchemaRegistered(pReg, key))
+				continue;
+
+			if (pmat == NULL) {
+				pmat = openSchemaRegistry(pReg);
+				failed = pmat == NULL;
+				if (failed || isSchemaRegistered(pReg, key))
+					continue;
+			}
+
+			char name[32];
+			snprintf(name, sizeof(name), "h%08x_%08x", pg->configHash, hashGroupName(pg->name));
+			mxArray *mxEntry = buildSchemaEntry(pg);
+			failed = matPutVariable(pmat, name, mxEntry) != 0;
+			mxDestroyArray(mxEntry);
+			if (!failed)
+				addSchemaKey(pReg, key);
+		}
+
+		if (pmat != NULL && matClose(pmat) != 0)
+			failed = true;
+		if (failed)
+			logError("Writer Error: Could not register group layouts in %s\n", pReg->fileName);
+		else if (pCache != NULL)
+			pReg->checkedGeneration = pCache->generation;
+	}
+
+	pthread_mutex_unlock(&schemaRegistryMutex);
+	if (pCache != NULL)
+		releaseMetaCache(pCache);
+}
+#else
+// MATLAB owns the arrays handed back to it, so they are built afresh
+static MetaCache *acquireMetaCache(DataLoggerStatus *dlStatus) {
+	return NULL;
+}
+
+static void releaseMetaCache(MetaCache *pCache) {
+}
+
+static mxArray *retainCachedMeta(mxArray *pm) {
+	return NULL;
+}
+
+static void registerSchemas(DataLoggerStatus *dlStatus, const SignalFileInfo *pSigFileInfo) {
+	diep("Schema registries are not supported in MEX builds");
+}
+#endif
+
 void addGroupMetaField(mxArray *mxGroupMeta, const GroupInfo *pg) {
 	mxArray *thisGroupsField = setGroupMetaFields(pg, NULL, 0);
 
@@ -661,17 +1842,14 @@ bool addGroupTimestampsField(mxArray *mxTrial, const GroupInfo *pg, unsigned tri
 	else
 		strcpy(fieldName, "time");
 
-	timestamp_t *pTimestampsBase = pg->tsBuffers[trialIdx].timestamps;
-	uint32_t nTimestampsBase = pg->tsBuffers[trialIdx].nSamples;
+	const TimestampBuffer *ptsb = pg->tsBuffers + trialIdx;
+	uint32_t nTimestampsBase = ptsb->nSamples;
 
 	// create the matlab array to hold the timestamps, use double as the type
 	mxArray *mxTimestamps = mxCreateNumericMatrix(nTimestampsBase, 1, mxDOUBLE_CLASS, mxREAL);
 
-	// enter the timestamps minus the trial start into the array
-	double_t *buffer = (double_t*)mxGetData(mxTimestamps);
-	// no offsets, subtract trial start and round to ms (should be integer anyway)
-	for (unsigned i = 0; i < nTimestampsBase; i++)
-		buffer[i] = pTimestampsBase[i] - timeTrialStart;
+	// expand the timestamps minus the trial start into the array
+	copyTimestampBufferData(ptsb, (timestamp_t*)mxGetData(mxTimestamps), timeTrialStart);
 
 	// add to trial struct
 	int fieldNum;
@@ -679,13 +1857,109 @@ bool addGroupTimestampsField(mxArray *mxTrial, const GroupInfo *pg, unsigned tri
 	if (fieldNum == -1)
 		fieldNum = mxAddField(mxTrial, fieldName);
 
+	setArrayCompressionForGroupType(mxTimestamps, pg->type);
 	mxSetFieldByNumber(mxTrial, index, fieldNum, mxTimestamps);
 
 	return true;
 }
 
-void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned trialIdx,
-		bool useGroupPrefix, unsigned nSamples) {
+// fill a newly created array with nBytes of data from a signal buffer
+static void setArrayDataFromBuffer(mxArray *mxData, const void *data, size_t nBytes) {
+#ifdef MATLAB_MEX_FILE
+	memcpy(mxGetData(mxData), data, nBytes);
+#else
+	// the native MAT writer streams straight from the buffer
+	if (nBytes > 0)
+		matSetBorrowedData(mxData, data);
+#endif
+}
+
+// the samples of a signal that can't be concatenated, packed into a struct with .data, all of their
+// elements in one column, .lengths, the number of elements of each sample, and .sampleDims, the
+// size of each sample along all dimensions but the last ([] for vectors, 1 for strings). Numeric
+// data is borrowed from the buffer rather than copied where no sample has a partial element
+static mxArray *buildPackedSamples(const SignalDataBuffer *psdb, const SampleBufferView *ptb,
+		unsigned nSamples) {
+	const char *fieldNames[] = { "data", "lengths", "sampleDims" };
+	bool isChar = psdb->dataTypeId == DTID_CHAR;
+	unsigned bytesPerElement = getSizeOfDataTypeId(psdb->dataTypeId);
+
+	// strings become 1 x N rows, other samples keep every dimension but the last
+	unsigned nSampleDims = isChar ? 1 : (psdb->nDims > 0 ? psdb->nDims - 1 : 0);
+	mxArray *mxSampleDims = mxCreateDoubleMatrix(1, nSampleDims, mxREAL);
+	double *sampleDims = mxGetPr(mxSampleDims);
+	unsigned elementsPerColumn = 1;
+	if (isChar)
+		sampleDims[0] = 1;
+	else {
+		for (unsigned i = 0; i < nSampleDims; i++) {
+			sampleDims[i] = psdb->dims[i];
+			elementsPerColumn *= psdb->dims[i];
+		}
+	}
+	if (elementsPerColumn == 0)
+		elementsPerColumn = 1;
+
+	mxArray *mxLengths = mxCreateNumericMatrix(nSamples, 1, mxUINT32_CLASS, mxREAL);
+	uint32_t *lengths = (uint32_t*)mxGetData(mxLengths);
+	mwSize nElements = 0;
+	bool wholeElements = !isChar;
+	const uint8_t *dataPtr = ptb->data;
+	for (unsigned iSample = 0; iSample < nSamples; iSample++) {
+		unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[iSample] : ptb->bytesFixed;
+		unsigned nElementsThisSample;
+		if (isChar)
+			// strings end at the first zero as in the cell arrays
+			nElementsThisSample = strnlen((const char*)dataPtr, bytesThisSample);
+		else
+			nElementsThisSample = bytesThisSample / bytesPerElement / elementsPerColumn * elementsPerColumn;
+		if (nElementsThisSample * bytesPerElement != bytesThisSample)
+			wholeElements = false;
+		lengths[iSample] = nElementsThisSample;
+		nElements += nElementsThisSample;
+		dataPtr += bytesThisSample;
+	}
+
+	mwSize dims[2] = { nElements, 1 };
+	mxArray *mxPacked;
+	if (psdb->dataTypeId == DTID_LOGICAL)
+		mxPacked = mxCreateLogicalArray(2, dims);
+	else if (isChar)
+		mxPacked = mxCreateCharArray(2, dims);
+	else
+		mxPacked = mxCreateNumericArray(2, dims, convertDataTypeIdToMxClassId(psdb->dataTypeId), mxREAL);
+
+	if (wholeElements) {
+		setArrayDataFromBuffer(mxPacked, ptb->data, nElements * bytesPerElement);
+	} else {
+		// drop what's past the end of strings or the partial elements at the end of samples,
+		// char arrays hold 2 bytes per character
+		uint8_t *dest = (uint8_t*)mxGetData(mxPacked);
+		uint16_t *destChars = (uint16_t*)dest;
+		dataPtr = ptb->data;
+		for (unsigned iSample = 0; iSample < nSamples; iSample++) {
+			unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[iSample] : ptb->bytesFixed;
+			if (isChar) {
+				for (unsigned i = 0; i < lengths[iSample]; i++)
+					*destChars++ = dataPtr[i];
+			} else {
+				memcpy(dest, dataPtr, lengths[iSample] * bytesPerElement);
+				dest += lengths[iSample] * bytesPerElement;
+			}
+			dataPtr += bytesThisSample;
+		}
+	}
+
+	mxArray *mxData = mxCreateStructMatrix(1, 1, 3, fieldNames);
+	mxSetField(mxData, 0, "data", mxPacked);
+	mxSetField(mxData, 0, "lengths", mxLengths);
+	mxSetField(mxData, 0, "sampleDims", mxSampleDims);
+	return mxData;
+}
+
+// adds the first nSamples samples of the view ptb of psdb's buffer as a field of mxTrial
+static void addSignalDataFieldFromView(mxArray *mxTrial, const SignalDataBuffer *psdb,
+		const SampleBufferView *ptb, bool useGroupPrefix, unsigned nSamples) {
 
 	mxArray *mxData;
 
@@ -696,7 +1970,6 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 	else
 		strncpy(fieldName, psdb->name, MAX_SIGNAL_NAME);
 
-	const SampleBuffer *ptb = psdb->buffers + trialIdx;
 	mwSize ndims = (mwSize)psdb->nDims;
 	mwSize dims[MAX_SIGNAL_NDIMS+1];
 	unsigned nBytesData, totalElements;
@@ -717,7 +1990,7 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 			mxData = mxCreateString("");
 		else {
 			// first copy string into buffer, then zero terminate it
-			unsigned bytesThisSample = ptb->bytesEachSample[0];
+			unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[0] : ptb->bytesFixed;
 			if (bytesThisSample > MAX_SIGNAL_SIZE) {
 				bytesThisSample = MAX_SIGNAL_SIZE;
 				logError("Writer Error: Overflow on signal %s", psdb->name);
@@ -769,7 +2042,13 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 			else
 				mxData = mxCreateNumericArray(ndims, dims, cid, mxREAL);
 
-			memcpy(mxGetData(mxData), ptb->data, nBytesData);
+			// char arrays hold 2 bytes per character and can't share the buffer
+			if (psdb->dataTypeId == DTID_CHAR)
+				memcpy(mxGetData(mxData), ptb->data, nBytesData);
+			else
+				setArrayDataFromBuffer(mxData, ptb->data, nBytesData);
+		} else if (packedVariableSize) {
+			mxData = buildPackedSamples(psdb, ptb, nSamples);
 		} else {
 			// data is char or samples have different sizes, put each in a cell array
 			mxData = mxCreateCellMatrix(nSamples, 1);
@@ -782,7 +2061,7 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 
 				for (unsigned iSample = 0; iSample < nSamples; iSample++) {
 					// first copy string into buffer, then zero terminate it
-					unsigned bytesThisSample = ptb->bytesEachSample[iSample];
+					unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[iSample] : ptb->bytesFixed;
 					// TODO: add memory overflow check here
 					memcpy(strBuffer, dataPtr, bytesThisSample);
 					strBuffer[bytesThisSample] = '\0';
@@ -795,6 +2074,7 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 				}
 			} else {
 				mxArray *mxSampleData;
+				const uint8_t *dataPtr = ptb->data;
 
 				// variable size numeric signal
 				totalElements = 1;
@@ -806,7 +2086,7 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 
 				// loop over each sample
 				for (unsigned iSample = 0; iSample < nSamples; iSample++) {
-					unsigned bytesThisSample = ptb->bytesEachSample[iSample];
+					unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[iSample] : ptb->bytesFixed;
 					// calculate last dimension by division
 					dims[ndims-1] = bytesThisSample / bytesPerElement / totalElements;
 					nBytesData = totalElements*dims[ndims-1]*bytesPerElement;
@@ -817,10 +2097,13 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 					else
 						mxSampleData = mxCreateNumericArray(ndims, dims, cid, mxREAL);
 
-					memcpy(mxGetData(mxSampleData), ptb->data, nBytesData);
+					setArrayDataFromBuffer(mxSampleData, dataPtr, nBytesData);
 
 					// and assign it into the cell
 					mxSetCell(mxData, iSample, mxSampleData);
+
+					// advance the data pointer
+					dataPtr += bytesThisSample;
 				}
 			}
 		}
@@ -828,12 +2111,177 @@ void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned
 
 	// add to trial struct
 	unsigned fieldNum = mxAddField(mxTrial, fieldName);
+	setArrayCompressionForGroupType(mxData, psdb->pGroupInfo->type);
 	mxSetFieldByNumber(mxTrial, 0, fieldNum, mxData);
 }
 
-void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
+void addSignalDataField(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned trialIdx,
+		bool useGroupPrefix, unsigned nSamples) {
+	// samples may live in the signal's own buffer or in the group's column buffer
+	SampleBufferView view;
+	getSignalSampleView(psdb, trialIdx, &view);
+	addSignalDataFieldFromView(mxTrial, psdb, &view, useGroupPrefix, nSamples);
+}
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t nBytes) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < nBytes; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+// identifies the folder a trial goes to, dataStore/subject/date/protocol/saveTag
+uint64_t getSaveTagKey(const DataLoggerStatus *dlStatus, unsigned trialIdx) {
+	struct tm timeInfo;
+	unsigned msec;
+	convertWallclockToLocalTime(dlStatus->byTrial[trialIdx].wallclockStart, &timeInfo, &msec);
+	char folder[MAX_FILENAME_LENGTH];
+	snprintf_nowarn(folder, MAX_FILENAME_LENGTH, "%s/%s/%04d-%02d-%02d/%s/%u", dlStatus->dataStore,
+			dlStatus->subject, timeInfo.tm_year + 1900, timeInfo.tm_mon + 1, timeInfo.tm_mday,
+			dlStatus->protocol, dlStatus->saveTag);
+	return hashBytes(14695981039346656037ull, folder, strlen(folder));
+}
+
+// with params written only on change, adds signalName as struct sameAsTrialId with the id of the
+// last trial of the saveTag the param was written to when it had the same value then, and returns
+// true. Otherwise the param's value is to be written in full and this trial is remembered for it.
+// Values are compared byte for byte with a copy of the value last written, a hash of them only
+// tells most changes apart quicker
+bool addParamReferenceField(mxArray *mxTrial, SignalDataBuffer *psdb, const DataLoggerStatus *dlStatus,
+		unsigned trialIdx, unsigned nSamples, uint64_t saveTagKey) {
+	SampleBufferView view;
+	getSignalSampleView(psdb, trialIdx, &view);
+	if (nSamples > view.nSamples)
+		nSamples = view.nSamples;
+
+	// the value as compared: the sample count, type and dims, the size of each sample, the samples
+	size_t nBytes = 0;
+	for (unsigned iSample = 0; iSample < nSamples; iSample++)
+		nBytes += view.bytesEachSample ? view.bytesEachSample[iSample] : view.bytesFixed;
+	size_t dimsBytes = sizeof(psdb->dims[0]) * psdb->nDims;
+	size_t valueBytes = sizeof(nSamples) + sizeof(psdb->dataTypeId) + dimsBytes + sizeof(unsigned) * nSamples + nBytes;
+	uint8_t *value = (uint8_t*)MALLOC(valueBytes);
+	if (value == NULL) {
+		logError("Writer Error: No memory to compare param %s, writing it in full\n", psdb->name);
+		return false;
+	}
+
+	uint8_t *p = value;
+	memcpy(p, &nSamples, sizeof(nSamples));
+	p += sizeof(nSamples);
+	memcpy(p, &psdb->dataTypeId, sizeof(psdb->dataTypeId));
+	p += sizeof(psdb->dataTypeId);
+	memcpy(p, psdb->dims, dimsBytes);
+	p += dimsBytes;
+	for (unsigned iSample = 0; iSample < nSamples; iSample++) {
+		unsigned bytesThisSample = view.bytesEachSample ? view.bytesEachSample[iSample] : view.bytesFixed;
+		memcpy(p, &bytesThisSample, sizeof(bytesThisSample));
+		p += sizeof(bytesThisSample);
+	}
+	memcpy(p, view.data, nBytes);
+	uint64_t valueHash = hashBytes(14695981039346656037ull, value, valueBytes);
+
+	uint32_t trialId = dlStatus->byTrial[trialIdx].trialId;
+	pthread_mutex_lock(&paramsOnChangeMutex);
+	bool unchanged = psdb->writtenValueValid && psdb->writtenSaveTagKey == saveTagKey &&
+		psdb->writtenValueHash == valueHash && psdb->writtenValueBytes == valueBytes &&
+		memcmp(psdb->writtenValue, value, valueBytes) == 0 && psdb->writtenTrialId != trialId;
+	uint32_t sameAsTrialId = psdb->writtenTrialId;
+	if (!unchanged) {
+		FREE(psdb->writtenValue);
+		psdb->writtenValue = value;
+		psdb->writtenValueBytes = valueBytes;
+		psdb->writtenValueValid = true;
+		psdb->writtenValueHash = valueHash;
+		psdb->writtenSaveTagKey = saveTagKey;
+		psdb->writtenTrialId = trialId;
+		value = NULL;
+	}
+	pthread_mutex_unlock(&paramsOnChangeMutex);
+	FREE(value);
+
+	if (!unchanged)
+		return false;
+
+	const char *fieldNames[] = { "sameAsTrialId" };
+	mxArray *mxReference = mxCreateStructMatrix(1, 1, 1, fieldNames);
+	mxArray *mxTrialId = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL);
+	((uint32_t*)mxGetData(mxTrialId))[0] = sameAsTrialId;
+	mxSetField(mxReference, 0, "sameAsTrialId", mxTrialId);
+
+	unsigned fieldNum = mxAddField(mxTrial, psdb->name);
+	mxSetFieldByNumber(mxTrial, 0, fieldNum, mxReference);
+	return true;
+}
+
+// adds signalName_changeTimes with the time of each change of a param's value within the trial,
+// the first being when the value in effect at the start of the trial was received, and
+// signalName_changeValues with a cell containing each of those values
+void addParamChangeLogFields(mxArray *mxTrial, const SignalDataBuffer *psdb, unsigned trialIdx,
+		timestamp_t timeTrialStart) {
+	const SampleBuffer *pValues = psdb->changeValues + trialIdx;
+	const TimestampBuffer *pTimes = psdb->changeTimes + trialIdx;
+	char fieldName[MAX_SIGNAL_NAME];
+	unsigned fieldNum;
+
+	mxArray *mxTimes = mxCreateNumericMatrix(pTimes->nSamples, 1, mxDOUBLE_CLASS, mxREAL);
+	copyTimestampBufferData(pTimes, (timestamp_t*)mxGetData(mxTimes), timeTrialStart);
+
+	mxArray *mxValues = mxCreateCellMatrix(pValues->nSamples, 1);
+	mxClassID cid = convertDataTypeIdToMxClassId(psdb->dataTypeId);
+	unsigned bytesPerElement = getSizeOfDataTypeId(psdb->dataTypeId);
+	const uint8_t *dataPtr = pValues->data;
+	mwSize ndims = (mwSize)psdb->nDims;
+	mwSize dims[MAX_SIGNAL_NDIMS+1];
+
+	// get size along all dimensions but last, which is computed from the size of each value
+	unsigned totalElements = 1;
+	for (int i = 0; i < (int)ndims - 1; i++) {
+		dims[i] = (mwSize)(psdb->dims[i]);
+		totalElements *= dims[i];
+	}
+
+	for (unsigned iSample = 0; iSample < pValues->nSamples; iSample++) {
+		unsigned bytesThisSample = pValues->samplesDifferentSizes ?
+			pValues->bytesEachSample[iSample] : pValues->bytesFixed;
+		mxArray *mxSampleData;
+
+		if (psdb->dataTypeId == DTID_CHAR) {
+			char strBuffer[MAX_SIGNAL_SIZE+1];
+			unsigned nChars = bytesThisSample > MAX_SIGNAL_SIZE ? MAX_SIGNAL_SIZE : bytesThisSample;
+			memcpy(strBuffer, dataPtr, nChars);
+			strBuffer[nChars] = '\0';
+			mxSampleData = mxCreateString(strBuffer);
+		} else {
+			dims[ndims-1] = bytesThisSample / bytesPerElement / totalElements;
+
+			if (psdb->dataTypeId == DTID_LOGICAL)
+				mxSampleData = mxCreateLogicalArray(ndims, dims);
+			else
+				mxSampleData = mxCreateNumericArray(ndims, dims, cid, mxREAL);
+
+			memcpy(mxGetData(mxSampleData), dataPtr, totalElements*dims[ndims-1]*bytesPerElement);
+		}
+
+		mxSetCell(mxValues, iSample, mxSampleData);
+		dataPtr += bytesThisSample;
+	}
+
+	snprintf_nowarn(fieldName, MAX_SIGNAL_NAME, "%s_changeTimes", psdb->name);
+	fieldNum = mxAddField(mxTrial, fieldName);
+	setArrayCompressionForGroupType(mxTimes, psdb->pGroupInfo->type);
+	mxSetFieldByNumber(mxTrial, 0, fieldNum, mxTimes);
+
+	snprintf_nowarn(fieldName, MAX_SIGNAL_NAME, "%s_changeValues", psdb->name);
+	fieldNum = mxAddField(mxTrial, fieldName);
+	setArrayCompressionForGroupType(mxValues, psdb->pGroupInfo->type);
+	mxSetFieldByNumber(mxTrial, 0, fieldNum, mxValues);
+}
+
+// adds the events of the (at most) nSamples samples from firstSample on
+static void addEventGroupFieldsForSamples(mxArray *mxTrial, mxArray *mxGroupMeta,
 		const GroupInfo *pg, unsigned trialIdx, timestamp_t timeTrialStart,
-		bool useGroupPrefix, unsigned groupMetaIndex) {
+		bool useGroupPrefix, unsigned groupMetaIndex, uint32_t firstSample, uint32_t nSamples) {
 
 	// field names will be groupName_<eventName>
 	// but the signal always comes in as .eventName and the contents are the name of the event
@@ -845,6 +2293,10 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 	// get timestamp buffer from group buffer
 	const TimestampBuffer *groupTimestamps = pg->tsBuffers + trialIdx;
 	const char *groupName = pg->name;
+	if (firstSample > groupTimestamps->nSamples)
+		firstSample = groupTimestamps->nSamples;
+	if (nSamples > groupTimestamps->nSamples - firstSample)
+		nSamples = groupTimestamps->nSamples - firstSample;
 
 	// for now check that the event group has only 1 signal and it's type is EventName
 	bool printError = false;
@@ -858,13 +2310,24 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 	}
 
 	const SignalDataBuffer *psdb = pg->signals[0];
-	const SampleBuffer *ptb = psdb->buffers + trialIdx;
+	SampleBufferView view;
+	getSignalSampleViewRange(psdb, trialIdx, firstSample, nSamples, &view);
+	const SampleBufferView *ptb = &view;
 	char eventName[MAX_SIGNAL_NAME];
 
+	// expand the group timestamps, one per event
+	timestamp_t *eventTimestamps = (timestamp_t*)CALLOC(sizeof(timestamp_t), nSamples + 1);
+	if (eventTimestamps == NULL) {
+		logError("Writer Error: Issue building event fields\n");
+		trie_flush(eventTrie, FREE);
+		return;
+	}
+	copyTimestampBufferDataRange(groupTimestamps, firstSample, nSamples, eventTimestamps, 0);
+
 	char *dataPtr = (char*)ptb->data;
-	for (unsigned iSample = 0; iSample < ptb->nSamples; iSample++) {
+	for (unsigned iSample = 0; iSample < ptb->nSamples && iSample < nSamples; iSample++) {
 		// first copy string into buffer, then zero terminate it
-		unsigned bytesThisSample = ptb->bytesEachSample[iSample];
+		unsigned bytesThisSample = ptb->bytesEachSample ? ptb->bytesEachSample[iSample] : ptb->bytesFixed;
 
 		// TODO: add overflow detection
 		memcpy(eventName, dataPtr, bytesThisSample);
@@ -882,13 +2345,17 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 
 
 		// push this timestamp to the buffer
-		bool success = pushTimestampToTimestampBuffer(&info->tsBuffer, groupTimestamps->timestamps[iSample]);
+		bool success = pushTimestampToTimestampBuffer(&info->tsBuffer, eventTimestamps[iSample]);
 		if (!success) {
 			logError("Writer Error: Issue building event fields\n");
+			FREE(eventTimestamps);
+			trie_flush(eventTrie, (void (*)(void*))freeEventTrieInfo);
 			return;
 		}
 	}
 
+	FREE(eventTimestamps);
+
 	// now iterate over the eventName trie and add each field
 	unsigned nEventNames = trie_count(eventTrie);
 	mxArray *mxSignalNames = mxCreateCellMatrix(nEventNames, 1);
@@ -914,11 +2381,13 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 
 		// subtract off trial start time and convert to ms, rounding at ms
 		double_t *buffer = (double_t*)mxGetData(mxTimestamps);
+		copyTimestampBufferData(&info->tsBuffer, buffer, timeTrialStart);
 		for (unsigned i = 0; i < info->tsBuffer.nSamples; i++)
-			buffer[i] = round((info->tsBuffer.timestamps[i] - timeTrialStart));
+			buffer[i] = round(buffer[i]);
 
 		// add event time list field to trial struct
 		fieldNum = mxAddField(mxTrial, fieldName);
+		setArrayCompressionForGroupType(mxTimestamps, pg->type);
 		mxSetFieldByNumber(mxTrial, 0, fieldNum, mxTimestamps);
 
 		// get the next event in the trie
@@ -927,7 +2396,7 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 	}
 
 	// free the event Trie resources
-	trie_flush(eventTrie, FREE);
+	trie_flush(eventTrie, (void (*)(void*))freeEventTrieInfo);
 
 	// add signal names to the meta array
 	fieldNum = mxGetFieldNumber(mxGroupMeta, "signalNames");
@@ -936,6 +2405,13 @@ void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
 	mxSetFieldByNumber(mxGroupMeta, groupMetaIndex, fieldNum, mxSignalNames);
 }
 
+void addEventGroupFields(mxArray *mxTrial, mxArray *mxGroupMeta,
+		const GroupInfo *pg, unsigned trialIdx, timestamp_t timeTrialStart,
+		bool useGroupPrefix, unsigned groupMetaIndex) {
+	addEventGroupFieldsForSamples(mxTrial, mxGroupMeta, pg, trialIdx, timeTrialStart, useGroupPrefix,
+			groupMetaIndex, 0, pg->tsBuffers[trialIdx].nSamples);
+}
+
 //////////// FOR UDP MEX INTERACE /////////////////
 mxArray *buildGroupsArrayForCurrentTrial(bool clearBuffers) {
 	// if we're going to clear this trial's data, make sure we don't continue
@@ -945,9 +2421,12 @@ mxArray *buildGroupsArrayForCurrentTrial(bool clearBuffers) {
 	unsigned trialIdx;
 
 	// TODO: fix this, this isn't thread safe
-	if (clearBuffers)
+	if (clearBuffers) {
+		// the samples buffered up to here are all in the trial split off below, so they are the
+		// ones this hands out, the ones buffered after are new to latestValuesWaitForNew
+		latestValuesMarkSeen();
 		trialIdx = controlManualSplitCurrentTrialMarkForWriting(dlStatus);
-	else
+	} else
 		trialIdx = dlStatus->currentTrial;
 
 	return buildGroupsArrayForTrial(dlStatus, trialIdx, clearBuffers);
@@ -1004,10 +2483,6 @@ mxArray *buildGroupsArrayForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx,
 							continue;
 						// add the signal data to mxSignals which is groups(iGroup).signals
 						addSignalDataField(mxSignals, psdb, trialIdx, false, nSamples);
-
-						// clear the timeseries buffer as these samples are no longer needed
-						if (clearBuffers)
-							clearSampleBuffer(psdb->buffers + trialIdx);
 					}
 				} else { // event group
 					// add the events directly to mxSignals, i.e. groups(iGroup.signals),
@@ -1015,20 +2490,14 @@ mxArray *buildGroupsArrayForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx,
 					// add the meta field group.signalNames as groups(iGroup).signalNames
 					addEventGroupFields(mxSignals, mxGroups, pg, trialIdx,
 							trialStartTime, false, iGroupInArray);
-					if (clearBuffers) {
-						for (unsigned iSignal = 0; iSignal < pg->nSignals; iSignal++) {
-							psdb = pg->signals[iSignal];
-							clearSampleBuffer(psdb->buffers + trialIdx);
-						}
-					}
 				}
 
 				// add signals to groups(i).signals
 				mxSetField(mxGroups, iGroupInArray, "signals", mxSignals);
 
-				// clear the group's timestamp buffer
+				// clear the group's sample and timestamp buffers as these samples are no longer needed
 				if (clearBuffers)
-					clearTimestampBuffer(pg->tsBuffers + trialIdx);
+					clearGroupInfoTrialData(pg, trialIdx);
 
 				nGroupsUsed++;
 			}
@@ -1050,6 +2519,254 @@ mxArray *buildGroupsArrayForTrial(DataLoggerStatus *dlStatus, unsigned trialIdx,
 	return mxGroups;
 }
 
+#ifdef MATLAB_MEX_FILE
+// element index of the double field fieldName of a 1x1 struct, -1 if any of them is missing
+static double getCursorField(const mxArray *mxStruct, const char *fieldName, size_t index) {
+	if (mxStruct == NULL || !mxIsStruct(mxStruct) || mxGetNumberOfElements(mxStruct) != 1)
+		return -1;
+	const mxArray *mxValue = mxGetField(mxStruct, 0, fieldName);
+	if (mxValue == NULL || !mxIsDouble(mxValue) || mxGetNumberOfElements(mxValue) <= index)
+		return -1;
+	return mxGetPr(mxValue)[index];
+}
+
+// builds the groups array of the current trial as buildGroupsArrayForTrial does, but with only the
+// samples each group received since mxCursor, the cursor returned in *pMxCursor by the previous call
+// ([] at first). Groups without new samples are left out. The cursor holds the trialId and
+// wallclockStart of the trial and in .groups the numbers of timestamps and samples of each group
+// returned so far, which differ for groups with a timestamps signal; with a cursor from an earlier
+// trial all of the current trial is returned. Buffers are left as they are, and the samples before
+// the cursor aren't copied again
+mxArray *buildGroupsArrayForCurrentTrialSince(const mxArray *mxCursor, mxArray **pMxCursor) {
+	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
+
+	int nFieldsGroup = 7;
+	const char *fieldNames[] = {"name", "type", "configHash", "version", "signalNames", "signals", "time"};
+	const char *cursorFieldNames[] = {"trialId", "wallclockStart", "groups"};
+	mxArray *mxGroups, *mxSignals;
+
+	// trialId and wallclockStart stay [] until the trial is utilized
+	mxArray *mxNewCursor = mxCreateStructMatrix(1, 1, 3, cursorFieldNames);
+	mxArray *mxNewCursorGroups = mxCreateStructMatrix(1, 1, 0, NULL);
+	mxSetField(mxNewCursor, 0, "groups", mxNewCursorGroups);
+	*pMxCursor = mxNewCursor;
+
+	if (dlStatus == NULL) {
+		logError("Writer Error: No current data logger status");
+		return mxCreateStructMatrix(0, 1, nFieldsGroup, fieldNames);
+	}
+
+	unsigned trialIdx = dlStatus->currentTrial;
+	DataLoggerStatusByTrial *trialStatus = dlStatus->byTrial + trialIdx;
+	GroupTrie *gtrie = dlStatus->gtrie;
+
+	unsigned nGroups = getGroupCount(gtrie);
+	unsigned nGroupsUsed = 0;
+
+	mxGroups = mxCreateStructMatrix(nGroups, 1, nFieldsGroup, fieldNames);
+
+	if (trialStatus->utilized) {
+		timestamp_t trialStartTime = trialStatus->timestampStart;
+
+		mxSetField(mxNewCursor, 0, "trialId", mxCreateDoubleScalar(trialStatus->trialId));
+		mxSetField(mxNewCursor, 0, "wallclockStart", mxCreateDoubleScalar(trialStatus->wallclockStart));
+
+		// the counts of a cursor from another trial don't apply
+		const mxArray *mxCursorGroups = NULL;
+		if (getCursorField(mxCursor, "trialId", 0) == trialStatus->trialId &&
+				getCursorField(mxCursor, "wallclockStart", 0) == trialStatus->wallclockStart)
+			mxCursorGroups = mxGetField(mxCursor, 0, "groups");
+
+		GroupTrie *groupNode = getFirstGroupNode(gtrie);
+		SignalDataBuffer *psdb;
+		for (unsigned iGroup = 0; iGroup < nGroups; iGroup++) {
+			if (groupNode == NULL)
+				break;
+
+			GroupInfo *pg = (GroupInfo*)groupNode->value;
+
+			// samples keep arriving, timestamps ahead of the signals, so everything below is built
+			// from the timestamps and the samples of all signals that have arrived by now. Params
+			// only hold their latest value
+			uint32_t nTimestampsTotal = pg->tsBuffers[trialIdx].nSamples;
+			uint32_t nSamplesTotal = nTimestampsTotal;
+			for (unsigned iSignal = 0; iSignal < pg->nSignals; iSignal++) {
+				psdb = pg->signals[iSignal];
+				if (psdb == NULL || pg->replaceSignal[iSignal])
+					continue;
+				SampleBufferView view;
+				getSignalSampleView(psdb, trialIdx, &view);
+				if (view.nSamples < nSamplesTotal)
+					nSamplesTotal = view.nSamples;
+			}
+			// each event comes with one timestamp
+			if (pg->type == GROUP_TYPE_EVENT)
+				nTimestampsTotal = nSamplesTotal;
+
+			// start over if the buffers were cleared since
+			double nTimestampsSeen = getCursorField(mxCursorGroups, pg->name, 0);
+			double nSamplesSeen = getCursorField(mxCursorGroups, pg->name, 1);
+			uint32_t firstTimestamp = 0, firstSample = 0;
+			if (nTimestampsSeen >= 0 && nTimestampsSeen <= nTimestampsTotal &&
+					nSamplesSeen >= 0 && nSamplesSeen <= nSamplesTotal) {
+				firstTimestamp = (uint32_t)nTimestampsSeen;
+				firstSample = (uint32_t)nSamplesSeen;
+			}
+			uint32_t nTimestamps = nTimestampsTotal - firstTimestamp;
+			uint32_t nSamples = nSamplesTotal - firstSample;
+
+			if (nTimestampsTotal > 0) {
+				mxArray *mxCounts = mxCreateDoubleMatrix(1, 2, mxREAL);
+				mxGetPr(mxCounts)[0] = nTimestampsTotal;
+				mxGetPr(mxCounts)[1] = nSamplesTotal;
+				mxSetFieldByNumber(mxNewCursorGroups, 0, mxAddField(mxNewCursorGroups, pg->name), mxCounts);
+			}
+
+			if (nTimestamps > 0 || nSamples > 0) {
+				unsigned iGroupInArray = nGroupsUsed;
+
+				setGroupMetaFields((const GroupInfo*)pg, mxGroups, iGroupInArray);
+
+				if (pg->type == GROUP_TYPE_ANALOG) {
+					mxArray *mxTimestamps = mxCreateNumericMatrix(nTimestamps, 1, mxDOUBLE_CLASS, mxREAL);
+					copyTimestampBufferDataRange(pg->tsBuffers + trialIdx, firstTimestamp, nTimestamps,
+							(timestamp_t*)mxGetData(mxTimestamps), trialStartTime);
+					mxSetField(mxGroups, iGroupInArray, "time", mxTimestamps);
+				}
+
+				mxSignals = mxCreateStructMatrix(1,1,0,NULL);
+				if (pg->type != GROUP_TYPE_EVENT) {
+					for (unsigned iSignal = 0; iSignal < pg->nSignals; iSignal++) {
+						psdb = pg->signals[iSignal];
+						if (psdb == NULL)
+							continue;
+						// a param's latest value, whenever there's something new
+						SampleBufferView view;
+						if (pg->replaceSignal[iSignal])
+							getSignalSampleView(psdb, trialIdx, &view);
+						else
+							getSignalSampleViewRange(psdb, trialIdx, firstSample, nSamples, &view);
+						addSignalDataFieldFromView(mxSignals, psdb, &view, false, view.nSamples);
+					}
+				} else {
+					addEventGroupFieldsForSamples(mxSignals, mxGroups, pg, trialIdx,
+							trialStartTime, false, iGroupInArray, firstSample, nSamples);
+				}
+				mxSetField(mxGroups, iGroupInArray, "signals", mxSignals);
+
+				nGroupsUsed++;
+			}
+
+			groupNode = getNextGroupNode(groupNode);
+		}
+	}
+	// shrink the groups array in case some groups had nothing new
+	if (nGroupsUsed < nGroups)
+		mxSetM(mxGroups, nGroupsUsed);
+
+	return mxGroups;
+}
+
+static const char *latestGroupFieldNames[] = {"name", "type", "configHash", "version", "signalNames",
+	"signals", "time", "seq"};
+#define LATEST_GROUP_NUM_FIELDS 8
+
+// a signal sample as it was received, with its own dimensions
+static mxArray *buildArrayFromSignalSample(const SignalSample *ps) {
+	// chars are zero terminated by parseSignalFromBuffer
+	if (ps->dataTypeId == DTID_CHAR)
+		return mxCreateString((const char*)ps->data);
+
+	mwSize ndims = ps->nDims;
+	mwSize dims[MAX_SIGNAL_NDIMS+1];
+	for (unsigned i = 0; i < ps->nDims; i++)
+		dims[i] = ps->dims[i];
+	if (ndims == 1)
+		dims[ndims++] = 1;
+
+	mxArray *mxData;
+	if (ps->dataTypeId == DTID_LOGICAL)
+		mxData = mxCreateLogicalArray(ndims, dims);
+	else
+		mxData = mxCreateNumericArray(ndims, dims, convertDataTypeIdToMxClassId(ps->dataTypeId), mxREAL);
+	memcpy(mxGetData(mxData), ps->data, ps->dataBytes);
+	return mxData;
+}
+
+// fills mxGroups(index) with the latest sample of the group in slot of the latest values, see
+// latestValues.h. .time is the timestamp of the group's header, .seq the number of samples received
+static void setLatestGroupFields(mxArray *mxGroups, unsigned index, unsigned slot,
+		uint8_t **pBuffer, uint32_t *pAllocated) {
+	uint64_t seq;
+	uint32_t nBytes = latestValuesRead(slot, pBuffer, pAllocated, &seq);
+	if (nBytes == 0)
+		return;
+
+	// the parser has checked these bytes once already
+	GroupInfo g;
+	const uint8_t *pBuf = parseGroupInfoHeader(*pBuffer, &g);
+	if (pBuf == NULL)
+		return;
+
+	char groupTypeName[MAX_GROUP_TYPE_NAME];
+	getGroupTypeName(g.type, groupTypeName);
+	mxArray *mxConfigHash = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL);
+	memcpy(mxGetData(mxConfigHash), &g.configHash, sizeof(uint32_t));
+	mxArray *mxVersion = mxCreateNumericMatrix(1, 1, mxUINT16_CLASS, mxREAL);
+	memcpy(mxGetData(mxVersion), &g.version, sizeof(uint16_t));
+
+	mxSetField(mxGroups, index, "name", mxCreateString(g.name));
+	mxSetField(mxGroups, index, "type", mxCreateString(groupTypeName));
+	mxSetField(mxGroups, index, "configHash", mxConfigHash);
+	mxSetField(mxGroups, index, "version", mxVersion);
+	mxSetField(mxGroups, index, "time", mxCreateDoubleScalar((double)g.lastTimestamp));
+	mxSetField(mxGroups, index, "seq", mxCreateDoubleScalar((double)seq));
+
+	mxArray *mxSignalNames = mxCreateCellMatrix(g.nSignals, 1);
+	mxArray *mxSignals = mxCreateStructMatrix(1, 1, 0, NULL);
+	SignalSample sample;
+	for (unsigned iSignal = 0; iSignal < g.nSignals && pBuf != NULL; iSignal++) {
+		pBuf = parseSignalFromBuffer(pBuf, &sample);
+		if (pBuf == NULL)
+			break;
+		mxSetCell(mxSignalNames, iSignal, mxCreateString(sample.name));
+		mxSetFieldByNumber(mxSignals, 0, mxAddField(mxSignals, sample.name),
+				buildArrayFromSignalSample(&sample));
+		freeSignalSampleData(&sample);
+	}
+	mxSetField(mxGroups, index, "signalNames", mxSignalNames);
+	mxSetField(mxGroups, index, "signals", mxSignals);
+}
+
+// the latest sample of the group, as a 1x1 struct with the fields of the groups arrays and .seq, the
+// number of samples received so far. Empty if the group hasn't been received since start
+mxArray *buildLatestGroupStruct(const char *groupName) {
+	int slot = latestValuesFind(groupName);
+	if (slot < 0)
+		return mxCreateStructMatrix(0, 1, LATEST_GROUP_NUM_FIELDS, latestGroupFieldNames);
+
+	uint8_t *buffer = NULL;
+	uint32_t allocated = 0;
+	mxArray *mxGroup = mxCreateStructMatrix(1, 1, LATEST_GROUP_NUM_FIELDS, latestGroupFieldNames);
+	setLatestGroupFields(mxGroup, 0, (unsigned)slot, &buffer, &allocated);
+	FREE(buffer);
+	return mxGroup;
+}
+
+// the same for every group received, in the order they were first received
+mxArray *buildLatestGroupsArray(void) {
+	unsigned nGroups = latestValuesCount();
+	uint8_t *buffer = NULL;
+	uint32_t allocated = 0;
+
+	mxArray *mxGroups = mxCreateStructMatrix(nGroups, 1, LATEST_GROUP_NUM_FIELDS, latestGroupFieldNames);
+	for (unsigned i = 0; i < nGroups; i++)
+		setLatestGroupFields(mxGroups, i, i, &buffer, &allocated);
+	FREE(buffer);
+	return mxGroups;
+}
+#endif
+
 mxArray *buildControlStatusStructForCurrentTrial(void) {
 	DataLoggerStatus *dlStatus = controlGetCurrentStatus();
 
@@ -1,10 +1,18 @@
 #ifndef WRITER_H_INCLUDED
 #define WRITER_H_INCLUDED
 
+#include <sys/types.h>
+
 #include "utils.h"
 #include "signal.h"
 #include "signalLogger.h"
 
+// an index file appended to through fileio.h, fd is -1 while it's closed
+typedef struct IndexFile {
+	int fd;
+	off_t size;
+} IndexFile;
+
 typedef struct SignalFileInfo {
 	// folder that filename is sitting in
 	char filePath[MAX_FILENAME_LENGTH];
@@ -24,13 +32,67 @@ typedef struct SignalFileInfo {
 	// index file contains a list of .mat file names for a specific protocol, saveTag
 	char saveTagIndexFileName[MAX_FILENAME_LENGTH];
 
-	// file handle for index file
-	FILE* indexFile;
-	FILE* saveTagIndexFile;
+	// binary index with a record per trial, next to indexFileName, see trialIndex.h
+	char binaryIndexFileName[MAX_FILENAME_LENGTH];
+
+	// data root the file is on. Files on any root but the first, or on the staging tier, are
+	// linked to from linkName, in the folder on the first root they'd otherwise be in, linkPath
+	unsigned dataRoot;
+	char linkPath[MAX_FILENAME_LENGTH];
+	char linkName[MAX_FILENAME_LENGTH];
+
+	// staged files are written to fileName on the staging tier and moved to archiveName on
+	// their data root later on, see migrator.h
+	bool staged;
+	char archivePath[MAX_FILENAME_LENGTH];
+	char archiveName[MAX_FILENAME_LENGTH];
+
+	// index files, only opened on the writers' shared index file info
+	IndexFile indexFile;
+	IndexFile saveTagIndexFile;
+	IndexFile binaryIndexFile;
 } SignalFileInfo; 
 
+// at most this many writer threads, every one of them may be holding a trial buffer
+#define MAX_WRITER_THREADS (BUFFER_NUM_TRIALS - 2)
+// threads compressing MAT 7.3 chunks for the writers
+#define MAX_COMPRESSION_THREADS 32
+// each data root needs a writer thread of its own
+#define MAX_DATA_ROOTS 4
+
+// how trials are assigned to data roots, see setDataRootPolicy
+typedef enum {
+	DATA_ROOT_ROUND_ROBIN,
+	DATA_ROOT_FREE_SPACE,
+	DATA_ROOT_QUEUE_DEPTH
+} DataRootPolicy;
+
 const char* getDataRoot();
 void setDataRoot(const char* path);
+// stripe trials over several data roots, the first call replaces the default root
+bool addDataRoot(const char* path);
+bool setDataRootPolicy(const char* policy);
+void setWriterThreadCount(unsigned);
+void setCompressionThreadCount(unsigned);
+bool setOutputFormat(const char* format);
+#ifndef MATLAB_MEX_FILE
+bool setGroupTypeCompression(const char* spec);
+void setContainerOutput(bool useContainer);
+// keep each group layout once in the saveTag folder's schema.mat, trials' meta then only lists
+// the layouts they have in meta.layouts and the meta of their event groups
+void setSchemaRegistry(bool useRegistry);
+// write the samples of signals that can't be concatenated packed into one vector with their lengths
+// instead of a cell with an array each
+void setPackedVariableSize(bool usePacked);
+// write each signal of a trial as a top-level variable of its own, so that it can be loaded alone,
+// the trial variable then only holds the trial's header fields and the names of those variables
+void setSplitSignalVariables(bool useSplit);
+// write a param only when its value differs from the last trial of the saveTag it was written to,
+// other trials refer to that one with struct sameAsTrialId in its stead
+void setParamsOnChange(bool onChange);
+// write trials to fast local storage first and migrate them to the data roots in the background
+void setStagingRoot(const char* path);
+#endif
 void signalWriterThreadStart();
 void signalWriterThreadTerminate();
 
@@ -44,6 +106,15 @@ void signalWriterThreadTerminate();
 // after polling or simply leave them be
 mxArray* buildGroupsArrayForTrial(DataLoggerStatus*, unsigned, bool);
 mxArray* buildGroupsArrayForCurrentTrial(bool);
+#ifdef MATLAB_MEX_FILE
+// the same with only the samples received since the cursor returned by the previous call, which
+// is given first ([] to start with), the updated cursor goes into the second argument
+mxArray* buildGroupsArrayForCurrentTrialSince(const mxArray*, mxArray**);
+// the latest sample of a group, kept by the parser in latestValues.c, and of all groups, with
+// their sequence numbers
+mxArray* buildLatestGroupStruct(const char*);
+mxArray* buildLatestGroupsArray(void);
+#endif
 
 mxArray *buildControlStatusStructForCurrentTrial(void);
 
@@ -0,0 +1,1127 @@
+/*
+ * Offline compaction of a saveTag folder of trial .mat files into a columnar session file
+ *
+ *   bin/compactSession-lin [-o FILE] [-j THREADS] [-c] SAVETAG_FOLDER
+ *
+ * See src/sessionFile.h for the layout. Every numeric, logical and char field of the trials'
+ * trial variable, and every signal variable of trials written with -V, becomes one array across
+ * all trials. Cells and structs (variable size samples, -P packed signals, -o param references)
+ * and signals whose class differs between trials are left out and listed. Only MAT v5 files can
+ * be read, trials written with -f v7.3 or containers (-c) aren't compacted.
+ *
+ * The trials are scanned, copied and verified on a pool of threads. Scanning maps each file and
+ * walks its element tags, which fixes where every array goes, so that the data is copied straight
+ * from the trial files to its place in the session file (in kernel, where Linux can). The file is
+ * written as FILE.partial, with the trials copied so far marked in FILE.progress once they are on
+ * disk, so that a compaction that was interrupted picks up where it left off when run again on
+ * the same trial files. Once all trials are copied the file is read back and compared with the
+ * trial files, and only then gets its header and is renamed to FILE. -c compares an existing
+ * session file with the trial files the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <argp.h>
+
+#include "../src/errors.h"
+#include "../src/matfile.h"
+#include "../src/sessionFile.h"
+
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+#define MAX_PATH_LENGTH 1024
+// the most dimensions of an array that is compacted
+#define COMPACT_MAX_DIMS 8
+// data is copied and compared in chunks of this size
+#define COMPACT_CHUNK_BYTES (1 << 20)
+// trials are marked as copied in the progress file after this many, once the data is synced
+#define COMPACT_SYNC_BATCH 64
+
+#define PARTIAL_SUFFIX ".partial"
+#define PROGRESS_SUFFIX ".progress"
+#define PROGRESS_MAGIC "MATUDPCP"
+
+// MAT v5 data types, see matfile.c
+#define miINT8       1
+#define miUINT8      2
+#define miINT16      3
+#define miUINT16     4
+#define miINT32      5
+#define miUINT32     6
+#define miSINGLE     7
+#define miDOUBLE     9
+#define miINT64     12
+#define miUINT64    13
+#define miMATRIX    14
+#define miCOMPRESSED 15
+#define miUTF16     17
+
+#define MAT_HEADER_BYTES 128
+#define ARRAY_FLAG_COMPLEX 0x0800
+#define ARRAY_FLAG_LOGICAL 0x0200
+
+// FNV-1a, 64 bit, as in migrator.c
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME 0x100000001b3ULL
+
+#define NO_SIGNAL UINT32_MAX
+
+// an array of a trial file
+typedef struct SignalSource {
+	char name[SESSION_SIGNAL_NAME_LENGTH];
+	uint32_t classId;    // mxUNKNOWN_CLASS for cells, structs and anything else that can't be compacted
+	uint32_t nDims;
+	uint32_t dims[COMPACT_MAX_DIMS];
+	uint64_t fileOffset; // of its data in the trial file
+	uint64_t nBytes;
+
+	uint32_t signal;     // in the session's signals, NO_SIGNAL if left out
+	uint64_t outOffset;  // of its data in the session file
+} SignalSource;
+
+typedef struct TrialSource {
+	char* fileName;
+	uint32_t trialId;
+	uint32_t slot;       // in the session's trials
+	uint64_t fileBytes;
+	int64_t mtime;
+	bool valid;          // scanned, part of the session
+	bool copied;         // marked in the progress file
+	bool failed;         // copying or comparing it failed
+
+	SignalSource* sources;
+	uint32_t nSources;
+	uint32_t nSourcesAllocated;
+} TrialSource;
+
+typedef struct Session {
+	char* folder;
+	char fileName[MAX_PATH_LENGTH];
+	char partialName[MAX_PATH_LENGTH + sizeof(PARTIAL_SUFFIX)];
+	char progressName[MAX_PATH_LENGTH + sizeof(PROGRESS_SUFFIX)];
+
+	TrialSource* trials;
+	uint32_t nTrials;
+	// those that are part of the session, in trialId order
+	TrialSource** valid;
+	uint32_t nValid;
+
+	SessionSignal* signals;
+	uint32_t nSignals;
+
+	// everything up to the first signal's data, the header left zero until the file is complete
+	SessionFileHeader header;
+	uint8_t* index;
+	uint64_t indexBytes;
+	uint64_t layoutChecksum;
+
+	int fd;
+	int progressFd;
+
+	// trials copied since the last sync
+	uint32_t* pending;
+	uint32_t nPending;
+
+	pthread_mutex_t mutex;
+	uint32_t nextTrial;
+	unsigned nThreads;
+} Session;
+
+// runs on the thread pool for one trial at a time, buffer holds 2 * COMPACT_CHUNK_BYTES
+typedef bool (*TrialFn)(Session*, TrialSource*, uint8_t* buffer);
+
+typedef struct Phase {
+	Session* session;
+	TrialSource** trials;
+	uint32_t nTrials;
+	TrialFn fn;
+	unsigned nFailed;
+} Phase;
+
+static const char* outputName = NULL;
+static const char* folderArg = NULL;
+static unsigned nThreadsArg = DEFAULT_THREADS;
+static bool checkOnly = false;
+
+static void diep(const char *s) {
+	perror(s);
+	exit(EXIT_FAILURE);
+}
+
+static double getMonotonicTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t addToChecksum(uint64_t checksum, const void* data, size_t nBytes) {
+	const uint8_t* p = (const uint8_t*)data;
+	for (size_t i = 0; i < nBytes; i++) {
+		checksum ^= p[i];
+		checksum *= CHECKSUM_PRIME;
+	}
+	return checksum;
+}
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+static bool preadAll(int fd, uint8_t* buffer, size_t nBytes, off_t offset) {
+	while (nBytes > 0) {
+		ssize_t n = pread(fd, buffer, nBytes, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buffer += n;
+		nBytes -= n;
+		offset += n;
+	}
+	return true;
+}
+
+static bool pwriteAll(int fd, const uint8_t* buffer, size_t nBytes, off_t offset) {
+	while (nBytes > 0) {
+		ssize_t n = pwrite(fd, buffer, nBytes, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buffer += n;
+		nBytes -= n;
+		offset += n;
+	}
+	return true;
+}
+
+// -- thread pool
+
+static void* phaseThread(void* arg) {
+	Phase* pPhase = (Phase*)arg;
+	Session* s = pPhase->session;
+
+	uint8_t* buffer = (uint8_t*)malloc(2 * COMPACT_CHUNK_BYTES);
+	if (buffer == NULL) {
+		logError("Compact Error: No memory for buffers\n");
+		pthread_mutex_lock(&s->mutex);
+		pPhase->nFailed++;
+		pthread_mutex_unlock(&s->mutex);
+		return NULL;
+	}
+
+	while (true) {
+		pthread_mutex_lock(&s->mutex);
+		uint32_t i = s->nextTrial++;
+		pthread_mutex_unlock(&s->mutex);
+		if (i >= pPhase->nTrials)
+			break;
+
+		if (!pPhase->fn(s, pPhase->trials[i], buffer)) {
+			pthread_mutex_lock(&s->mutex);
+			pPhase->nFailed++;
+			pthread_mutex_unlock(&s->mutex);
+		}
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+// call fn for each of the trials on the pool, returns how many failed
+static unsigned runPhase(Session* s, TrialSource** trials, uint32_t nTrials, TrialFn fn) {
+	Phase phase = { s, trials, nTrials, fn, 0 };
+	pthread_t threads[MAX_THREADS];
+	unsigned nStarted = 0;
+
+	s->nextTrial = 0;
+	for (unsigned i = 0; i < s->nThreads && i < nTrials; i++) {
+		if (pthread_create(threads + nStarted, NULL, phaseThread, &phase) == 0)
+			nStarted++;
+	}
+	if (nStarted == 0 && nTrials > 0)
+		phaseThread(&phase);
+	for (unsigned i = 0; i < nStarted; i++)
+		pthread_join(threads[i], NULL);
+	return phase.nFailed;
+}
+
+// -- listing
+
+static int compareTrials(const void* a, const void* b) {
+	const TrialSource* ta = (const TrialSource*)a;
+	const TrialSource* tb = (const TrialSource*)b;
+	if (ta->trialId != tb->trialId)
+		return ta->trialId < tb->trialId ? -1 : 1;
+	return strcmp(ta->fileName, tb->fileName);
+}
+
+// trial file names have _id<trialId>_ in them, see writer.c
+static bool parseTrialFileName(const char* name, uint32_t* pTrialId) {
+	size_t length = strlen(name);
+	if (length < 4 || strcmp(name + length - 4, ".mat") != 0)
+		return false;
+	const char* id = strstr(name, "_id");
+	if (id == NULL)
+		return false;
+	char* end;
+	unsigned long trialId = strtoul(id + 3, &end, 10);
+	if (end == id + 3 || *end != '_')
+		return false;
+	*pTrialId = (uint32_t)trialId;
+	return true;
+}
+
+static bool listTrialFiles(Session* s) {
+	DIR* dir = opendir(s->folder);
+	if (dir == NULL) {
+		logError("Compact Error: Could not open %s (%s)\n", s->folder, strerror(errno));
+		return false;
+	}
+
+	uint32_t nAllocated = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		uint32_t trialId;
+		if (!parseTrialFileName(entry->d_name, &trialId))
+			continue;
+		if (s->nTrials == nAllocated) {
+			nAllocated = nAllocated ? 2 * nAllocated : 256;
+			s->trials = (TrialSource*)realloc(s->trials, nAllocated * sizeof(TrialSource));
+			if (s->trials == NULL) {
+				logError("Compact Error: No memory to list %s\n", s->folder);
+				closedir(dir);
+				return false;
+			}
+		}
+		TrialSource* t = s->trials + s->nTrials++;
+		memset(t, 0, sizeof(TrialSource));
+		t->fileName = strdup(entry->d_name);
+		t->trialId = trialId;
+	}
+	closedir(dir);
+
+	if (s->nTrials == 0) {
+		logError("Compact Error: No trial files in %s\n", s->folder);
+		return false;
+	}
+	qsort(s->trials, s->nTrials, sizeof(TrialSource), compareTrials);
+	return true;
+}
+
+// -- scanning
+
+typedef struct Element {
+	uint32_t type;
+	uint64_t nBytes;
+	uint64_t dataOffset;
+	uint64_t next;
+} Element;
+
+static bool readElement(const uint8_t* base, uint64_t offset, uint64_t end, Element* pe) {
+	if (offset + 8 > end)
+		return false;
+	uint32_t tag[2];
+	memcpy(tag, base + offset, sizeof(tag));
+	if (tag[0] >> 16) {
+		// small data element, up to 4 bytes held in the tag
+		pe->type = tag[0] & 0xffff;
+		pe->nBytes = tag[0] >> 16;
+		pe->dataOffset = offset + 4;
+		pe->next = offset + 8;
+		return pe->nBytes <= 4;
+	}
+	pe->type = tag[0];
+	pe->nBytes = tag[1];
+	pe->dataOffset = offset + 8;
+	pe->next = alignUp(pe->dataOffset + pe->nBytes, 8);
+	if (pe->next > end)
+		pe->next = end;
+	return pe->dataOffset + pe->nBytes <= end;
+}
+
+static uint32_t getStorageTypeOfClass(uint32_t classId) {
+	switch (classId) {
+		case mxDOUBLE_CLASS:  return miDOUBLE;
+		case mxSINGLE_CLASS:  return miSINGLE;
+		case mxINT8_CLASS:    return miINT8;
+		case mxUINT8_CLASS:   return miUINT8;
+		case mxINT16_CLASS:   return miINT16;
+		case mxUINT16_CLASS:  return miUINT16;
+		case mxINT32_CLASS:   return miINT32;
+		case mxUINT32_CLASS:  return miUINT32;
+		case mxINT64_CLASS:   return miINT64;
+		case mxUINT64_CLASS:  return miUINT64;
+		case mxLOGICAL_CLASS: return miUINT8;
+		case mxCHAR_CLASS:    return miUINT16;
+		default:              return 0;
+	}
+}
+
+static uint32_t getElementBytesOfClass(uint32_t classId) {
+	switch (getStorageTypeOfClass(classId)) {
+		case miINT8: case miUINT8:   return 1;
+		case miINT16: case miUINT16: return 2;
+		case miINT32: case miUINT32: case miSINGLE: return 4;
+		case miINT64: case miUINT64: case miDOUBLE: return 8;
+		default:                     return 0;
+	}
+}
+
+// the array flags, dimensions and name of the miMATRIX element, *pOffset is left at what follows
+static bool readArrayHeader(const uint8_t* base, const Element* pMatrix, uint32_t* pFlags,
+		SignalSource* ps, uint64_t* pOffset) {
+	uint64_t end = pMatrix->dataOffset + pMatrix->nBytes;
+	Element flags, dims, name;
+	if (!readElement(base, pMatrix->dataOffset, end, &flags) || flags.type != miUINT32 || flags.nBytes != 8 ||
+			!readElement(base, flags.next, end, &dims) || dims.type != miINT32 || dims.nBytes % 4 != 0 ||
+			!readElement(base, dims.next, end, &name) || name.type != miINT8)
+		return false;
+
+	memcpy(pFlags, base + flags.dataOffset, sizeof(uint32_t));
+
+	ps->nDims = (uint32_t)(dims.nBytes / 4);
+	ps->classId = ps->nDims <= COMPACT_MAX_DIMS ? (*pFlags & 0xff) : mxUNKNOWN_CLASS;
+	for (uint32_t d = 0; d < ps->nDims && d < COMPACT_MAX_DIMS; d++) {
+		int32_t dim;
+		memcpy(&dim, base + dims.dataOffset + 4 * d, sizeof(dim));
+		ps->dims[d] = dim > 0 ? (uint32_t)dim : 0;
+	}
+
+	// variables are named in their element, struct fields by the struct
+	if (name.nBytes > 0) {
+		size_t length = name.nBytes < SESSION_SIGNAL_NAME_LENGTH ? name.nBytes : SESSION_SIGNAL_NAME_LENGTH - 1;
+		memset(ps->name, 0, SESSION_SIGNAL_NAME_LENGTH);
+		memcpy(ps->name, base + name.dataOffset, length);
+	}
+
+	*pOffset = name.next;
+	return true;
+}
+
+// where the data of the array is, or mxUNKNOWN_CLASS if it can't be compacted
+static bool readArray(const uint8_t* base, const Element* pMatrix, SignalSource* ps) {
+	uint32_t flags;
+	uint64_t offset;
+	if (!readArrayHeader(base, pMatrix, &flags, ps, &offset))
+		return false;
+
+	if (flags & ARRAY_FLAG_LOGICAL)
+		ps->classId = mxLOGICAL_CLASS;
+	uint32_t storageType = getStorageTypeOfClass(ps->classId);
+	if (storageType == 0 || (flags & ARRAY_FLAG_COMPLEX)) {
+		ps->classId = mxUNKNOWN_CLASS;
+		return true;
+	}
+
+	Element data;
+	if (!readElement(base, offset, pMatrix->dataOffset + pMatrix->nBytes, &data))
+		return false;
+
+	uint64_t nElements = 1;
+	for (uint32_t d = 0; d < ps->nDims; d++)
+		nElements *= ps->dims[d];
+	bool sameType = data.type == storageType || (ps->classId == mxCHAR_CLASS && data.type == miUTF16);
+	if (!sameType || data.nBytes != nElements * getElementBytesOfClass(ps->classId)) {
+		// stored as another type, as MATLAB does to save space, not by the trialLogger
+		ps->classId = mxUNKNOWN_CLASS;
+		return true;
+	}
+
+	ps->fileOffset = data.dataOffset;
+	ps->nBytes = data.nBytes;
+	return true;
+}
+
+static SignalSource* addSource(TrialSource* t) {
+	if (t->nSources == t->nSourcesAllocated) {
+		t->nSourcesAllocated = t->nSourcesAllocated ? 2 * t->nSourcesAllocated : 32;
+		SignalSource* sources = (SignalSource*)realloc(t->sources, t->nSourcesAllocated * sizeof(SignalSource));
+		if (sources == NULL)
+			return NULL;
+		t->sources = sources;
+	}
+	SignalSource* ps = t->sources + t->nSources++;
+	memset(ps, 0, sizeof(SignalSource));
+	ps->signal = NO_SIGNAL;
+	return ps;
+}
+
+// the fields of the trial struct
+static bool readTrialFields(const uint8_t* base, const Element* pMatrix, TrialSource* t) {
+	SignalSource header;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t end = pMatrix->dataOffset + pMatrix->nBytes;
+	if (!readArrayHeader(base, pMatrix, &flags, &header, &offset) || header.classId != mxSTRUCT_CLASS ||
+			header.nDims != 2 || header.dims[0] != 1 || header.dims[1] != 1)
+		return false;
+
+	Element nameLength, names;
+	int32_t fieldNameLength;
+	if (!readElement(base, offset, end, &nameLength) || nameLength.nBytes != 4 ||
+			!readElement(base, nameLength.next, end, &names))
+		return false;
+	memcpy(&fieldNameLength, base + nameLength.dataOffset, sizeof(fieldNameLength));
+	if (fieldNameLength <= 0 || names.nBytes % fieldNameLength != 0)
+		return false;
+
+	offset = names.next;
+	for (uint64_t f = 0; f < names.nBytes / fieldNameLength; f++) {
+		Element field;
+		if (!readElement(base, offset, end, &field) || field.type != miMATRIX)
+			return false;
+		offset = field.next;
+
+		const char* name = (const char*)(base + names.dataOffset + f * fieldNameLength);
+		// the names of the signal variables of trials written with -V
+		if (strncmp(name, "signalVariables", fieldNameLength) == 0)
+			continue;
+
+		SignalSource* ps = addSource(t);
+		if (ps == NULL || !readArray(base, &field, ps))
+			return false;
+		size_t length = strnlen(name, fieldNameLength);
+		if (length >= SESSION_SIGNAL_NAME_LENGTH)
+			length = SESSION_SIGNAL_NAME_LENGTH - 1;
+		memset(ps->name, 0, SESSION_SIGNAL_NAME_LENGTH);
+		memcpy(ps->name, name, length);
+	}
+	return true;
+}
+
+static bool scanTrial(Session* s, TrialSource* t, uint8_t* buffer) {
+	char path[MAX_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/%s", s->folder, t->fileName);
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		logError("Compact Error: Could not open %s (%s), left out\n", t->fileName, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	t->fileBytes = (uint64_t)st.st_size;
+	t->mtime = (int64_t)st.st_mtime;
+
+	const uint8_t* base = t->fileBytes >= MAT_HEADER_BYTES ?
+		(const uint8_t*)mmap(NULL, t->fileBytes, PROT_READ, MAP_PRIVATE, fd, 0) : (const uint8_t*)MAP_FAILED;
+	close(fd);
+	// version 0x0100, little endian
+	if (base == MAP_FAILED || base[124] != 0x00 || base[125] != 0x01 || base[126] != 'I' || base[127] != 'M') {
+		logError("Compact Error: %s is not a MAT v5 file, left out\n", t->fileName);
+		if (base != MAP_FAILED)
+			munmap((void*)base, t->fileBytes);
+		return false;
+	}
+
+	bool hasTrial = false;
+	bool success = true;
+	uint64_t offset = MAT_HEADER_BYTES;
+	while (success && offset < t->fileBytes) {
+		Element variable;
+		SignalSource name;
+		memset(&name, 0, sizeof(name));
+		uint32_t flags;
+		uint64_t afterName;
+		if (!readElement(base, offset, t->fileBytes, &variable) || variable.type != miMATRIX ||
+				!readArrayHeader(base, &variable, &flags, &name, &afterName)) {
+			success = false;
+			break;
+		}
+		offset = variable.next;
+
+		if (strcmp(name.name, "meta") == 0)
+			continue;
+		if (strcmp(name.name, "trial") == 0) {
+			hasTrial = true;
+			success = readTrialFields(base, &variable, t);
+		} else {
+			// a signal variable of a trial written with -V
+			SignalSource* ps = addSource(t);
+			success = ps != NULL && readArray(base, &variable, ps);
+		}
+	}
+	munmap((void*)base, t->fileBytes);
+
+	if (!success || !hasTrial) {
+		logError("Compact Error: Could not read %s, left out\n", t->fileName);
+		free(t->sources);
+		t->sources = NULL;
+		t->nSources = 0;
+		return false;
+	}
+	t->valid = true;
+	return true;
+}
+
+// -- layout
+
+static int compareNames(const void* a, const void* b) {
+	return strncmp(*(const char* const*)a, *(const char* const*)b, SESSION_SIGNAL_NAME_LENGTH);
+}
+
+static int compareSignalName(const void* name, const void* signal) {
+	return strncmp((const char*)name, ((const SessionSignal*)signal)->name, SESSION_SIGNAL_NAME_LENGTH);
+}
+
+// pick the signals, every array of the same name that can be compacted and has the same class in
+// every trial, and list the rest
+static bool chooseSignals(Session* s) {
+	size_t nNames = 0;
+	for (uint32_t i = 0; i < s->nValid; i++)
+		nNames += s->valid[i]->nSources;
+	const char** names = (const char**)malloc((nNames ? nNames : 1) * sizeof(char*));
+	if (names == NULL)
+		return false;
+	nNames = 0;
+	for (uint32_t i = 0; i < s->nValid; i++)
+		for (uint32_t j = 0; j < s->valid[i]->nSources; j++)
+			names[nNames++] = s->valid[i]->sources[j].name;
+	qsort(names, nNames, sizeof(char*), compareNames);
+
+	s->signals = (SessionSignal*)calloc(nNames ? nNames : 1, sizeof(SessionSignal));
+	if (s->signals == NULL) {
+		free(names);
+		return false;
+	}
+	for (size_t i = 0; i < nNames; i++) {
+		if (s->nSignals > 0 && compareSignalName(names[i], s->signals + s->nSignals - 1) == 0)
+			continue;
+		strncpy(s->signals[s->nSignals].name, names[i], SESSION_SIGNAL_NAME_LENGTH - 1);
+		s->signals[s->nSignals].classId = mxVOID_CLASS; // none seen yet
+		s->nSignals++;
+	}
+	free(names);
+
+	for (uint32_t i = 0; i < s->nValid; i++) {
+		TrialSource* t = s->valid[i];
+		for (uint32_t j = 0; j < t->nSources; j++) {
+			SignalSource* ps = t->sources + j;
+			SessionSignal* pSignal = (SessionSignal*)bsearch(ps->name, s->signals, s->nSignals,
+					sizeof(SessionSignal), compareSignalName);
+			if (pSignal->classId == mxVOID_CLASS)
+				pSignal->classId = ps->classId;
+			else if (pSignal->classId != ps->classId)
+				pSignal->classId = mxUNKNOWN_CLASS;
+			if (ps->nDims > pSignal->nDims)
+				pSignal->nDims = ps->nDims;
+		}
+	}
+
+	// drop the ones left out
+	char leftOut[1024] = "";
+	size_t nLeftOut = 0;
+	uint32_t nKept = 0;
+	for (uint32_t i = 0; i < s->nSignals; i++) {
+		SessionSignal* pSignal = s->signals + i;
+		if (pSignal->classId == mxUNKNOWN_CLASS) {
+			// as many names as fit
+			size_t length = strlen(leftOut);
+			if (length + SESSION_SIGNAL_NAME_LENGTH + 8 < sizeof(leftOut))
+				snprintf(leftOut + length, sizeof(leftOut) - length, "%s%s", nLeftOut ? ", " : "", pSignal->name);
+			nLeftOut++;
+			continue;
+		}
+		pSignal->elementBytes = getElementBytesOfClass(pSignal->classId);
+		s->signals[nKept++] = *pSignal;
+	}
+	s->nSignals = nKept;
+	if (nLeftOut > 0)
+		logInfo("Compact: %zu cell, struct or mixed class signals left out: %s\n", nLeftOut, leftOut);
+
+	for (uint32_t i = 0; i < s->nValid; i++) {
+		TrialSource* t = s->valid[i];
+		for (uint32_t j = 0; j < t->nSources; j++) {
+			SignalSource* ps = t->sources + j;
+			SessionSignal* pSignal = (SessionSignal*)bsearch(ps->name, s->signals, s->nSignals,
+					sizeof(SessionSignal), compareSignalName);
+			ps->signal = pSignal ? (uint32_t)(pSignal - s->signals) : NO_SIGNAL;
+		}
+	}
+	return true;
+}
+
+// place everything, the index is built in memory and the data offsets go into the sources
+static bool layOut(Session* s) {
+	uint64_t offset = alignUp(sizeof(SessionFileHeader), 8);
+	s->header.trialIdsOffset = offset;
+	offset = alignUp(offset + (uint64_t)s->nValid * sizeof(uint32_t), 8);
+	s->header.signalsOffset = offset;
+	offset += (uint64_t)s->nSignals * sizeof(SessionSignal);
+	for (uint32_t i = 0; i < s->nSignals; i++) {
+		SessionSignal* pSignal = s->signals + i;
+		pSignal->trialOffsetsOffset = offset;
+		offset += ((uint64_t)s->nValid + 1) * sizeof(uint64_t);
+		pSignal->dimsOffset = offset;
+		offset = alignUp(offset + (uint64_t)s->nValid * pSignal->nDims * sizeof(uint32_t), 8);
+	}
+	s->indexBytes = offset;
+
+	s->index = (uint8_t*)calloc(s->indexBytes, 1);
+	if (s->index == NULL)
+		return false;
+
+	uint32_t* trialIds = (uint32_t*)(s->index + s->header.trialIdsOffset);
+	for (uint32_t i = 0; i < s->nValid; i++)
+		trialIds[i] = s->valid[i]->trialId;
+
+	// element counts and sizes first, then the data offsets from them
+	offset = alignUp(s->indexBytes, SESSION_DATA_ALIGNMENT);
+	for (uint32_t k = 0; k < s->nSignals; k++) {
+		SessionSignal* pSignal = s->signals + k;
+		uint64_t* trialOffsets = (uint64_t*)(s->index + pSignal->trialOffsetsOffset);
+		uint32_t* dims = (uint32_t*)(s->index + pSignal->dimsOffset);
+		pSignal->dataOffset = offset;
+
+		uint64_t nElements = 0;
+		for (uint32_t i = 0; i < s->nValid; i++) {
+			TrialSource* t = s->valid[i];
+			trialOffsets[i] = nElements;
+			for (uint32_t j = 0; j < t->nSources; j++) {
+				SignalSource* ps = t->sources + j;
+				if (ps->signal != k)
+					continue;
+				for (uint32_t d = 0; d < pSignal->nDims; d++)
+					dims[(uint64_t)i * pSignal->nDims + d] = d < ps->nDims ? ps->dims[d] : 1;
+				ps->outOffset = pSignal->dataOffset + nElements * pSignal->elementBytes;
+				nElements += ps->nBytes / pSignal->elementBytes;
+				break;
+			}
+		}
+		trialOffsets[s->nValid] = nElements;
+		pSignal->nElements = nElements;
+		offset = alignUp(offset + nElements * pSignal->elementBytes, SESSION_DATA_ALIGNMENT);
+	}
+	memcpy(s->index + s->header.signalsOffset, s->signals, (size_t)s->nSignals * sizeof(SessionSignal));
+
+	memcpy(s->header.magic, SESSION_FILE_MAGIC, sizeof(s->header.magic));
+	s->header.version = SESSION_FILE_VERSION;
+	s->header.headerBytes = sizeof(SessionFileHeader);
+	s->header.nTrials = s->nValid;
+	s->header.nSignals = s->nSignals;
+	s->header.signalBytes = sizeof(SessionSignal);
+	s->header.fileBytes = offset;
+
+	// what a partial file written before must match to be picked up, the trial files included
+	uint64_t checksum = addToChecksum(CHECKSUM_SEED, &s->header, sizeof(s->header));
+	checksum = addToChecksum(checksum, s->index, s->indexBytes);
+	for (uint32_t i = 0; i < s->nValid; i++) {
+		TrialSource* t = s->valid[i];
+		checksum = addToChecksum(checksum, t->fileName, strlen(t->fileName));
+		checksum = addToChecksum(checksum, &t->fileBytes, sizeof(t->fileBytes));
+		checksum = addToChecksum(checksum, &t->mtime, sizeof(t->mtime));
+	}
+	s->layoutChecksum = checksum;
+	return true;
+}
+
+// -- copying
+
+typedef struct ProgressHeader {
+	char magic[8];
+	uint64_t layoutChecksum;
+	uint32_t nTrials;
+	uint32_t reserved;
+} ProgressHeader;
+
+// continue the partial file if its progress file is of the same layout, else start it over
+static bool openPartialFile(Session* s, uint32_t* pnCopied) {
+	*pnCopied = 0;
+	ProgressHeader header;
+	uint8_t* marks = (uint8_t*)calloc(s->nValid ? s->nValid : 1, 1);
+	if (marks == NULL)
+		return false;
+
+	s->progressFd = open(s->progressName, O_RDWR);
+	s->fd = open(s->partialName, O_RDWR);
+	bool resume = s->progressFd >= 0 && s->fd >= 0 &&
+		preadAll(s->progressFd, (uint8_t*)&header, sizeof(header), 0) &&
+		memcmp(header.magic, PROGRESS_MAGIC, sizeof(header.magic)) == 0 &&
+		header.layoutChecksum == s->layoutChecksum && header.nTrials == s->nValid &&
+		preadAll(s->progressFd, marks, s->nValid, sizeof(header));
+
+	if (resume) {
+		for (uint32_t i = 0; i < s->nValid; i++) {
+			s->valid[i]->copied = marks[i] != 0;
+			*pnCopied += marks[i] != 0;
+		}
+	} else {
+		if (s->progressFd >= 0)
+			close(s->progressFd);
+		if (s->fd >= 0)
+			close(s->fd);
+		s->fd = open(s->partialName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		s->progressFd = open(s->progressName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, PROGRESS_MAGIC, sizeof(header.magic));
+		header.layoutChecksum = s->layoutChecksum;
+		header.nTrials = s->nValid;
+		memset(marks, 0, s->nValid);
+		if (s->fd < 0 || s->progressFd < 0 || ftruncate(s->fd, (off_t)s->header.fileBytes) != 0 ||
+				!pwriteAll(s->progressFd, (uint8_t*)&header, sizeof(header), 0) ||
+				!pwriteAll(s->progressFd, marks, s->nValid, sizeof(header))) {
+			logError("Compact Error: Could not create %s (%s)\n", s->partialName, strerror(errno));
+			free(marks);
+			return false;
+		}
+	}
+	free(marks);
+
+	// the index is rewritten either way, the header stays zero until the file is complete
+	SessionFileHeader none;
+	memset(&none, 0, sizeof(none));
+	if (!pwriteAll(s->fd, s->index, s->indexBytes, 0) || !pwriteAll(s->fd, (uint8_t*)&none, sizeof(none), 0)) {
+		logError("Compact Error: Could not write %s (%s)\n", s->partialName, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// sync the data copied so far and mark those trials in the progress file, so that a run that is
+// interrupted after this doesn't copy them again
+static bool markPendingTrials(Session* s, const uint32_t* pending, uint32_t nPending) {
+	if (nPending == 0)
+		return true;
+	if (fsync(s->fd) != 0) {
+		logError("Compact Error: Could not fsync %s (%s)\n", s->partialName, strerror(errno));
+		return false;
+	}
+	uint8_t copied = 1;
+	for (uint32_t i = 0; i < nPending; i++)
+		pwriteAll(s->progressFd, &copied, 1, sizeof(ProgressHeader) + pending[i]);
+	return true;
+}
+
+static bool copyRange(int in, uint64_t inOffset, int out, uint64_t outOffset, uint64_t nBytes, uint8_t* buffer) {
+#ifdef LINUX
+	// in kernel, and without copying at all on file systems that share extents
+	while (nBytes > 0) {
+		loff_t from = (loff_t)inOffset, to = (loff_t)outOffset;
+		ssize_t n = copy_file_range(in, &from, out, &to, nBytes, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		inOffset += n;
+		outOffset += n;
+		nBytes -= n;
+	}
+#endif
+	while (nBytes > 0) {
+		size_t nChunk = nBytes < COMPACT_CHUNK_BYTES ? (size_t)nBytes : COMPACT_CHUNK_BYTES;
+		if (!preadAll(in, buffer, nChunk, (off_t)inOffset) || !pwriteAll(out, buffer, nChunk, (off_t)outOffset))
+			return false;
+		inOffset += nChunk;
+		outOffset += nChunk;
+		nBytes -= nChunk;
+	}
+	return true;
+}
+
+static bool copyTrial(Session* s, TrialSource* t, uint8_t* buffer) {
+	char path[MAX_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/%s", s->folder, t->fileName);
+
+	int in = open(path, O_RDONLY);
+	bool success = in >= 0;
+	for (uint32_t j = 0; success && j < t->nSources; j++) {
+		const SignalSource* ps = t->sources + j;
+		if (ps->signal != NO_SIGNAL && ps->nBytes > 0)
+			success = copyRange(in, ps->fileOffset, s->fd, ps->outOffset, ps->nBytes, buffer);
+	}
+	if (in >= 0)
+		close(in);
+	if (!success) {
+		logError("Compact Error: Could not copy %s (%s)\n", t->fileName, strerror(errno));
+		t->failed = true;
+		return false;
+	}
+
+	// every so often, sync and mark what was copied so far
+	uint32_t* batch = NULL;
+	uint32_t nBatch = 0;
+	pthread_mutex_lock(&s->mutex);
+	s->pending[s->nPending++] = t->slot;
+	if (s->nPending >= COMPACT_SYNC_BATCH) {
+		batch = (uint32_t*)malloc(s->nPending * sizeof(uint32_t));
+		if (batch != NULL) {
+			memcpy(batch, s->pending, s->nPending * sizeof(uint32_t));
+			nBatch = s->nPending;
+			s->nPending = 0;
+		}
+	}
+	pthread_mutex_unlock(&s->mutex);
+
+	if (batch != NULL) {
+		markPendingTrials(s, batch, nBatch);
+		free(batch);
+	}
+	return true;
+}
+
+// -- verifying
+
+static bool compareRange(int a, uint64_t aOffset, int b, uint64_t bOffset, uint64_t nBytes, uint8_t* buffer) {
+	while (nBytes > 0) {
+		size_t nChunk = nBytes < COMPACT_CHUNK_BYTES ? (size_t)nBytes : COMPACT_CHUNK_BYTES;
+		if (!preadAll(a, buffer, nChunk, (off_t)aOffset) ||
+				!preadAll(b, buffer + COMPACT_CHUNK_BYTES, nChunk, (off_t)bOffset) ||
+				memcmp(buffer, buffer + COMPACT_CHUNK_BYTES, nChunk) != 0)
+			return false;
+		aOffset += nChunk;
+		bOffset += nChunk;
+		nBytes -= nChunk;
+	}
+	return true;
+}
+
+static bool verifyTrial(Session* s, TrialSource* t, uint8_t* buffer) {
+	char path[MAX_PATH_LENGTH];
+	snprintf(path, sizeof(path), "%s/%s", s->folder, t->fileName);
+
+	int in = open(path, O_RDONLY);
+	struct stat st;
+	bool same = in >= 0 && fstat(in, &st) == 0 && (uint64_t)st.st_size == t->fileBytes;
+	for (uint32_t j = 0; same && j < t->nSources; j++) {
+		const SignalSource* ps = t->sources + j;
+		if (ps->signal != NO_SIGNAL && ps->nBytes > 0)
+			same = compareRange(in, ps->fileOffset, s->fd, ps->outOffset, ps->nBytes, buffer);
+	}
+	if (in >= 0)
+		close(in);
+	if (!same) {
+		logError("Compact Error: The data of %s doesn't match its copy\n", t->fileName);
+		t->failed = true;
+	}
+	return same;
+}
+
+// the index as written, then the data of every trial
+static bool verifySession(Session* s) {
+	uint8_t* index = (uint8_t*)malloc(s->indexBytes);
+	bool same = index != NULL && preadAll(s->fd, index, s->indexBytes, 0) &&
+		memcmp(index + sizeof(SessionFileHeader), s->index + sizeof(SessionFileHeader),
+				s->indexBytes - sizeof(SessionFileHeader)) == 0;
+	free(index);
+	if (!same) {
+		logError("Compact Error: The index of %s doesn't match\n", s->partialName);
+		return false;
+	}
+	return runPhase(s, s->valid, s->nValid, verifyTrial) == 0;
+}
+
+// make the rename in the folder of fileName durable, as in migrator.c
+static void syncDirectoryOf(const char* fileName) {
+	char dir[MAX_PATH_LENGTH];
+	strncpy(dir, fileName, MAX_PATH_LENGTH - 1);
+	dir[MAX_PATH_LENGTH - 1] = '\0';
+	char* last = strrchr(dir, '/');
+	if (last == NULL)
+		return;
+	*last = '\0';
+
+	int fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return;
+	fsync(fd);
+	close(fd);
+}
+
+// -- main
+
+static int checkSessionFile(Session* s) {
+	s->fd = open(s->fileName, O_RDONLY);
+	SessionFileHeader header;
+	if (s->fd < 0 || !preadAll(s->fd, (uint8_t*)&header, sizeof(header), 0) ||
+			memcmp(&header, &s->header, sizeof(header)) != 0) {
+		logError("Compact Error: %s is missing, incomplete or of other trial files\n", s->fileName);
+		return EXIT_FAILURE;
+	}
+	if (!verifySession(s))
+		return EXIT_FAILURE;
+	logInfo("Compact: %s matches the %u trials it holds\n", s->fileName, s->nValid);
+	return EXIT_SUCCESS;
+}
+
+static int compactSession(Session* s) {
+	uint32_t nCopied;
+	if (!openPartialFile(s, &nCopied))
+		return EXIT_FAILURE;
+	if (nCopied > 0)
+		logInfo("Compact: Resuming %s, %u of %u trials are copied already\n", s->partialName, nCopied, s->nValid);
+
+	TrialSource** toCopy = (TrialSource**)malloc((s->nValid ? s->nValid : 1) * sizeof(TrialSource*));
+	s->pending = (uint32_t*)malloc((s->nValid ? s->nValid : 1) * sizeof(uint32_t));
+	if (toCopy == NULL || s->pending == NULL)
+		diep("Compact: No memory for the trial lists");
+	uint32_t nToCopy = 0;
+	for (uint32_t i = 0; i < s->nValid; i++)
+		if (!s->valid[i]->copied)
+			toCopy[nToCopy++] = s->valid[i];
+
+	unsigned nFailed = runPhase(s, toCopy, nToCopy, copyTrial);
+	bool success = markPendingTrials(s, s->pending, s->nPending) && nFailed == 0;
+	s->nPending = 0;
+	free(toCopy);
+	if (!success) {
+		logError("Compact Error: %u trials could not be copied, run again to retry them\n", nFailed);
+		return EXIT_FAILURE;
+	}
+
+#ifdef LINUX
+	// read it back from the disk rather than from memory
+	posix_fadvise(s->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	if (!verifySession(s)) {
+		// copy those again next time
+		uint8_t notCopied = 0;
+		for (uint32_t i = 0; i < s->nValid; i++)
+			if (s->valid[i]->failed)
+				pwriteAll(s->progressFd, &notCopied, 1, sizeof(ProgressHeader) + i);
+		logError("Compact Error: %s doesn't match the trial files, run again to copy them again\n", s->partialName);
+		return EXIT_FAILURE;
+	}
+
+	if (!pwriteAll(s->fd, (uint8_t*)&s->header, sizeof(s->header), 0) || fsync(s->fd) != 0 ||
+			rename(s->partialName, s->fileName) != 0) {
+		logError("Compact Error: Could not complete %s (%s)\n", s->fileName, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	syncDirectoryOf(s->fileName);
+	unlink(s->progressName);
+	return EXIT_SUCCESS;
+}
+
+static void freeSession(Session* s) {
+	if (s->fd >= 0)
+		close(s->fd);
+	if (s->progressFd >= 0)
+		close(s->progressFd);
+	for (uint32_t i = 0; i < s->nTrials; i++) {
+		free(s->trials[i].fileName);
+		free(s->trials[i].sources);
+	}
+	free(s->trials);
+	free(s->valid);
+	free(s->signals);
+	free(s->index);
+	free(s->pending);
+	free(s->folder);
+	pthread_mutex_destroy(&s->mutex);
+}
+
+error_t parse_opt(int key, char *arg, struct argp_state *state) {
+	switch(key) {
+		case 'o':
+			outputName = arg;
+			break;
+		case 'j':
+			nThreadsArg = (unsigned)atoi(arg);
+			if (nThreadsArg < 1 || nThreadsArg > MAX_THREADS)
+				argp_error(state, "Threads must be 1 to %d", MAX_THREADS);
+			break;
+		case 'c':
+			checkOnly = true;
+			break;
+		case ARGP_KEY_ARG:
+			if (folderArg != NULL)
+				argp_error(state, "Only one saveTag folder at a time");
+			folderArg = arg;
+			break;
+		case ARGP_KEY_END:
+			if (folderArg == NULL)
+				argp_error(state, "No saveTag folder given");
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	struct argp_option options[] = {
+		{ "output", 'o', "FILE", 0, "Session file to write (default SAVETAG_FOLDER/" SESSION_FILE_NAME ")"},
+		{ "threads", 'j', "N", 0, "Threads scanning, copying and verifying trials (default 4)"},
+		{ "check", 'c', 0, 0, "Only compare an existing session file with the trial files"},
+		{ 0 }
+	};
+	struct argp argp = { options, parse_opt, "SAVETAG_FOLDER",
+		"Compacts the trial .mat files of a saveTag folder into a columnar session file" };
+	if (argp_parse(&argp, argc, argv, 0, 0, 0) != 0) {
+		fprintf(stderr, "\tInput parsing error\n");
+		exit(EXIT_FAILURE);
+	}
+
+	Session session;
+	Session* s = &session;
+	memset(s, 0, sizeof(Session));
+	s->fd = -1;
+	s->progressFd = -1;
+	s->nThreads = nThreadsArg;
+	pthread_mutex_init(&s->mutex, NULL);
+
+	s->folder = strdup(folderArg);
+	size_t length = strlen(s->folder);
+	while (length > 1 && s->folder[length - 1] == '/')
+		s->folder[--length] = '\0';
+	if (outputName != NULL)
+		snprintf(s->fileName, MAX_PATH_LENGTH, "%s", outputName);
+	else
+		snprintf(s->fileName, MAX_PATH_LENGTH, "%s/%s", s->folder, SESSION_FILE_NAME);
+	snprintf_nowarn(s->partialName, sizeof(s->partialName), "%s%s", s->fileName, PARTIAL_SUFFIX);
+	snprintf_nowarn(s->progressName, sizeof(s->progressName), "%s%s", s->fileName, PROGRESS_SUFFIX);
+
+	double tStart = getMonotonicTime();
+	if (!listTrialFiles(s))
+		exit(EXIT_FAILURE);
+
+	TrialSource** all = (TrialSource**)malloc(s->nTrials * sizeof(TrialSource*));
+	s->valid = (TrialSource**)malloc(s->nTrials * sizeof(TrialSource*));
+	if (all == NULL || s->valid == NULL)
+		diep("Compact: No memory for the trial lists");
+	for (uint32_t i = 0; i < s->nTrials; i++)
+		all[i] = s->trials + i;
+	runPhase(s, all, s->nTrials, scanTrial);
+	free(all);
+
+	for (uint32_t i = 0; i < s->nTrials; i++) {
+		TrialSource* t = s->trials + i;
+		if (!t->valid)
+			continue;
+		if (s->nValid > 0 && s->valid[s->nValid - 1]->trialId == t->trialId) {
+			logError("Compact Error: Trial %u is in %s and %s, the latter left out\n", t->trialId,
+					s->valid[s->nValid - 1]->fileName, t->fileName);
+			continue;
+		}
+		t->slot = s->nValid;
+		s->valid[s->nValid++] = t;
+	}
+	if (s->nValid == 0) {
+		logError("Compact Error: No trials could be read in %s\n", s->folder);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!chooseSignals(s) || !layOut(s))
+		diep("Compact: No memory for the layout");
+
+	int status = checkOnly ? checkSessionFile(s) : compactSession(s);
+	if (status == EXIT_SUCCESS && !checkOnly)
+		logInfo("Compact: %u trials, %u signals, %.1f MB written to %s in %.1f s\n", s->nValid, s->nSignals,
+				s->header.fileBytes / 1e6, s->fileName, getMonotonicTime() - tStart);
+	freeSession(s);
+	return status;
+}
@@ -36,6 +36,15 @@
 #include "../trialLogger/src/writer.h"
 #include "../trialLogger/src/parser.h"
 #include "../trialLogger/src/network.h"
+#include "../trialLogger/src/latestValues.h"
+
+// most group names taken by 'waitForGroups' and 'subscribe'
+#define MAX_GROUP_NAMES_ARG 256
+// 'waitForGroups' waits in slices this long, checking for Ctrl-C in between
+#define WAIT_SLICE_SEC 0.1
+
+// undocumented, exported by libut: whether Ctrl-C was pressed while in the mex function
+extern bool utIsInterruptPending(void);
 
 ///////////// GLOBALS /////////////
 
@@ -46,6 +55,8 @@ int mex_call_counter = 0;
 static bool startUdpMexServer();
 static void stopUdpMexServer();
 static void cleanupAtExit();
+static unsigned getGroupNamesArg(const mxArray*, const char**, const char*);
+static void checkWaitGroupNames(const char**, unsigned);
 int strcmpi(const char*, const char*); // case insensitive string compare
 int convertInputArgsToBytestream(uint8_t*, unsigned, int, const mxArray**);
 
@@ -77,6 +88,9 @@ static bool startUdpMexServer() {
 	// false means start buffering immediately, even if next trial hasn't been received
 	controlInitialize(true);
 
+	// keep the latest sample of each group for getLatest
+	latestValuesEnable(true);
+
 	// install the callback function to process incoming packet data
 	networkSetPacketRecvCallbackFn(&processReceivedPacketData);
 
@@ -84,6 +98,7 @@ static bool startUdpMexServer() {
 
 	if (!success) {
 		controlTerminate();   // freeDataLoggerStatus
+		latestValuesClear();
 		mexUnlock();          // allowed to clear MEX file from memory
 		snprintf_nowarn(errMsg, MAX_HOST_LENGTH + 50, "Could not start network receiver at %s",
 				getNetworkAddressAsString(&recv));
@@ -105,6 +120,66 @@ static void stopUdpMexServer() {
 	//dataFlushThreadTerminate();
 	networkThreadTerminate();
 	controlTerminate();
+	latestValuesClear();
+	parserSubscribeGroups(NULL, 0);
+}
+
+// the group names in mxNames, a string or cell of strings, pointed to in groupNames. Returns their
+// number, 0 for an empty string or cell. Errors out to MATLAB with errorId if they aren't strings
+static unsigned getGroupNamesArg(const mxArray *mxNames, const char **groupNames, const char *errorId) {
+	static char groupNameBuffers[MAX_GROUP_NAMES_ARG][MAX_GROUP_NAME+1];
+	unsigned nGroupNames = 0;
+
+	if (mxIsChar(mxNames)) {
+		if (!mxIsEmpty(mxNames)) {
+			mxGetString(mxNames, groupNameBuffers[0], MAX_GROUP_NAME+1);
+			groupNames[nGroupNames++] = groupNameBuffers[0];
+		}
+		return nGroupNames;
+	}
+
+	size_t nCells = mxGetNumberOfElements(mxNames);
+	if (nCells > MAX_GROUP_NAMES_ARG)
+		mexErrMsgIdAndTxt(errorId, "udpMexReceiver: at most %d group names", MAX_GROUP_NAMES_ARG);
+	for (size_t i = 0; i < nCells; i++) {
+		const mxArray *mxName = mxGetCell(mxNames, i);
+		if (mxName == NULL || !mxIsChar(mxName))
+			mexErrMsgIdAndTxt(errorId, "udpMexReceiver: groupNames must be a string or cell of strings");
+		mxGetString(mxName, groupNameBuffers[nGroupNames], MAX_GROUP_NAME+1);
+		groupNames[nGroupNames] = groupNameBuffers[nGroupNames];
+		nGroupNames++;
+	}
+	return nGroupNames;
+}
+
+// waitForGroups only wakes for samples that are buffered, so raise an error for groups that never
+// will be, and warn about groups that haven't been received yet (a misspelled name looks the same)
+static void checkWaitGroupNames(const char **groupNames, unsigned nGroupNames) {
+	uint8_t *buffer = NULL;
+	uint32_t allocated = 0;
+
+	for (unsigned i = 0; i < nGroupNames; i++) {
+		int slot = latestValuesFind(groupNames[i]);
+		uint64_t seq;
+		GroupInfo g;
+		if (slot >= 0 && latestValuesRead((unsigned)slot, &buffer, &allocated, &seq) > 0
+				&& parseGroupInfoHeader(buffer, &g) != NULL && g.type == GROUP_TYPE_CONTROL) {
+			FREE(buffer);
+			mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:waitForGroups",
+					"udpMexReceiver: group %s is a control group, control groups are never buffered", groupNames[i]);
+		}
+
+		if (!parserIsGroupSubscribed(groupNames[i])) {
+			FREE(buffer);
+			mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:waitForGroups",
+					"udpMexReceiver: group %s is not subscribed to, it is never buffered", groupNames[i]);
+		}
+
+		if (slot < 0)
+			mexWarnMsgIdAndTxt("MATLAB:udpMexReceiver:waitForGroups",
+					"udpMexReceiver: group %s has not been received yet", groupNames[i]);
+	}
+	FREE(buffer);
 }
 
 // Compare strings without case sensitivity
@@ -268,8 +343,72 @@ void mexFunction(
 				return;
 			}
 
-			// send groups on buffer out
+			// send groups on buffer out, the groups received after are new to waitForGroups
 			plhs[0] = buildGroupsArrayForCurrentTrial(true);
+		} else if (strcmpi(fun, "waitForGroups") == 0) {
+			if (!mexIsLocked()) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:waitForGroups",
+						"udpMexReceiver: call with 'start' to bind socket first.");
+				return;
+			}
+
+			if (nlhs > 2 || nrhs != 3 || !(mxIsChar(prhs[1]) || mxIsCell(prhs[1]))
+					|| !mxIsNumeric(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1
+					|| !(mxGetScalar(prhs[2]) >= 0)) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:waitForGroups",
+						"Usage: [groups, received] = udpMexReceiver('waitForGroups', groupNames, timeoutMs)");
+				return;
+			}
+
+			// none for any group
+			const char *groupNames[MAX_GROUP_NAMES_ARG];
+			unsigned nGroupNames = getGroupNamesArg(prhs[1], groupNames, "MATLAB:udpMexReceiver:waitForGroups");
+			checkWaitGroupNames(groupNames, nGroupNames);
+
+			// block until one of the groups is received, or timeoutMs is up (never for Inf), then
+			// flush the groups out as retrieveGroups does. Waits in slices so that Ctrl-C gets through,
+			// the groups are then left on the buffer and returned as pollGroups does
+			double timeoutSec = mxGetScalar(prhs[2]) / 1000.0;
+			struct timespec start, now;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			bool received = false, interrupted = false;
+			for (;;) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				double remainingSec = timeoutSec - (now.tv_sec - start.tv_sec) - (now.tv_nsec - start.tv_nsec) / 1e9;
+				received = latestValuesWaitForNew(groupNames, nGroupNames,
+						remainingSec < WAIT_SLICE_SEC ? remainingSec : WAIT_SLICE_SEC);
+				if (received || remainingSec <= WAIT_SLICE_SEC)
+					break;
+				if (utIsInterruptPending()) {
+					interrupted = true;
+					break;
+				}
+			}
+			plhs[0] = buildGroupsArrayForCurrentTrial(!interrupted);
+			if (nlhs > 1)
+				plhs[1] = mxCreateLogicalScalar(received);
+		} else if (strcmpi(fun, "subscribe") == 0) {
+			if (!mexIsLocked()) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:subscribe",
+						"udpMexReceiver: call with 'start' to bind socket first.");
+				return;
+			}
+
+			if (nlhs > 0 || nrhs != 2 || !(mxIsChar(prhs[1]) || mxIsCell(prhs[1]))) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:subscribe",
+						"Usage: udpMexReceiver('subscribe', groupNames)");
+				return;
+			}
+
+			// only the groups named (and control groups) are buffered and kept for getLatest from here
+			// on, all groups again for {}. Until 'stop'
+			const char *groupNames[MAX_GROUP_NAMES_ARG];
+			unsigned nGroupNames = getGroupNamesArg(prhs[1], groupNames, "MATLAB:udpMexReceiver:subscribe");
+			if (!parserSubscribeGroups(groupNames, nGroupNames)) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:subscribe",
+						"udpMexReceiver: could not subscribe to the groups");
+				return;
+			}
 		} else if (strcmpi(fun, "pollGroups") == 0) {
 			if (!mexIsLocked()) {
 				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:pollGroups",
@@ -285,6 +424,53 @@ void mexFunction(
 
 			// send groups on buffer out
 			plhs[0] = buildGroupsArrayForCurrentTrial(false);
+		} else if (strcmpi(fun, "pollGroupsSince") == 0) {
+			if (!mexIsLocked()) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:pollGroupsSince",
+						"udpMexReceiver: call with 'start' to bind socket first.");
+				return;
+			}
+
+			if (nlhs != 2 || nrhs > 2) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:pollGroupsSince",
+						"Usage: [groups, cursor] = udpMexReceiver('pollGroupsSince', cursor)");
+				return;
+			}
+
+			// send the groups' samples since cursor ([] or omitted at first) out, with the new cursor
+			plhs[0] = buildGroupsArrayForCurrentTrialSince(nrhs > 1 ? prhs[1] : NULL, &(plhs[1]));
+		} else if (strcmpi(fun, "getLatest") == 0) {
+			if (!mexIsLocked()) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:getLatest",
+						"udpMexReceiver: call with 'start' to bind socket first.");
+				return;
+			}
+
+			if (nlhs > 1 || nrhs != 2 || !mxIsChar(prhs[1])) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:getLatest",
+						"Usage: group = udpMexReceiver('getLatest', groupName)");
+				return;
+			}
+
+			// the newest sample of the group with its sequence number, [] if not received yet
+			char groupName[MAX_GROUP_NAME+1];
+			mxGetString(prhs[1], groupName, MAX_GROUP_NAME+1);
+			plhs[0] = buildLatestGroupStruct(groupName);
+		} else if (strcmpi(fun, "getLatestAll") == 0) {
+			if (!mexIsLocked()) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:getLatestAll",
+						"udpMexReceiver: call with 'start' to bind socket first.");
+				return;
+			}
+
+			if (nlhs > 1) {
+				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:getLatestAll",
+						"Usage: groups = udpMexReceiver('getLatestAll')");
+				return;
+			}
+
+			// the newest sample of every group received
+			plhs[0] = buildLatestGroupsArray();
 		} else if (strcmpi(fun, "retrieveCompleteTrial") == 0) {
 			if (!mexIsLocked()) {
 				mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:retrieveCompleteTrial",
@@ -340,7 +526,8 @@ void mexFunction(
 	} else {
 		mexErrMsgIdAndTxt("MATLAB:udpMexReceiver:commandArgumentUsage",
 				"udpMexReceiver: please call with command argument "
-				"('start', 'stop', 'receiveGroups', 'pollGroups', "
+				"('start', 'stop', 'subscribe', 'receiveGroups', 'waitForGroups', 'pollGroups', 'pollGroupsSince', "
+				"'getLatest', 'getLatestAll', "
 				"'retrieveCompleteTrial', 'pollCurrentTrial', 'getCurrentControlStatus')");
 	}
 